@@ -15,6 +15,14 @@ static ngx_int_t ngx_getopt(ngx_master_ctx_t *ctx, ngx_cycle_t *cycle);
 static void *ngx_core_module_create_conf(ngx_cycle_t *cycle);
 static char *ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf);
 static char *ngx_set_user(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
+                                  void *conf);
+
+
+/* the priority may be -1, so its unset value is out of the -20..20 range */
+
+#define NGX_CONF_UNSET_PRIORITY  -100
 
 
 static ngx_command_t  ngx_core_commands[] = {
@@ -40,6 +48,55 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, worker_processes),
       NULL },
 
+    { ngx_string("worker_priority"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_set_priority,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("worker_rlimit_nofile"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_core_conf_t, rlimit_nofile),
+      NULL },
+
+    { ngx_string("worker_cpu_affinity"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_1MORE,
+      ngx_set_cpu_affinity,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("cache_manager"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, cache_manager),
+      NULL },
+
+    { ngx_string("cache_manager_files"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_core_conf_t, cache_manager_files),
+      NULL },
+
+    { ngx_string("cache_manager_slice"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_core_conf_t, cache_manager_slice),
+      NULL },
+
+    { ngx_string("cache_manager_sleep"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_core_conf_t, cache_manager_sleep),
+      NULL },
+
 #if (NGX_THREADS)
 
     { ngx_string("worker_threads"),
@@ -176,6 +233,13 @@ int main(int argc, char *const *argv)
         ngx_log_error(NGX_LOG_INFO, log, 0,
                       "the configuration file %s was tested successfully",
                       init_cycle.conf_file.data);
+
+        if (ngx_conf_snapshot_name.len) {
+            if (ngx_conf_snapshot_save(cycle, log) == NGX_ERROR) {
+                return 1;
+            }
+        }
+
         return 0;
     }
 
@@ -265,6 +329,9 @@ static ngx_int_t ngx_add_inherited_sockets(ngx_cycle_t *cycle)
             if (!(ls = ngx_push_array(&cycle->listening))) {
                 return NGX_ERROR;
             }
+
+            ngx_memzero(ls, sizeof(ngx_listening_t));
+
             // 保存之前的fd
             ls->fd = s;
         }
@@ -343,6 +410,20 @@ static ngx_int_t ngx_getopt(ngx_master_ctx_t *ctx, ngx_cycle_t *cycle)
             cycle->conf_file.len = ngx_strlen(cycle->conf_file.data);
             break;
 
+        /* the configuration snapshot is created by the test */
+        case 'o':
+            if (ctx->argv[i + 1] == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                              "the option: \"%s\" requires file name",
+                              ctx->argv[i]);
+                return NGX_ERROR;
+            }
+
+            ngx_conf_snapshot_name.data = (u_char *) ctx->argv[++i];
+            ngx_conf_snapshot_name.len =
+                                       ngx_strlen(ngx_conf_snapshot_name.data);
+            break;
+
         default:
             ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
                           "invalid option: \"%s\"", ctx->argv[i]);
@@ -359,6 +440,18 @@ static ngx_int_t ngx_getopt(ngx_master_ctx_t *ctx, ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+    if (ngx_conf_snapshot_name.len) {
+        if (!ngx_test_config) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "the option: \"-o\" requires \"-t\"");
+            return NGX_ERROR;
+        }
+
+        if (ngx_conf_full_name(cycle, &ngx_conf_snapshot_name) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -374,10 +467,19 @@ static void *ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *
      * ccf->pid = NULL;
      * ccf->newpid = NULL;
+     * ccf->cpu_affinity_auto = 0;
+     * ccf->cpu_affinity_n = 0;
+     * ccf->cpu_affinity = NULL;
      */
     ccf->daemon = NGX_CONF_UNSET;
     ccf->master = NGX_CONF_UNSET;
     ccf->worker_processes = NGX_CONF_UNSET;
+    ccf->priority = NGX_CONF_UNSET_PRIORITY;
+    ccf->rlimit_nofile = NGX_CONF_UNSET;
+    ccf->cache_manager = NGX_CONF_UNSET;
+    ccf->cache_manager_files = NGX_CONF_UNSET;
+    ccf->cache_manager_slice = NGX_CONF_UNSET_MSEC;
+    ccf->cache_manager_sleep = NGX_CONF_UNSET_MSEC;
 #if (NGX_THREADS)
     ccf->worker_threads = NGX_CONF_UNSET;
     ccf->thread_stack_size = NGX_CONF_UNSET;
@@ -402,6 +504,32 @@ static char *ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ccf->master, 1);
     ngx_conf_init_value(ccf->worker_processes, 1);
 
+    if (ccf->priority == NGX_CONF_UNSET_PRIORITY) {
+        ccf->priority = 0;
+    }
+
+    if (ccf->cpu_affinity_n && !ccf->cpu_affinity_auto
+        && ccf->cpu_affinity_n != 1
+        && ccf->cpu_affinity_n != (ngx_uint_t) ccf->worker_processes)
+    {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "the number of \"worker_processes\" is not equal to "
+                      "the number of \"worker_cpu_affinity\" masks, "
+                      "using the last mask for the remaining worker "
+                      "processes");
+    }
+
+    ngx_conf_init_value(ccf->cache_manager, 1);
+    ngx_conf_init_value(ccf->cache_manager_files, 1000);
+    ngx_conf_init_msec_value(ccf->cache_manager_slice, 50);
+    ngx_conf_init_msec_value(ccf->cache_manager_sleep, 60000);
+
+    if (ccf->cache_manager_files <= 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"cache_manager_files\" must be more than 0");
+        return NGX_CONF_ERROR;
+    }
+
 #if (NGX_THREADS)
     ngx_conf_init_value(ccf->worker_threads, 0);
     ngx_threads_n = ccf->worker_threads;
@@ -512,3 +640,211 @@ static char *ngx_set_user(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 #endif
 }
+
+
+static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_core_conf_t  *ccf = conf;
+
+    ngx_str_t        *value;
+    ngx_uint_t        n, minus;
+
+    if (ccf->priority != NGX_CONF_UNSET_PRIORITY) {
+        return "is duplicate";
+    }
+
+    value = (ngx_str_t *) cf->args->elts;
+
+    if (value[1].data[0] == '-') {
+        n = 1;
+        minus = 1;
+
+    } else if (value[1].data[0] == '+') {
+        n = 1;
+        minus = 0;
+
+    } else {
+        n = 0;
+        minus = 0;
+    }
+
+    ccf->priority = ngx_atoi(&value[1].data[n], value[1].len - n);
+    if (ccf->priority == NGX_ERROR || ccf->priority > 20) {
+        return "invalid number";
+    }
+
+    if (minus) {
+        ccf->priority = -ccf->priority;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * the masks are the strings of "0" and "1" where the rightmost digit is
+ * the CPU 0; a worker gets the mask in the order of the masks, and the
+ * last mask is used for the rest workers; in the "auto" mode the workers
+ * are bound one by one to the CPUs of an optional mask or to all CPUs
+ */
+
+static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
+                                  void *conf)
+{
+#if !(HAVE_SCHED_SETAFFINITY)
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"worker_cpu_affinity\" is not supported "
+                       "on this platform, ignored");
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_core_conf_t  *ccf = conf;
+
+    u_char           *p;
+    uint64_t         *mask;
+    ngx_str_t        *value;
+    ngx_uint_t        i, n;
+
+    if (ccf->cpu_affinity) {
+        return "is duplicate";
+    }
+
+    value = (ngx_str_t *) cf->args->elts;
+
+    n = 1;
+
+    if (ngx_strcmp(value[1].data, "auto") == 0) {
+
+        if (cf->args->nelts > 3) {
+            return "has too many masks in the \"auto\" mode";
+        }
+
+        ccf->cpu_affinity_auto = 1;
+        n = 2;
+    }
+
+    ccf->cpu_affinity_n = cf->args->nelts - n;
+
+    if (ccf->cpu_affinity_n == 0) {
+
+        /* "auto" without a mask: the zero mask means all CPUs */
+
+        if (!(mask = ngx_pcalloc(cf->pool, sizeof(uint64_t)))) {
+            return NGX_CONF_ERROR;
+        }
+
+        ccf->cpu_affinity_n = 1;
+        ccf->cpu_affinity = mask;
+
+        return NGX_CONF_OK;
+    }
+
+    if (!(mask = ngx_palloc(cf->pool, ccf->cpu_affinity_n * sizeof(uint64_t))))
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    ccf->cpu_affinity = mask;
+
+    for ( /* void */ ; n < cf->args->nelts; n++) {
+
+        if (value[n].len > 64) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"worker_cpu_affinity\" supports "
+                               "up to 64 CPUs only");
+            return NGX_CONF_ERROR;
+        }
+
+        *mask = 0;
+        p = value[n].data;
+
+        for (i = 0; i < value[n].len; i++) {
+
+            *mask <<= 1;
+
+            if (p[i] == '1') {
+                *mask |= 1;
+
+            } else if (p[i] != '0') {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid character \"%c\" in "
+                                   "\"worker_cpu_affinity\" mask \"%s\"",
+                                   p[i], p);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        if (*mask == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"worker_cpu_affinity\" mask \"%s\" "
+                               "has no CPUs", p);
+            return NGX_CONF_ERROR;
+        }
+
+        mask++;
+    }
+
+    return NGX_CONF_OK;
+
+#endif
+}
+
+
+/* the CPU mask of the worker process n, 0 means no affinity */
+
+uint64_t ngx_get_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n)
+{
+    uint64_t          mask;
+    ngx_uint_t        i, cpus;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->cpu_affinity == NULL) {
+        return 0;
+    }
+
+    if (!ccf->cpu_affinity_auto) {
+        if (n >= ccf->cpu_affinity_n) {
+            n = ccf->cpu_affinity_n - 1;
+        }
+
+        return ccf->cpu_affinity[n];
+    }
+
+    mask = ccf->cpu_affinity[0];
+
+    if (mask == 0) {
+        if (ngx_ncpu >= 64) {
+            mask = (uint64_t) -1;
+
+        } else {
+            mask = ((uint64_t) 1 << ngx_ncpu) - 1;
+        }
+    }
+
+    cpus = 0;
+
+    for (i = 0; i < 64; i++) {
+        if (mask & ((uint64_t) 1 << i)) {
+            cpus++;
+        }
+    }
+
+    /* the workers wrap around if there are more workers than CPUs */
+
+    n %= cpus;
+
+    for (i = 0; i < 64; i++) {
+        if (mask & ((uint64_t) 1 << i)) {
+            if (n-- == 0) {
+                break;
+            }
+        }
+    }
+
+    return (uint64_t) 1 << i;
+}
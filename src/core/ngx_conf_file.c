@@ -6,6 +6,7 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <nginx.h>
 
 
 static char *ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -49,22 +50,135 @@ static int argument_number[] = {
 };
 
 static int ngx_conf_read_token(ngx_conf_t *cf);
+static ngx_int_t ngx_conf_init_commands(ngx_log_t *log);
+
+static ngx_int_t ngx_conf_snapshot_create(ngx_conf_t *cf);
+static ngx_int_t ngx_conf_snapshot_token(ngx_conf_t *cf, uint32_t type);
+static u_char *ngx_conf_snapshot_alloc(ngx_buf_t *b, size_t size);
+static ngx_int_t ngx_conf_snapshot_load(ngx_conf_t *cf);
+static void ngx_conf_snapshot_unmap(void *data);
+static int ngx_conf_snapshot_read_token(ngx_conf_t *cf);
+static uint32_t ngx_conf_snapshot_signature(void);
+
+
+/*
+ * the directives of all modules are hashed by their names; the commands
+ * of the same name are chained in the modules order, so the lookup finds
+ * the same command as the walk of the modules' command arrays did
+ */
+
+typedef struct ngx_conf_command_s  ngx_conf_command_t;
+
+struct ngx_conf_command_s {
+    ngx_command_t       *cmd;
+    ngx_module_t        *module;
+    ngx_conf_command_t  *next;
+};
+
+
+static ngx_conf_command_t  **ngx_conf_commands_hash;
+static ngx_uint_t            ngx_conf_commands_hash_size;
+
+
+/*
+ * the configuration snapshot is created by "nginx -t -o file" and holds
+ * the directives of the tested configuration with the included files
+ * expanded and the pcre code of the regexes compiled during the test:
+ *
+ *     the header,
+ *     the regexes: ngx_conf_snapshot_regex_t, the pattern and the code,
+ *     the directives: the records of the uint32_t words.
+ *
+ * The strings are null-terminated and padded, the pattern and the code
+ * to 8 bytes, the rest to the word.  ngx_conf_parse() maps the snapshot
+ * given as the configuration file instead of reading the text files.
+ * The arguments point to the mapping that lives as long as the cycle pool,
+ * so the strings kept by the modules stay valid.
+ */
+
+#define NGX_CONF_SNAPSHOT_MAGIC  "NGXCONF1"
+#define NGX_CONF_SNAPSHOT_ORDER  0x01020304
+
+/* the records: FILE, len, name; TOKEN or BLOCK or END, line, nargs, args */
+
+#define NGX_CONF_SNAPSHOT_FILE   1
+#define NGX_CONF_SNAPSHOT_TOKEN  2
+#define NGX_CONF_SNAPSHOT_BLOCK  3
+#define NGX_CONF_SNAPSHOT_END    4
+
+#define ngx_conf_snapshot_align(n, a)  (((n) + (a) - 1) & ~((size_t) (a) - 1))
+
+typedef struct {
+    u_char                       magic[8];
+    uint32_t                     order;
+    uint32_t                     signature;  /* the nginx and pcre versions */
+    uint32_t                     size;
+    uint32_t                     crc;        /* of the data after the header */
+    uint32_t                     nregex;
+    uint32_t                     directives; /* the offset of the directives */
+} ngx_conf_snapshot_header_t;
+
+
+typedef struct {
+    uint32_t                     crc;        /* of the pattern */
+    uint32_t                     options;
+    uint32_t                     len;        /* of the pattern */
+    uint32_t                     size;       /* of the code */
+} ngx_conf_snapshot_regex_t;
+
+
+struct ngx_conf_snapshot_s {
+    u_char                      *start;
+    size_t                       size;
+    ngx_str_t                    name;
+    ngx_log_t                   *log;
+
+    /* the open addressing hash of the regexes */
+    ngx_conf_snapshot_regex_t  **regex;
+    ngx_uint_t                   nregex;
+};
+
+
+typedef struct {
+    ngx_pool_t                  *pool;
+    ngx_buf_t                    regex;
+    ngx_buf_t                    directives;
+    ngx_uint_t                   nregex;
+
+    /* the name of the file of the last directive */
+    u_char                      *file;
+} ngx_conf_snapshot_ctx_t;
+
+
+ngx_str_t                         ngx_conf_snapshot_name;
+
+/* the snapshot being created and the snapshot being parsed */
+static ngx_conf_snapshot_ctx_t   *ngx_conf_snapshot_out;
+static ngx_conf_snapshot_t       *ngx_conf_snapshot_in;
 
 // 解析配置函数
 char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
 {
-    int               m, rc, found, valid;
-    char             *rv;
-    void             *conf, **confp;
-    ngx_fd_t          fd;
-    ngx_str_t        *name;
-    ngx_conf_file_t  *prev;
-    ngx_command_t    *cmd;
+    int                  rc, valid;
+    char                *rv;
+    void                *conf, **confp;
+    size_t               size;
+    ngx_fd_t             fd;
+    ngx_str_t           *name;
+    ngx_conf_file_t     *prev;
+    ngx_command_t       *cmd;
+    ngx_conf_command_t  *c;
 
 #if (NGX_SUPPRESS_WARN)
     fd = NGX_INVALID_FILE;
     prev = NULL;
 #endif
+
+    if (ngx_conf_commands_hash == NULL) {
+        if (ngx_conf_init_commands(cf->log) == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
+    }
     // 
     if (filename) {
 
@@ -87,10 +201,6 @@ char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
             ngx_log_error(NGX_LOG_EMERG, cf->log, ngx_errno,
                           ngx_fd_info_n " %s failed", filename->data);
         }
-        // 分配一块由buffer管理的内存给分析文件时用
-        if (!(cf->conf_file->buffer = ngx_create_temp_buf(cf->pool, 1024))) {
-            return NGX_CONF_ERROR;
-        }
 
         cf->conf_file->file.fd = fd;
         cf->conf_file->file.name.len = filename->len;
@@ -98,6 +208,43 @@ char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
         cf->conf_file->file.offset = 0;
         cf->conf_file->file.log = cf->log;;
         cf->conf_file->line = 1;
+        cf->conf_file->snapshot = NULL;
+
+        rc = NGX_DECLINED;
+
+        if (prev == NULL) {
+
+            /* the main configuration file may be a snapshot */
+
+            if (ngx_conf_snapshot_name.len && ngx_conf_snapshot_out == NULL) {
+                if (ngx_conf_snapshot_create(cf) == NGX_ERROR) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            rc = ngx_conf_snapshot_load(cf);
+
+            if (rc == NGX_ERROR) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        if (rc == NGX_DECLINED) {
+
+            /* a small included file does not need the whole buffer */
+
+            size = NGX_CONF_BUFFER;
+
+            if (ngx_file_size(&cf->conf_file->file.info) < (off_t) size) {
+                size = (size_t) ngx_file_size(&cf->conf_file->file.info);
+            }
+
+            // 分配一块由buffer管理的内存给分析文件时用
+            cf->conf_file->buffer = ngx_create_temp_buf(cf->pool, size);
+            if (cf->conf_file->buffer == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
     }
 
     for ( ;; ) {
@@ -116,6 +263,14 @@ ngx_log_debug(cf->log, "token %d" _ rc);
             break;
         }
 
+        if (rc == NGX_CONF_BLOCK_DONE && ngx_conf_snapshot_out) {
+            if (ngx_conf_snapshot_token(cf, NGX_CONF_SNAPSHOT_BLOCK)
+                                                                 == NGX_ERROR)
+            {
+                rc = NGX_ERROR;
+            }
+        }
+
         if (rc != NGX_OK) {
             break;
         }
@@ -124,6 +279,15 @@ ngx_log_debug(cf->log, "token %d" _ rc);
 
             /* custom handler, i.e. used in http "types { ... }" directive */
 
+            if (ngx_conf_snapshot_out) {
+                if (ngx_conf_snapshot_token(cf, NGX_CONF_SNAPSHOT_TOKEN)
+                                                                 == NGX_ERROR)
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+            }
+
             rv = (*cf->handler)(cf, NULL, cf->handler_conf);
             if (rv == NGX_CONF_OK) {
                 continue;
@@ -144,169 +308,177 @@ ngx_log_debug(cf->log, "token %d" _ rc);
         }
         // 在ngx_conf_read_token里赋值
         name = (ngx_str_t *) cf->args->elts;
-        found = 0;
-        // 把解析到的参数分到每个匹配的模块中处理
-        for (m = 0; rc != NGX_ERROR && !found && ngx_modules[m]; m++) {
 
-            /* look up the directive in the appropriate modules */
+        /* look up the directive in the appropriate modules */
+
+        for (c = ngx_conf_commands_hash[ngx_crc((char *) name->data, name->len)
+                                        % ngx_conf_commands_hash_size];
+             c;
+             c = c->next)
+        {
             // cf->module_type保存了当前的模块类型
-            if (ngx_modules[m]->type != NGX_CONF_MODULE
-                && ngx_modules[m]->type != cf->module_type)
+            if (c->module->type != NGX_CONF_MODULE
+                && c->module->type != cf->module_type)
             {
                 continue;
             }
 
-            cmd = ngx_modules[m]->commands;
-            if (cmd == NULL) {
-                continue;
+            if (name->len == c->cmd->name.len
+                && ngx_strcmp(name->data, c->cmd->name.data) == 0)
+            {
+                break;
             }
-            // 匹配到当前命令
-            while (cmd->name.len) {
-                if (name->len == cmd->name.len
-                    && ngx_strcmp(name->data, cmd->name.data) == 0)
-                {
+        }
+        // 该指令没有匹配到任何模块
+        if (c == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "unknown directive \"%s\" in %s:%d",
+                          name->data,
+                          cf->conf_file->file.name.data,
+                          cf->conf_file->line);
+
+            rc = NGX_ERROR;
+            break;
+        }
+
+        cmd = c->cmd;
 
-                    found = 1;
 #if 0
 ngx_log_debug(cf->log, "command '%s'" _ cmd->name.data);
 #endif
-                    /* is the directive's location right ? */
-
-                    if ((cmd->type & cf->cmd_type) == 0) {
-                        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                                      "directive \"%s\" in %s:%d "
-                                      "is not allowed here",
-                                      name->data,
-                                      cf->conf_file->file.name.data,
-                                      cf->conf_file->line);
-                        rc = NGX_ERROR;
-                        break;
-                    }
+        /* is the directive's location right ? */
 
-                    /* is the directive's argument count right ? */
+        if ((cmd->type & cf->cmd_type) == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "directive \"%s\" in %s:%d "
+                          "is not allowed here",
+                          name->data,
+                          cf->conf_file->file.name.data,
+                          cf->conf_file->line);
+            rc = NGX_ERROR;
+            break;
+        }
 
-                    if (cmd->type & NGX_CONF_ANY) {
-                        valid = 1;
+        /* is the directive's argument count right ? */
 
-                    } else if (cmd->type & NGX_CONF_FLAG) {
+        if (cmd->type & NGX_CONF_ANY) {
+            valid = 1;
 
-                        if (cf->args->nelts == 2) {
-                            valid = 1;
-                        } else {
-                            valid = 0;
-                        }
+        } else if (cmd->type & NGX_CONF_FLAG) {
 
-                    } else if (cmd->type & NGX_CONF_1MORE) {
+            if (cf->args->nelts == 2) {
+                valid = 1;
+            } else {
+                valid = 0;
+            }
 
-                        if (cf->args->nelts > 1) {
-                            valid = 1;
-                        } else {
-                            valid = 0;
-                        }
+        } else if (cmd->type & NGX_CONF_1MORE) {
 
-                    } else if (cmd->type & NGX_CONF_2MORE) {
+            if (cf->args->nelts > 1) {
+                valid = 1;
+            } else {
+                valid = 0;
+            }
 
-                        if (cf->args->nelts > 2) {
-                            valid = 1;
-                        } else {
-                            valid = 0;
-                        }
+        } else if (cmd->type & NGX_CONF_2MORE) {
 
-                    } else if (cf->args->nelts <= 10
-                               && (cmd->type
-                                   & argument_number[cf->args->nelts - 1]))
-                    {
-                        valid = 1;
+            if (cf->args->nelts > 2) {
+                valid = 1;
+            } else {
+                valid = 0;
+            }
 
-                    } else {
-                        valid = 0;
-                    }
+        } else if (cf->args->nelts <= 10
+                   && (cmd->type & argument_number[cf->args->nelts - 1]))
+        {
+            valid = 1;
 
-                    if (!valid) {
-                        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                                      "invalid number arguments in "
-                                      "directive \"%s\" in %s:%d",
-                                      name->data,
-                                      cf->conf_file->file.name.data,
-                                      cf->conf_file->line);
-                        rc = NGX_ERROR;
-                        break;
-                    }
+        } else {
+            valid = 0;
+        }
 
-                    /* set up the directive's configuration context */
+        if (!valid) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "invalid number arguments in "
+                          "directive \"%s\" in %s:%d",
+                          name->data,
+                          cf->conf_file->file.name.data,
+                          cf->conf_file->line);
+            rc = NGX_ERROR;
+            break;
+        }
 
-                    conf = NULL;
-                    // 可以出现在配置文件中最外层。只有ngx_core_module_ctx模块才是这种类型
-                    if (cmd->type & NGX_DIRECT_CONF) {
-                        // 二级指针
-                        conf = ((void **) cf->ctx)[ngx_modules[m]->index];
+        /* the included files are expanded in the snapshot */
 
-                    } else if (cmd->type & NGX_MAIN_CONF) {
-                        // conf是四级指针
-                        conf = &(((void **) cf->ctx)[ngx_modules[m]->index]);
+        if (ngx_conf_snapshot_out && cmd->set != ngx_conf_include) {
+            if (ngx_conf_snapshot_token(cf, NGX_CONF_SNAPSHOT_TOKEN)
+                                                                 == NGX_ERROR)
+            {
+                rc = NGX_ERROR;
+                break;
+            }
+        }
 
-                    } else if (cf->ctx) { // 指向当前模块下的配置数组
-                        // 拿到上下文某个字段的地址 
-                        confp = *(void **) ((char *) cf->ctx + cmd->conf);
-                        // 获取数组中的本模块的配置
-                        if (confp) {
-                            conf = confp[ngx_modules[m]->ctx_index];
-                        }
-                    }
+        /* set up the directive's configuration context */
 
-                    rv = cmd->set(cf, cmd, conf);
+        conf = NULL;
+        // 可以出现在配置文件中最外层。只有ngx_core_module_ctx模块才是这种类型
+        if (cmd->type & NGX_DIRECT_CONF) {
+            // 二级指针
+            conf = ((void **) cf->ctx)[c->module->index];
 
-#if 0
-ngx_log_debug(cf->log, "rv: %d" _ rv);
-#endif
+        } else if (cmd->type & NGX_MAIN_CONF) {
+            // conf是四级指针
+            conf = &(((void **) cf->ctx)[c->module->index]);
 
-                    if (rv == NGX_CONF_OK) {
-                        break;
+        } else if (cf->ctx) { // 指向当前模块下的配置数组
+            // 拿到上下文某个字段的地址 
+            confp = *(void **) ((char *) cf->ctx + cmd->conf);
+            // 获取数组中的本模块的配置
+            if (confp) {
+                conf = confp[c->module->ctx_index];
+            }
 
-                    } else if (rv == NGX_CONF_ERROR) {
-                        rc = NGX_ERROR;
-                        break;
+            if (cf->modules_set && c->module->type == cf->module_type) {
+                cf->modules_set[c->module->ctx_index] = 1;
+            }
+        }
 
-                    } else {
-                        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                                      "the \"%s\" directive %s in %s:%d",
-                                      name->data, rv,
-                                      cf->conf_file->file.name.data,
-                                      cf->conf_file->line);
+        rv = cmd->set(cf, cmd, conf);
 
-                        rc = NGX_ERROR;
-                        break;
-                    }
-                }
+#if 0
+ngx_log_debug(cf->log, "rv: %d" _ rv);
+#endif
 
-                cmd++;
-            }
+        if (rv == NGX_CONF_ERROR) {
+            rc = NGX_ERROR;
+            break;
         }
-        // 该指令没有匹配到任何模块
-        if (!found) {
+
+        if (rv != NGX_CONF_OK) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                          "unknown directive \"%s\" in %s:%d",
-                          name->data,
+                          "the \"%s\" directive %s in %s:%d",
+                          name->data, rv,
                           cf->conf_file->file.name.data,
                           cf->conf_file->line);
 
             rc = NGX_ERROR;
             break;
         }
-
-        if (rc == NGX_ERROR) {
-            break;
-        }
     }
 
     if (filename) {
         // 保存原来的文件信息
         cf->conf_file = prev;
+
+        if (prev == NULL) {
+            ngx_conf_snapshot_in = NULL;
+        }
+
         // 关闭打开的配置文件
         if (ngx_close_file(fd) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                          ngx_close_file_n " %s failed",
-                          cf->conf_file->file.name.data);
+                          ngx_close_file_n " %s failed", filename->data);
             return NGX_CONF_ERROR;
         }
     }
@@ -319,6 +491,615 @@ ngx_log_debug(cf->log, "rv: %d" _ rv);
 }
 
 
+static ngx_int_t ngx_conf_init_commands(ngx_log_t *log)
+{
+    ngx_uint_t            m, n, key;
+    ngx_command_t        *cmd;
+    ngx_conf_command_t   *c, **last;
+
+    n = 0;
+
+    for (m = 0; ngx_modules[m]; m++) {
+        for (cmd = ngx_modules[m]->commands; cmd && cmd->name.len; cmd++) {
+            n++;
+        }
+    }
+
+    /* the modules are the same for the process life, so is the hash */
+
+    ngx_conf_commands_hash_size = 2 * n + 1;
+
+    ngx_conf_commands_hash = ngx_calloc(ngx_conf_commands_hash_size
+                                              * sizeof(ngx_conf_command_t *)
+                                        + n * sizeof(ngx_conf_command_t),
+                                        log);
+    if (ngx_conf_commands_hash == NULL) {
+        return NGX_ERROR;
+    }
+
+    c = (ngx_conf_command_t *)
+                         (ngx_conf_commands_hash + ngx_conf_commands_hash_size);
+
+    for (m = 0; ngx_modules[m]; m++) {
+        for (cmd = ngx_modules[m]->commands; cmd && cmd->name.len; cmd++) {
+
+            key = ngx_crc((char *) cmd->name.data, cmd->name.len)
+                                                % ngx_conf_commands_hash_size;
+
+            for (last = &ngx_conf_commands_hash[key];
+                 *last;
+                 last = &(*last)->next)
+            {
+                /* void */
+            }
+
+            c->cmd = cmd;
+            c->module = ngx_modules[m];
+            c->next = NULL;
+
+            *last = c++;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_conf_snapshot_create(ngx_conf_t *cf)
+{
+    ngx_conf_snapshot_ctx_t  *ctx;
+
+    if (!(ctx = ngx_pcalloc(cf->pool, sizeof(ngx_conf_snapshot_ctx_t)))) {
+        return NGX_ERROR;
+    }
+
+    ctx->pool = cf->pool;
+
+    ngx_conf_snapshot_out = ctx;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_conf_snapshot_token(ngx_conf_t *cf, uint32_t type)
+{
+    u_char                   *p;
+    size_t                    size;
+    uint32_t                 *w;
+    ngx_str_t                *name, *args;
+    ngx_uint_t                i;
+    ngx_conf_snapshot_ctx_t  *ctx;
+
+    ctx = ngx_conf_snapshot_out;
+    name = &cf->conf_file->file.name;
+
+    if (ctx->file != name->data) {
+        ctx->file = name->data;
+
+        size = 2 * sizeof(uint32_t)
+               + ngx_conf_snapshot_align(name->len + 1, sizeof(uint32_t));
+
+        if (!(p = ngx_conf_snapshot_alloc(&ctx->directives, size))) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(p, size);
+
+        w = (uint32_t *) p;
+        w[0] = NGX_CONF_SNAPSHOT_FILE;
+        w[1] = name->len;
+        ngx_memcpy(&w[2], name->data, name->len);
+    }
+
+    args = cf->args->elts;
+
+    size = 3 * sizeof(uint32_t);
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        size += sizeof(uint32_t)
+                + ngx_conf_snapshot_align(args[i].len + 1, sizeof(uint32_t));
+    }
+
+    if (!(p = ngx_conf_snapshot_alloc(&ctx->directives, size))) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(p, size);
+
+    w = (uint32_t *) p;
+    w[0] = type;
+    w[1] = cf->conf_file->line;
+    w[2] = cf->args->nelts;
+
+    p += 3 * sizeof(uint32_t);
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        *(uint32_t *) p = args[i].len;
+        ngx_memcpy(p + sizeof(uint32_t), args[i].data, args[i].len);
+
+        p += sizeof(uint32_t)
+             + ngx_conf_snapshot_align(args[i].len + 1, sizeof(uint32_t));
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *ngx_conf_snapshot_alloc(ngx_buf_t *b, size_t size)
+{
+    u_char  *p;
+    size_t   n;
+
+    if ((size_t) (b->end - b->last) < size) {
+        n = 2 * (b->end - b->start);
+
+        if (n < (size_t) (b->last - b->start) + size) {
+            n = (b->last - b->start) + size;
+        }
+
+        if (n < NGX_CONF_BUFFER) {
+            n = NGX_CONF_BUFFER;
+        }
+
+        if (!(p = ngx_palloc(ngx_conf_snapshot_out->pool, n))) {
+            return NULL;
+        }
+
+        if (b->start) {
+            ngx_memcpy(p, b->start, b->last - b->start);
+            ngx_pfree(ngx_conf_snapshot_out->pool, b->start);
+        }
+
+        b->last = p + (b->last - b->start);
+        b->start = p;
+        b->end = p + n;
+    }
+
+    p = b->last;
+    b->last += size;
+
+    return p;
+}
+
+
+ngx_int_t ngx_conf_snapshot_add_regex(ngx_str_t *pattern, ngx_int_t options,
+                                      void *code, size_t size)
+{
+    u_char                     *p;
+    size_t                      n;
+    ngx_conf_snapshot_ctx_t    *ctx;
+    ngx_conf_snapshot_regex_t  *re;
+
+    ctx = ngx_conf_snapshot_out;
+
+    if (ctx == NULL) {
+        return NGX_OK;
+    }
+
+    n = sizeof(ngx_conf_snapshot_regex_t)
+        + ngx_conf_snapshot_align(pattern->len + 1, 8)
+        + ngx_conf_snapshot_align(size, 8);
+
+    if (!(p = ngx_conf_snapshot_alloc(&ctx->regex, n))) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(p, n);
+
+    re = (ngx_conf_snapshot_regex_t *) p;
+    re->crc = ngx_crc((char *) pattern->data, pattern->len);
+    re->options = (uint32_t) options;
+    re->len = pattern->len;
+    re->size = size;
+
+    p += sizeof(ngx_conf_snapshot_regex_t);
+    ngx_memcpy(p, pattern->data, pattern->len);
+
+    p += ngx_conf_snapshot_align(pattern->len + 1, 8);
+    ngx_memcpy(p, code, size);
+
+    ctx->nregex++;
+
+    return NGX_OK;
+}
+
+
+/* the code is used in place, so it is not compiled again */
+
+void *ngx_conf_snapshot_regex(ngx_str_t *pattern, ngx_int_t options)
+{
+    uint32_t                    crc;
+    ngx_uint_t                  key;
+    ngx_conf_snapshot_t        *s;
+    ngx_conf_snapshot_regex_t  *re;
+
+    s = ngx_conf_snapshot_in;
+
+    if (s == NULL) {
+        return NULL;
+    }
+
+    crc = ngx_crc((char *) pattern->data, pattern->len);
+
+    for (key = crc % s->nregex; s->regex[key]; key = (key + 1) % s->nregex) {
+        re = s->regex[key];
+
+        if (re->crc == crc
+            && re->options == (uint32_t) options
+            && re->len == pattern->len
+            && ngx_strncmp((u_char *) (re + 1), pattern->data, re->len) == 0)
+        {
+            return (u_char *) (re + 1)
+                   + ngx_conf_snapshot_align(re->len + 1, 8);
+        }
+    }
+
+    return NULL;
+}
+
+
+ngx_int_t ngx_conf_snapshot_save(ngx_cycle_t *cycle, ngx_log_t *log)
+{
+    u_char                      *buf, *p;
+    size_t                       size, rsize, dsize;
+    ssize_t                      n;
+    uint32_t                    *w;
+    ngx_str_t                    temp;
+    ngx_file_t                   file;
+    ngx_conf_snapshot_ctx_t     *ctx;
+    ngx_conf_snapshot_header_t  *h;
+
+    ctx = ngx_conf_snapshot_out;
+
+    if (!(w = (uint32_t *) ngx_conf_snapshot_alloc(&ctx->directives,
+                                                   3 * sizeof(uint32_t))))
+    {
+        return NGX_ERROR;
+    }
+
+    w[0] = NGX_CONF_SNAPSHOT_END;
+    w[1] = 0;
+    w[2] = 0;
+
+    rsize = ctx->regex.last - ctx->regex.start;
+    dsize = ctx->directives.last - ctx->directives.start;
+    size = sizeof(ngx_conf_snapshot_header_t) + rsize + dsize;
+
+    if (size != (uint32_t) size) {
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "the configuration snapshot is too large");
+        return NGX_ERROR;
+    }
+
+    if (!(buf = ngx_alloc(size, log))) {
+        return NGX_ERROR;
+    }
+
+    h = (ngx_conf_snapshot_header_t *) buf;
+    ngx_memzero(h, sizeof(ngx_conf_snapshot_header_t));
+
+    ngx_memcpy(h->magic, NGX_CONF_SNAPSHOT_MAGIC, sizeof(h->magic));
+    h->order = NGX_CONF_SNAPSHOT_ORDER;
+    h->signature = ngx_conf_snapshot_signature();
+    h->size = size;
+    h->nregex = ctx->nregex;
+    h->directives = sizeof(ngx_conf_snapshot_header_t) + rsize;
+
+    p = buf + sizeof(ngx_conf_snapshot_header_t);
+
+    if (rsize) {
+        p = ngx_cpymem(p, ctx->regex.start, rsize);
+    }
+
+    ngx_memcpy(p, ctx->directives.start, dsize);
+
+    h->crc = ngx_crc((char *) buf + sizeof(ngx_conf_snapshot_header_t),
+                     size - sizeof(ngx_conf_snapshot_header_t));
+
+    /* the snapshot is renamed, so a reload never maps a partial one */
+
+    temp.len = ngx_conf_snapshot_name.len + sizeof(".tmp") - 1;
+    if (!(temp.data = ngx_palloc(cycle->pool, temp.len + 1))) {
+        ngx_free(buf);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(ngx_cpymem(temp.data, ngx_conf_snapshot_name.data,
+                          ngx_conf_snapshot_name.len),
+               ".tmp", sizeof(".tmp"));
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = temp;
+    file.log = log;
+
+    file.fd = ngx_open_file(temp.data, NGX_FILE_RDWR,
+                            NGX_FILE_CREATE_OR_OPEN|NGX_FILE_TRUNCATE);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_open_file_n " %s failed", temp.data);
+        ngx_free(buf);
+        return NGX_ERROR;
+    }
+
+    n = ngx_write_file(&file, buf, size, 0);
+
+    ngx_free(buf);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " %s failed", temp.data);
+        n = NGX_ERROR;
+    }
+
+    if (n == NGX_ERROR) {
+        if (ngx_delete_file(temp.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_delete_file_n " %s failed", temp.data);
+        }
+
+        return NGX_ERROR;
+    }
+
+    if (ngx_rename_file(temp.data, ngx_conf_snapshot_name.data)
+                                                              == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_rename_file_n " %s to %s failed",
+                      temp.data, ngx_conf_snapshot_name.data);
+        return NGX_ERROR;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "the configuration snapshot %s is created, "
+                  SIZE_T_FMT " bytes, %" NGX_UINT_T_FMT " regexes",
+                  ngx_conf_snapshot_name.data, size, ctx->nregex);
+
+    return NGX_OK;
+}
+
+
+/*
+ * NGX_DECLINED is returned if the file is not a snapshot; a snapshot of
+ * another binary is an error, its regexes could not be used
+ */
+
+static ngx_int_t ngx_conf_snapshot_load(ngx_conf_t *cf)
+{
+    u_char                      *p, *last;
+    size_t                       size;
+    ssize_t                      n;
+    uint32_t                     i;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   key;
+    ngx_file_t                  *file;
+    ngx_pool_cleanup_t          *cln;
+    ngx_conf_snapshot_t         *s;
+    ngx_conf_snapshot_regex_t   *re;
+    ngx_conf_snapshot_header_t   h;
+
+    file = &cf->conf_file->file;
+    size = (size_t) ngx_file_size(&file->info);
+
+    if (size < sizeof(ngx_conf_snapshot_header_t)) {
+        return NGX_DECLINED;
+    }
+
+    n = ngx_read_file(file, (u_char *) &h, sizeof(ngx_conf_snapshot_header_t),
+                      0);
+
+    file->offset = 0;
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if ((size_t) n != sizeof(ngx_conf_snapshot_header_t)
+        || ngx_strncmp(h.magic, NGX_CONF_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (h.order != NGX_CONF_SNAPSHOT_ORDER
+        || h.signature != ngx_conf_snapshot_signature())
+    {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "the configuration snapshot %s was created "
+                      "by another nginx binary", file->name.data);
+        return NGX_ERROR;
+    }
+
+    if (h.size != size || h.directives > size) {
+        goto corrupted;
+    }
+
+    if (!(s = ngx_palloc(cf->pool, sizeof(ngx_conf_snapshot_t)))) {
+        return NGX_ERROR;
+    }
+
+    if (!(cln = ngx_pool_cleanup_add(cf->pool, 0))) {
+        return NGX_ERROR;
+    }
+
+    if (!(s->start = ngx_map_file(file, size))) {
+        return NGX_ERROR;
+    }
+
+    s->size = size;
+    s->name = file->name;
+    s->log = cf->cycle->log;
+
+    cln->handler = ngx_conf_snapshot_unmap;
+    cln->data = s;
+
+    if (ngx_crc((char *) s->start + sizeof(ngx_conf_snapshot_header_t),
+                size - sizeof(ngx_conf_snapshot_header_t)) != h.crc)
+    {
+        goto corrupted;
+    }
+
+    s->nregex = 2 * h.nregex + 1;
+
+    if (!(s->regex = ngx_pcalloc(cf->pool, s->nregex
+                                      * sizeof(ngx_conf_snapshot_regex_t *))))
+    {
+        return NGX_ERROR;
+    }
+
+    p = s->start + sizeof(ngx_conf_snapshot_header_t);
+    last = s->start + h.directives;
+
+    for (i = 0; i < h.nregex; i++) {
+        re = (ngx_conf_snapshot_regex_t *) p;
+
+        p += sizeof(ngx_conf_snapshot_regex_t);
+
+        if (p > last) {
+            goto corrupted;
+        }
+
+        p += ngx_conf_snapshot_align(re->len + 1, 8)
+             + ngx_conf_snapshot_align(re->size, 8);
+
+        if (p > last) {
+            goto corrupted;
+        }
+
+        for (key = re->crc % s->nregex;
+             s->regex[key];
+             key = (key + 1) % s->nregex)
+        {
+            /* void */
+        }
+
+        s->regex[key] = re;
+    }
+
+    if (!(b = ngx_calloc_buf(cf->pool))) {
+        return NGX_ERROR;
+    }
+
+    b->start = last;
+    b->pos = last;
+    b->last = s->start + size;
+    b->end = s->start + size;
+
+    cf->conf_file->buffer = b;
+    cf->conf_file->snapshot = s;
+
+    ngx_conf_snapshot_in = s;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                   "configuration snapshot %s, " SIZE_T_FMT " bytes",
+                   file->name.data, size);
+
+    return NGX_OK;
+
+corrupted:
+
+    ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                  "the configuration snapshot %s is corrupted",
+                  file->name.data);
+
+    return NGX_ERROR;
+}
+
+
+static void ngx_conf_snapshot_unmap(void *data)
+{
+    ngx_conf_snapshot_t  *s = data;
+
+    ngx_unmap_file(s->start, s->size, s->log);
+}
+
+
+static int ngx_conf_snapshot_read_token(ngx_conf_t *cf)
+{
+    u_char       *p;
+    uint32_t     *w, n;
+    ngx_str_t    *word;
+    ngx_buf_t    *b;
+
+    cf->args->nelts = 0;
+    b = cf->conf_file->buffer;
+
+    for ( ;; ) {
+
+        if (b->last - b->pos < (ssize_t) (3 * sizeof(uint32_t))) {
+            break;
+        }
+
+        w = (uint32_t *) b->pos;
+
+        if (w[0] == NGX_CONF_SNAPSHOT_FILE) {
+            cf->conf_file->file.name.len = w[1];
+            cf->conf_file->file.name.data = (u_char *) &w[2];
+
+            b->pos += 2 * sizeof(uint32_t)
+                      + ngx_conf_snapshot_align(w[1] + 1, sizeof(uint32_t));
+            continue;
+        }
+
+        if (w[0] == NGX_CONF_SNAPSHOT_END) {
+            return NGX_CONF_FILE_DONE;
+        }
+
+        if (w[0] != NGX_CONF_SNAPSHOT_TOKEN
+            && w[0] != NGX_CONF_SNAPSHOT_BLOCK)
+        {
+            break;
+        }
+
+        cf->conf_file->line = w[1];
+
+        p = b->pos + 3 * sizeof(uint32_t);
+
+        for (n = w[2]; n; n--) {
+            if (!(word = ngx_push_array(cf->args))) {
+                return NGX_ERROR;
+            }
+
+            word->len = *(uint32_t *) p;
+            word->data = p + sizeof(uint32_t);
+
+            p += sizeof(uint32_t)
+                 + ngx_conf_snapshot_align(word->len + 1, sizeof(uint32_t));
+        }
+
+        b->pos = p;
+
+        return (w[0] == NGX_CONF_SNAPSHOT_TOKEN) ? NGX_OK :
+                                                   NGX_CONF_BLOCK_DONE;
+    }
+
+    ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                  "the configuration snapshot %s is corrupted",
+                  cf->conf_file->snapshot->name.data);
+
+    return NGX_ERROR;
+}
+
+
+/* the pcre code depends on the pcre library version and the platform */
+
+static uint32_t ngx_conf_snapshot_signature(void)
+{
+    int   n;
+    char  buf[128];
+
+    n = ngx_snprintf(buf, sizeof(buf), "%s %s " SIZE_T_FMT, NGINX_VER,
+#if (HAVE_PCRE)
+                     pcre_version(),
+#else
+                     "-",
+#endif
+                     sizeof(void *));
+
+    return ngx_crc(buf, n);
+}
+
+
 static int ngx_conf_read_token(ngx_conf_t *cf)
 {
     u_char      *start, ch, *src, *dst;
@@ -335,6 +1116,10 @@ static int ngx_conf_read_token(ngx_conf_t *cf)
     sharp_comment = 0;
     quoted = s_quoted = d_quoted = 0;
 
+    if (cf->conf_file->snapshot) {
+        return ngx_conf_snapshot_read_token(cf);
+    }
+
     cf->args->nelts = 0;
     b = cf->conf_file->buffer;
     start = b->pos;
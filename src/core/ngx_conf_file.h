@@ -32,6 +32,8 @@
 
 #define NGX_CONF_TAKE23      (NGX_CONF_TAKE2|NGX_CONF_TAKE3)
 
+#define NGX_CONF_TAKE123     (NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3)
+
 #define NGX_CONF_TAKE1234    (NGX_CONF_TAKE1|NGX_CONF_TAKE2|NGX_CONF_TAKE3   \
                               |NGX_CONF_TAKE4)
 
@@ -70,6 +72,9 @@
 
 #define NGX_MAX_CONF_ERRSTR  256
 
+/* the configuration file read buffer size, the token should fit in it */
+#define NGX_CONF_BUFFER      (64 * 1024)
+
 
 struct ngx_command_s {
     ngx_str_t     name; // 命令名字
@@ -119,10 +124,15 @@ typedef struct {
 } ngx_core_module_t; 
 
 
+typedef struct ngx_conf_snapshot_s  ngx_conf_snapshot_t;
+
 typedef struct {
-    ngx_file_t   file;
-    ngx_buf_t   *buffer;
-    ngx_uint_t   line;
+    ngx_file_t            file;
+    ngx_buf_t            *buffer;
+    ngx_uint_t            line;
+
+    /* the mapped snapshot, the buffer points to its directives then */
+    ngx_conf_snapshot_t  *snapshot;
 } ngx_conf_file_t;
 
 
@@ -145,6 +155,9 @@ struct ngx_conf_s {
 
     ngx_conf_handler_pt   handler;
     char                 *handler_conf;
+
+    /* if set, the directives mark the ctx indices of their modules in it */
+    u_char               *modules_set;
 };
 
 
@@ -272,6 +285,11 @@ char *ngx_conf_check_num_bounds(ngx_conf_t *cf, void *post, void *data);
 
 char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename);
 
+ngx_int_t ngx_conf_snapshot_save(ngx_cycle_t *cycle, ngx_log_t *log);
+ngx_int_t ngx_conf_snapshot_add_regex(ngx_str_t *pattern, ngx_int_t options,
+                                      void *code, size_t size);
+void *ngx_conf_snapshot_regex(ngx_str_t *pattern, ngx_int_t options);
+
 
 ngx_int_t ngx_conf_full_name(ngx_cycle_t *cycle, ngx_str_t *name);
 ngx_open_file_t *ngx_conf_open_file(ngx_cycle_t *cycle, ngx_str_t *name);
@@ -293,5 +311,7 @@ char *ngx_conf_set_bitmask_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 extern ngx_uint_t     ngx_max_module;
 extern ngx_module_t  *ngx_modules[];
 
+extern ngx_str_t      ngx_conf_snapshot_name;
+
 
 #endif /* _NGX_HTTP_CONF_FILE_H_INCLUDED_ */
@@ -261,9 +261,9 @@ ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle)
 
 void ngx_close_listening_sockets(ngx_cycle_t *cycle)
 {
-    ngx_uint_t        i;
-    ngx_socket_t      fd;
-    ngx_listening_t  *ls;
+    ngx_uint_t         i;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c;
 
     if (ngx_event_flags & NGX_USE_IOCP_EVENT) {
         return;
@@ -274,27 +274,25 @@ void ngx_close_listening_sockets(ngx_cycle_t *cycle)
 
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
-        fd = ls[i].fd;
 
-#if (WIN32)
-        /*
-         * Winsock assignes a socket number divisible by 4
-         * so to find a connection we divide a socket number by 4.
-         */
+        c = ls[i].connection;
 
-        fd /= 4;
-#endif
+        if (c) {
+            if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
+                if (c->read->active) {
+                    ngx_del_conn(c, NGX_CLOSE_EVENT);
+                }
 
-        if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
-            if (cycle->connections[fd].read->active) {
-                ngx_del_conn(&cycle->connections[fd], NGX_CLOSE_EVENT);
+            } else {
+                if (c->read->active) {
+                    ngx_del_event(c->read, NGX_READ_EVENT, NGX_CLOSE_EVENT);
+                }
             }
 
-        } else {
-            if (cycle->read_events[fd].active) {
-                ngx_del_event(&cycle->read_events[fd],
-                              NGX_READ_EVENT, NGX_CLOSE_EVENT);
-            }
+            ngx_free_connection(c);
+
+            c->fd = (ngx_socket_t) -1;
+            ls[i].connection = NULL;
         }
 
         if (ngx_close_socket(ls[i].fd) == -1) {
@@ -302,8 +300,344 @@ void ngx_close_listening_sockets(ngx_cycle_t *cycle)
                           ngx_close_socket_n " %s failed",
                           ls[i].addr_text.data);
         }
+    }
+}
+
+
+static ngx_connection_chunk_t *ngx_add_connection_chunk(ngx_cycle_t *cycle,
+                                                        ngx_log_t *log);
+static void ngx_shrink_connections(ngx_event_t *ev);
+
+
+#define ngx_align_cache_line(n)                                               \
+    (((n) + NGX_CPU_CACHE_LINE - 1) & ~((size_t) NGX_CPU_CACHE_LINE - 1))
+
+
+static ngx_event_t       ngx_shrink_event;
+static ngx_connection_t  ngx_shrink_dumb;
+
+
+ngx_int_t ngx_init_connections(ngx_cycle_t *cycle)
+{
+    cycle->chunks = NULL;
+    cycle->free_chunk = NULL;
+    cycle->allocated_connection_n = 0;
+    cycle->free_connection_n = cycle->connection_n;
+
+    if (ngx_add_connection_chunk(cycle, cycle->log) == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_shrink_event.event_handler = ngx_shrink_connections;
+    ngx_shrink_event.log = cycle->log;
+    ngx_shrink_event.data = &ngx_shrink_dumb;
+    ngx_shrink_dumb.fd = (ngx_socket_t) -1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the connections are taken from the free lists of the chunks of
+ * the current cycle instead of being indexed by a socket number;
+ * the first chunk that has a free connection is used, so the busy
+ * connections are packed in the old chunks and the new ones may drain
+ */
+
+ngx_connection_t *ngx_get_connection(ngx_socket_t s, ngx_log_t *log)
+{
+    ngx_uint_t               instance;
+    ngx_event_t             *rev, *wev;
+    ngx_cycle_t             *cycle;
+    ngx_connection_t        *c;
+    ngx_connection_chunk_t  *chunk;
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+
+    /* disable warning: Win32 SOCKET is u_int while UNIX socket is int */
+
+    if (cycle->files && (ngx_uint_t) s >= cycle->files_n) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "the new socket has number %d, "
+                      "but only %" NGX_UINT_T_FMT " files are available",
+                      s, cycle->files_n);
+        return NULL;
+    }
+
+    chunk = cycle->free_chunk;
+
+    if (chunk == NULL) {
+
+        if (cycle->allocated_connection_n == cycle->connection_n) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "%" NGX_UINT_T_FMT " connections are not enough",
+                          cycle->connection_n);
+            return NULL;
+        }
+
+        chunk = ngx_add_connection_chunk(cycle, log);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    c = chunk->free;
+
+    chunk->free = c->data;
+    chunk->free_n--;
+    chunk->idle = 0;
+
+    cycle->free_connection_n--;
+
+    if (chunk->free_n == 0) {
+
+        /* find the next chunk that has a free connection */
+
+        do {
+            chunk = chunk->next;
+        } while (chunk && chunk->free_n == 0);
+
+        cycle->free_chunk = chunk;
+    }
+
+    if (cycle->files) {
+        cycle->files[s] = c;
+    }
+
+    rev = c->read;
+    wev = c->write;
+
+#if (NGX_THREADS)
+
+    if (*(&c->lock)) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                       "spinlock in get connection, fd:%d", s);
+        ngx_spinlock(&c->lock, 1000);
+        ngx_unlock(&c->lock);
+    }
+
+#endif
+
+    instance = rev->instance;
+    chunk = c->chunk;
+
+    ngx_memzero(c, sizeof(ngx_connection_t));
+    ngx_memzero(rev, sizeof(ngx_event_t));
+    ngx_memzero(wev, sizeof(ngx_event_t));
+
+    /* the stale events of the previous connection are detected by instance */
+
+    rev->instance = !instance;
+    wev->instance = !instance;
+
+    rev->index = NGX_INVALID_INDEX;
+    wev->index = NGX_INVALID_INDEX;
+
+    rev->data = c;
+    wev->data = c;
+
+    wev->write = 1;
+
+    c->read = rev;
+    c->write = wev;
+    c->fd = s;
+    c->chunk = chunk;
+
+    c->log = log;
+    rev->log = log;
+    wev->log = log;
+
+#if (NGX_THREADS)
+    rev->lock = &c->lock;
+    wev->lock = &c->lock;
+    rev->own_lock = &c->lock;
+    wev->own_lock = &c->lock;
+#endif
+
+    return c;
+}
+
+
+void ngx_free_connection(ngx_connection_t *c)
+{
+    ngx_cycle_t             *cycle;
+    ngx_connection_chunk_t  *chunk;
+
+    /* the connection of an old cycle returns to the chunk of that cycle */
+
+    chunk = c->chunk;
+    cycle = chunk->cycle;
+
+    c->data = chunk->free;
+    chunk->free = c;
+    chunk->free_n++;
+
+    cycle->free_connection_n++;
+
+    if (cycle->files && c->fd != (ngx_socket_t) -1) {
+        cycle->files[c->fd] = NULL;
+    }
+
+    /* the free chunk is the first one in the list that has free connections */
+
+    if (cycle->free_chunk == NULL || chunk->number < cycle->free_chunk->number)
+    {
+        cycle->free_chunk = chunk;
+    }
+}
+
+
+static ngx_connection_chunk_t *ngx_add_connection_chunk(ngx_cycle_t *cycle,
+                                                        ngx_log_t *log)
+{
+    u_char                  *p;
+    size_t                   size, csize, esize;
+    ngx_uint_t               i, n;
+    ngx_connection_t        *c, *next;
+    ngx_connection_chunk_t  *chunk, **last;
+
+    n = cycle->connection_n - cycle->allocated_connection_n;
+
+    if (n > NGX_CONNECTION_CHUNK) {
+        n = NGX_CONNECTION_CHUNK;
+    }
+
+    /*
+     * the chunk, its connections and its events are allocated at once
+     * and each array starts a cache line
+     */
+
+    size = ngx_align_cache_line(sizeof(ngx_connection_chunk_t));
+    csize = ngx_align_cache_line(sizeof(ngx_connection_t) * n);
+    esize = ngx_align_cache_line(sizeof(ngx_event_t) * n);
+
+    p = ngx_memalign(NGX_CPU_CACHE_LINE, size + csize + 2 * esize, log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(p, size + csize + 2 * esize);
+
+    chunk = (ngx_connection_chunk_t *) p;
+    chunk->connections = (ngx_connection_t *) (p + size);
+    chunk->read_events = (ngx_event_t *) (p + size + csize);
+    chunk->write_events = (ngx_event_t *) (p + size + csize + esize);
+    chunk->n = n;
+    chunk->cycle = cycle;
+
+    c = chunk->connections;
+    next = NULL;
+
+    i = n;
+
+    do {
+        i--;
+
+        c[i].data = next;
+        c[i].read = &chunk->read_events[i];
+        c[i].write = &chunk->write_events[i];
+        c[i].fd = (ngx_socket_t) -1;
+        c[i].chunk = chunk;
+
+        chunk->read_events[i].closed = 1;
+        chunk->write_events[i].closed = 1;
+
+        next = &c[i];
+
+    } while (i);
+
+    chunk->free = next;
+    chunk->free_n = n;
+
+    /* the chunks are kept in the order of their numbers */
+
+    for (last = &cycle->chunks; *last; last = &(*last)->next) {
+        chunk->number = (*last)->number + 1;
+    }
+
+    *last = chunk;
+
+    if (cycle->free_chunk == NULL) {
+        cycle->free_chunk = chunk;
+    }
+
+    cycle->allocated_connection_n += n;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "connection chunk: " PTR_FMT ", n:%d", chunk, n);
+
+#if !(NGX_THREADS)
+
+    if (cycle->chunks != chunk
+        && !ngx_shrink_event.timer_set
+        && !(ngx_event_flags & NGX_USE_AIO_EVENT))
+    {
+        ngx_add_timer(&ngx_shrink_event, NGX_CONNECTION_SHRINK_TIME);
+    }
+
+#endif
+
+    return chunk;
+}
+
+
+/*
+ * the chunks except the first one are released if they stay free during
+ * NGX_CONNECTION_SHRINK_TIME; the timer runs after all events returned by
+ * the kernel have been handled, so there are no stale events that may point
+ * to the connections of a released chunk
+ */
+
+static void ngx_shrink_connections(ngx_event_t *ev)
+{
+    ngx_uint_t               more;
+    ngx_cycle_t             *cycle;
+    ngx_connection_chunk_t  *chunk, **prev;
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "shrink connections");
+
+    more = 0;
+    prev = &cycle->chunks->next;
+
+    for (chunk = *prev; chunk; chunk = *prev) {
+
+        if (chunk->free_n != chunk->n) {
+            chunk->idle = 0;
+            prev = &chunk->next;
+            more = 1;
+            continue;
+        }
+
+        if (!chunk->idle && !ngx_exiting) {
+            chunk->idle = 1;
+            prev = &chunk->next;
+            more = 1;
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                       "free connection chunk: " PTR_FMT ", n:%d",
+                       chunk, chunk->n);
+
+        *prev = chunk->next;
 
-        cycle->connections[fd].fd = (ngx_socket_t) -1;
+        cycle->allocated_connection_n -= chunk->n;
+
+        ngx_free(chunk);
+    }
+
+    for (chunk = cycle->chunks; chunk; chunk = chunk->next) {
+        if (chunk->free_n) {
+            break;
+        }
+    }
+
+    cycle->free_chunk = chunk;
+
+    if (more) {
+        ngx_add_timer(ev, NGX_CONNECTION_SHRINK_TIME);
     }
 }
 
@@ -395,9 +729,10 @@ void ngx_close_connection(ngx_connection_t *c)
 
 #endif
 
+    ngx_free_connection(c);
+
     fd = c->fd;
     c->fd = (ngx_socket_t) -1;
-    c->data = NULL;
 
     ngx_destroy_pool(c->pool);
 
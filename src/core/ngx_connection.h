@@ -12,7 +12,9 @@
 #include <ngx_core.h>
 
 
-typedef struct {
+typedef struct ngx_listening_s  ngx_listening_t;
+
+struct ngx_listening_s {
     ngx_socket_t      fd;
 
     struct sockaddr  *sockaddr;
@@ -40,6 +42,9 @@ typedef struct {
     time_t            post_accept_timeout;     /* should be here because
                                                   of the deferred accept */
 
+    ngx_listening_t  *previous;   /* the same socket in the old cycle */
+    ngx_connection_t *connection;
+
     unsigned          new:1;
     unsigned          remain:1;
     unsigned          ignore:1;
@@ -57,7 +62,7 @@ typedef struct {
 #endif
 
     unsigned          addr_ntop:1;
-} ngx_listening_t;
+};
 
 
 typedef enum {
@@ -75,6 +80,12 @@ typedef enum {
 } ngx_connection_tcp_nopush_e;
 
 
+/*
+ * the fields that are used on every read and write go first and fill
+ * the first cache line of the connection, the ones that are set once
+ * on accept() or are needed to log an error follow them
+ */
+
 struct ngx_connection_s {
     void               *data;
     ngx_event_t        *read;
@@ -82,48 +93,50 @@ struct ngx_connection_s {
 
     ngx_socket_t        fd;
 
+    unsigned            log_error:2;  /* ngx_connection_log_error_e */
+
+    unsigned            buffered:1;
+    unsigned            single_connection:1;
+    unsigned            unexpected_eof:1;
+    unsigned            timedout:1;
+    unsigned            idle:1;       /* an idle keepalive connection */
+    unsigned            close:1;      /* the idle connection must be closed */
+    signed              tcp_nopush:2;
+#if (HAVE_IOCP)
+    unsigned            accept_context_updated:1;
+#endif
+
     ngx_recv_pt         recv;
     ngx_send_chain_pt   send_chain;
 
-    ngx_listening_t    *listening;
-
     off_t               sent;
 
-    void               *ctx;
-    void               *servers;
-
+    ngx_buf_t          *buffer;
 
+    ngx_pool_t         *pool;
     ngx_log_t          *log;
 
-    ngx_pool_t         *pool;
+#if (NGX_OPENSSL)
+    ngx_ssl_t          *ssl;
+#endif
+
+    ngx_listening_t    *listening;
+
+    void               *ctx;
+    void               *servers;
 
     struct sockaddr    *sockaddr;
     socklen_t           socklen;
     ngx_str_t           addr_text;
 
-#if (NGX_OPENSSL)
-    ngx_ssl_t          *ssl;
-#endif
-
 #if (HAVE_IOCP)
     struct sockaddr    *local_sockaddr;
     socklen_t           local_socklen;
 #endif
 
-    ngx_buf_t          *buffer;
-
     ngx_uint_t          number;
 
-    unsigned            log_error:2;  /* ngx_connection_log_error_e */
-
-    unsigned            buffered:1;
-    unsigned            single_connection:1;
-    unsigned            unexpected_eof:1;
-    unsigned            timedout:1;
-    signed              tcp_nopush:2;
-#if (HAVE_IOCP)
-    unsigned            accept_context_updated:1;
-#endif
+    ngx_connection_chunk_t  *chunk;
 
 #if (NGX_THREADS)
     ngx_atomic_t        lock;
@@ -131,6 +144,40 @@ struct ngx_connection_s {
 };
 
 
+/*
+ * the connections and their events are allocated in the chunks
+ * of NGX_CONNECTION_CHUNK connections up to the "connections" number
+ * and the chunks that stay free are released back, so the memory follows
+ * the number of the busy connections; a chunk is never moved, so the
+ * pointers to the connections and their events are always valid
+ */
+
+#ifndef NGX_CONNECTION_CHUNK
+#define NGX_CONNECTION_CHUNK        256
+#endif
+
+#ifndef NGX_CONNECTION_SHRINK_TIME
+#define NGX_CONNECTION_SHRINK_TIME  10000
+#endif
+
+struct ngx_connection_chunk_s {
+    ngx_connection_t        *connections;
+    ngx_event_t             *read_events;
+    ngx_event_t             *write_events;
+    ngx_uint_t               n;
+
+    ngx_connection_t        *free;
+    ngx_uint_t               free_n;
+
+    ngx_uint_t               number;
+    ngx_cycle_t             *cycle;
+    ngx_connection_chunk_t  *next;
+
+    /* the chunk was free on the previous shrink check */
+    unsigned                 idle:1;
+};
+
+
 #ifndef ngx_ssl_set_nosendshut
 #define ngx_ssl_set_nosendshut(ssl)
 #endif
@@ -143,6 +190,9 @@ ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_close_listening_sockets(ngx_cycle_t *cycle);
 void ngx_close_connection(ngx_connection_t *c);
+ngx_int_t ngx_init_connections(ngx_cycle_t *cycle);
+ngx_connection_t *ngx_get_connection(ngx_socket_t s, ngx_log_t *log);
+void ngx_free_connection(ngx_connection_t *c);
 ngx_int_t ngx_connection_error(ngx_connection_t *c, ngx_err_t err, char *text);
 
 
@@ -19,6 +19,7 @@ typedef struct ngx_command_s     ngx_command_t;
 typedef struct ngx_file_s        ngx_file_t;
 typedef struct ngx_event_s       ngx_event_t;
 typedef struct ngx_connection_s  ngx_connection_t;
+typedef struct ngx_connection_chunk_s  ngx_connection_chunk_t;
 
 typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
 
@@ -58,6 +59,7 @@ typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
 #include <ngx_regex.h>
 #endif
 #include <ngx_rbtree.h>
+#include <ngx_radix_tree.h>
 #include <ngx_times.h>
 #include <ngx_inet.h>
 #include <ngx_cycle.h>
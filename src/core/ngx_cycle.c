@@ -9,6 +9,7 @@
 #include <ngx_event.h>
 
 
+static void ngx_shared_zone_cleanup(void *data);
 static void ngx_clean_old_cycles(ngx_event_t *ev);
 
 
@@ -44,10 +45,10 @@ ngx_cycle_t *ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_conf_t          conf;
     ngx_pool_t         *pool;
     ngx_cycle_t        *cycle, **old;
-    ngx_socket_t        fd;
     ngx_list_part_t    *part;
     ngx_open_file_t    *file;
     ngx_listening_t    *ls, *nls;
+    ngx_shared_zone_t  *zone;
     ngx_core_module_t  *module;
 
     log = old_cycle->log;
@@ -102,6 +103,13 @@ ngx_cycle_t *ngx_init_cycle(ngx_cycle_t *old_cycle)
         return NULL;
     }
 
+    if (ngx_list_init(&cycle->shared_zones, pool, 1, sizeof(ngx_shared_zone_t))
+                                                                  == NGX_ERROR)
+    {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
     // 创建一个ngx_log_t结构体,管理错误输出的log
     if (!(cycle->new_log = ngx_log_create_errlog(cycle, NULL))) {
         ngx_destroy_pool(pool);
@@ -295,28 +303,9 @@ ngx_cycle_t *ngx_init_cycle(ngx_cycle_t *old_cycle)
                     if (ngx_memcmp(nls[n].sockaddr,
                                    ls[i].sockaddr, ls[i].socklen) == 0)
                     {
-                        fd = ls[i].fd;
-#if (WIN32)
-                        /*
-                         * Winsock assignes a socket number divisible by 4 so
-                         * to find a connection we divide a socket number by 4.
-                         */
-
-                        fd /= 4;
-#endif
-                        if (fd >= (ngx_socket_t) cycle->connection_n) {
-                            ngx_log_error(NGX_LOG_EMERG, log, 0,
-                                        "%d connections is not enough to hold "
-                                        "an open listening socket on %s, "
-                                        "required at least %d connections",
-                                        cycle->connection_n,
-                                        ls[i].addr_text.data, fd);
-                            failed = 1;
-                            break;
-                        }
-
                         nls[n].fd = ls[i].fd;
-                        nls[i].remain = 1;
+                        nls[n].previous = &ls[i];
+                        nls[n].remain = 1;
                         ls[i].remain = 1;
                         break;
                     }
@@ -397,6 +386,28 @@ ngx_cycle_t *ngx_init_cycle(ngx_cycle_t *old_cycle)
 
     /* commit the new cycle configuration */
 
+    /* the reused shared zones belong to the new cycle from now on */
+
+    part = &cycle->shared_zones.part;
+    zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            zone = part->elts;
+            i = 0;
+        }
+
+        if (zone[i].previous) {
+            zone[i].previous->addr = NULL;
+            zone[i].previous = NULL;
+        }
+    }
+
 #if !(WIN32)
     // log不是输出到标准错误流，则把错误输出重定向到fd对应的文件中
     if (!ngx_test_config && cycle->log->file->fd != STDERR_FILENO) {
@@ -472,7 +483,7 @@ ngx_cycle_t *ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
     }
 
-    if (old_cycle->connections == NULL) {
+    if (old_cycle->chunks == NULL) {
         /* an old cycle is an init cycle */
         ngx_destroy_pool(old_cycle->pool);
         return cycle;
@@ -724,11 +735,138 @@ void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
 }
 
 
+/*
+ * the zone is found in the new cycle, or it is taken from the old cycle
+ * if it has the same name, size and owner, or it is created;
+ * "exists" is set if the zone is already initialized
+ */
+
+u_char *ngx_shared_zone(ngx_cycle_t *cycle, ngx_str_t *name, size_t size,
+                        void *tag, ngx_uint_t *exists)
+{
+    ngx_uint_t           i;
+    ngx_list_part_t     *part;
+    ngx_shared_zone_t   *zone, *old;
+    ngx_pool_cleanup_t  *cln;
+
+    part = &cycle->shared_zones.part;
+    zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            zone = part->elts;
+            i = 0;
+        }
+
+        if (zone[i].name.len != name->len
+            || ngx_strncmp(zone[i].name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (zone[i].size != size || zone[i].tag != tag) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "the shared zone \"%s\" is already used "
+                          "with another size or by another module",
+                          name->data);
+            return NULL;
+        }
+
+        *exists = 1;
+        return zone[i].addr;
+    }
+
+    old = NULL;
+
+    part = &cycle->old_cycle->shared_zones.part;
+    zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            zone = part->elts;
+            i = 0;
+        }
+
+        if (zone[i].addr
+            && zone[i].size == size
+            && zone[i].tag == tag
+            && zone[i].name.len == name->len
+            && ngx_strncmp(zone[i].name.data, name->data, name->len) == 0)
+        {
+            old = &zone[i];
+            break;
+        }
+    }
+
+    if (!(zone = ngx_list_push(&cycle->shared_zones))) {
+        return NULL;
+    }
+
+    if (!(cln = ngx_pool_cleanup_add(cycle->pool, 0))) {
+        return NULL;
+    }
+
+    zone->name = *name;
+    zone->size = size;
+    zone->tag = tag;
+    zone->previous = old;
+
+    if (old) {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "reuse shared zone \"%s\": " PTR_FMT,
+                       name->data, old->addr);
+
+        zone->addr = old->addr;
+        *exists = 1;
+
+    } else {
+        if (!(zone->addr = ngx_create_shared_memory(size, cycle->log))) {
+            return NULL;
+        }
+
+        *exists = 0;
+    }
+
+    cln->handler = ngx_shared_zone_cleanup;
+    cln->data = zone;
+
+    return zone->addr;
+}
+
+
+static void ngx_shared_zone_cleanup(void *data)
+{
+    ngx_shared_zone_t  *zone = data;
+
+    /*
+     * the zone that is passed on to the new cycle has no address, and
+     * the zone of the failed new cycle still belongs to the old cycle
+     */
+
+    if (zone->addr == NULL || zone->previous) {
+        return;
+    }
+
+    ngx_free_shared_memory(zone->addr, zone->size, ngx_cycle->log);
+}
+
+
 static void ngx_clean_old_cycles(ngx_event_t *ev)
 {
-    ngx_uint_t     i, n, found, live;
-    ngx_log_t     *log;
-    ngx_cycle_t  **cycle;
+    ngx_uint_t               i, n, found, live;
+    ngx_log_t               *log;
+    ngx_cycle_t            **cycle;
+    ngx_connection_chunk_t  *chunk;
 
     log = ngx_cycle->log;
     ngx_temp_pool->log = log;
@@ -746,13 +884,16 @@ static void ngx_clean_old_cycles(ngx_event_t *ev)
 
         found = 0;
 
-        for (n = 0; n < cycle[i]->connection_n; n++) {
-            if (cycle[i]->connections[n].fd != (ngx_socket_t) -1) {
-                found = 1;
+        for (chunk = cycle[i]->chunks; chunk && !found; chunk = chunk->next) {
+            for (n = 0; n < chunk->n; n++) {
+                if (chunk->connections[n].fd != (ngx_socket_t) -1) {
+                    found = 1;
 
-                ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0, "live fd:%d", n);
+                    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0, "live fd:%d",
+                                   chunk->connections[n].fd);
 
-                break;
+                    break;
+                }
             }
         }
 
@@ -763,6 +904,18 @@ static void ngx_clean_old_cycles(ngx_event_t *ev)
 
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0, "clean old cycle: %d", i);
 
+        /* the connection chunks and the files are not in the cycle pool */
+
+        while (cycle[i]->chunks) {
+            chunk = cycle[i]->chunks;
+            cycle[i]->chunks = chunk->next;
+            ngx_free(chunk);
+        }
+
+        if (cycle[i]->files) {
+            ngx_free(cycle[i]->files);
+        }
+
         ngx_destroy_pool(cycle[i]->pool);
         cycle[i] = NULL;
     }
@@ -12,26 +12,53 @@
 #include <ngx_core.h>
 
 
+typedef struct ngx_shared_zone_s  ngx_shared_zone_t;
+
+/*
+ * a named shared memory zone is kept on the reconfiguration if the new
+ * cycle asks for the zone of the same name, size and owner, so its data,
+ * for example the SSL sessions, survive the reload
+ */
+
+struct ngx_shared_zone_s {
+    ngx_str_t                 name;
+    size_t                    size;
+    void                     *tag;        /* the owner */
+    u_char                   *addr;       /* NULL if the zone is passed on */
+
+    /* the same zone of the old cycle until the new cycle is committed */
+    ngx_shared_zone_t        *previous;
+};
+
+
 struct ngx_cycle_s {
-    void           ****conf_ctx;
-    ngx_pool_t        *pool;
+    void                  ****conf_ctx;
+    ngx_pool_t               *pool;
+
+    ngx_log_t                *log;
+    ngx_log_t                *new_log;
+
+    ngx_array_t               listening;
+    ngx_array_t               pathes;
+    ngx_list_t                open_files;
+    ngx_list_t                shared_zones;
 
-    ngx_log_t         *log;
-    ngx_log_t         *new_log;
+    /* the maximum number, the connections are allocated in chunks */
+    ngx_uint_t                connection_n;
+    ngx_uint_t                allocated_connection_n;
+    ngx_uint_t                free_connection_n;
 
-    ngx_array_t        listening;
-    ngx_array_t        pathes;
-    ngx_list_t         open_files;
+    ngx_connection_chunk_t   *chunks;
+    ngx_connection_chunk_t   *free_chunk;
 
-    ngx_uint_t         connection_n;
-    ngx_connection_t  *connections;
-    ngx_event_t       *read_events;
-    ngx_event_t       *write_events;
+    /* the connections by a socket number for poll, /dev/poll and rt signals */
+    ngx_connection_t        **files;
+    ngx_uint_t                files_n;
 
-    ngx_cycle_t       *old_cycle;
+    ngx_cycle_t              *old_cycle;
 
-    ngx_str_t          conf_file;
-    ngx_str_t          root;
+    ngx_str_t                 conf_file;
+    ngx_str_t                 root;
 };
 
 
@@ -41,6 +68,19 @@ typedef struct {
 
      ngx_int_t   worker_processes;
 
+     ngx_int_t   priority;
+     ngx_int_t   rlimit_nofile;
+
+     /* the CPU masks of the workers, the last one is used for the rest */
+     ngx_uint_t  cpu_affinity_auto;
+     ngx_uint_t  cpu_affinity_n;
+     uint64_t   *cpu_affinity;
+
+     ngx_flag_t  cache_manager;
+     ngx_int_t   cache_manager_files;
+     ngx_msec_t  cache_manager_slice;
+     ngx_msec_t  cache_manager_sleep;
+
      ngx_uid_t   user;
      ngx_gid_t   group;
 
@@ -65,6 +105,9 @@ ngx_int_t ngx_create_pidfile(ngx_cycle_t *cycle, ngx_cycle_t *old_cycle);
 void ngx_delete_pidfile(ngx_cycle_t *cycle);
 void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user);
 ngx_pid_t ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv);
+uint64_t ngx_get_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n);
+u_char *ngx_shared_zone(ngx_cycle_t *cycle, ngx_str_t *name, size_t size,
+                        void *tag, ngx_uint_t *exists);
 
 
 extern volatile ngx_cycle_t  *ngx_cycle;
@@ -196,9 +196,9 @@ char *ngx_conf_set_path_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char  *p = conf;
 
-    ngx_int_t    level;
+    ngx_int_t    level, inactive, size;
     ngx_uint_t   i, n;
-    ngx_str_t   *value;
+    ngx_str_t   *value, s;
     ngx_path_t  *path, **pp;
 
     pp = (ngx_path_t **) (p + cmd->offset);
@@ -222,14 +222,47 @@ char *ngx_conf_set_path_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     path->name = value[1];
     // 初始化子目录长度为0
     path->len = 0;
+    path->inactive = NGX_PATH_INACTIVE;
+    path->max_size = 0;
     // 设置每层子目录长度
-    for (i = 0, n = 2; n < cf->args->nelts; i++, n++) {
+    for (i = 0, n = 2; n < cf->args->nelts; n++) {
+
+        if (ngx_strncmp(value[n].data, "inactive=", 9) == 0) {
+            s.len = value[n].len - 9;
+            s.data = value[n].data + 9;
+
+            inactive = ngx_parse_time(&s, 1);
+            if (inactive == NGX_ERROR || inactive == NGX_PARSE_LARGE_TIME) {
+                return "invalid \"inactive\" value";
+            }
+
+            path->inactive = (time_t) inactive;
+            continue;
+        }
+
+        if (ngx_strncmp(value[n].data, "max_size=", 9) == 0) {
+            s.len = value[n].len - 9;
+            s.data = value[n].data + 9;
+
+            size = ngx_parse_size(&s);
+            if (size == NGX_ERROR) {
+                return "invalid \"max_size\" value";
+            }
+
+            path->max_size = (off_t) size;
+            continue;
+        }
+
+        if (i == NGX_MAX_PATH_LEVEL) {
+            return "has too many levels";
+        }
+
         level = ngx_atoi(value[n].data, value[n].len);
         if (level == NGX_ERROR || level == 0) {
             return "invalid value";
         }
 
-        path->level[i] = level;
+        path->level[i++] = level;
         path->len += level + 1;// 目录后加\，占一字节
     }
     // 填充0
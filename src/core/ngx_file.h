@@ -13,6 +13,8 @@
 
 typedef struct ngx_path_s  ngx_path_t;
 
+#define NGX_MAX_PATH_LEVEL  3
+
 #include <ngx_garbage_collector.h>
 
 
@@ -29,16 +31,19 @@ struct ngx_file_s {
     unsigned         info_valid:1;
 };
 
-#define NGX_MAX_PATH_LEVEL  3
-
 struct ngx_path_s {
     ngx_str_t           name;// 根目录名字
     u_int               len;// level层子目录的总长度
     u_int               level[3];// 每层随机子目录长度，最多三层
+    time_t              inactive;
+    off_t               max_size;
     ngx_gc_handler_pt   gc_handler;
 };
 
 
+#define NGX_PATH_INACTIVE   3600
+
+
 typedef struct {
     ngx_file_t   file;
     off_t        offset;
@@ -72,6 +77,8 @@ char *ngx_conf_set_path_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
             conf->level[1] = l2;                                             \
             conf->level[2] = l3;                                             \
             conf->len = l1 + l2 + l3 + (l1 ? 1:0) + (l2 ? 1:0) + (l3 ? 1:0); \
+            conf->inactive = NGX_PATH_INACTIVE;                              \
+            conf->max_size = 0;                                              \
         } else {                                                             \
             conf = prev;                                                     \
         }                                                                    \
@@ -13,155 +13,133 @@ int ngx_garbage_collector_temp_handler(ngx_gc_t *ctx, ngx_str_t *name,
                                        ngx_dir_t *dir);
 
 
-static int ngx_collect_garbage(ngx_gc_t *ctx, ngx_str_t *dname, int level);
+static ngx_int_t ngx_gc_push_dir(ngx_gc_t *ctx, ngx_str_t *name,
+                                 ngx_int_t level);
+static void ngx_gc_pop_dir(ngx_gc_t *ctx);
+static void ngx_gc_delete_file(ngx_gc_t *ctx, ngx_str_t *name, ngx_dir_t *dir);
+static void ngx_gc_account(ngx_gc_t *ctx, ngx_dir_t *dir);
+static void ngx_gc_done(ngx_gc_t *ctx);
 
 
+/* the time is checked after every NGX_GC_TIME_CHECK entries */
+#define NGX_GC_TIME_CHECK  16
 
-#if 0
-
-{
-    ngx_test_null(cycle->timer_events,
-                  ngx_alloc(sizeof(ngx_event_t) * TIMERS, cycle->log),
-                  NGX_ERROR);
-
-    ngx_event_timer_init(cycle);
-}
 
+/*
+ * ngx_collect_garbage() walks the path hierarchy incrementally: it handles
+ * no more than "files" directory entries and returns in "slice" milliseconds
+ * at most.  The walk state is kept in the ctx->dirs stack of the opened
+ * directories, so the next call continues from the same place.
+ *
+ * It returns NGX_AGAIN if the walk is not complete yet and NGX_OK
+ * if the whole path hierarchy has been walked.
+ */
 
-void garbage_collector()
+ngx_int_t ngx_collect_garbage(ngx_gc_t *ctx, ngx_uint_t files,
+                              ngx_msec_t slice)
 {
-    ngx_msec_t        timer;
-    struct timeval    tv;
-    ngx_epoch_msec_t  delta;
-
-    for ( ;; ) {
-        timer = ngx_event_find_timer();
-
-        ngx_gettimeofday(&tv);
-        delta = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-
-        msleep(timer);
-
-        ngx_gettimeofday(&tv);
-
-        ngx_cached_time = tv.tv_sec;
-        ngx_time_update();
-
-        delta = tv.tv_sec * 1000 + tv.tv_usec / 1000 - delta;
-
-        ngx_event_expire_timers((ngx_msec_t) delta);
+    u_char            *last;
+    size_t             len;
+    ngx_err_t          err;
+    ngx_str_t          fname;
+    ngx_int_t          level;
+    ngx_uint_t         deleted;
+    ngx_gc_dir_t      *d;
+    struct timeval     tv;
+    ngx_epoch_msec_t   start, now;
+
+    ctx->walked = 0;
+
+    if (ctx->depth == 0) {
+        ctx->files = 0;
+        ctx->size = 0;
+        ngx_memzero(ctx->ages, NGX_GC_AGE_BUCKETS * sizeof(off_t));
+
+        if (ngx_gc_push_dir(ctx, &ctx->path->name, 0) == NGX_ERROR) {
+            return NGX_OK;
+        }
     }
-}
-
-#endif
 
+    ngx_gettimeofday(&tv);
+    start = (ngx_epoch_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
 
-void stub_init(ngx_cycle_t *cycle)
-{
-    ngx_uint_t    i;
-    ngx_gc_t      ctx;
-    ngx_path_t  **path;
+    while (ctx->walked < files) {
 
-    path = cycle->pathes.elts;
-    for (i = 0; i < cycle->pathes.nelts; i++) {
-        ctx.path = path[i];
-        ctx.log = cycle->log;
-        ctx.handler = path[i]->gc_handler;
+        if (ctx->walked && ctx->walked % NGX_GC_TIME_CHECK == 0) {
+            ngx_gettimeofday(&tv);
+            now = (ngx_epoch_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
 
-        ngx_collect_garbage(&ctx, &path[i]->name, 0);
-    }
-}
-
-
-static int ngx_collect_garbage(ngx_gc_t *ctx, ngx_str_t *dname, int level)
-{
-    int         rc;
-    u_char     *last;
-    size_t      len;
-    ngx_err_t   err;
-    ngx_str_t   fname, buf;
-    ngx_dir_t   dir;
-
-    buf.len = 0;
-#if (NGX_SUPPRESS_WARN)
-    buf.data = NULL;
-    fname.data = NULL;
-#endif
+            if (now - start >= (ngx_epoch_msec_t) slice) {
+                break;
+            }
+        }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->log, 0,
-                   "gc dir \"%s\":%d", dname->data, dname->len);
+        d = &ctx->dirs[ctx->depth - 1];
 
-    if (ngx_open_dir(dname, &dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_open_dir_n " \"%s\" failed", dname->data);
-        return NGX_ERROR;
-    }
-
-    for ( ;; ) {
         ngx_set_errno(0);
-        if (ngx_read_dir(&dir) == NGX_ERROR) {
+        if (ngx_read_dir(&d->dir) == NGX_ERROR) {
             err = ngx_errno;
 
             if (err != NGX_ENOMOREFILES) {
                 ngx_log_error(NGX_LOG_CRIT, ctx->log, err,
-                              ngx_read_dir_n " \"%s\" failed", dname->data);
-                rc = NGX_ERROR;
+                              ngx_read_dir_n " \"%s\" failed", d->name.data);
+            }
 
-            } else {
-                rc = NGX_OK;
+            ngx_gc_pop_dir(ctx);
+
+            if (ctx->depth == 0) {
+                ngx_gc_done(ctx);
+                return NGX_OK;
             }
 
-            break;
+            continue;
         }
 
-        len = ngx_de_namelen(&dir);
+        ctx->walked++;
+
+        len = ngx_de_namelen(&d->dir);
 
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->log, 0,
-                      "gc name \"%s\":%d", ngx_de_name(&dir), len);
+                      "gc name \"%s\":%d", ngx_de_name(&d->dir), len);
 
-        if (len == 1 && ngx_de_name(&dir)[0] == '.') {
+        if (len == 1 && ngx_de_name(&d->dir)[0] == '.') {
             continue;
         }
 
         if (len == 2
-            && ngx_de_name(&dir)[0] == '.'
-            && ngx_de_name(&dir)[1] == '.')
+            && ngx_de_name(&d->dir)[0] == '.'
+            && ngx_de_name(&d->dir)[1] == '.')
         {
             continue;
         }
 
-        fname.len = dname->len + 1+ len;
-
-        if (fname.len + NGX_DIR_MASK_LEN > buf.len) {
+        fname.len = d->name.len + 1 + len;
 
-            if (buf.len) {
-                ngx_free(buf.data);
-            }
-
-            buf.len = dname->len + 1 + len + NGX_DIR_MASK_LEN;
-
-            if (!(buf.data = ngx_alloc(buf.len + 1, ctx->log))) {
-                return NGX_ABORT;
-            }
+        if (!(fname.data = ngx_alloc(fname.len + NGX_DIR_MASK_LEN + 1,
+                                     ctx->log)))
+        {
+            return NGX_ABORT;
         }
 
-        last = ngx_cpymem(buf.data, dname->data, dname->len);
+        last = ngx_cpymem(fname.data, d->name.data, d->name.len);
         *last++ = '/';
-        ngx_memcpy(last, ngx_de_name(&dir), len + 1);
-        fname.data = buf.data;
+        ngx_memcpy(last, ngx_de_name(&d->dir), len + 1);
 
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ctx->log, 0,
                        "gc path: \"%s\"", fname.data);
 
-        if (!dir.info_valid) {
-            if (ngx_de_info(fname.data, &dir) == NGX_FILE_ERROR) {
+        if (!d->dir.info_valid) {
+            if (ngx_de_info(fname.data, &d->dir) == NGX_FILE_ERROR) {
                 ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
                               ngx_de_info_n " \"%s\" failed", fname.data);
+                ngx_free(fname.data);
                 continue;
             }
         }
 
-        if (ngx_de_is_dir(&dir)) {
+        level = d->level;
+
+        if (ngx_de_is_dir(&d->dir)) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_CORE, ctx->log, 0,
                            "gc enter dir \"%s\"", fname.data);
@@ -172,33 +150,20 @@ static int ngx_collect_garbage(ngx_gc_t *ctx, ngx_str_t *dname, int level)
                    /* an directory from the old path hierarchy */
                 || len != ctx->path->level[level])
             {
-                if (ngx_collect_garbage(ctx, &fname, -1) == NGX_ABORT) {
-                    return NGX_ABORT;
-                }
-
-                fname.data[fname.len] = '\0';
+                level = -1;
 
-                ngx_log_error(NGX_LOG_NOTICE, ctx->log, 0,
-                              "delete old hierachy directory \"%s\"",
-                              fname.data);
-
-                if (ngx_delete_dir(fname.data) == NGX_FILE_ERROR) {
-                    ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                                  ngx_delete_dir_n " \"%s\" failed",
-                                  fname.data);
-                } else {
-                    ctx->deleted++;
-                    ctx->freed += ngx_de_size(&dir);
-                }
-
-                continue;
+            } else {
+                level++;
             }
 
-            if (ngx_collect_garbage(ctx, &fname, level + 1) == NGX_ABORT) {
-                return NGX_ABORT;
+            if (ngx_gc_push_dir(ctx, &fname, level) == NGX_ERROR) {
+                ngx_free(fname.data);
             }
 
-        } else if (ngx_de_is_file(&dir)) {
+            continue;
+        }
+
+        if (ngx_de_is_file(&d->dir)) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_CORE, ctx->log, 0,
                            "gc file \"%s\"", fname.data);
@@ -206,46 +171,175 @@ static int ngx_collect_garbage(ngx_gc_t *ctx, ngx_str_t *dname, int level)
             if (level == -1
                 || (level < NGX_MAX_PATH_LEVEL && ctx->path->level[level] != 0))
             {
-                if (ngx_delete_file(fname.data) == NGX_FILE_ERROR) {
-                    ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                                  ngx_delete_file_n " \"%s\" failed",
-                                  fname.data);
-                } else {
-                    ctx->deleted++;
-                    ctx->freed += ngx_de_size(&dir);
-                }
+                ngx_gc_delete_file(ctx, &fname, &d->dir);
 
-                continue;
-            }
-
-            if (ctx->handler(ctx, &fname, &dir) == NGX_ABORT) {
-                return NGX_ABORT;
-            }
+            } else if (ctx->evict
+                       && ngx_time() - ngx_de_mtime(&d->dir) >= ctx->evict)
+            {
+                ngx_log_error(NGX_LOG_NOTICE, ctx->log, 0,
+                              "evict \"%s\"", fname.data);
 
-        } else {
-            ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                          "\"%s\" has unknown file type, deleting", fname.data);
+                ngx_gc_delete_file(ctx, &fname, &d->dir);
 
-            if (ngx_delete_file(fname.data) == NGX_FILE_ERROR) {
-                ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                              ngx_delete_file_n " \"%s\" failed", fname.data);
             } else {
-                ctx->deleted++;
-                ctx->freed += ngx_de_size(&dir);
+                deleted = ctx->deleted;
+
+                if (ctx->handler(ctx, &fname, &d->dir) == NGX_ABORT) {
+                    ngx_free(fname.data);
+                    return NGX_ABORT;
+                }
+
+                if (ctx->deleted == deleted) {
+                    ngx_gc_account(ctx, &d->dir);
+                }
             }
+
+            ngx_free(fname.data);
+            continue;
         }
+
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      "\"%s\" has unknown file type, deleting", fname.data);
+
+        ngx_gc_delete_file(ctx, &fname, &d->dir);
+        ngx_free(fname.data);
     }
 
-    if (buf.len) {
-        ngx_free(buf.data);
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t ngx_gc_push_dir(ngx_gc_t *ctx, ngx_str_t *name,
+                                 ngx_int_t level)
+{
+    ngx_gc_dir_t  *d;
+
+    if (ctx->depth == NGX_GC_MAX_DEPTH) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "the directory \"%s\" is too deep, skipped", name->data);
+        return NGX_ERROR;
     }
 
-    if (ngx_close_dir(&dir) == NGX_ERROR) {
+    d = &ctx->dirs[ctx->depth];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->log, 0,
+                   "gc dir \"%s\":%d", name->data, name->len);
+
+    if (ngx_open_dir(name, &d->dir) == NGX_ERROR) {
         ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_close_dir_n " \"%s\" failed", fname.data);
+                      ngx_open_dir_n " \"%s\" failed", name->data);
+        return NGX_ERROR;
+    }
+
+    /* the root path name belongs to the configuration */
+
+    d->name = *name;
+    d->level = level;
+    d->remove = (level == -1) ? 1 : 0;
+
+    ctx->depth++;
+
+    return NGX_OK;
+}
+
+
+static void ngx_gc_pop_dir(ngx_gc_t *ctx)
+{
+    ngx_gc_dir_t  *d;
+
+    d = &ctx->dirs[--ctx->depth];
+
+    if (ngx_close_dir(&d->dir) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_close_dir_n " \"%s\" failed", d->name.data);
+    }
+
+    if (ctx->depth == 0) {
+        return;
+    }
+
+    if (d->remove) {
+        ngx_log_error(NGX_LOG_NOTICE, ctx->log, 0,
+                      "delete old hierachy directory \"%s\"", d->name.data);
+
+        if (ngx_delete_dir(d->name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                          ngx_delete_dir_n " \"%s\" failed", d->name.data);
+        } else {
+            ctx->deleted++;
+        }
+    }
+
+    ngx_free(d->name.data);
+}
+
+
+static void ngx_gc_delete_file(ngx_gc_t *ctx, ngx_str_t *name, ngx_dir_t *dir)
+{
+    if (ngx_delete_file(name->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name->data);
+        return;
+    }
+
+    ctx->deleted++;
+    ctx->freed += ngx_de_size(dir);
+}
+
+
+static void ngx_gc_account(ngx_gc_t *ctx, ngx_dir_t *dir)
+{
+    time_t      age;
+    ngx_uint_t  n;
+
+    ctx->files++;
+    ctx->size += ngx_de_size(dir);
+
+    age = ngx_time() - ngx_de_mtime(dir);
+
+    for (n = 0; age > 1 && n < NGX_GC_AGE_BUCKETS - 1; n++) {
+        age >>= 1;
+    }
+
+    ctx->ages[n] += ngx_de_size(dir);
+}
+
+
+/*
+ * if the path size exceeds max_size then the oldest age buckets are
+ * dropped until the rest fits, and the lower bound of the last dropped
+ * bucket becomes the eviction age for the next pass
+ */
+
+static void ngx_gc_done(ngx_gc_t *ctx)
+{
+    off_t       size;
+    ngx_int_t   n;
+
+    ctx->total_files = ctx->files;
+    ctx->total_size = ctx->size;
+    ctx->evict = 0;
+
+    if (ctx->path->max_size && ctx->size > ctx->path->max_size) {
+        size = ctx->size;
+
+        for (n = NGX_GC_AGE_BUCKETS - 1; n >= 0; n--) {
+            size -= ctx->ages[n];
+
+            if (size <= ctx->path->max_size) {
+                break;
+            }
+        }
+
+        ctx->evict = (n > 0) ? (time_t) 1 << n : 1;
     }
 
-    return rc;
+    ngx_log_error(NGX_LOG_INFO, ctx->log, 0,
+                  "gc \"%s\": %d files, " OFF_T_FMT " bytes, "
+                  "%d deleted, " OFF_T_FMT " bytes freed, evict age: "
+                  TIME_T_FMT,
+                  ctx->path->name.data, ctx->total_files, ctx->total_size,
+                  ctx->deleted, ctx->freed, ctx->evict);
 }
 
 
@@ -259,7 +353,7 @@ int ngx_garbage_collector_temp_handler(ngx_gc_t *ctx, ngx_str_t *name,
      *    Unices have the mount option "noatime".
      */
 
-    if (ngx_time() - ngx_de_mtime(dir) < 3600) {
+    if (ngx_time() - ngx_de_mtime(dir) < ctx->path->inactive) {
         return NGX_OK;
     }
 
@@ -14,15 +14,53 @@ typedef int (*ngx_gc_handler_pt) (ngx_gc_t *ctx, ngx_str_t *name,
                                   ngx_dir_t *dir);
 
 
+/* the depth of the old hierarchy directories that can be walked */
+#define NGX_GC_MAX_DEPTH    (NGX_MAX_PATH_LEVEL + 5)
+
+/* the file ages are accounted in the power of two seconds buckets */
+#define NGX_GC_AGE_BUCKETS  32
+
+
+typedef struct {
+    ngx_dir_t           dir;
+    ngx_str_t           name;
+    ngx_int_t           level;
+    unsigned            remove:1;
+} ngx_gc_dir_t;
+
+
 struct ngx_gc_s {
     ngx_path_t         *path;
     u_int               deleted;
     off_t               freed;
     ngx_gc_handler_pt   handler;
     ngx_log_t          *log;
+
+    /* the state of the incremental walk */
+
+    ngx_uint_t          depth;
+    ngx_gc_dir_t        dirs[NGX_GC_MAX_DEPTH];
+    ngx_uint_t          walked;
+
+    /* the statistics of the current pass */
+
+    ngx_uint_t          files;
+    off_t               size;
+    off_t               ages[NGX_GC_AGE_BUCKETS];
+
+    /* the statistics of the last complete pass */
+
+    ngx_uint_t          total_files;
+    off_t               total_size;
+
+    /* the files older than evict seconds are deleted, 0 disables it */
+    time_t              evict;
 };
 
 
+ngx_int_t ngx_collect_garbage(ngx_gc_t *ctx, ngx_uint_t files,
+                              ngx_msec_t slice);
+
 int ngx_garbage_collector_temp_handler(ngx_gc_t *ctx, ngx_str_t *name,
                                        ngx_dir_t *dir);
 
@@ -8,11 +8,48 @@
 #include <ngx_core.h>
 
 
+static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
+static void *ngx_palloc_large(ngx_pool_t *pool, size_t size, size_t alignment);
+
+
+/*
+ * the pool blocks are rounded up to NGX_POOL_CLASS bytes and the destroyed
+ * blocks up to NGX_POOL_CACHE_BLOCK bytes are kept in the per process lists
+ * of the same size, so the connection and request pools of the typical
+ * sizes are reused without malloc() and free()
+ */
+
+#define ngx_pool_class(size)                                                 \
+            (((size) + NGX_POOL_CLASS - 1) & ~((size_t) NGX_POOL_CLASS - 1))
+
+#if (NGX_THREADS)
+
+/* the workers threads may create and destroy the pools concurrently */
+
+#define ngx_pool_cache_get(size)  NULL
+#define ngx_pool_cache_put(p)     ngx_free(p)
+
+#else
+
+static ngx_pool_t *ngx_pool_cache_get(size_t size);
+static void ngx_pool_cache_put(ngx_pool_t *p);
+
+static ngx_pool_t  *ngx_pool_cache[NGX_POOL_CACHE_BLOCK / NGX_POOL_CLASS + 1];
+static size_t       ngx_pool_cached;
+
+#endif
+
+
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
+
+    size = ngx_pool_class(size);
+
+    p = ngx_pool_cache_get(size);
+
     // 在堆上分配一块大小为size的连续虚拟内存
-    if (!(p = ngx_alloc(size, log))) {
+    if (p == NULL && !(p = ngx_alloc(size, log))) {
        return NULL;
     }
     // last代表没有使用的空间首地址，分配的内存前面保存ngx_pool_t结构体
@@ -21,8 +58,11 @@ ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log)
     p->end = (char *) p + size;
     // 下一个池子
     p->next = NULL;
+    p->current = p;
+    p->failed = 0;
     // 用于分配大块内存的池子
     p->large = NULL;
+    p->cleanup = NULL;
     p->log = log;
 
     return p;
@@ -31,17 +71,26 @@ ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log)
 
 void ngx_destroy_pool(ngx_pool_t *pool)
 {
-    ngx_pool_t        *p, *n;
-    ngx_pool_large_t  *l;
+    ngx_pool_t          *p, *n;
+    ngx_pool_large_t    *l, *next;
+    ngx_pool_cleanup_t  *c;
+
+    for (c = pool->cleanup; c; c = c->next) {
+        if (c->handler) {
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                           "run cleanup: " PTR_FMT, c);
+            c->handler(c->data);
+        }
+    }
+
     // 释放大块内存对应的池子
-    for (l = pool->large; l; l = l->next) {
+    for (l = pool->large; l; l = next) {
 
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                        "free: " PTR_FMT, l->alloc);
 
-        if (l->alloc) {
-            free(l->alloc);
-        }
+        next = l->next;
+        ngx_free(l->alloc);
     }
 
 #if (NGX_DEBUG)
@@ -64,7 +113,7 @@ void ngx_destroy_pool(ngx_pool_t *pool)
 #endif
     // p指向当前需要释放的池子，n指向当前下一个池子，即待释放的池子（如果有的话）
     for (p = pool, n = pool->next; /* void */; p = n, n = n->next) {
-        free(p);
+        ngx_pool_cache_put(p);
         // 没有下一个池子，退出循环
         if (n == NULL) {
             break;
@@ -72,12 +121,12 @@ void ngx_destroy_pool(ngx_pool_t *pool)
     }
 }
 
+
 // 在池子上分配size大小的内存
 void *ngx_palloc(ngx_pool_t *pool, size_t size)
 {
     char              *m;
-    ngx_pool_t        *p, *n;
-    ngx_pool_large_t  *large, *last;
+    ngx_pool_t        *p;
     /*
         如果需要分配的内存没有超过大块内存大小，并且没有超过pool最大可使用的空间，则可能可以在pool上分配
         pool指向池子首地址，pool->end - (char *) pool) - sizeof(ngx_pool_t)代表池子最大分配的内存，
@@ -86,7 +135,7 @@ void *ngx_palloc(ngx_pool_t *pool, size_t size)
     if (size <= (size_t) NGX_MAX_ALLOC_FROM_POOL
         && size <= (size_t) (pool->end - (char *) pool) - sizeof(ngx_pool_t))
     {
-        for (p = pool, n = pool->next; /* void */; p = n, n = n->next) {
+        for (p = pool->current; p; p = p->next) {
             // 内存对齐，得到可分配地址的首地址
             m = ngx_align(p->last);
             // 如果未使用的空间大于等于size，则直接在pool上分配
@@ -95,76 +144,125 @@ void *ngx_palloc(ngx_pool_t *pool, size_t size)
                 // 返回分配的内存首地址
                 return m;
             }
-            // 如果当前块内存不足，则到下一块找，如果没有下一块，则结束循环
-            if (n == NULL) {
-                break;
-            }
         }
 
-        /* allocate a new pool block */
         // 跑到这里说明当前的池子内存不够，则申请一个新的池子，大小为当前池子规格
-        if (!(n = ngx_create_pool((size_t) (p->end - (char *) p), p->log))) {
-            return NULL;
-        }
-        // 插入当前链表
-        p->next = n;
-        // 直接分配内存并重算last的值，if那里保证了新申请的池子是一定可以大于等于size的
-        m = n->last;
-        n->last += size;
-
-        return m;
+        return ngx_palloc_block(pool, size);
     }
 
     /* allocate a large block */
 
-    large = NULL;
-    last = NULL;
-    // 分配大块内存
-    if (pool->large) {
-        /*
-            如果当前大块池子有可用内存，并且下一块不为空，则循环，
-            如果当前池子没有可用内存或下一块为空则结束循环。
-            即找到最后一个可用的池子，由last保存
-        */
-        for (last = pool->large; /* void */ ; last = last->next) {
-            if (last->alloc == NULL) {
-                large = last;
-                last = NULL;
-                break;
-            }
+    return ngx_palloc_large(pool, size, 0);
+}
+
+
+/*
+ * ngx_pnalloc() is used for the byte strings that do not need
+ * the alignment, so the small allocations do not waste the pool space
+ */
 
-            if (last->next == NULL) {
-                break;
+void *ngx_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    char        *m;
+    ngx_pool_t  *p;
+
+    if (size <= (size_t) NGX_MAX_ALLOC_FROM_POOL
+        && size <= (size_t) (pool->end - (char *) pool) - sizeof(ngx_pool_t))
+    {
+        for (p = pool->current; p; p = p->next) {
+            if ((size_t) (p->end - p->last) >= size) {
+                m = p->last;
+                p->last += size;
+                return m;
             }
         }
+
+        return ngx_palloc_block(pool, size);
     }
 
-    if (large == NULL) {
-        if (!(large = ngx_palloc(pool, sizeof(ngx_pool_large_t)))) {
-            return NULL;
-        }
+    return ngx_palloc_large(pool, size, 0);
+}
+
+
+/*
+ * the new block is added to the end of the chain; the blocks that have
+ * failed to satisfy several allocations are nearly full and are skipped
+ * by the later allocations, so the long lived pools such as the cycle pool
+ * of a large configuration are not walked from the start on every call
+ */
+
+static void *ngx_palloc_block(ngx_pool_t *pool, size_t size)
+{
+    char        *m;
+    ngx_pool_t  *p, *n, *current;
 
-        large->next = NULL;
+    current = pool->current;
+
+    for (p = current; p->next; p = p->next) {
+        if (p->failed++ > 4) {
+            current = p->next;
+        }
     }
 
-#if 0
-    if (!(p = ngx_memalign(ngx_pagesize, size, pool->log))) {
+    if (!(n = ngx_create_pool((size_t) (p->end - (char *) p), p->log))) {
         return NULL;
     }
-#else
-    if (!(p = ngx_alloc(size, pool->log))) {
+
+    p->next = n;
+    pool->current = current;
+
+    m = n->last;
+    n->last += size;
+
+    return m;
+}
+
+
+/*
+ * ngx_pmemalign() always allocates a large block, so it can be freed
+ * by ngx_pfree(); the alignment should be a power of two
+ */
+
+void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
+{
+    return ngx_palloc_large(pool, size, alignment);
+}
+
+
+/*
+ * the large block is allocated together with its ngx_pool_large_t header
+ * that is placed just before the returned address, so the block does not
+ * need a separate allocation from the pool and ngx_pfree() can free it
+ */
+
+static void *ngx_palloc_large(ngx_pool_t *pool, size_t size, size_t alignment)
+{
+    u_char            *m, *p;
+    ngx_pool_large_t  *large;
+
+    if (alignment <= NGX_ALIGN + 1) {
+        alignment = 0;
+    }
+
+    if (!(m = ngx_alloc(sizeof(ngx_pool_large_t) + size + alignment,
+                        pool->log)))
+    {
         return NULL;
     }
-#endif
 
-    if (pool->large == NULL) {
-        pool->large = large;
+    p = m + sizeof(ngx_pool_large_t);
 
-    } else if (last) {
-        last->next = large;
+    if (alignment) {
+        p = (u_char *) ((NGX_ALIGN_CAST p + alignment - 1)
+                                         & ~(NGX_ALIGN_CAST alignment - 1));
     }
 
-    large->alloc = p;
+    large = (ngx_pool_large_t *) p - 1;
+
+    large->alloc = m;
+    large->next = pool->large;
+
+    pool->large = large;
 
     return p;
 }
@@ -172,20 +270,36 @@ void *ngx_palloc(ngx_pool_t *pool, size_t size)
 
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p)
 {
-    ngx_pool_large_t  *l;
+    ngx_pool_large_t  *l, **lp;
 
-    for (l = pool->large; l; l = l->next) {
-        if (p == l->alloc) {
-            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
-                           "free: " PTR_FMT, l->alloc);
-            free(l->alloc);
-            l->alloc = NULL;
+    /*
+     * the pointer is looked up in the large list and the memory before
+     * the pointer is never read, so the pointers to the pool blocks, to
+     * the middle of the large blocks and to the memory of other pools
+     * are safely declined; a pool has a few large blocks, so the walk
+     * is short
+     */
 
-            return NGX_OK;
+    for (lp = &pool->large; *lp; lp = &(*lp)->next) {
+        if ((void *) (*lp + 1) == p) {
+            break;
         }
     }
 
-    return NGX_DECLINED;
+    l = *lp;
+
+    if (l == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "free: " PTR_FMT, l->alloc);
+
+    *lp = l->next;
+
+    ngx_free(l->alloc);
+
+    return NGX_OK;
 }
 
 
@@ -201,29 +315,77 @@ void *ngx_pcalloc(ngx_pool_t *pool, size_t size)
     return p;
 }
 
-#if 0
+ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size)
+{
+    ngx_pool_cleanup_t  *c;
+
+    if (!(c = ngx_palloc(p, sizeof(ngx_pool_cleanup_t)))) {
+        return NULL;
+    }
+
+    if (size) {
+        if (!(c->data = ngx_palloc(p, size))) {
+            return NULL;
+        }
+
+    } else {
+        c->data = NULL;
+    }
+
+    c->handler = NULL;
+    c->next = p->cleanup;
+
+    p->cleanup = c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, p->log, 0, "add cleanup: " PTR_FMT, c);
+
+    return c;
+}
+
 
-static void *ngx_get_cached_block(size_t size)
+#if !(NGX_THREADS)
+
+static ngx_pool_t *ngx_pool_cache_get(size_t size)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_pool_t  *p, **slot;
 
-    if (ngx_cycle->cache == NULL) {
+    if (size > NGX_POOL_CACHE_BLOCK) {
         return NULL;
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    slot = &ngx_pool_cache[size / NGX_POOL_CLASS];
+
+    p = *slot;
+
+    if (p) {
+        *slot = p->next;
+        ngx_pool_cached -= size;
+    }
+
+    return p;
+}
+
+
+static void ngx_pool_cache_put(ngx_pool_t *p)
+{
+    size_t       size;
+    ngx_pool_t  **slot;
 
-    slot->tries++;
+    size = p->end - (char *) p;
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
-        return p;
+    if (size > NGX_POOL_CACHE_BLOCK
+        || ngx_pool_cached + size > NGX_POOL_CACHE_SIZE)
+    {
+        ngx_free(p);
+        return;
     }
 
-    return NULL;
+    slot = &ngx_pool_cache[size / NGX_POOL_CLASS];
+
+    p->next = *slot;
+    *slot = p;
+
+    ngx_pool_cached += size;
 }
 
 #endif
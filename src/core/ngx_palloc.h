@@ -21,9 +21,27 @@
 
 #define NGX_DEFAULT_POOL_SIZE   (16 * 1024)
 
+/* the pool block size granularity, the largest cached block size */
+#define NGX_POOL_CLASS          64
+#define NGX_POOL_CACHE_BLOCK    (16 * 1024)
+
+/* the limit of the cached pool blocks memory per process */
+#define NGX_POOL_CACHE_SIZE     (1024 * 1024)
+
 #define ngx_test_null(p, alloc, rc)  if ((p = alloc) == NULL) { return rc; }
 
 
+typedef void (*ngx_pool_cleanup_pt)(void *data);
+
+typedef struct ngx_pool_cleanup_s  ngx_pool_cleanup_t;
+
+struct ngx_pool_cleanup_s {
+    ngx_pool_cleanup_pt   handler;
+    void                 *data;
+    ngx_pool_cleanup_t   *next;
+};
+
+
 typedef struct ngx_pool_large_s  ngx_pool_large_t;
 // 用来分配大块内存的池子
 struct ngx_pool_large_s {
@@ -33,11 +51,18 @@ struct ngx_pool_large_s {
 
 // 分配内存的池子
 struct ngx_pool_s {
-    char              *last;
-    char              *end;
-    ngx_pool_t        *next;
-    ngx_pool_large_t  *large;
-    ngx_log_t         *log;
+    char                *last;
+    char                *end;
+    ngx_pool_t          *next;
+
+    /* the block to start the allocations from, set in the first block */
+    ngx_pool_t          *current;
+    /* the number of the allocations the block has failed */
+    ngx_uint_t           failed;
+
+    ngx_pool_large_t    *large;
+    ngx_pool_cleanup_t  *cleanup;
+    ngx_log_t           *log;
 };
 
 
@@ -48,8 +73,12 @@ ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 
 void *ngx_palloc(ngx_pool_t *pool, size_t size);
+void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
+void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
 
+ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
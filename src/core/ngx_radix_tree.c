@@ -0,0 +1,199 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
+
+
+ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool)
+{
+    ngx_radix_tree_t  *tree;
+
+    if (!(tree = ngx_palloc(pool, sizeof(ngx_radix_tree_t)))) {
+        return NULL;
+    }
+
+    tree->pool = pool;
+    tree->start = NULL;
+    tree->size = 0;
+    tree->nodes = 0;
+
+    if (!(tree->root = ngx_radix_alloc(tree))) {
+        return NULL;
+    }
+
+    tree->root->right = NULL;
+    tree->root->left = NULL;
+    tree->root->value = NGX_RADIX_NO_VALUE;
+
+    return tree;
+}
+
+
+/*
+ * the prefix value is set in the node of the prefix depth,
+ * NGX_BUSY is returned if the prefix already has a value
+ */
+
+ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
+                                 uint32_t key, uint32_t mask, uintptr_t value)
+{
+    uint32_t           bit;
+    ngx_radix_node_t  *node, *next;
+
+    bit = 0x80000000;
+
+    node = tree->root;
+    next = tree->root;
+
+    while (bit & mask) {
+        if (key & bit) {
+            next = node->right;
+
+        } else {
+            next = node->left;
+        }
+
+        if (next == NULL) {
+            break;
+        }
+
+        bit >>= 1;
+        node = next;
+    }
+
+    if (next) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return NGX_BUSY;
+        }
+
+        node->value = value;
+        return NGX_OK;
+    }
+
+    while (bit & mask) {
+        if (!(next = ngx_radix_alloc(tree))) {
+            return NGX_ERROR;
+        }
+
+        next->right = NULL;
+        next->left = NULL;
+        next->value = NGX_RADIX_NO_VALUE;
+
+        if (key & bit) {
+            node->right = next;
+
+        } else {
+            node->left = next;
+        }
+
+        bit >>= 1;
+        node = next;
+    }
+
+    node->value = value;
+
+    return NGX_OK;
+}
+
+
+/* the value of the longest prefix that matches the key */
+
+uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
+{
+    uint32_t           bit;
+    uintptr_t          value;
+    ngx_radix_node_t  *node;
+
+    bit = 0x80000000;
+    value = NGX_RADIX_NO_VALUE;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+    }
+
+    return value;
+}
+
+
+/*
+ * the value of the longest prefix that contains the whole key/mask
+ * network, that is the prefixes that are not longer than the mask
+ */
+
+uintptr_t ngx_radix32tree_find_prefix(ngx_radix_tree_t *tree,
+                                      uint32_t key, uint32_t mask)
+{
+    uint32_t           bit;
+    uintptr_t          value;
+    ngx_radix_node_t  *node;
+
+    bit = 0x80000000;
+    value = NGX_RADIX_NO_VALUE;
+    node = tree->root;
+
+    for ( ;; ) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if (!(bit & mask)) {
+            break;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        if (node == NULL) {
+            break;
+        }
+
+        bit >>= 1;
+    }
+
+    return value;
+}
+
+
+static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree)
+{
+    char  *p;
+
+    if (tree->size < sizeof(ngx_radix_node_t)) {
+        if (!(tree->start = ngx_palloc(tree->pool, ngx_pagesize))) {
+            return NULL;
+        }
+
+        tree->size = ngx_pagesize;
+    }
+
+    p = tree->start;
+    tree->start += sizeof(ngx_radix_node_t);
+    tree->size -= sizeof(ngx_radix_node_t);
+
+    tree->nodes++;
+
+    return (ngx_radix_node_t *) p;
+}
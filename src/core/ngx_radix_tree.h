@@ -0,0 +1,49 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#ifndef _NGX_RADIX_TREE_H_INCLUDED_
+#define _NGX_RADIX_TREE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_RADIX_NO_VALUE   (uintptr_t) -1
+
+typedef struct ngx_radix_node_s  ngx_radix_node_t;
+
+struct ngx_radix_node_s {
+    ngx_radix_node_t  *right;
+    ngx_radix_node_t  *left;
+    uintptr_t          value;
+};
+
+
+typedef struct {
+    ngx_radix_node_t  *root;
+    ngx_pool_t        *pool;
+
+    /* the nodes are allocated from the pool by the pages */
+    char              *start;
+    size_t             size;
+
+    ngx_uint_t         nodes;
+} ngx_radix_tree_t;
+
+
+ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool);
+
+/* the key and the mask are in the host byte order */
+
+ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
+                                 uint32_t key, uint32_t mask, uintptr_t value);
+uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
+uintptr_t ngx_radix32tree_find_prefix(ngx_radix_tree_t *tree,
+                                      uint32_t key, uint32_t mask);
+
+
+#endif /* _NGX_RADIX_TREE_H_INCLUDED_ */
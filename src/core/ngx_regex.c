@@ -8,12 +8,47 @@
 #include <ngx_core.h>
 
 
+static void ngx_regex_literal(ngx_str_t *pattern, u_char *buf,
+                              ngx_str_t *literal);
+static u_char *ngx_regex_skip_class(u_char *p, u_char *last);
+static ngx_int_t ngx_regex_quantifier(u_char **pp, u_char *last);
+#ifdef PCRE_STUDY_JIT_COMPILE
+static void ngx_regex_free_study(void *data);
+#if !(NGX_THREADS)
+static pcre_jit_stack *ngx_regex_jit_stack_get(void *data);
+static void ngx_regex_jit_stack_free(void *data);
+#endif
+#endif
 static void *ngx_regex_malloc(size_t size);
 static void ngx_regex_free(void *p);
 
 
+#define ngx_regex_lower(c)                                                    \
+    (u_char) (((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : (c))
+
+#define ngx_regex_end_run()                                                   \
+    do {                                                                      \
+        if ((size_t) (b - run) > literal->len) {                              \
+            literal->data = run;                                              \
+            literal->len = b - run;                                           \
+        }                                                                     \
+        run = b;                                                              \
+    } while (0)
+
+
 static ngx_pool_t  *ngx_pcre_pool;
 
+#if (defined PCRE_STUDY_JIT_COMPILE && !(NGX_THREADS))
+
+/*
+ * the JIT stack is allocated by the first match in a process and is shared
+ * by all regexes, it lives as long as the cycle pool
+ */
+
+static pcre_jit_stack  *ngx_regex_jit_stack;
+
+#endif
+
 
 void ngx_regex_init()
 {
@@ -25,11 +60,15 @@ void ngx_regex_init()
 ngx_regex_t *ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options,
                                ngx_pool_t *pool, ngx_str_t *err)
 {
-    int              erroff;
-    const char      *errstr;
-    ngx_regex_t     *re;
+    int                  erroff;
+    size_t               size;
+    const char          *errstr;
+    ngx_regex_t         *re;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    ngx_pool_cleanup_t  *cln;
+#endif
 #if (NGX_THREADS)
-    ngx_core_tls_t  *tls;
+    ngx_core_tls_t      *tls;
 
 #if (NGX_SUPPRESS_WARN)
     tls = NULL;
@@ -48,10 +87,22 @@ ngx_regex_t *ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options,
 
 #endif
 
-    re = pcre_compile((const char *) pattern->data, (int) options,
-                      &errstr, &erroff, NULL);
+    if (!(re = ngx_palloc(pool, sizeof(ngx_regex_t)))) {
+        ngx_snprintf((char *) err->data, err->len - 1,
+                     "could not allocate the regex \"%s\"", pattern->data);
+        goto failed;
+    }
+
+    /* the code of the configuration snapshot is used in place */
 
-    if (re == NULL) {
+    re->code = ngx_conf_snapshot_regex(pattern, options);
+
+    if (re->code == NULL) {
+        re->code = pcre_compile((const char *) pattern->data, (int) options,
+                                &errstr, &erroff, NULL);
+    }
+
+    if (re->code == NULL) {
        if ((size_t) erroff == pattern->len) {
            ngx_snprintf((char *) err->data, err->len - 1,
                         "pcre_compile() failed: %s in \"%s\"",
@@ -61,8 +112,57 @@ ngx_regex_t *ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options,
                         "pcre_compile() failed: %s in \"%s\" at \"%s\"",
                         errstr, pattern->data, pattern->data + erroff);
         }
+
+        re = NULL;
+        goto failed;
+    }
+
+    if (pcre_fullinfo(re->code, NULL, PCRE_INFO_SIZE, &size) == 0
+        && ngx_conf_snapshot_add_regex(pattern, options, re->code, size)
+                                                                  == NGX_ERROR)
+    {
+        ngx_snprintf((char *) err->data, err->len - 1,
+                     "could not add the regex \"%s\" to the snapshot",
+                     pattern->data);
+        re = NULL;
+        goto failed;
+    }
+
+    /*
+     * the failed study is not an error: pcre_exec() interprets
+     * the bytecode without the extra data
+     */
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+
+    re->extra = pcre_study(re->code, PCRE_STUDY_JIT_COMPILE, &errstr);
+
+    if (re->extra) {
+
+        /* the JIT code is not allocated from the pool */
+
+        if (!(cln = ngx_pool_cleanup_add(pool, 0))) {
+            pcre_free_study(re->extra);
+            re->extra = NULL;
+
+        } else {
+            cln->handler = ngx_regex_free_study;
+            cln->data = re->extra;
+
+#if !(NGX_THREADS)
+            pcre_assign_jit_stack(re->extra, ngx_regex_jit_stack_get, NULL);
+#endif
+        }
     }
 
+#else
+
+    re->extra = pcre_study(re->code, 0, &errstr);
+
+#endif
+
+failed:
+
     /* ensure that there is no current pool */
 
 #if (NGX_THREADS)
@@ -84,7 +184,7 @@ ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s,
 {
     int  rc;
 
-    rc = pcre_exec(re, NULL, (const char *) s->data, s->len, 0, 0,
+    rc = pcre_exec(re->code, re->extra, (const char *) s->data, s->len, 0, 0,
                    matches, size);
 
     if (rc == -1) {
@@ -95,6 +195,532 @@ ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s,
 }
 
 
+ngx_regex_set_t *ngx_regex_set_compile(ngx_str_t *patterns, ngx_uint_t n,
+                                       ngx_pool_t *pool)
+{
+    u_char            c, *buf;
+    size_t            size;
+    ngx_int_t         m;
+    ngx_str_t        *literals;
+    ngx_uint_t        i, k, a, nc, s, t, *fail, *queue, head, tail;
+    ngx_regex_set_t  *set;
+
+    if (!(set = ngx_pcalloc(pool, sizeof(ngx_regex_set_t)))) {
+        return NULL;
+    }
+
+    set->nregex = n;
+
+    if (!(set->always = ngx_pcalloc(pool, n))) {
+        return NULL;
+    }
+
+    if (!(literals = ngx_palloc(pool, n * sizeof(ngx_str_t)))) {
+        return NULL;
+    }
+
+    /*
+     * the literals are lowercased and the uppercase letters of a subject
+     * get the same classes as the lowercase ones, so the caseless regexes
+     * are prefiltered too, and the other regexes may only get the extra
+     * candidates
+     */
+
+    size = 0;
+    nc = 0;
+
+    for (k = 0; k < n; k++) {
+        if (!(buf = ngx_palloc(pool, patterns[k].len + 1))) {
+            return NULL;
+        }
+
+        ngx_regex_literal(&patterns[k], buf, &literals[k]);
+
+        if (literals[k].len == 0) {
+            set->always[k] = 1;
+            continue;
+        }
+
+        size += literals[k].len;
+
+        for (i = 0; i < literals[k].len; i++) {
+            c = literals[k].data[i];
+
+            if (set->class[c] == 0) {
+                set->class[c] = (u_char) ++nc;
+
+                if (c >= 'a' && c <= 'z') {
+                    set->class[c & ~0x20] = (u_char) nc;
+                }
+            }
+        }
+    }
+
+    nc++;
+    set->nclasses = nc;
+
+    /* the trie of the literals, the transitions to the root are zeroes */
+
+    if (!(set->next = ngx_pcalloc(pool, (size + 1) * nc * sizeof(ngx_uint_t))))
+    {
+        return NULL;
+    }
+
+    if (!(set->match = ngx_palloc(pool, (size + 1) * sizeof(ngx_int_t)))) {
+        return NULL;
+    }
+
+    if (!(set->output = ngx_pcalloc(pool, (size + 1) * sizeof(ngx_uint_t)))) {
+        return NULL;
+    }
+
+    if (!(set->matches = ngx_palloc(pool, n * sizeof(ngx_regex_set_match_t))))
+    {
+        return NULL;
+    }
+
+    if (!(fail = ngx_palloc(pool, 2 * (size + 1) * sizeof(ngx_uint_t)))) {
+        return NULL;
+    }
+
+    queue = fail + size + 1;
+
+    for (s = 0; s <= size; s++) {
+        set->match[s] = -1;
+    }
+
+    set->nstates = 1;
+    m = 0;
+
+    for (k = 0; k < n; k++) {
+        s = 0;
+
+        for (i = 0; i < literals[k].len; i++) {
+            a = set->class[literals[k].data[i]];
+
+            if (set->next[s * nc + a] == 0) {
+                set->next[s * nc + a] = set->nstates++;
+            }
+
+            s = set->next[s * nc + a];
+        }
+
+        if (i) {
+            set->matches[m].regex = k;
+            set->matches[m].next = set->match[s];
+            set->match[s] = m++;
+        }
+    }
+
+    /*
+     * the failure links are found in the breadth first order and
+     * the missing transitions are replaced by the transitions of
+     * the failure state, so the automaton becomes a DFA
+     */
+
+    head = 0;
+    tail = 0;
+
+    for (a = 0; a < nc; a++) {
+        t = set->next[a];
+
+        if (t) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+
+        set->output[s] = (set->match[fail[s]] != -1) ? fail[s]:
+                                                       set->output[fail[s]];
+
+        for (a = 0; a < nc; a++) {
+            t = set->next[s * nc + a];
+
+            if (t) {
+                fail[t] = set->next[fail[s] * nc + a];
+                queue[tail++] = t;
+
+            } else {
+                set->next[s * nc + a] = set->next[fail[s] * nc + a];
+            }
+        }
+    }
+
+    return set;
+}
+
+
+/* returns the number of the candidates */
+
+ngx_uint_t ngx_regex_set_candidates(ngx_regex_set_t *set, ngx_str_t *s,
+                                    u_char *candidates)
+{
+    u_char      *p, *last;
+    ngx_int_t    m;
+    ngx_uint_t   k, n, state, t;
+
+    ngx_memcpy(candidates, set->always, set->nregex);
+
+    if (set->nstates > 1) {
+        state = 0;
+        last = s->data + s->len;
+
+        for (p = s->data; p < last; p++) {
+            state = set->next[state * set->nclasses + set->class[*p]];
+
+            for (t = state; t; t = set->output[t]) {
+                for (m = set->match[t]; m != -1; m = set->matches[m].next) {
+                    candidates[set->matches[m].regex] = 1;
+                }
+            }
+        }
+    }
+
+    n = 0;
+
+    for (k = 0; k < set->nregex; k++) {
+        n += candidates[k];
+    }
+
+    return n;
+}
+
+
+/*
+ * the longest run of the literal characters that any match must contain,
+ * the run ends on the metacharacters, the groups and the classes are
+ * skipped, and an alternation at the top level or an unknown syntax gives
+ * no literal
+ */
+
+static void ngx_regex_literal(ngx_str_t *pattern, u_char *buf,
+                              ngx_str_t *literal)
+{
+    u_char      c, *p, *q, *last, *b, *run;
+    ngx_int_t   rc;
+    ngx_uint_t  depth;
+
+    literal->len = 0;
+    literal->data = buf;
+
+    p = pattern->data;
+    last = p + pattern->len;
+
+    b = buf;
+    run = buf;
+
+    while (p < last) {
+        c = *p++;
+
+        switch (c) {
+
+        case '(':
+            ngx_regex_end_run();
+
+            /* the option like (?x) changes the syntax */
+
+            if (p < last && *p == '?') {
+                for (q = p + 1; q < last && *q != ')' && *q != ':'; q++) {
+                    if (*q == 'x') {
+                        goto none;
+                    }
+                }
+            }
+
+            for (depth = 1; p < last; p++) {
+                if (*p == '\\') {
+                    p++;
+
+                } else if (*p == '[') {
+                    if (!(p = ngx_regex_skip_class(p + 1, last))) {
+                        goto none;
+                    }
+
+                    p--;
+
+                } else if (*p == '(') {
+                    depth++;
+
+                } else if (*p == ')') {
+                    if (--depth == 0) {
+                        break;
+                    }
+                }
+            }
+
+            if (p >= last) {
+                goto none;
+            }
+
+            p++;
+
+            if (ngx_regex_quantifier(&p, last) == NGX_ERROR) {
+                goto none;
+            }
+
+            continue;
+
+        case '[':
+            ngx_regex_end_run();
+
+            if (!(p = ngx_regex_skip_class(p, last))) {
+                goto none;
+            }
+
+            if (ngx_regex_quantifier(&p, last) == NGX_ERROR) {
+                goto none;
+            }
+
+            continue;
+
+        case '.':
+            ngx_regex_end_run();
+
+            if (ngx_regex_quantifier(&p, last) == NGX_ERROR) {
+                goto none;
+            }
+
+            continue;
+
+        case '^':
+        case '$':
+            ngx_regex_end_run();
+            continue;
+
+        case '|':
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            goto none;
+
+        case '\\':
+            if (p == last) {
+                goto none;
+            }
+
+            c = *p++;
+
+            if ((c >= '0' && c <= '9')
+                || (c >= 'A' && c <= 'Z')
+                || (c >= 'a' && c <= 'z'))
+            {
+                /* the types and the assertions that are not literals */
+
+                if (strchr("dDwWsSbBAzZGhHvVRXK", c) == NULL) {
+                    goto none;
+                }
+
+                ngx_regex_end_run();
+
+                if (ngx_regex_quantifier(&p, last) == NGX_ERROR) {
+                    goto none;
+                }
+
+                continue;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        /* the literal character */
+
+        rc = ngx_regex_quantifier(&p, last);
+
+        if (rc == NGX_ERROR) {
+            goto none;
+        }
+
+        if (rc == 1) {
+            /* the optional character */
+            ngx_regex_end_run();
+            continue;
+        }
+
+        *b++ = ngx_regex_lower(c);
+
+        if (rc == 2) {
+            ngx_regex_end_run();
+        }
+    }
+
+    ngx_regex_end_run();
+
+    return;
+
+none:
+
+    literal->len = 0;
+}
+
+
+/* returns the position after the class or NULL */
+
+static u_char *ngx_regex_skip_class(u_char *p, u_char *last)
+{
+    if (p < last && *p == '^') {
+        p++;
+    }
+
+    if (p < last && *p == ']') {
+        p++;
+    }
+
+    while (p < last && *p != ']') {
+        if (*p == '\\') {
+            p++;
+
+        } else if (*p == '[' && p + 1 < last && p[1] == ':') {
+
+            /* the POSIX class [:alpha:] */
+
+            for (p += 2; p + 1 < last; p++) {
+                if (p[0] == ':' && p[1] == ']') {
+                    break;
+                }
+            }
+
+            p++;
+        }
+
+        p++;
+    }
+
+    if (p >= last) {
+        return NULL;
+    }
+
+    return p + 1;
+}
+
+
+/*
+ * returns 0 if there is no quantifier, 1 if the atom is optional,
+ * 2 if the atom is required, and NGX_ERROR for the unknown syntax
+ */
+
+static ngx_int_t ngx_regex_quantifier(u_char **pp, u_char *last)
+{
+    u_char     *p;
+    ngx_int_t   rc;
+
+    p = *pp;
+
+    if (p == last) {
+        return 0;
+    }
+
+    switch (*p) {
+
+    case '?':
+    case '*':
+        rc = 1;
+        p++;
+        break;
+
+    case '+':
+        rc = 2;
+        p++;
+        break;
+
+    case '{':
+        p++;
+
+        if (p == last || *p < '0' || *p > '9') {
+            return NGX_ERROR;
+        }
+
+        rc = (*p == '0') ? 1 : 2;
+
+        while (p < last && ((*p >= '0' && *p <= '9') || *p == ',')) {
+            p++;
+        }
+
+        if (p == last || *p != '}') {
+            return NGX_ERROR;
+        }
+
+        p++;
+        break;
+
+    default:
+        return 0;
+    }
+
+    /* the lazy and possessive quantifiers */
+
+    if (p < last && (*p == '?' || *p == '+')) {
+        p++;
+    }
+
+    *pp = p;
+
+    return rc;
+}
+
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+
+static void ngx_regex_free_study(void *data)
+{
+    pcre_extra  *extra = data;
+
+    pcre_free_study(extra);
+}
+
+
+#if !(NGX_THREADS)
+
+static pcre_jit_stack *ngx_regex_jit_stack_get(void *data)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    if (ngx_regex_jit_stack) {
+        return ngx_regex_jit_stack;
+    }
+
+    /*
+     * if the stack can not be allocated then PCRE uses the 32K stack
+     * on the machine stack
+     */
+
+    if (!(cln = ngx_pool_cleanup_add(ngx_cycle->pool, 0))) {
+        return NULL;
+    }
+
+    ngx_pcre_pool = ngx_cycle->pool;
+
+    ngx_regex_jit_stack = pcre_jit_stack_alloc(NGX_REGEX_JIT_STACK_MIN,
+                                               NGX_REGEX_JIT_STACK_MAX);
+
+    ngx_pcre_pool = NULL;
+
+    if (ngx_regex_jit_stack) {
+        cln->handler = ngx_regex_jit_stack_free;
+    }
+
+    return ngx_regex_jit_stack;
+}
+
+
+static void ngx_regex_jit_stack_free(void *data)
+{
+    pcre_jit_stack_free(ngx_regex_jit_stack);
+    ngx_regex_jit_stack = NULL;
+}
+
+#endif
+
+#endif
+
+
 static void *ngx_regex_malloc(size_t size)
 {
     ngx_pool_t      *pool;
@@ -16,7 +16,13 @@
 
 #define NGX_REGEX_CASELESS  PCRE_CASELESS
 
-typedef pcre  ngx_regex_t;
+#define NGX_REGEX_JIT_STACK_MIN   32768
+#define NGX_REGEX_JIT_STACK_MAX   1048576
+
+typedef struct {
+    pcre        *code;
+    pcre_extra  *extra;          /* the study data and the JIT code */
+} ngx_regex_t;
 
 void ngx_regex_init();
 ngx_regex_t *ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options,
@@ -27,4 +33,38 @@ ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s,
 #define ngx_regex_exec_n  "pcre_exec()"
 
 
+/*
+ * the prefilter of a list of the regexes: the literal that is required by
+ * each regex is searched in a subject by one Aho-Corasick automaton, and
+ * only the regexes whose literals are found or that have no literals at all
+ * are candidates to run
+ */
+
+typedef struct {
+    ngx_uint_t    regex;
+    ngx_int_t     next;           /* the next match in the same state */
+} ngx_regex_set_match_t;
+
+
+typedef struct {
+    ngx_uint_t              nregex;
+    u_char                 *always;       /* the regexes without a literal */
+
+    ngx_uint_t              nstates;
+    ngx_uint_t              nclasses;
+    u_char                  class[256];   /* the byte classes of the input */
+
+    ngx_uint_t             *next;         /* nstates * nclasses transitions */
+    ngx_int_t              *match;        /* the first match of a state */
+    ngx_uint_t             *output;       /* the next state with the matches */
+    ngx_regex_set_match_t  *matches;
+} ngx_regex_set_t;
+
+
+ngx_regex_set_t *ngx_regex_set_compile(ngx_str_t *patterns, ngx_uint_t n,
+                                       ngx_pool_t *pool);
+ngx_uint_t ngx_regex_set_candidates(ngx_regex_set_t *set, ngx_str_t *s,
+                                    u_char *candidates);
+
+
 #endif /* _NGX_REGEX_H_INCLUDED_ */
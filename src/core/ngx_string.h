@@ -60,10 +60,12 @@ typedef struct {
  * icc may also inline several mov's of a zeroed register for small blocks.
  */
 #define ngx_memzero(buf, n)       memset(buf, 0, n)
+#define ngx_memset(buf, c, n)     memset(buf, c, n)
 
 /* msvc and icc compile memcpy() to the inline "rep movs" */
 #define ngx_memcpy(dst, src, n)   memcpy(dst, src, n)
 #define ngx_cpymem(dst, src, n)   ((u_char *) memcpy(dst, src, n)) + n
+#define ngx_memmove(dst, src, n)  memmove(dst, src, n)
 
 /* msvc and icc compile memcmp() to the inline loop */
 #define ngx_memcmp                memcmp
@@ -68,13 +68,19 @@ volatile time_t   ngx_cached_time;
 
 ngx_thread_volatile ngx_str_t  ngx_cached_err_log_time;
 ngx_thread_volatile ngx_str_t  ngx_cached_http_time;
+ngx_thread_volatile ngx_str_t  ngx_cached_http_date;
 ngx_thread_volatile ngx_str_t  ngx_cached_http_log_time;
 
 
 static u_char  cached_err_log_time[NGX_TIME_SLOTS]
                                                [sizeof("1970/09/28 12:00:00")];
+/*
+ * the HTTP time is kept inside the complete "Date" header line,
+ * so ngx_cached_http_time is not null-terminated
+ */
+
 static u_char  cached_http_time[NGX_TIME_SLOTS]
-                                     [sizeof("Mon, 28 Sep 1970 06:00:00 GMT")];
+                           [sizeof("Date: Mon, 28 Sep 1970 06:00:00 GMT" CRLF)];
 static u_char  cached_http_log_time[NGX_TIME_SLOTS]
                                         [sizeof("28/Sep/1970:12:00:00 +0600")];
 
@@ -95,6 +101,8 @@ void ngx_time_init()
 
     ngx_cached_err_log_time.len = sizeof("1970/09/28 12:00:00") - 1;
     ngx_cached_http_time.len = sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1;
+    ngx_cached_http_date.len =
+                       sizeof("Date: Mon, 28 Sep 1970 06:00:00 GMT" CRLF) - 1;
     ngx_cached_http_log_time.len = sizeof("28/Sep/1970:12:00:00 +0600") - 1;
 
 #if (NGX_THREADS && (TIME_T_SIZE > SIG_ATOMIC_T_SIZE))
@@ -163,8 +171,8 @@ void ngx_time_update(time_t s)
 
     p = cached_http_time[slot];
     // 把字符串写到p中
-    ngx_snprintf((char *) p, sizeof("Mon, 28 Sep 1970 06:00:00 GMT"),
-                 "%s, %02d %s %4d %02d:%02d:%02d GMT",
+    ngx_snprintf((char *) p, sizeof("Date: Mon, 28 Sep 1970 06:00:00 GMT" CRLF),
+                 "Date: %s, %02d %s %4d %02d:%02d:%02d GMT" CRLF,
                  week[ngx_cached_gmtime.ngx_tm_wday],
                  ngx_cached_gmtime.ngx_tm_mday,
                  months[ngx_cached_gmtime.ngx_tm_mon - 1],
@@ -173,7 +181,8 @@ void ngx_time_update(time_t s)
                  ngx_cached_gmtime.ngx_tm_min,
                  ngx_cached_gmtime.ngx_tm_sec);
 
-    ngx_cached_http_time.data = p;
+    ngx_cached_http_time.data = p + sizeof("Date: ") - 1;
+    ngx_cached_http_date.data = p;
 
 
 #if (HAVE_GETTIMEZONE)
@@ -37,6 +37,7 @@ extern volatile time_t     ngx_cached_time;
 
 extern ngx_thread_volatile ngx_str_t  ngx_cached_err_log_time;
 extern ngx_thread_volatile ngx_str_t  ngx_cached_http_time;
+extern ngx_thread_volatile ngx_str_t  ngx_cached_http_date;
 extern ngx_thread_volatile ngx_str_t  ngx_cached_http_log_time;
 
 extern ngx_epoch_msec_t    ngx_start_msec;
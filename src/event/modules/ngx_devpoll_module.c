@@ -167,7 +167,7 @@ static int ngx_devpoll_init(ngx_cycle_t *cycle)
 
     ngx_event_actions = ngx_devpoll_module_ctx.actions;
 
-    ngx_event_flags = NGX_USE_LEVEL_EVENT;
+    ngx_event_flags = NGX_USE_LEVEL_EVENT|NGX_USE_FD_EVENT;
 
     return NGX_OK;
 }
@@ -437,22 +437,23 @@ int ngx_devpoll_process_events(ngx_cycle_t *cycle)
     lock = 1;
 
     for (i = 0; i < events; i++) {
-        c = &ngx_cycle->connections[event_list[i].fd];
+        c = ngx_cycle->files[event_list[i].fd];
 
-        if (c->fd == -1) {
+        if (c == NULL) {
             old_cycle = ngx_old_cycles.elts;
             for (j = 0; j < ngx_old_cycles.nelts; j++) {
-                if (old_cycle[j] == NULL) {
+                if (old_cycle[j] == NULL || old_cycle[j]->files == NULL) {
                     continue;
                 }
-                c = &old_cycle[j]->connections[event_list[i].fd];
-                if (c->fd != -1) {
+                c = old_cycle[j]->files[event_list[i].fd];
+                if (c && c->fd != -1) {
                     break;
                 }
+                c = NULL;
             }
         }
 
-        if (c->fd == -1) {
+        if (c == NULL) {
             ngx_log_error(NGX_LOG_EMERG, cycle->log, 0, "unknown cycle");
             exit(1);
         }
@@ -100,7 +100,9 @@ static ngx_int_t ngx_poll_init(ngx_cycle_t *cycle)
 
     ngx_event_actions = ngx_poll_module_ctx.actions;
 
-    ngx_event_flags = NGX_USE_LEVEL_EVENT|NGX_USE_ONESHOT_EVENT;
+    ngx_event_flags = NGX_USE_LEVEL_EVENT
+                      |NGX_USE_ONESHOT_EVENT
+                      |NGX_USE_FD_EVENT;
 
     return NGX_OK;
 }
@@ -217,22 +219,23 @@ static ngx_int_t ngx_poll_del_event(ngx_event_t *ev, int event, u_int flags)
 
             event_list[ev->index] = event_list[nevents];
 
-            c = &ngx_cycle->connections[event_list[nevents].fd];
+            c = ngx_cycle->files[event_list[nevents].fd];
 
-            if (c->fd == -1) {
+            if (c == NULL) {
                 cycle = ngx_old_cycles.elts;
                 for (i = 0; i < ngx_old_cycles.nelts; i++) {
-                    if (cycle[i] == NULL) {
+                    if (cycle[i] == NULL || cycle[i]->files == NULL) {
                         continue;
                     }
-                    c = &cycle[i]->connections[event_list[nevents].fd];
-                    if (c->fd != -1) {
+                    c = cycle[i]->files[event_list[nevents].fd];
+                    if (c && c->fd != -1) {
                         break;
                     }
+                    c = NULL;
                 }
             }
 
-            if (c->fd == -1) {
+            if (c == NULL) {
                 ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
                               "unexpected last event");
 
@@ -415,22 +418,23 @@ static ngx_int_t ngx_poll_process_events(ngx_cycle_t *cycle)
             continue;
         }
 
-        c = &ngx_cycle->connections[event_list[i].fd];
+        c = ngx_cycle->files[event_list[i].fd];
 
-        if (c->fd == -1) {
+        if (c == NULL) {
             old_cycle = ngx_old_cycles.elts;
             for (n = 0; n < ngx_old_cycles.nelts; n++) {
-                if (old_cycle[n] == NULL) {
+                if (old_cycle[n] == NULL || old_cycle[n]->files == NULL) {
                     continue;
                 }
-                c = &old_cycle[n]->connections[event_list[i].fd];
-                if (c->fd != -1) {
+                c = old_cycle[n]->files[event_list[i].fd];
+                if (c && c->fd != -1) {
                     break;
                 }
+                c = NULL;
             }
         }
 
-        if (c->fd == -1) {
+        if (c == NULL) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, 0, "unexpected event");
 
             /*
@@ -162,7 +162,9 @@ static ngx_int_t ngx_rtsig_init(ngx_cycle_t *cycle)
 
     ngx_event_actions = ngx_rtsig_module_ctx.actions;
 
-    ngx_event_flags = NGX_USE_RTSIG_EVENT|NGX_HAVE_GREEDY_EVENT;
+    ngx_event_flags = NGX_USE_RTSIG_EVENT
+                      |NGX_HAVE_GREEDY_EVENT
+                      |NGX_USE_FD_EVENT;
 
     return NGX_OK;
 }
@@ -420,13 +422,11 @@ ngx_int_t ngx_rtsig_process_events(ngx_cycle_t *cycle)
 
         /* TODO: old_cycles */
 
-        c = &ngx_cycle->connections[si.si_fd];
+        c = ngx_cycle->files[si.si_fd];
 
         instance = signo - rtscf->signo;
 
-        rev = c->read;
-
-        if (c->read->instance != instance) {
+        if (c == NULL || c->read->instance != instance) {
 
             /*
              * the stale event from a file descriptor
@@ -441,6 +441,8 @@ ngx_int_t ngx_rtsig_process_events(ngx_cycle_t *cycle)
             return NGX_OK;
         }
 
+        rev = c->read;
+
         if (si.si_band & (POLLIN|POLLHUP|POLLERR)) {
             if (rev->active) {
 
@@ -583,13 +585,15 @@ static ngx_int_t ngx_rtsig_process_overflow(ngx_cycle_t *cycle)
         n = 0;
         while (n < rtscf->overflow_events) {
 
-            if (overflow_current == cycle->connection_n) {
+            if (overflow_current == cycle->files_n) {
                 break;
             }
 
-            c = &cycle->connections[overflow_current++];
+            /* the connections are scanned in the socket number order */
 
-            if (c->fd == -1) {
+            c = cycle->files[overflow_current++];
+
+            if (c == NULL) {
                 continue;
             }
 
@@ -643,7 +647,11 @@ static ngx_int_t ngx_rtsig_process_overflow(ngx_cycle_t *cycle)
         }
 
         for (i = 0; i < n; i++) {
-            c = &cycle->connections[overflow_list[i].fd];
+            c = cycle->files[overflow_list[i].fd];
+
+            if (c == NULL) {
+                continue;
+            }
 
             rev = c->read;
 
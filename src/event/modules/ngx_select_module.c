@@ -172,6 +172,18 @@ static ngx_int_t ngx_select_add_event(ngx_event_t *ev, int event, u_int flags)
 
 #else
 
+    /*
+     * the connections are not indexed by a socket number anymore,
+     * so the number is not limited by the "connections" directive
+     */
+
+    if (c->fd >= FD_SETSIZE) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "the socket number %d is too big for select(), "
+                      "FD_SETSIZE is " ngx_value(FD_SETSIZE), c->fd);
+        return NGX_ERROR;
+    }
+
     if (event == NGX_READ_EVENT) {
         FD_SET(c->fd, &master_read_fd_set);
 
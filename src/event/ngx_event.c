@@ -86,6 +86,20 @@ ngx_atomic_t   ngx_stat_reading0;
 ngx_atomic_t  *ngx_stat_reading = &ngx_stat_reading0;
 ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t  *ngx_stat_writing = &ngx_stat_reading0;
+ngx_atomic_t   ngx_stat_pipe_memory0;
+ngx_atomic_t  *ngx_stat_pipe_memory = &ngx_stat_pipe_memory0;
+ngx_atomic_t   ngx_stat_pipe_spills0;
+ngx_atomic_t  *ngx_stat_pipe_spills = &ngx_stat_pipe_spills0;
+ngx_atomic_t   ngx_stat_pipe_spilled0;
+ngx_atomic_t  *ngx_stat_pipe_spilled = &ngx_stat_pipe_spilled0;
+ngx_atomic_t   ngx_stat_ssl_full0;
+ngx_atomic_t  *ngx_stat_ssl_full = &ngx_stat_ssl_full0;
+ngx_atomic_t   ngx_stat_ssl_resumed0;
+ngx_atomic_t  *ngx_stat_ssl_resumed = &ngx_stat_ssl_resumed0;
+ngx_atomic_t   ngx_stat_idle0;
+ngx_atomic_t  *ngx_stat_idle = &ngx_stat_idle0;
+ngx_atomic_t   ngx_stat_idle_memory0;
+ngx_atomic_t  *ngx_stat_idle_memory = &ngx_stat_idle_memory0;
 
 #endif
 
@@ -222,7 +236,14 @@ static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle)
            + 128          /* ngx_stat_requests */
            + 128          /* ngx_stat_active */
            + 128          /* ngx_stat_reading */
-           + 128;         /* ngx_stat_writing */
+           + 128          /* ngx_stat_writing */
+           + 128          /* ngx_stat_pipe_memory */
+           + 128          /* ngx_stat_pipe_spills */
+           + 128          /* ngx_stat_pipe_spilled */
+           + 128          /* ngx_stat_ssl_full */
+           + 128          /* ngx_stat_ssl_resumed */
+           + 128          /* ngx_stat_idle */
+           + 128;         /* ngx_stat_idle_memory */
 
 #endif
     // 创建进程间共享的内存
@@ -240,6 +261,13 @@ static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_active = (ngx_atomic_t *) (shared + 4 * 128);
     ngx_stat_reading = (ngx_atomic_t *) (shared + 5 * 128);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 6 * 128);
+    ngx_stat_pipe_memory = (ngx_atomic_t *) (shared + 7 * 128);
+    ngx_stat_pipe_spills = (ngx_atomic_t *) (shared + 8 * 128);
+    ngx_stat_pipe_spilled = (ngx_atomic_t *) (shared + 9 * 128);
+    ngx_stat_ssl_full = (ngx_atomic_t *) (shared + 10 * 128);
+    ngx_stat_ssl_resumed = (ngx_atomic_t *) (shared + 11 * 128);
+    ngx_stat_idle = (ngx_atomic_t *) (shared + 12 * 128);
+    ngx_stat_idle_memory = (ngx_atomic_t *) (shared + 13 * 128);
 
 #endif
 
@@ -256,10 +284,9 @@ static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle)
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle)
 {
     ngx_uint_t           m, i;
-    ngx_socket_t         fd;
     ngx_event_t         *rev, *wev;
     ngx_listening_t     *s;
-    ngx_connection_t    *c;
+    ngx_connection_t    *c, *old;
     ngx_core_conf_t     *ccf;
     ngx_event_conf_t    *ecf;
     ngx_event_module_t  *module;
@@ -307,51 +334,30 @@ static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle)
             break;
         }
     }
-    // 根据配置分配大小为connections的数组
-    cycle->connections = ngx_alloc(sizeof(ngx_connection_t) * ecf->connections,
-                                   cycle->log);
-    if (cycle->connections == NULL) {
-        return NGX_ERROR;
-    }
 
-    c = cycle->connections;
-    // 初始化字段
-    for (i = 0; i < cycle->connection_n; i++) {
-        c[i].fd = (ngx_socket_t) -1;
-        c[i].data = NULL;
-#if (NGX_THREADS)
-        c[i].lock = 0;
-#endif
-    }
-    // 分配大小为connections的读写事件数组
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * ecf->connections,
-                                   cycle->log);
-    if (cycle->read_events == NULL) {
-        return NGX_ERROR;
-    }
+    if (ngx_event_flags & NGX_USE_FD_EVENT) {
 
-    rev = cycle->read_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        rev[i].closed = 1;
-#if (NGX_THREADS)
-        rev[i].lock = &c[i].lock;
-        rev[i].own_lock = &c[i].lock;
-#endif
-    }
+        /*
+         * poll, /dev/poll and rt signals report a socket number only,
+         * so they need a table to find a connection by the number
+         */
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * ecf->connections,
-                                   cycle->log);
-    if (cycle->write_events == NULL) {
-        return NGX_ERROR;
+        cycle->files_n = ngx_max_sockets > 0 ? (ngx_uint_t) ngx_max_sockets:
+                                               cycle->connection_n;
+
+        cycle->files = ngx_alloc(sizeof(ngx_connection_t *) * cycle->files_n,
+                                 cycle->log);
+        if (cycle->files == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(cycle->files, sizeof(ngx_connection_t *) * cycle->files_n);
     }
 
-    wev = cycle->write_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        wev[i].closed = 1;
-#if (NGX_THREADS)
-        wev[i].lock = &c[i].lock;
-        wev[i].own_lock = &c[i].lock;
-#endif
+    /* the first chunk of the connections, the others are allocated on demand */
+
+    if (ngx_init_connections(cycle) == NGX_ERROR) {
+        return NGX_ERROR;
     }
 
     /* for each listening socket */
@@ -359,42 +365,24 @@ static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle)
     s = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
-        fd = s[i].fd;
-
-#if (WIN32)
-        /*
-         * Winsock assignes a socket number divisible by 4
-         * so to find a connection we divide a socket number by 4.
-         */
+        c = ngx_get_connection(s[i].fd, cycle->log);
 
-        fd /= 4;
-#endif
-
-        c = &cycle->connections[fd];
-        rev = &cycle->read_events[fd];
-        wev = &cycle->write_events[fd];
+        if (c == NULL) {
+            return NGX_ERROR;
+        }
 
-        ngx_memzero(c, sizeof(ngx_connection_t));
-        ngx_memzero(rev, sizeof(ngx_event_t));
         // 把监听的fd和listening结构体挂载到connection结构体中
-        c->fd = s[i].fd;
         c->listening = &s[i];
+        s[i].connection = c;
 
         c->ctx = s[i].ctx;
         c->servers = s[i].servers;
         c->log = s[i].log;
-        c->read = rev;
-
-        /* required by iocp in "c->write->active = 1" */
-        c->write = wev;
 
-        /* required by poll */
-        wev->index = NGX_INVALID_INDEX;
+        rev = c->read;
+        wev = c->write;
 
         rev->log = c->log;
-        // connection结构体
-        rev->data = c;
-        rev->index = NGX_INVALID_INDEX;
 
         rev->available = 0;
 
@@ -405,20 +393,24 @@ static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
         // 
         if (!(ngx_event_flags & NGX_USE_IOCP_EVENT)) {
-            if (s[i].remain) {
+            if (s[i].remain && s[i].previous && s[i].previous->connection) {
 
                 /*
                  * delete the old accept events that were bound to
                  * the old cycle read events array
                  */
 
-                if (ngx_del_event(&cycle->old_cycle->read_events[fd],
-                                 NGX_READ_EVENT, NGX_CLOSE_EVENT) == NGX_ERROR)
+                old = s[i].previous->connection;
+
+                if (ngx_del_event(old->read, NGX_READ_EVENT, NGX_CLOSE_EVENT)
+                                                                  == NGX_ERROR)
                 {
                     return NGX_ERROR;
                 }
 
-                cycle->old_cycle->connections[fd].fd = (ngx_socket_t) -1;
+                ngx_free_connection(old);
+
+                old->fd = (ngx_socket_t) -1;
             }
         }
 // 忽略
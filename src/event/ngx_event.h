@@ -34,9 +34,18 @@ typedef struct {
 } ngx_event_mutex_t;
 
 
+/*
+ * the fields that are tested and changed on every event are placed first,
+ * so a wakeup touches the first cache line of the event only; the timer
+ * tree links, the log and the platform specific fields follow them
+ */
+
 struct ngx_event_s {
     void            *data;
 
+    /* TODO rename to handler */
+    ngx_event_handler_pt  event_handler;
+
     unsigned         write:1;
 
     unsigned         accept:1;
@@ -77,6 +86,8 @@ struct ngx_event_s {
     /* the pending eof reported by kqueue or in aio chain operation */
     unsigned         pending_eof:1;
 
+    unsigned         closed:1;
+
 #if !(NGX_THREADS)
     unsigned         posted_ready:1;
 #endif
@@ -88,11 +99,10 @@ struct ngx_event_s {
 
 #if (HAVE_KQUEUE)
     unsigned         kq_vnode:1;
-
-    /* the pending errno reported by kqueue */
-    int              kq_errno;
 #endif
 
+    u_int            index;
+
     /*
      * kqueue only:
      *   accept:     number of sockets that wait to be accepted
@@ -113,25 +123,9 @@ struct ngx_event_s {
     unsigned         available:1;
 #endif
 
-    /* TODO rename to handler */
-    ngx_event_handler_pt  event_handler;
-
-
-#if (HAVE_AIO)
-
-#if (HAVE_IOCP)
-    ngx_event_ovlp_t ovlp;
-#else
-    struct aiocb     aiocb;
-#endif
-
-#endif
-
-    u_int            index;
-
-    ngx_log_t       *log;
-
-    /* TODO: threads: padding to cache line */
+    /* the links of the posted queue */
+    ngx_event_t     *next;
+    ngx_event_t    **prev;
 
     /*
      * STUB: The inline of "ngx_rbtree_t  rbtree;"
@@ -143,8 +137,22 @@ struct ngx_event_s {
     void            *rbtree_parent;
     char             rbtree_color;
 
+    ngx_log_t       *log;
 
-    unsigned         closed:1;
+#if (HAVE_KQUEUE)
+    /* the pending errno reported by kqueue */
+    int              kq_errno;
+#endif
+
+#if (HAVE_AIO)
+
+#if (HAVE_IOCP)
+    ngx_event_ovlp_t ovlp;
+#else
+    struct aiocb     aiocb;
+#endif
+
+#endif
 
 #if (NGX_THREADS)
 
@@ -170,10 +178,6 @@ struct ngx_event_s {
 
 #endif
 
-    /* the links of the posted queue */
-    ngx_event_t     *next;
-    ngx_event_t    **prev;
-
 
 #if 0
 
@@ -276,6 +280,12 @@ extern ngx_event_actions_t   ngx_event_actions;
  */
 #define NGX_USE_IOCP_EVENT       0x00000200
 
+/*
+ * The event filter reports the file descriptor only and the connection
+ * must be found by it - poll, /dev/poll, rt signals.
+ */
+#define NGX_USE_FD_EVENT         0x00000400
+
 
 
 /*
@@ -447,6 +457,19 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 
+/* the size of the upstream bufs, the spilled responses and bytes */
+extern ngx_atomic_t  *ngx_stat_pipe_memory;
+extern ngx_atomic_t  *ngx_stat_pipe_spills;
+extern ngx_atomic_t  *ngx_stat_pipe_spilled;
+
+/* the full and the resumed SSL handshakes */
+extern ngx_atomic_t  *ngx_stat_ssl_full;
+extern ngx_atomic_t  *ngx_stat_ssl_resumed;
+
+/* the idle keepalive connections and the memory of their pools */
+extern ngx_atomic_t  *ngx_stat_idle;
+extern ngx_atomic_t  *ngx_stat_idle_memory;
+
 #endif
 
 
@@ -468,6 +491,7 @@ extern ngx_module_t           ngx_event_core_module;
 
 
 void ngx_event_accept(ngx_event_t *ev);
+void ngx_event_accept_passed(ngx_cycle_t *cycle, ngx_socket_t s);
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
 ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle);
 ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
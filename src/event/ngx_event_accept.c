@@ -17,12 +17,13 @@ typedef struct {
 
 
 static void ngx_close_accepted_socket(ngx_socket_t s, ngx_log_t *log);
+static void ngx_close_accepted_connection(ngx_connection_t *c);
 static size_t ngx_accept_log_error(void *data, char *buf, size_t len);
 
 
 void ngx_event_accept(ngx_event_t *ev)
 {
-    ngx_uint_t             instance, accepted;
+    ngx_uint_t             accepted;
     socklen_t              len;
     struct sockaddr       *sa;
     ngx_err_t              err;
@@ -136,23 +137,8 @@ void ngx_event_accept(ngx_event_t *ev)
         (*ngx_stat_accepted)++;
 #endif
 
-        ngx_accept_disabled = (ngx_uint_t) s + NGX_ACCEPT_THRESHOLD
-                                                            - ecf->connections;
-
-        /* disable warning: Win32 SOCKET is u_int while UNIX socket is int */
-
-        if ((ngx_uint_t) s >= ecf->connections) {
-
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "accept() on %s returned socket #%d while "
-                          "only %d connections was configured, "
-                          "closing the connection",
-                          ls->listening->addr_text.data, s, ecf->connections);
-
-            ngx_close_accepted_socket(s, log);
-            ngx_destroy_pool(pool);
-            return;
-        }
+        ngx_accept_disabled = NGX_ACCEPT_THRESHOLD
+                              - (ngx_int_t) ngx_cycle->free_connection_n;
 
 #if (NGX_STAT_STUB)
         (*ngx_stat_active)++;
@@ -185,45 +171,16 @@ void ngx_event_accept(ngx_event_t *ev)
             }
         }
 
-#if (WIN32)
-        /*
-         * Winsock assignes a socket number divisible by 4
-         * so to find a connection we divide a socket number by 4.
-         */
-
-        if (s % 4) {
-            ngx_log_error(NGX_LOG_EMERG, ev->log, 0,
-                          "accept() on %s returned socket #%d, "
-                          "not divisible by 4",
-                          ls->listening->addr_text.data, s);
-            exit(1);
-        }
-
-        c = &ngx_cycle->connections[s / 4];
-        rev = &ngx_cycle->read_events[s / 4];
-        wev = &ngx_cycle->write_events[s / 4];
-#else
-        c = &ngx_cycle->connections[s];
-        rev = &ngx_cycle->read_events[s];
-        wev = &ngx_cycle->write_events[s];
-#endif
-
-        instance = rev->instance;
+        c = ngx_get_connection(s, log);
 
-#if (NGX_THREADS)
-
-        if (*(&c->lock)) {
-            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
-                           "spinlock in accept, fd:%", s);
-            ngx_spinlock(&c->lock, 1000);
-            ngx_unlock(&c->lock);
+        if (c == NULL) {
+            ngx_close_accepted_socket(s, log);
+            ngx_destroy_pool(pool);
+            return;
         }
 
-#endif
-
-        ngx_memzero(rev, sizeof(ngx_event_t));
-        ngx_memzero(wev, sizeof(ngx_event_t));
-        ngx_memzero(c, sizeof(ngx_connection_t));
+        rev = c->read;
+        wev = c->write;
 
         c->pool = pool;
 
@@ -231,22 +188,8 @@ void ngx_event_accept(ngx_event_t *ev)
         c->sockaddr = sa;
         c->socklen = len;
 
-        rev->instance = !instance;
-        wev->instance = !instance;
-
-        rev->index = NGX_INVALID_INDEX;
-        wev->index = NGX_INVALID_INDEX;
-
-        rev->data = c;
-        wev->data = c;
-
-        c->read = rev;
-        c->write = wev;
-
-        c->fd = s;
         c->unexpected_eof = 1;
 
-        wev->write = 1;
         wev->ready = 1;
 
         if (ngx_event_flags & (NGX_USE_AIO_EVENT|NGX_USE_RTSIG_EVENT)) {
@@ -264,10 +207,6 @@ void ngx_event_accept(ngx_event_t *ev)
         c->recv = ngx_recv;
         c->send_chain = ngx_send_chain;
 
-        c->log = log;
-        rev->log = log;
-        wev->log = log;
-
         /*
          * TODO: MT: - atomic increment (x86: lock xadd)
          *             or protection by critical section or light mutex
@@ -279,13 +218,6 @@ void ngx_event_accept(ngx_event_t *ev)
         // 修改共享内存需要互斥访问
         c->number = ngx_atomic_inc(ngx_connection_counter);
 
-#if (NGX_THREADS)
-        rev->lock = &c->lock;
-        wev->lock = &c->lock;
-        rev->own_lock = &c->lock;
-        wev->own_lock = &c->lock;
-#endif
-
         ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                        "accept: fd:%d c:%d", s, c->number);
 
@@ -293,7 +225,7 @@ void ngx_event_accept(ngx_event_t *ev)
             c->addr_text.data = ngx_palloc(c->pool,
                                            c->listening->addr_text_max_len);
             if (c->addr_text.data == NULL) {
-                ngx_close_accepted_socket(s, log);
+                ngx_close_accepted_connection(c);
                 ngx_destroy_pool(pool);
                 return;
             }
@@ -302,7 +234,7 @@ void ngx_event_accept(ngx_event_t *ev)
                                              c->addr_text.data,
                                              c->listening->addr_text_max_len);
             if (c->addr_text.len == 0) {
-                ngx_close_accepted_socket(s, log);
+                ngx_close_accepted_connection(c);
                 ngx_destroy_pool(pool);
                 return;
             }
@@ -329,7 +261,7 @@ void ngx_event_accept(ngx_event_t *ev)
         // 实现了ngx_add_conn并且没有使用epoll
         if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
             if (ngx_add_conn(c) == NGX_ERROR) {
-                ngx_close_accepted_socket(s, log);
+                ngx_close_accepted_connection(c);
                 ngx_destroy_pool(pool);
                 return;
             }
@@ -387,27 +319,22 @@ ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle)
 
 ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle)
 {
-    ngx_uint_t        i;
-    ngx_listening_t  *s;
+    ngx_uint_t         i;
+    ngx_listening_t   *s;
+    ngx_connection_t  *c;
 
     s = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
-        /*
-         * we do not need to handle the Winsock sockets here (divide a socket
-         * number by 4) because this function would never called
-         * in the Winsock environment
-         */
+        c = s[i].connection;
 
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
-            if (ngx_add_conn(&cycle->connections[s[i].fd]) == NGX_ERROR) {
+            if (ngx_add_conn(c) == NGX_ERROR) {
                 return NGX_ERROR;
             }
 
         } else {
-            if (ngx_add_event(&cycle->read_events[s[i].fd], NGX_READ_EVENT, 0)
-                                                                  == NGX_ERROR)
-            {
+            if (ngx_add_event(c->read, NGX_READ_EVENT, 0) == NGX_ERROR) {
                 return NGX_ERROR;
             }
         }
@@ -419,36 +346,27 @@ ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle)
 
 ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle)
 {
-    ngx_uint_t        i;
-    ngx_listening_t  *s;
+    ngx_uint_t         i;
+    ngx_listening_t   *s;
+    ngx_connection_t  *c;
 
     s = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
-        /*
-         * we do not need to handle the Winsock sockets here (divide a socket
-         * number by 4) because this function would never called
-         * in the Winsock environment
-         */
+        c = s[i].connection;
 
-        if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
-            if (!cycle->connections[s[i].fd].read->active) {
-                continue;
-            }
+        if (!c->read->active) {
+            continue;
+        }
 
-            if (ngx_del_conn(&cycle->connections[s[i].fd], NGX_DISABLE_EVENT)
-                                                                  == NGX_ERROR)
-            {
+        if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
+            if (ngx_del_conn(c, NGX_DISABLE_EVENT) == NGX_ERROR) {
                 return NGX_ERROR;
             }
 
         } else {
-            if (!cycle->read_events[s[i].fd].active) {
-                continue;
-            }
-
-            if (ngx_del_event(&cycle->read_events[s[i].fd], NGX_READ_EVENT,
-                                               NGX_DISABLE_EVENT) == NGX_ERROR)
+            if (ngx_del_event(c->read, NGX_READ_EVENT, NGX_DISABLE_EVENT)
+                                                                  == NGX_ERROR)
             {
                 return NGX_ERROR;
             }
@@ -459,6 +377,198 @@ ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle)
 }
 
 
+/*
+ * a connection that was accepted by a worker process of the previous
+ * configuration and passed to this one on the graceful reload; the
+ * listening socket is found by the local address of the connection
+ */
+
+void ngx_event_accept_passed(ngx_cycle_t *cycle, ngx_socket_t s)
+{
+    socklen_t              len;
+    ngx_uint_t             i;
+    ngx_log_t             *log;
+    ngx_pool_t            *pool;
+    ngx_listening_t       *ls, *found;
+    ngx_connection_t      *c;
+    struct sockaddr_in    *sin, *lsin, local;
+    ngx_accept_log_ctx_t  *ctx;
+
+    len = sizeof(struct sockaddr_in);
+
+    if (getsockname(s, (struct sockaddr *) &local, &len) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "getsockname() of the passed connection failed");
+        ngx_close_accepted_socket(s, cycle->log);
+        return;
+    }
+
+    /* AF_INET only, the listening sockets are matched by sockaddr_in */
+
+    if (local.sin_family != AF_INET) {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "the passed connection of the address family %d "
+                      "is not supported", local.sin_family);
+        ngx_close_accepted_socket(s, cycle->log);
+        return;
+    }
+
+    /* the exact address is preferred to the wildcard one */
+
+    found = NULL;
+
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (ls[i].family != AF_INET) {
+            continue;
+        }
+
+        lsin = (struct sockaddr_in *) ls[i].sockaddr;
+
+        if (lsin->sin_port != local.sin_port) {
+            continue;
+        }
+
+        if (lsin->sin_addr.s_addr == local.sin_addr.s_addr) {
+            found = &ls[i];
+            break;
+        }
+
+        if (lsin->sin_addr.s_addr == INADDR_ANY) {
+            found = &ls[i];
+        }
+    }
+
+    if (found == NULL || found->connection == NULL) {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "the passed connection has no listening socket "
+                      "in the new configuration");
+        ngx_close_accepted_socket(s, cycle->log);
+        return;
+    }
+
+    ls = found;
+
+    if (!(pool = ngx_create_pool(ls->pool_size, cycle->log))) {
+        ngx_close_accepted_socket(s, cycle->log);
+        return;
+    }
+
+    if (!(sin = ngx_palloc(pool, ls->socklen))) {
+        ngx_close_accepted_socket(s, cycle->log);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    if (!(log = ngx_palloc(pool, sizeof(ngx_log_t)))) {
+        ngx_close_accepted_socket(s, cycle->log);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    if (!(ctx = ngx_palloc(pool, sizeof(ngx_accept_log_ctx_t)))) {
+        ngx_close_accepted_socket(s, cycle->log);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    ngx_memcpy(log, ls->log, sizeof(ngx_log_t));
+    pool->log = log;
+
+    ctx->flag = -1;
+    ctx->name = ls->addr_text.data;
+
+    log->data = ctx;
+    log->handler = ngx_accept_log_error;
+
+    len = ls->socklen;
+
+    if (getpeername(s, (struct sockaddr *) sin, &len) == -1) {
+
+        /* the client has already closed the connection */
+
+        ngx_log_error(NGX_LOG_INFO, log, ngx_socket_errno,
+                      "getpeername() of the passed connection failed");
+        ngx_close_accepted_socket(s, log);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+#if (NGX_STAT_STUB)
+    (*ngx_stat_active)++;
+#endif
+
+    ngx_accept_disabled = NGX_ACCEPT_THRESHOLD
+                          - (ngx_int_t) ngx_cycle->free_connection_n;
+
+    /* the socket is already in the non-blocking mode */
+
+    if (!(c = ngx_get_connection(s, log))) {
+        ngx_close_accepted_socket(s, log);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    c->pool = pool;
+
+    c->listening = ls;
+    c->sockaddr = (struct sockaddr *) sin;
+    c->socklen = len;
+
+    c->unexpected_eof = 1;
+
+    c->write->ready = 1;
+
+    c->ctx = ls->ctx;
+    c->servers = ls->servers;
+
+    c->recv = ngx_recv;
+    c->send_chain = ngx_send_chain;
+
+    c->number = ngx_atomic_inc(ngx_connection_counter);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "passed connection: fd:%d c:%d", s, c->number);
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_palloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_connection(c);
+            ngx_destroy_pool(pool);
+            return;
+        }
+
+        c->addr_text.len = ngx_sock_ntop(ls->family, c->sockaddr,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_connection(c);
+            ngx_destroy_pool(pool);
+            return;
+        }
+    }
+
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_accepted_connection(c);
+            ngx_destroy_pool(pool);
+            return;
+        }
+    }
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    /*
+     * the request data that may be already in the socket are reported
+     * by the event, when the socket is added to the event set
+     */
+
+    ls->handler(c);
+}
+
+
 static void ngx_close_accepted_socket(ngx_socket_t s, ngx_log_t *log)
 {
     if (ngx_close_socket(s) == -1) {
@@ -468,6 +578,19 @@ static void ngx_close_accepted_socket(ngx_socket_t s, ngx_log_t *log)
 }
 
 
+static void ngx_close_accepted_connection(ngx_connection_t *c)
+{
+    ngx_socket_t  fd;
+
+    ngx_free_connection(c);
+
+    fd = c->fd;
+    c->fd = (ngx_socket_t) -1;
+
+    ngx_close_accepted_socket(fd, c->log);
+}
+
+
 static size_t ngx_accept_log_error(void *data, char *buf, size_t len)
 {
     ngx_accept_log_ctx_t  *ctx = data;
@@ -16,7 +16,6 @@
 int ngx_event_connect_peer(ngx_peer_connection_t *pc)
 {
     int                  rc;
-    ngx_uint_t           instance;
     u_int                event;
     time_t               now;
     ngx_err_t            err;
@@ -24,7 +23,6 @@ int ngx_event_connect_peer(ngx_peer_connection_t *pc)
     ngx_socket_t         s;
     ngx_event_t         *rev, *wev;
     ngx_connection_t    *c;
-    ngx_event_conf_t    *ecf;
     struct sockaddr_in   addr;
 
     now = ngx_time();
@@ -120,28 +118,6 @@ int ngx_event_connect_peer(ngx_peer_connection_t *pc)
         return NGX_ERROR;
     }
 
-
-    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
-
-    /* disable warning: Win32 SOCKET is u_int while UNIX socket is int */
-    // 判断socket的有效性，是否超过连接池大小，连接池是被动和主动连接共享的
-    if ((ngx_uint_t) s >= ecf->connections) {
-
-        ngx_log_error(NGX_LOG_ALERT, pc->log, 0,
-                      "socket() returned socket #%d while only %d "
-                      "connections was configured, closing the socket",
-                      s, ecf->connections);
-
-        if (ngx_close_socket(s) == -1) {
-            ngx_log_error(NGX_LOG_ALERT, pc->log, ngx_socket_errno,
-                          ngx_close_socket_n "failed");
-        }
-
-        /* TODO: sleep for some time */
-
-        return NGX_ERROR;
-    }
-
     // 是否设置了缓冲区大小
     if (pc->rcvbuf) {
         // 设置缓冲区大小
@@ -171,66 +147,20 @@ int ngx_event_connect_peer(ngx_peer_connection_t *pc)
         return NGX_ERROR;
     }
 
-#if (WIN32)
-    /*
-     * Winsock assignes a socket number divisible by 4
-     * so to find a connection we divide a socket number by 4.
-     */
-
-    if (s % 4) {
-        ngx_log_error(NGX_LOG_EMERG, pc->log, 0,
-                      ngx_socket_n
-                      " created socket %d, not divisible by 4", s);
-        exit(1);
-    }
-
-    c = &ngx_cycle->connections[s / 4];
-    rev = &ngx_cycle->read_events[s / 4];
-    wev = &ngx_cycle->write_events[s / 4];
-
-#else
     // 获取connections结构体和对应的读写事件
-    c = &ngx_cycle->connections[s];
-    rev = &ngx_cycle->read_events[s];
-    wev = &ngx_cycle->write_events[s];
+    c = ngx_get_connection(s, pc->log);
 
-#endif
-
-    instance = rev->instance;
-
-#if (NGX_THREADS)
+    if (c == NULL) {
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, pc->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
 
-    if (*(&c->lock)) {
-        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, pc->log, 0,
-                       "spinlock in connect, fd:%d", s);
-        ngx_spinlock(&c->lock, 1000);
-        ngx_unlock(&c->lock);
+        return NGX_ERROR;
     }
 
-#endif
-
-    ngx_memzero(c, sizeof(ngx_connection_t));
-    ngx_memzero(rev, sizeof(ngx_event_t));
-    ngx_memzero(wev, sizeof(ngx_event_t));
-
-    rev->instance = !instance;
-    wev->instance = !instance;
-
-    rev->index = NGX_INVALID_INDEX;
-    wev->index = NGX_INVALID_INDEX;
-
-    rev->data = c;
-    wev->data = c;
-
-    c->read = rev;
-    c->write = wev;
-    wev->write = 1;
-
-    c->log = pc->log;
-    rev->log = pc->log;
-    wev->log = pc->log;
-
-    c->fd = s;
+    rev = c->read;
+    wev = c->write;
 
     c->log_error = pc->log_error;
 
@@ -250,8 +180,6 @@ int ngx_event_connect_peer(ngx_peer_connection_t *pc)
 #if (NGX_THREADS)
     rev->lock = pc->lock;
     wev->lock = pc->lock;
-    rev->own_lock = &c->lock;
-    wev->own_lock = &c->lock;
 #endif
     // 加入epoll等待回调
     if (ngx_add_conn) {
@@ -284,6 +212,8 @@ int ngx_event_connect_peer(ngx_peer_connection_t *pc)
                               ngx_close_socket_n " failed");
             }
 
+            ngx_free_connection(c);
+
             c->fd = (ngx_socket_t) -1;
 
             return NGX_CONNECT_ERROR;
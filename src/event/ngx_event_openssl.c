@@ -9,7 +9,48 @@
 #include <ngx_event.h>
 
 
+typedef struct {
+    size_t         size;
+    u_char         name[16];
+    u_char         hmac_key[32];
+    u_char         aes_key[32];
+} ngx_ssl_ticket_key_t;
+
+
 static ngx_int_t ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size);
+static void ngx_ssl_handshaked(ngx_connection_t *c);
+
+static int ngx_ssl_new_session(SSL *ssl, SSL_SESSION *sess);
+static SSL_SESSION *ngx_ssl_get_cached_session(SSL *ssl, const u_char *id,
+                                               int len, int *copy);
+static void ngx_ssl_remove_session(SSL_CTX *ssl_ctx, SSL_SESSION *sess);
+static ngx_ssl_sess_node_t **ngx_ssl_session_lookup(
+                           ngx_ssl_session_cache_t *cache, const u_char *id,
+                           size_t len, uint32_t hash);
+static void ngx_ssl_session_delete(ngx_ssl_session_cache_t *cache,
+                                   ngx_ssl_sess_node_t **np);
+static void ngx_ssl_session_expire(ngx_ssl_session_cache_t *cache,
+                                   ngx_uint_t n);
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+typedef EVP_MAC_CTX  ngx_ssl_hmac_ctx_t;
+#else
+typedef HMAC_CTX     ngx_ssl_hmac_ctx_t;
+#endif
+
+static int ngx_ssl_ticket_key_callback(SSL *ssl, u_char *name, u_char *iv,
+                                       EVP_CIPHER_CTX *ectx,
+                                       ngx_ssl_hmac_ctx_t *hctx, int enc);
+static int ngx_ssl_ticket_hmac_init(ngx_ssl_hmac_ctx_t *hctx,
+                                    ngx_ssl_ticket_key_t *key);
+
+#endif
+
+
+static int  ngx_ssl_session_cache_index;
+static int  ngx_ssl_ticket_keys_index;
 
 
 ngx_int_t ngx_ssl_init(ngx_log_t *log)
@@ -17,6 +58,17 @@ ngx_int_t ngx_ssl_init(ngx_log_t *log)
     SSL_library_init();
     SSL_load_error_strings();
 
+    ngx_ssl_session_cache_index = SSL_CTX_get_ex_new_index(0, NULL, NULL,
+                                                           NULL, NULL);
+    ngx_ssl_ticket_keys_index = SSL_CTX_get_ex_new_index(0, NULL, NULL,
+                                                         NULL, NULL);
+
+    if (ngx_ssl_session_cache_index == -1 || ngx_ssl_ticket_keys_index == -1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0,
+                      "SSL_CTX_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -52,13 +104,550 @@ ngx_int_t ngx_ssl_create_session(ngx_ssl_ctx_t *ssl_ctx, ngx_connection_t *c,
 
     SSL_set_accept_state(ssl->ssl);
 
+    SSL_set_app_data(ssl->ssl, c);
+
     c->ssl = ssl;
 
     return NGX_OK;
 }
 
 
-ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
+/*
+ * OpenSSL 3.0 and later installs the negotiated keys into the kernel with
+ * setsockopt(TLS_TX) and setsockopt(TLS_RX) itself if the cipher is
+ * supported by the kernel TLS, otherwise the connection uses the SSL
+ * library as usual
+ */
+
+ngx_int_t ngx_ssl_ktls(ngx_ssl_ctx_t *ssl_ctx, ngx_log_t *log)
+{
+#if defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "the kernel TLS is not supported by OpenSSL "
+                  OPENSSL_VERSION_TEXT ", ignored");
+
+#endif
+
+    return NGX_OK;
+}
+
+
+/*
+ * the session cache is shared by all workers, it is used instead of
+ * the OpenSSL internal cache that is private to a process; the least
+ * recently used session is evicted if the cache is full.  The cache is
+ * the shared zone of the given name, so the sessions survive the reload
+ */
+
+ngx_int_t ngx_ssl_session_cache(ngx_ssl_ctx_t *ssl_ctx, ngx_cycle_t *cycle,
+                                ngx_str_t *name, size_t size, time_t timeout,
+                                ngx_log_t *log)
+{
+    u_char                   *p;
+    size_t                    n;
+    ngx_uint_t                i, exists;
+    ngx_ssl_sess_node_t      *node;
+    ngx_ssl_session_cache_t  *cache;
+
+    SSL_CTX_set_session_id_context(ssl_ctx, (const u_char *) "nginx",
+                                   sizeof("nginx") - 1);
+    SSL_CTX_set_timeout(ssl_ctx, timeout);
+
+    n = size / (sizeof(ngx_ssl_sess_node_t) + sizeof(ngx_ssl_sess_node_t *));
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "the SSL session cache size " SIZE_T_FMT
+                      " is too small", size);
+        return NGX_ERROR;
+    }
+
+    p = ngx_shared_zone(cycle, name,
+                        sizeof(ngx_ssl_session_cache_t)
+                        + n * sizeof(ngx_ssl_sess_node_t *)
+                        + n * sizeof(ngx_ssl_sess_node_t),
+                        &ngx_ssl_session_cache_index, &exists);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache = (ngx_ssl_session_cache_t *) p;
+
+    if (exists) {
+        goto done;
+    }
+
+    /* the shared memory is zeroed, so the hash buckets are empty */
+
+    p += sizeof(ngx_ssl_session_cache_t);
+
+    cache->hash = (ngx_ssl_sess_node_t **) p;
+    cache->hash_size = n;
+    p += n * sizeof(ngx_ssl_sess_node_t *);
+
+    cache->queue.prev = &cache->queue;
+    cache->queue.next = &cache->queue;
+
+    node = (ngx_ssl_sess_node_t *) p;
+
+    for (i = 0; i < n; i++) {
+        node[i].next = cache->free;
+        cache->free = &node[i];
+    }
+
+done:
+
+    if (SSL_CTX_set_ex_data(ssl_ctx, ngx_ssl_session_cache_index, cache) == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0, "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER
+                                            |SSL_SESS_CACHE_NO_INTERNAL);
+
+    SSL_CTX_sess_set_new_cb(ssl_ctx, ngx_ssl_new_session);
+    SSL_CTX_sess_set_get_cb(ssl_ctx, ngx_ssl_get_cached_session);
+    SSL_CTX_sess_set_remove_cb(ssl_ctx, ngx_ssl_remove_session);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "SSL session cache: " PTR_FMT ", %d sessions", cache, n);
+
+    return NGX_OK;
+}
+
+
+static int ngx_ssl_new_session(SSL *ssl, SSL_SESSION *sess)
+{
+    int                       len;
+    u_char                   *p, buf[NGX_SSL_MAX_SESSION_SIZE];
+    uint32_t                  hash;
+    unsigned int              id_len;
+    const u_char             *id;
+    ngx_connection_t         *c;
+    ngx_ssl_sess_node_t      *node, **np;
+    ngx_ssl_session_cache_t  *cache;
+
+    c = SSL_get_app_data(ssl);
+
+    len = i2d_SSL_SESSION(sess, NULL);
+
+    if (len <= 0 || len > NGX_SSL_MAX_SESSION_SIZE) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL session is not cached, size: %d", len);
+        return 0;
+    }
+
+    id = SSL_SESSION_get_id(sess, &id_len);
+
+    if (id_len == 0 || id_len > NGX_SSL_MAX_SESSION_ID_SIZE) {
+        return 0;
+    }
+
+    p = buf;
+    i2d_SSL_SESSION(sess, &p);
+
+    cache = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+                                ngx_ssl_session_cache_index);
+
+    hash = ngx_crc((char *) id, id_len);
+
+    ngx_spinlock(&cache->lock, 1000);
+
+    ngx_ssl_session_expire(cache, 2);
+
+    np = ngx_ssl_session_lookup(cache, id, id_len, hash);
+
+    if (np) {
+        ngx_ssl_session_delete(cache, np);
+    }
+
+    if (cache->free == NULL) {
+
+        /* evict the least recently used session */
+
+        node = cache->queue.prev;
+        np = ngx_ssl_session_lookup(cache, node->id, node->id_len, node->hash);
+        ngx_ssl_session_delete(cache, np);
+    }
+
+    node = cache->free;
+    cache->free = node->next;
+
+    node->expire = ngx_time() + SSL_SESSION_get_timeout(sess);
+    node->hash = hash;
+    node->len = len;
+    node->id_len = (u_char) id_len;
+    ngx_memcpy(node->id, id, id_len);
+    ngx_memcpy(node->data, buf, len);
+
+    node->hnext = cache->hash[hash % cache->hash_size];
+    cache->hash[hash % cache->hash_size] = node;
+
+    node->prev = &cache->queue;
+    node->next = cache->queue.next;
+    node->next->prev = node;
+    cache->queue.next = node;
+
+    ngx_unlock(&cache->lock);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL session cached: %08X, size: %d", hash, len);
+
+    /* the session is copied, OpenSSL may free it */
+
+    return 0;
+}
+
+
+static SSL_SESSION *ngx_ssl_get_cached_session(SSL *ssl, const u_char *id,
+                                               int len, int *copy)
+{
+    size_t                    n;
+    u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
+    uint32_t                  hash;
+    const u_char             *p;
+    ngx_connection_t         *c;
+    ngx_ssl_sess_node_t      *node, **np;
+    ngx_ssl_session_cache_t  *cache;
+
+    c = SSL_get_app_data(ssl);
+
+    *copy = 0;
+
+    if (len <= 0 || len > NGX_SSL_MAX_SESSION_ID_SIZE) {
+        return NULL;
+    }
+
+    cache = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+                                ngx_ssl_session_cache_index);
+
+    hash = ngx_crc((char *) id, len);
+
+    ngx_spinlock(&cache->lock, 1000);
+
+    np = ngx_ssl_session_lookup(cache, id, len, hash);
+
+    if (np == NULL) {
+        ngx_unlock(&cache->lock);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL session is not found: %08X", hash);
+        return NULL;
+    }
+
+    node = *np;
+
+    if (node->expire <= ngx_time()) {
+        ngx_ssl_session_delete(cache, np);
+        ngx_unlock(&cache->lock);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL session is expired: %08X", hash);
+        return NULL;
+    }
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+
+    node->prev = &cache->queue;
+    node->next = cache->queue.next;
+    node->next->prev = node;
+    cache->queue.next = node;
+
+    n = node->len;
+    ngx_memcpy(buf, node->data, n);
+
+    ngx_unlock(&cache->lock);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL session is found: %08X", hash);
+
+    p = buf;
+
+    return d2i_SSL_SESSION(NULL, &p, n);
+}
+
+
+static void ngx_ssl_remove_session(SSL_CTX *ssl_ctx, SSL_SESSION *sess)
+{
+    uint32_t                  hash;
+    unsigned int              id_len;
+    const u_char             *id;
+    ngx_ssl_sess_node_t     **np;
+    ngx_ssl_session_cache_t  *cache;
+
+    id = SSL_SESSION_get_id(sess, &id_len);
+
+    if (id_len == 0 || id_len > NGX_SSL_MAX_SESSION_ID_SIZE) {
+        return;
+    }
+
+    cache = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    hash = ngx_crc((char *) id, id_len);
+
+    ngx_spinlock(&cache->lock, 1000);
+
+    np = ngx_ssl_session_lookup(cache, id, id_len, hash);
+
+    if (np) {
+        ngx_ssl_session_delete(cache, np);
+    }
+
+    ngx_unlock(&cache->lock);
+}
+
+
+static ngx_ssl_sess_node_t **ngx_ssl_session_lookup(
+                           ngx_ssl_session_cache_t *cache, const u_char *id,
+                           size_t len, uint32_t hash)
+{
+    ngx_ssl_sess_node_t  **np;
+
+    for (np = &cache->hash[hash % cache->hash_size]; *np; np = &(*np)->hnext) {
+        if ((*np)->hash == hash
+            && (*np)->id_len == len
+            && ngx_memcmp((*np)->id, id, len) == 0)
+        {
+            return np;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void ngx_ssl_session_delete(ngx_ssl_session_cache_t *cache,
+                                   ngx_ssl_sess_node_t **np)
+{
+    ngx_ssl_sess_node_t  *node;
+
+    node = *np;
+    *np = node->hnext;
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+
+    node->next = cache->free;
+    cache->free = node;
+}
+
+
+/* deletes no more than n expired sessions from the queue tail */
+
+static void ngx_ssl_session_expire(ngx_ssl_session_cache_t *cache,
+                                   ngx_uint_t n)
+{
+    time_t                 now;
+    ngx_ssl_sess_node_t   *node, **np;
+
+    now = ngx_time();
+
+    while (n-- && cache->queue.prev != &cache->queue) {
+        node = cache->queue.prev;
+
+        if (node->expire > now) {
+            return;
+        }
+
+        np = ngx_ssl_session_lookup(cache, node->id, node->id_len, node->hash);
+        ngx_ssl_session_delete(cache, np);
+    }
+}
+
+
+/*
+ * every file contains a 48 or 80 bytes key: the 16 bytes key name,
+ * then the HMAC and AES keys of 16 or 32 bytes each; the first key
+ * encrypts the new tickets, the rest only decrypt the tickets issued
+ * before the key rotation
+ */
+
+ngx_int_t ngx_ssl_session_ticket_keys(ngx_ssl_ctx_t *ssl_ctx,
+                                      ngx_array_t *paths, ngx_pool_t *pool,
+                                      ngx_log_t *log)
+{
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+    u_char                 buf[81];
+    ssize_t                n;
+    ngx_str_t             *path;
+    ngx_uint_t             i;
+    ngx_file_t             file;
+    ngx_array_t           *keys;
+    ngx_ssl_ticket_key_t  *key;
+
+    if (!(keys = ngx_create_array(pool, paths->nelts,
+                                  sizeof(ngx_ssl_ticket_key_t))))
+    {
+        return NGX_ERROR;
+    }
+
+    path = paths->elts;
+
+    for (i = 0; i < paths->nelts; i++) {
+
+        ngx_memzero(&file, sizeof(ngx_file_t));
+        file.name = path[i];
+        file.log = log;
+
+        file.fd = ngx_open_file(path[i].data, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+
+        if (file.fd == NGX_INVALID_FILE) {
+            ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", path[i].data);
+            return NGX_ERROR;
+        }
+
+        n = ngx_read_file(&file, buf, sizeof(buf), 0);
+
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", path[i].data);
+        }
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n != 48 && n != 80) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0,
+                          "\"%s\" must be 48 or 80 bytes", path[i].data);
+            return NGX_ERROR;
+        }
+
+        if (!(key = ngx_push_array(keys))) {
+            return NGX_ERROR;
+        }
+
+        key->size = (n == 48) ? 16 : 32;
+
+        ngx_memcpy(key->name, buf, 16);
+        ngx_memcpy(key->hmac_key, buf + 16, key->size);
+        ngx_memcpy(key->aes_key, buf + 16 + key->size, key->size);
+    }
+
+    ngx_memzero(buf, sizeof(buf));
+
+    if (SSL_CTX_set_ex_data(ssl_ctx, ngx_ssl_ticket_keys_index, keys) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, log, 0, "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, ngx_ssl_ticket_key_callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, ngx_ssl_ticket_key_callback);
+#endif
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "the session ticket keys are not supported by OpenSSL "
+                  OPENSSL_VERSION_TEXT ", ignored");
+
+#endif
+
+    return NGX_OK;
+}
+
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+static int ngx_ssl_ticket_key_callback(SSL *ssl, u_char *name, u_char *iv,
+                                       EVP_CIPHER_CTX *ectx,
+                                       ngx_ssl_hmac_ctx_t *hctx, int enc)
+{
+    ngx_uint_t             i;
+    ngx_array_t           *keys;
+    ngx_connection_t      *c;
+    const EVP_CIPHER      *cipher;
+    ngx_ssl_ticket_key_t  *key;
+
+    c = SSL_get_app_data(ssl);
+
+    keys = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl),
+                               ngx_ssl_ticket_keys_index);
+    key = keys->elts;
+
+    if (enc == 1) {
+        cipher = (key[0].size == 16) ? EVP_aes_128_cbc() : EVP_aes_256_cbc();
+
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1
+            || EVP_EncryptInit_ex(ectx, cipher, NULL, key[0].aes_key, iv) != 1
+            || ngx_ssl_ticket_hmac_init(hctx, &key[0]) != 1)
+        {
+            ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                          "SSL session ticket encryption failed");
+            return -1;
+        }
+
+        ngx_memcpy(name, key[0].name, 16);
+
+        return 1;
+    }
+
+    for (i = 0; i < keys->nelts; i++) {
+        if (ngx_memcmp(name, key[i].name, 16) == 0) {
+            break;
+        }
+    }
+
+    if (i == keys->nelts) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL session ticket key is not found");
+        return 0;
+    }
+
+    cipher = (key[i].size == 16) ? EVP_aes_128_cbc() : EVP_aes_256_cbc();
+
+    if (ngx_ssl_ticket_hmac_init(hctx, &key[i]) != 1
+        || EVP_DecryptInit_ex(ectx, cipher, NULL, key[i].aes_key, iv) != 1)
+    {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL session ticket decryption failed");
+        return -1;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL session ticket key: %d", i);
+
+    /* the tickets encrypted with the old keys are renewed */
+
+    return (i == 0) ? 1 : 2;
+}
+
+
+static int ngx_ssl_ticket_hmac_init(ngx_ssl_hmac_ctx_t *hctx,
+                                    ngx_ssl_ticket_key_t *key)
+{
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+
+    OSSL_PARAM  params[2];
+
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char *) "SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+
+    return EVP_MAC_init(hctx, key->hmac_key, key->size, params);
+
+#else
+
+    return HMAC_Init_ex(hctx, key->hmac_key, key->size, EVP_sha256(), NULL);
+
+#endif
+}
+
+#endif
+
+
+ssize_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 {
     int         n, sslerr;
     ngx_err_t   err;
@@ -68,6 +657,10 @@ ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_read: %d", n); 
 
+    if (!c->ssl->handshaked && SSL_is_init_finished(c->ssl->ssl)) {
+        ngx_ssl_handshaked(c);
+    }
+
     if (n > 0) {
         return n;
     }
@@ -82,6 +675,13 @@ ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
         return NGX_AGAIN;
     }
 
+    if (!SSL_is_init_finished(c->ssl->ssl)) {
+        handshake = "in SSL handshake";
+
+    } else {
+        handshake = "";
+    }
+
     if (sslerr == SSL_ERROR_WANT_WRITE) {
         ngx_log_error(NGX_LOG_ALERT, c->log, err,
                       "SSL wants to write%s", handshake);
@@ -91,13 +691,6 @@ ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 #endif
     }
 
-    if (!SSL_is_init_finished(c->ssl->ssl)) {
-        handshake = "in SSL handshake";
-
-    } else {
-        handshake = "";
-    }
-
     c->ssl->no_rcv_shut = 1;
 
     if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
@@ -114,6 +707,44 @@ ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 }
 
 
+static void ngx_ssl_handshaked(ngx_connection_t *c)
+{
+    c->ssl->handshaked = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL handshake: %s",
+                   SSL_session_reused(c->ssl->ssl) ? "resumed" : "full");
+
+#if defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+
+    /*
+     * the kernel encrypts the data sent by write() and sendfile(),
+     * so the connection uses the plain send chain and the response bodies
+     * may be sent from the files without copying them to the SSL buffer
+     */
+
+    if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->ssl))) {
+        c->ssl->sendfile = 1;
+        c->send_chain = ngx_io.send_chain;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL kernel TLS send: %d",
+                   c->ssl->sendfile);
+
+#endif
+
+#if (NGX_STAT_STUB)
+
+    if (SSL_session_reused(c->ssl->ssl)) {
+        (*ngx_stat_ssl_resumed)++;
+
+    } else {
+        (*ngx_stat_ssl_full)++;
+    }
+
+#endif
+}
+
+
 /*
  * OpenSSL has no SSL_writev() so we copy several bufs into our 16K buffer
  * before SSL_write() call to decrease a SSL overhead.
@@ -154,6 +785,19 @@ ngx_chain_t *ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in,
         return in;
     }
 
+    if (buf->start == NULL) {
+
+        /* the buffer was freed while the connection was idle */
+
+        if (!(buf->start = ngx_palloc(c->pool, NGX_SSL_BUFSIZE))) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        buf->pos = buf->start;
+        buf->last = buf->start;
+        buf->end = buf->start + NGX_SSL_BUFSIZE;
+    }
+
     send = 0;
     flush = (in == NULL) ? 1 : 0;
 
@@ -265,13 +909,12 @@ static ngx_int_t ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
     }
 
     if (sslerr == SSL_ERROR_WANT_READ) {
-        ngx_log_error(NGX_LOG_ALERT, c->log, err,
-                      "SSL wants to read%s", handshake);
+        ngx_log_error(NGX_LOG_ALERT, c->log, err, "SSL wants to read");
         return NGX_ERROR;
 #if 0
         return NGX_AGAIN;
-    }
 #endif
+    }
 
     c->ssl->no_rcv_shut = 1;
 
@@ -281,6 +924,37 @@ static ngx_int_t ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 }
 
 
+/*
+ * an idle keepalive connection does not need the send buffer and
+ * the OpenSSL read and write buffers, so they are freed and then
+ * allocated again on the first read or write
+ */
+
+ngx_int_t ngx_ssl_free_buffers(ngx_connection_t *c)
+{
+    ngx_buf_t  *buf;
+
+    buf = c->ssl->buf;
+
+    if (buf->pos < buf->last || SSL_pending(c->ssl->ssl)) {
+        return NGX_DECLINED;
+    }
+
+    if (buf->start && ngx_pfree(c->pool, buf->start) == NGX_OK) {
+        buf->start = NULL;
+        buf->pos = NULL;
+        buf->last = NULL;
+        buf->end = NULL;
+    }
+
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+    SSL_free_buffers(c->ssl->ssl);
+#endif
+
+    return NGX_OK;
+}
+
+
 ngx_int_t ngx_ssl_shutdown(ngx_connection_t *c)
 {
     int         n, sslerr;
@@ -13,6 +13,13 @@
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+#include <openssl/core_names.h>
+#endif
 
 
 typedef struct {
@@ -23,6 +30,8 @@ typedef struct {
     unsigned               buffer:1;
     unsigned               no_rcv_shut:1;
     unsigned               no_send_shut:1;
+    unsigned               handshaked:1;
+    unsigned               sendfile:1;
 } ngx_ssl_t;
 
 
@@ -35,18 +44,72 @@ typedef SSL_CTX  ngx_ssl_ctx_t;
 #define NGX_SSL_BUFSIZE      16384
 
 
+/*
+ * the DER encoded sessions larger than NGX_SSL_MAX_SESSION_SIZE,
+ * for example, with the client certificates, are not cached
+ */
+
+#define NGX_SSL_MAX_SESSION_SIZE     512
+#define NGX_SSL_MAX_SESSION_ID_SIZE  32
+
+
+typedef struct ngx_ssl_sess_node_s  ngx_ssl_sess_node_t;
+
+struct ngx_ssl_sess_node_s {
+    ngx_ssl_sess_node_t   *hnext;
+    ngx_ssl_sess_node_t   *prev;
+    ngx_ssl_sess_node_t   *next;
+
+    time_t                 expire;
+    uint32_t               hash;
+    size_t                 len;
+    u_char                 id_len;
+    u_char                 id[NGX_SSL_MAX_SESSION_ID_SIZE];
+    u_char                 data[NGX_SSL_MAX_SESSION_SIZE];
+};
+
+
+/*
+ * the session cache is allocated in the shared memory before the workers
+ * are forked, so the pointers are the same in all processes
+ */
+
+typedef struct {
+    ngx_atomic_t           lock;
+
+    ngx_ssl_sess_node_t  **hash;
+    ngx_uint_t             hash_size;
+
+    /* queue.next is the most recently used session */
+    ngx_ssl_sess_node_t    queue;
+    ngx_ssl_sess_node_t   *free;
+} ngx_ssl_session_cache_t;
+
+
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create_session(ngx_ssl_ctx_t *ctx, ngx_connection_t *c,
                                  ngx_uint_t flags);
+ngx_int_t ngx_ssl_ktls(ngx_ssl_ctx_t *ssl_ctx, ngx_log_t *log);
+ngx_int_t ngx_ssl_session_cache(ngx_ssl_ctx_t *ssl_ctx, ngx_cycle_t *cycle,
+                                ngx_str_t *name, size_t size, time_t timeout,
+                                ngx_log_t *log);
+ngx_int_t ngx_ssl_session_ticket_keys(ngx_ssl_ctx_t *ssl_ctx,
+                                      ngx_array_t *paths, ngx_pool_t *pool,
+                                      ngx_log_t *log);
 
 #define ngx_ssl_handshake(c)     NGX_OK
 
-ngx_int_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size);
+/* the decrypted data that are already read from the socket */
+#define ngx_ssl_pending(c)       SSL_pending(c->ssl->ssl)
+
+ssize_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size);
 ngx_chain_t *ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in,
                                 off_t limit);
+ngx_int_t ngx_ssl_free_buffers(ngx_connection_t *c);
 ngx_int_t ngx_ssl_shutdown(ngx_connection_t *c);
 void ngx_ssl_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
                    char *fmt, ...);
+void ngx_ssl_close_handler(ngx_event_t *ev);
 
 #define ngx_ssl_set_nosendshut(ssl)                                          \
             if (ssl) {                                                       \
@@ -13,7 +13,12 @@
 static ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p);
 static ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p);
 
+static ngx_chain_t *ngx_event_pipe_alloc_raw_buf(ngx_event_pipe_t *p);
+static void ngx_event_pipe_cleanup(void *data);
 static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
+static void ngx_event_pipe_preallocate_temp_file(ngx_event_pipe_t *p);
+static void ngx_event_pipe_drop_temp_file_cache(ngx_event_pipe_t *p,
+                                                off_t offset);
 ngx_inline static void ngx_event_pipe_remove_shadow_links(ngx_buf_t *buf);
 ngx_inline static void ngx_event_pipe_free_shadow_raw_buf(ngx_chain_t **free,
                                                           ngx_buf_t *buf);
@@ -22,6 +27,11 @@ ngx_inline static void ngx_event_pipe_add_free_buf(ngx_chain_t **chain,
 static ngx_int_t ngx_event_pipe_drain_chains(ngx_event_pipe_t *p);
 
 
+/* the size of the upstream raw bufs allocated in the worker */
+
+size_t  ngx_event_pipe_memory;
+
+
 ngx_int_t ngx_event_pipe(ngx_event_pipe_t *p, int do_write)
 {
     u_int         flags;
@@ -163,15 +173,10 @@ ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
                 /* allocate a new buf if it's still allowed */
 
-                if (!(b = ngx_create_temp_buf(p->pool, p->bufs.size))) {
+                if (!(chain = ngx_event_pipe_alloc_raw_buf(p))) {
                     return NGX_ABORT;
                 }
 
-                p->allocated++;
-
-                ngx_alloc_link_and_set_buf(tl, b, p->pool, NGX_ABORT);
-                chain = tl;
-
             } else if (!p->cachable && p->downstream->write->ready) {
 
                 /*
@@ -186,8 +191,29 @@ ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
                 break;
 
+            } else if (!p->cachable
+                       && p->buffering == NGX_EVENT_PIPE_BUFFERING_ADAPTIVE
+                       && ngx_event_pipe_memory + p->bufs.size
+                                                             <= p->max_memory)
+            {
+
+                /*
+                 * a downstream is slow, so the bufs are grown while
+                 * the worker memory budget allows and only then
+                 * the bufs are written to a temporary file
+                 */
+
+                if (!(chain = ngx_event_pipe_alloc_raw_buf(p))) {
+                    return NGX_ABORT;
+                }
+
+                ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                               "pipe adaptive buf: %d, worker memory: "
+                               SIZE_T_FMT, p->allocated, ngx_event_pipe_memory);
+
             } else if (p->cachable
-                       || p->temp_file->offset < p->max_temp_file_size)
+                       || (p->buffering != NGX_EVENT_PIPE_BUFFERING_MEMORY
+                           && p->temp_file->offset < p->max_temp_file_size))
             {
 
                 /*
@@ -337,7 +363,15 @@ ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
         if (p->free_bufs) {
             for (cl = p->free_raw_bufs; cl; cl = cl->next) {
-                ngx_pfree(p->pool, cl->buf->start); 
+                if (ngx_pfree(p->pool, cl->buf->start) == NGX_OK) {
+                    size = cl->buf->end - cl->buf->start;
+
+                    p->memory -= size;
+                    ngx_event_pipe_memory -= size;
+#if (NGX_STAT_STUB)
+                    (*ngx_stat_pipe_memory) -= size;
+#endif
+                }
             }
         }
     }
@@ -472,6 +506,13 @@ ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
         for (cl = p->free; cl; cl = cl->next) {
 
             if (cl->buf->temp_file) {
+                if (p->temp_file_nocache
+                    && cl->buf->file_last > p->temp_file_dropped)
+                {
+                    ngx_event_pipe_drop_temp_file_cache(p,
+                                                        cl->buf->file_last);
+                }
+
                 if (p->cachable || !p->cyclic_temp_file) {
                     continue;
                 }
@@ -480,6 +521,7 @@ ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
 
                 if (cl->buf->file_last == p->temp_file->offset) {
                     p->temp_file->offset = 0;
+                    p->temp_file_dropped = 0;
                 }
             }
 
@@ -505,9 +547,55 @@ ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
 }
 
 
+static ngx_chain_t *ngx_event_pipe_alloc_raw_buf(ngx_event_pipe_t *p)
+{
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl;
+    ngx_pool_cleanup_t  *cln;
+
+    /*
+     * the worker total is returned when the pool is destroyed, so the
+     * requests that are closed without the upstream finalization do not
+     * leak it
+     */
+
+    if (!p->memory_cleanup) {
+        if (!(cln = ngx_pool_cleanup_add(p->pool, 0))) {
+            return NULL;
+        }
+
+        cln->handler = ngx_event_pipe_cleanup;
+        cln->data = p;
+
+        p->memory_cleanup = 1;
+    }
+
+    if (!(b = ngx_create_temp_buf(p->pool, p->bufs.size))) {
+        return NULL;
+    }
+
+    if (!(cl = ngx_alloc_chain_link(p->pool))) {
+        return NULL;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    p->allocated++;
+    p->memory += p->bufs.size;
+    ngx_event_pipe_memory += p->bufs.size;
+
+#if (NGX_STAT_STUB)
+    (*ngx_stat_pipe_memory) += p->bufs.size;
+#endif
+
+    return cl;
+}
+
+
 static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
 {
-    ssize_t       size, bsize;
+    ssize_t       n, size, bsize;
     ngx_buf_t    *b;
     ngx_chain_t  *cl, *tl, *next, *out, **ll, **last_free, fl;
 
@@ -564,10 +652,23 @@ static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
         p->last_in = &p->in;
     }
 
-    if (ngx_write_chain_to_temp_file(p->temp_file, out) == NGX_ERROR) {
+    n = ngx_write_chain_to_temp_file(p->temp_file, out);
+
+    if (n == NGX_ERROR) {
         return NGX_ABORT;
     }
 
+    if (!p->spilled) {
+        p->spilled = 1;
+#if (NGX_STAT_STUB)
+        (*ngx_stat_pipe_spills)++;
+#endif
+    }
+
+#if (NGX_STAT_STUB)
+    (*ngx_stat_pipe_spilled) += n;
+#endif
+
     for (last_free = &p->free_raw_bufs;
          *last_free != NULL;
          last_free = &(*last_free)->next)
@@ -601,13 +702,133 @@ static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
             ngx_alloc_link_and_set_buf(tl, b->shadow, p->pool, NGX_ABORT);
             *last_free = tl;
             last_free = &tl->next;
+
+            /*
+             * the raw buf is reused for the reading, so the buf must not
+             * be linked with it and must be sent from the file only
+             */
+
+            b->shadow->shadow = NULL;
+            b->shadow = NULL;
+            b->last_shadow = 0;
         }
+
+        b->temporary = 0;
+    }
+
+    if (p->temp_file_preallocate && !p->cachable) {
+        ngx_event_pipe_preallocate_temp_file(p);
     }
 
     return NGX_OK;
 }
 
 
+/*
+ * the temporary file is preallocated by the big extents ahead of the writes,
+ * so the file system does not fragment it while it grows by the small writes.
+ * The cachable files are not preallocated because posix_fallocate() extends
+ * the file size.
+ */
+
+static void ngx_event_pipe_preallocate_temp_file(ngx_event_pipe_t *p)
+{
+#if (HAVE_POSIX_FALLOCATE)
+
+    off_t      size;
+    ngx_err_t  err;
+
+    if (p->temp_file->offset + p->temp_file_write_size
+                                                   <= p->temp_file_allocated)
+    {
+        return;
+    }
+
+    size = p->max_temp_file_size - p->temp_file_allocated;
+
+    if (size > p->temp_file_preallocate) {
+        size = p->temp_file_preallocate;
+    }
+
+    if (size <= 0) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe preallocate: " OFF_T_FMT ":" OFF_T_FMT,
+                   p->temp_file_allocated, size);
+
+    err = ngx_fallocate_file(p->temp_file->file.fd,
+                             p->temp_file_allocated, size);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, err,
+                      ngx_fallocate_file_n " \"%s\" failed",
+                      p->temp_file->file.name.data);
+
+        /* do not try again */
+        p->temp_file_preallocate = 0;
+        return;
+    }
+
+    p->temp_file_allocated += size;
+
+#endif
+}
+
+
+/*
+ * the already sent part of the temporary file is dropped from the page cache,
+ * so the big responses buffered for the slow clients do not wash out
+ * the page cache
+ */
+
+static void ngx_event_pipe_drop_temp_file_cache(ngx_event_pipe_t *p,
+                                                off_t offset)
+{
+#if (HAVE_POSIX_FADVISE)
+
+    ngx_err_t  err;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe drop cache: " OFF_T_FMT "-" OFF_T_FMT,
+                   p->temp_file_dropped, offset);
+
+    err = ngx_fadvise_dontneed(p->temp_file->file.fd, p->temp_file_dropped,
+                               offset - p->temp_file_dropped);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, err,
+                      ngx_fadvise_dontneed_n " \"%s\" failed",
+                      p->temp_file->file.name.data);
+    }
+
+#endif
+
+    p->temp_file_dropped = offset;
+}
+
+
+void ngx_event_pipe_free_memory(ngx_event_pipe_t *p)
+{
+    ngx_event_pipe_memory -= p->memory;
+
+#if (NGX_STAT_STUB)
+    (*ngx_stat_pipe_memory) -= p->memory;
+#endif
+
+    p->memory = 0;
+}
+
+
+static void ngx_event_pipe_cleanup(void *data)
+{
+    ngx_event_pipe_t  *p = data;
+
+    ngx_event_pipe_free_memory(p);
+}
+
+
 /* the copy input filter */
 
 ngx_int_t ngx_event_pipe_copy_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
@@ -13,6 +13,11 @@
 #include <ngx_event.h>
 
 
+#define NGX_EVENT_PIPE_BUFFERING_DISK      0
+#define NGX_EVENT_PIPE_BUFFERING_MEMORY    1
+#define NGX_EVENT_PIPE_BUFFERING_ADAPTIVE  2
+
+
 typedef struct ngx_event_pipe_s  ngx_event_pipe_t;
 
 typedef ngx_int_t (*ngx_event_pipe_input_filter_pt)(ngx_event_pipe_t *p,
@@ -57,11 +62,22 @@ struct ngx_event_pipe_s {
     unsigned           downstream_done:1;
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
+    unsigned           temp_file_nocache:1;
+    unsigned           spilled:1;
+    unsigned           memory_cleanup:1;
+
+    ngx_uint_t         buffering;
 
     ngx_int_t          allocated;
     ngx_bufs_t         bufs;
     ngx_buf_tag_t      tag;
 
+    /* the size of the allocated raw bufs */
+    size_t             memory;
+
+    /* the adaptive bufs are allocated while the worker total is less */
+    size_t             max_memory;
+
     size_t             busy_size;
 
     off_t              read_length;
@@ -69,6 +85,10 @@ struct ngx_event_pipe_s {
     off_t              max_temp_file_size;
     ssize_t            temp_file_write_size;
 
+    off_t              temp_file_preallocate;
+    off_t              temp_file_allocated;
+    off_t              temp_file_dropped;
+
     ngx_msec_t         read_timeout;
     ngx_msec_t         send_timeout;
     ssize_t            send_lowat;
@@ -88,6 +108,10 @@ struct ngx_event_pipe_s {
 
 ngx_int_t ngx_event_pipe(ngx_event_pipe_t *p, int do_write);
 ngx_int_t ngx_event_pipe_copy_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf);
+void ngx_event_pipe_free_memory(ngx_event_pipe_t *p);
+
+
+extern size_t  ngx_event_pipe_memory;
 
 
 #endif /* _NGX_EVENT_PIPE_H_INCLUDED_ */
@@ -0,0 +1,1022 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_connect.h>
+#include <ngx_event_resolver.h>
+
+
+/* the responses without EDNS0 do not exceed 512 bytes */
+#define NGX_RESOLVER_UDP_SIZE   4096
+#define NGX_RESOLVER_TCP_SIZE   (2 + 65535)
+
+/* ngx_close_connection() destroys the connection pool */
+#define NGX_RESOLVER_POOL_SIZE  256
+
+#define NGX_RESOLVER_TYPE_A     1
+#define NGX_RESOLVER_CLASS_IN   1
+
+
+static ngx_int_t ngx_resolver_create_query(ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_send_query(ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_udp_open(ngx_resolver_t *r);
+static void ngx_resolver_udp_read(ngx_event_t *rev);
+static ngx_int_t ngx_resolver_tcp_connect(ngx_resolver_node_t *rn);
+static void ngx_resolver_tcp_write(ngx_event_t *wev);
+static void ngx_resolver_tcp_read(ngx_event_t *rev);
+static void ngx_resolver_tcp_close(ngx_resolver_node_t *rn);
+static void ngx_resolver_timeout_handler(ngx_event_t *ev);
+static void ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf,
+                                          size_t n, ngx_resolver_node_t *tcp);
+static void ngx_resolver_done(ngx_resolver_node_t *rn, ngx_int_t state);
+static void ngx_resolver_cleanup(void *data);
+
+
+/* the node timers are not bound to a connection */
+
+static ngx_connection_t  ngx_resolver_dumb;
+
+
+ngx_resolver_t *ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *server)
+{
+    u_char              *p;
+    ngx_int_t            port;
+    ngx_uint_t           i;
+    in_addr_t            addr;
+    ngx_peer_t          *peer;
+    ngx_resolver_t      *r;
+    ngx_pool_cleanup_t  *cln;
+
+    for (i = 0; i < server->len; i++) {
+        if (server->data[i] == ':') {
+            break;
+        }
+    }
+
+    if (i == server->len) {
+        port = 53;
+
+    } else {
+        port = ngx_atoi(&server->data[i + 1], server->len - i - 1);
+        if (port < 1 || port > 65535) {
+            return NULL;
+        }
+    }
+
+    if (!(p = ngx_palloc(cf->pool, server->len + 1))) {
+        return NULL;
+    }
+
+    ngx_cpystrn(p, server->data, i + 1);
+
+    /* AF_INET only */
+
+    addr = inet_addr((char *) p);
+
+    if (addr == INADDR_NONE) {
+        return NULL;
+    }
+
+    ngx_cpystrn(p, server->data, server->len + 1);
+
+    if (!(r = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_t)))) {
+        return NULL;
+    }
+
+    r->peers.number = 1;
+
+    peer = &r->peers.peers[0];
+
+    peer->addr = addr;
+    peer->port = htons((in_port_t) port);
+    peer->host.len = i;
+    peer->host.data = p;
+    peer->addr_port_text.len = server->len;
+    peer->addr_port_text.data = p;
+
+    r->log = cf->cycle->new_log;
+
+    if (!(cln = ngx_pool_cleanup_add(cf->pool, 0))) {
+        return NULL;
+    }
+
+    cln->handler = ngx_resolver_cleanup;
+    cln->data = r;
+
+    return r;
+}
+
+
+/*
+ * ngx_resolve_name() returns NGX_OK if the cached answer is copied to ctx,
+ * NGX_AGAIN if ctx->handler will be called on the query completion,
+ * and NGX_ERROR if the query can not be started
+ */
+
+ngx_int_t ngx_resolve_name(ngx_resolver_ctx_t *ctx)
+{
+    ngx_uint_t            i;
+    ngx_str_t             name;
+    ngx_resolver_t       *r;
+    ngx_resolver_node_t  *rn;
+
+    r = ctx->resolver;
+    name = ctx->name;
+
+    if (name.len && name.data[name.len - 1] == '.') {
+        name.len--;
+    }
+
+    if (name.len == 0 || name.len > 253) {
+        return NGX_ERROR;
+    }
+
+    for (rn = r->nodes; rn; rn = rn->next) {
+        if (rn->name.len == name.len
+            && ngx_strncasecmp(rn->name.data, name.data, name.len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (rn) {
+        if (rn->pending) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                           "resolve \"%s\": waiting", rn->name.data);
+
+            ctx->next = rn->waiting;
+            rn->waiting = ctx;
+            ctx->node = rn;
+
+            return NGX_AGAIN;
+        }
+
+        if (rn->naddrs && rn->valid > ngx_time()) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                           "resolve \"%s\": cached", rn->name.data);
+
+            ctx->state = NGX_OK;
+            ctx->naddrs = rn->naddrs;
+            ngx_memcpy(ctx->addrs, rn->addrs, rn->naddrs * sizeof(in_addr_t));
+            ctx->valid = rn->valid;
+
+            return NGX_OK;
+        }
+
+    } else {
+        rn = ngx_calloc(sizeof(ngx_resolver_node_t) + name.len + 1, r->log);
+        if (rn == NULL) {
+            return NGX_ERROR;
+        }
+
+        rn->resolver = r;
+
+        rn->name.len = name.len;
+        rn->name.data = (u_char *) rn + sizeof(ngx_resolver_node_t);
+
+        for (i = 0; i < name.len; i++) {
+            rn->name.data[i] = (u_char) ((name.data[i] >= 'A'
+                                          && name.data[i] <= 'Z') ?
+                                             name.data[i] | 0x20 : name.data[i]);
+        }
+
+        rn->name.data[name.len] = '\0';
+
+        rn->event.data = &ngx_resolver_dumb;
+        rn->event.event_handler = ngx_resolver_timeout_handler;
+        rn->event.log = r->log;
+
+        if (ngx_resolver_create_query(rn) != NGX_OK) {
+            ngx_free(rn);
+            return NGX_ERROR;
+        }
+
+        rn->next = r->nodes;
+        r->nodes = rn;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                   "resolve \"%s\": query", rn->name.data);
+
+    rn->tcp_mode = 0;
+    rn->tries = ctx->timeout / NGX_RESOLVER_RESEND;
+
+    if (rn->tries == 0) {
+        rn->tries = 1;
+    }
+
+    if (r->udp == NULL) {
+        if (ngx_resolver_udp_open(r) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    /* the resent queries keep the id, so a late answer is accepted too */
+
+    rn->id = (uint16_t) random();
+
+    rn->query[2] = (u_char) (rn->id >> 8);
+    rn->query[3] = (u_char) (rn->id & 0xff);
+
+    if (ngx_resolver_send_query(rn) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    rn->pending = 1;
+
+    ctx->next = NULL;
+    rn->waiting = ctx;
+    ctx->node = rn;
+
+    ngx_add_timer(&rn->event, ctx->timeout < NGX_RESOLVER_RESEND ?
+                                   ctx->timeout : NGX_RESOLVER_RESEND);
+
+    return NGX_AGAIN;
+}
+
+
+/* the query is not cancelled, its answer is cached for the next lookups */
+
+void ngx_resolve_name_done(ngx_resolver_ctx_t *ctx)
+{
+    ngx_resolver_ctx_t  **pctx;
+
+    if (ctx->node == NULL) {
+        return;
+    }
+
+    for (pctx = &ctx->node->waiting; *pctx; pctx = &(*pctx)->next) {
+        if (*pctx == ctx) {
+            *pctx = ctx->next;
+            break;
+        }
+    }
+
+    ctx->node = NULL;
+}
+
+
+char *ngx_resolver_strerror(ngx_int_t err)
+{
+    static char *errors[] = {
+        "Format error",        /* NGX_RESOLVE_FORMERR */
+        "Server failure",      /* NGX_RESOLVE_SERVFAIL */
+        "Host not found",      /* NGX_RESOLVE_NXDOMAIN */
+        "Unimplemented",       /* NGX_RESOLVE_NOTIMP */
+        "Operation refused"    /* NGX_RESOLVE_REFUSED */
+    };
+
+    if (err > 0 && err < 6) {
+        return errors[err - 1];
+    }
+
+    if (err == NGX_RESOLVE_TIMEDOUT) {
+        return "Operation timed out";
+    }
+
+    return "Unknown error";
+}
+
+
+static ngx_int_t ngx_resolver_create_query(ngx_resolver_node_t *rn)
+{
+    u_char  *p, *s, *last, *label;
+
+    /* the TCP length, the header, the labels, the type and the class */
+
+    rn->query_len = 12 + rn->name.len + 2 + 4;
+
+    if (!(rn->query = ngx_alloc(2 + rn->query_len, rn->resolver->log))) {
+        return NGX_ERROR;
+    }
+
+    p = rn->query;
+
+    *p++ = (u_char) (rn->query_len >> 8);
+    *p++ = (u_char) (rn->query_len & 0xff);
+
+    /* the id is set on sending */
+    *p++ = 0; *p++ = 0;
+
+    /* the recursion desired */
+    *p++ = 0x01; *p++ = 0;
+
+    /* one question */
+    *p++ = 0; *p++ = 1;
+
+    /* no answer, authority and additional records */
+    *p++ = 0; *p++ = 0;
+    *p++ = 0; *p++ = 0;
+    *p++ = 0; *p++ = 0;
+
+    s = rn->name.data;
+    last = s + rn->name.len;
+
+    while (s < last) {
+        label = p++;
+
+        while (s < last && *s != '.') {
+            *p++ = *s++;
+        }
+
+        if (p - label - 1 == 0 || p - label - 1 > 63) {
+            ngx_free(rn->query);
+            rn->query = NULL;
+            return NGX_ERROR;
+        }
+
+        *label = (u_char) (p - label - 1);
+
+        if (s < last) {
+            s++;
+        }
+    }
+
+    *p++ = 0;
+
+    *p++ = 0; *p++ = NGX_RESOLVER_TYPE_A;
+    *p++ = 0; *p++ = NGX_RESOLVER_CLASS_IN;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_resolver_send_query(ngx_resolver_node_t *rn)
+{
+    ssize_t          n;
+    ngx_resolver_t  *r;
+
+    r = rn->resolver;
+
+    n = send(r->udp->fd, rn->query + 2, rn->query_len, 0);
+
+    if (n == -1) {
+
+        /* the query will be resent on the timer */
+
+        ngx_log_error(NGX_LOG_ERR, r->log, ngx_socket_errno,
+                      "send() to resolver %s failed",
+                      r->peers.peers[0].addr_port_text.data);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_resolver_udp_open(ngx_resolver_t *r)
+{
+    ngx_peer_t          *peer;
+    ngx_socket_t         s;
+    ngx_connection_t    *c;
+    struct sockaddr_in   addr;
+
+    s = ngx_socket(AF_INET, SOCK_DGRAM, 0, 0);
+
+    if (s == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->log, ngx_socket_errno,
+                      ngx_socket_n " failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        goto failed;
+    }
+
+    peer = &r->peers.peers[0];
+
+    ngx_memzero(&addr, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = peer->port;
+    addr.sin_addr.s_addr = peer->addr;
+
+    /* the connected socket does not accept the datagrams from other hosts */
+
+    if (connect(s, (struct sockaddr *) &addr, sizeof(struct sockaddr_in))
+                                                                       == -1)
+    {
+        ngx_log_error(NGX_LOG_CRIT, r->log, ngx_socket_errno,
+                      "connect() to resolver %s failed",
+                      peer->addr_port_text.data);
+        goto failed;
+    }
+
+    if (!(c = ngx_get_connection(s, r->log))) {
+        goto failed;
+    }
+
+    if (!(c->pool = ngx_create_pool(NGX_RESOLVER_POOL_SIZE, r->log))) {
+        ngx_free_connection(c);
+        goto failed;
+    }
+
+    c->data = r;
+    c->read->event_handler = ngx_resolver_udp_read;
+
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_connection(c);
+            return NGX_ERROR;
+        }
+
+    } else {
+        if (ngx_add_event(c->read, NGX_READ_EVENT, 0) == NGX_ERROR) {
+            ngx_close_connection(c);
+            return NGX_ERROR;
+        }
+    }
+
+    /* the query ids should not be predictable */
+
+    srandom((unsigned) (ngx_pid ^ ngx_time()));
+
+    r->udp = c;
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+
+    return NGX_ERROR;
+}
+
+
+static void ngx_resolver_udp_read(ngx_event_t *rev)
+{
+    ssize_t            n;
+    ngx_err_t          err;
+    ngx_resolver_t    *r;
+    ngx_connection_t  *c;
+    u_char             buf[NGX_RESOLVER_UDP_SIZE];
+
+    c = rev->data;
+    r = c->data;
+
+    for ( ;; ) {
+        n = recv(c->fd, buf, NGX_RESOLVER_UDP_SIZE, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ERR, r->log, err,
+                              "recv() from resolver %s failed",
+                              r->peers.peers[0].addr_port_text.data);
+            }
+
+            return;
+        }
+
+        ngx_resolver_process_response(r, buf, n, NULL);
+    }
+}
+
+
+static ngx_int_t ngx_resolver_tcp_connect(ngx_resolver_node_t *rn)
+{
+    ngx_int_t          rc;
+    ngx_pool_t        *pool;
+    ngx_resolver_t    *r;
+    ngx_connection_t  *c;
+
+    r = rn->resolver;
+
+    if (!(rn->tcp_buf = ngx_alloc(NGX_RESOLVER_TCP_SIZE, r->log))) {
+        return NGX_ERROR;
+    }
+
+    rn->tcp_sent = 0;
+    rn->tcp_recv = 0;
+
+    rn->id = (uint16_t) random();
+
+    rn->query[2] = (u_char) (rn->id >> 8);
+    rn->query[3] = (u_char) (rn->id & 0xff);
+
+    ngx_memzero(&rn->tcp, sizeof(ngx_peer_connection_t));
+
+    rn->tcp.peers = &r->peers;
+    rn->tcp.tries = 1;
+    rn->tcp.log = r->log;
+    rn->tcp.log_error = NGX_ERROR_ERR;
+
+    if (!(pool = ngx_create_pool(NGX_RESOLVER_POOL_SIZE, r->log))) {
+        ngx_resolver_tcp_close(rn);
+        return NGX_ERROR;
+    }
+
+    rc = ngx_event_connect_peer(&rn->tcp);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                   "resolver tcp connect: %d", rc);
+
+    if (rc == NGX_CONNECT_ERROR) {
+        rn->tcp.connection = NULL;
+    }
+
+    c = rn->tcp.connection;
+
+    if (c == NULL) {
+        ngx_destroy_pool(pool);
+        ngx_resolver_tcp_close(rn);
+        return NGX_ERROR;
+    }
+
+    c->pool = pool;
+    c->data = rn;
+    c->read->event_handler = ngx_resolver_tcp_read;
+    c->write->event_handler = ngx_resolver_tcp_write;
+
+    if (rc == NGX_ERROR) {
+        ngx_resolver_tcp_close(rn);
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        ngx_resolver_tcp_write(c->write);
+    }
+
+    return NGX_OK;
+}
+
+
+static void ngx_resolver_tcp_write(ngx_event_t *wev)
+{
+    ssize_t               n;
+    ngx_err_t             err;
+    ngx_connection_t     *c;
+    ngx_resolver_node_t  *rn;
+
+    c = wev->data;
+    rn = c->data;
+
+    while (rn->tcp_sent < 2 + rn->query_len) {
+        n = send(c->fd, rn->query + rn->tcp_sent,
+                 2 + rn->query_len - rn->tcp_sent, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                if (ngx_handle_write_event(wev, 0) == NGX_ERROR) {
+                    ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+                }
+
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, rn->resolver->log, err,
+                          "send() to resolver %s failed",
+                          rn->resolver->peers.peers[0].addr_port_text.data);
+
+            ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+            return;
+        }
+
+        rn->tcp_sent += n;
+    }
+
+    if (ngx_handle_level_write_event(wev) == NGX_ERROR) {
+        ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+    }
+}
+
+
+static void ngx_resolver_tcp_read(ngx_event_t *rev)
+{
+    size_t                size;
+    ssize_t               n;
+    ngx_err_t             err;
+    ngx_connection_t     *c;
+    ngx_resolver_node_t  *rn;
+
+    c = rev->data;
+    rn = c->data;
+
+    for ( ;; ) {
+        if (rn->tcp_recv < 2) {
+            size = 2 - rn->tcp_recv;
+
+        } else {
+            size = 2 + (rn->tcp_buf[0] << 8 | rn->tcp_buf[1]) - rn->tcp_recv;
+        }
+
+        n = recv(c->fd, rn->tcp_buf + rn->tcp_recv, size, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, rn->resolver->log, err,
+                          "recv() from resolver %s failed",
+                          rn->resolver->peers.peers[0].addr_port_text.data);
+
+            ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+            return;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ERR, rn->resolver->log, 0,
+                          "resolver %s prematurely closed connection",
+                          rn->resolver->peers.peers[0].addr_port_text.data);
+
+            ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+            return;
+        }
+
+        rn->tcp_recv += n;
+
+        if (rn->tcp_recv > 2
+            && rn->tcp_recv == 2 + (size_t) (rn->tcp_buf[0] << 8
+                                             | rn->tcp_buf[1]))
+        {
+            ngx_resolver_process_response(rn->resolver, rn->tcp_buf + 2,
+                                          rn->tcp_recv - 2, rn);
+
+            /* the ignored answer: there will not be another one */
+
+            if (rn->pending && rn->tcp_mode) {
+                ngx_resolver_done(rn, NGX_RESOLVE_FORMERR);
+            }
+
+            return;
+        }
+    }
+}
+
+
+static void ngx_resolver_tcp_close(ngx_resolver_node_t *rn)
+{
+    if (rn->tcp.connection) {
+        ngx_close_connection(rn->tcp.connection);
+        rn->tcp.connection = NULL;
+    }
+
+    if (rn->tcp_buf) {
+        ngx_free(rn->tcp_buf);
+        rn->tcp_buf = NULL;
+    }
+}
+
+
+static void ngx_resolver_timeout_handler(ngx_event_t *ev)
+{
+    ngx_resolver_node_t  *rn;
+
+    rn = (ngx_resolver_node_t *)
+                         ((u_char *) ev - offsetof(ngx_resolver_node_t, event));
+
+    if (--rn->tries) {
+
+        if (!rn->tcp_mode) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "resolve \"%s\": resend", rn->name.data);
+
+            (void) ngx_resolver_send_query(rn);
+        }
+
+        ngx_add_timer(ev, NGX_RESOLVER_RESEND);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, ev->log, NGX_ETIMEDOUT,
+                  "resolver %s timed out resolving \"%s\"",
+                  rn->resolver->peers.peers[0].addr_port_text.data,
+                  rn->name.data);
+
+    ngx_resolver_done(rn, NGX_RESOLVE_TIMEDOUT);
+}
+
+
+static void ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf,
+                                          size_t n, ngx_resolver_node_t *tcp)
+{
+    char                 *err;
+    size_t                i, len;
+    u_char               *s, *last, ch;
+    uint32_t              ttl, min_ttl;
+    ngx_uint_t            id, flags, code, nqs, nan, type, class, naddrs;
+    ngx_resolver_node_t  *rn;
+
+    if (n < 12) {
+        ngx_log_error(NGX_LOG_ERR, r->log, 0,
+                      "short resolver %s response",
+                      r->peers.peers[0].addr_port_text.data);
+        return;
+    }
+
+    id = buf[0] << 8 | buf[1];
+    flags = buf[2] << 8 | buf[3];
+    nqs = buf[4] << 8 | buf[5];
+    nan = buf[6] << 8 | buf[7];
+    code = flags & 0x0f;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                   "resolver response id:%d flags:%04X nqs:%d nan:%d",
+                   id, flags, nqs, nan);
+
+    if (tcp) {
+        rn = (tcp->id == id) ? tcp : NULL;
+
+    } else {
+        for (rn = r->nodes; rn; rn = rn->next) {
+            if (rn->pending && !rn->tcp_mode && rn->id == id) {
+                break;
+            }
+        }
+    }
+
+    if (rn == NULL || !(flags & 0x8000)) {
+        ngx_log_error(NGX_LOG_ERR, r->log, 0,
+                      "unexpected resolver %s response id:%d",
+                      r->peers.peers[0].addr_port_text.data, id);
+        return;
+    }
+
+    if (nqs != 1) {
+        err = "invalid number of questions in";
+        goto invalid;
+    }
+
+    /* the question must match the query: the spoofed answers are ignored */
+
+    i = 12;
+    s = rn->name.data;
+    last = s + rn->name.len;
+
+    for ( ;; ) {
+        if (i >= n) {
+            goto short_response;
+        }
+
+        len = buf[i++];
+
+        if (len == 0) {
+            break;
+        }
+
+        if (len > 63) {
+            err = "invalid name in";
+            goto invalid;
+        }
+
+        if (i + len > n) {
+            goto short_response;
+        }
+
+        if (s != rn->name.data) {
+            if (s == last || *s++ != '.') {
+                goto mismatch;
+            }
+        }
+
+        if ((size_t) (last - s) < len) {
+            goto mismatch;
+        }
+
+        while (len--) {
+            ch = buf[i++];
+
+            if (ch >= 'A' && ch <= 'Z') {
+                ch |= 0x20;
+            }
+
+            if (ch != *s++) {
+                goto mismatch;
+            }
+        }
+    }
+
+    if (s != last) {
+        goto mismatch;
+    }
+
+    if (i + 4 > n) {
+        goto short_response;
+    }
+
+    if ((buf[i] << 8 | buf[i + 1]) != NGX_RESOLVER_TYPE_A
+        || (buf[i + 2] << 8 | buf[i + 3]) != NGX_RESOLVER_CLASS_IN)
+    {
+        goto mismatch;
+    }
+
+    i += 4;
+
+    if ((flags & 0x0200) && tcp == NULL) {
+
+        /* the truncated response, repeat the query over TCP */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                       "resolve \"%s\": truncated, using tcp", rn->name.data);
+
+        rn->tcp_mode = 1;
+
+        if (ngx_resolver_tcp_connect(rn) == NGX_ERROR) {
+            ngx_resolver_done(rn, NGX_RESOLVE_SERVFAIL);
+        }
+
+        return;
+    }
+
+    if (code) {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                       "resolve \"%s\": rcode %d", rn->name.data, code);
+
+        ngx_resolver_done(rn, (ngx_int_t) code);
+        return;
+    }
+
+    /*
+     * only the A records are collected, the CNAME records are skipped
+     * because the recursive servers return the A records of the aliases
+     */
+
+    naddrs = 0;
+    min_ttl = 0x7fffffff;
+
+    while (nan--) {
+
+        /* skip the name */
+
+        for ( ;; ) {
+            if (i >= n) {
+                goto short_response;
+            }
+
+            len = buf[i];
+
+            if ((len & 0xc0) == 0xc0) {
+                i += 2;
+                break;
+            }
+
+            if (len & 0xc0) {
+                err = "invalid name in";
+                goto invalid;
+            }
+
+            i += 1 + len;
+
+            if (len == 0) {
+                break;
+            }
+        }
+
+        if (i + 10 > n) {
+            goto short_response;
+        }
+
+        type = buf[i] << 8 | buf[i + 1];
+        class = buf[i + 2] << 8 | buf[i + 3];
+        ttl = (uint32_t) buf[i + 4] << 24 | buf[i + 5] << 16
+              | buf[i + 6] << 8 | buf[i + 7];
+        len = buf[i + 8] << 8 | buf[i + 9];
+
+        i += 10;
+
+        if (i + len > n) {
+            goto short_response;
+        }
+
+        if (type == NGX_RESOLVER_TYPE_A
+            && class == NGX_RESOLVER_CLASS_IN
+            && len == 4
+            && naddrs < NGX_RESOLVER_MAX_ADDRS)
+        {
+            ngx_memcpy(&rn->addrs[naddrs++], &buf[i], sizeof(in_addr_t));
+
+            /* RFC 2181: the TTL with the most significant bit set is 0 */
+
+            if (ttl & 0x80000000) {
+                ttl = 0;
+            }
+
+            if (ttl < min_ttl) {
+                min_ttl = ttl;
+            }
+        }
+
+        i += len;
+    }
+
+    if (naddrs == 0) {
+        ngx_resolver_done(rn, NGX_RESOLVE_NXDOMAIN);
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, r->log, 0,
+                   "resolve \"%s\": %d addresses, ttl:%d",
+                   rn->name.data, naddrs, min_ttl);
+
+    rn->naddrs = naddrs;
+    rn->valid = ngx_time() + min_ttl;
+
+    ngx_resolver_done(rn, NGX_OK);
+
+    return;
+
+short_response:
+
+    err = "short";
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, r->log, 0,
+                  "%s resolver %s response for \"%s\"",
+                  err, r->peers.peers[0].addr_port_text.data, rn->name.data);
+
+    ngx_resolver_done(rn, NGX_RESOLVE_FORMERR);
+
+    return;
+
+mismatch:
+
+    ngx_log_error(NGX_LOG_ERR, r->log, 0,
+                  "resolver %s response does not match query for \"%s\"",
+                  r->peers.peers[0].addr_port_text.data, rn->name.data);
+
+    return;
+}
+
+
+static void ngx_resolver_done(ngx_resolver_node_t *rn, ngx_int_t state)
+{
+    ngx_resolver_ctx_t  *ctx, *next;
+
+    rn->pending = 0;
+
+    if (rn->event.timer_set) {
+        ngx_del_timer(&rn->event);
+    }
+
+    ngx_resolver_tcp_close(rn);
+
+    if (state != NGX_OK) {
+        rn->naddrs = 0;
+        rn->valid = 0;
+    }
+
+    /* the handlers may start the new queries */
+
+    ctx = rn->waiting;
+    rn->waiting = NULL;
+
+    while (ctx) {
+        next = ctx->next;
+
+        ctx->node = NULL;
+        ctx->state = state;
+        ctx->naddrs = rn->naddrs;
+        ngx_memcpy(ctx->addrs, rn->addrs, rn->naddrs * sizeof(in_addr_t));
+        ctx->valid = rn->valid;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    }
+}
+
+
+static void ngx_resolver_cleanup(void *data)
+{
+    ngx_resolver_t  *r = data;
+
+    ngx_resolver_node_t  *rn, *next;
+
+    for (rn = r->nodes; rn; rn = next) {
+        next = rn->next;
+
+        if (rn->event.timer_set) {
+            ngx_del_timer(&rn->event);
+        }
+
+        ngx_resolver_tcp_close(rn);
+
+        if (rn->query) {
+            ngx_free(rn->query);
+        }
+
+        ngx_free(rn);
+    }
+
+    r->nodes = NULL;
+
+    if (r->udp) {
+        ngx_close_connection(r->udp);
+        r->udp = NULL;
+    }
+}
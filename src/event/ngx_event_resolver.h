@@ -0,0 +1,104 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#ifndef _NGX_EVENT_RESOLVER_H_INCLUDED_
+#define _NGX_EVENT_RESOLVER_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_connect.h>
+
+
+#define NGX_RESOLVER_MAX_ADDRS      16
+
+/* the query is resent over UDP every second until the timeout expires */
+#define NGX_RESOLVER_RESEND         1000
+
+
+/* the DNS RCODEs, the timeout is reported as NGX_RESOLVE_TIMEDOUT */
+
+#define NGX_RESOLVE_FORMERR         1
+#define NGX_RESOLVE_SERVFAIL        2
+#define NGX_RESOLVE_NXDOMAIN        3
+#define NGX_RESOLVE_NOTIMP          4
+#define NGX_RESOLVE_REFUSED         5
+#define NGX_RESOLVE_TIMEDOUT        NGX_ETIMEDOUT
+
+
+typedef struct ngx_resolver_s       ngx_resolver_t;
+typedef struct ngx_resolver_node_s  ngx_resolver_node_t;
+typedef struct ngx_resolver_ctx_s   ngx_resolver_ctx_t;
+
+typedef void (*ngx_resolver_handler_pt)(ngx_resolver_ctx_t *ctx);
+
+
+struct ngx_resolver_s {
+    ngx_connection_t         *udp;          /* opened in a worker on demand */
+
+    ngx_peers_t               peers;        /* the server for TCP queries */
+    ngx_resolver_node_t      *nodes;        /* the cached and pending names */
+
+    ngx_log_t                *log;
+};
+
+
+struct ngx_resolver_node_s {
+    ngx_resolver_node_t      *next;
+    ngx_resolver_t           *resolver;
+
+    ngx_str_t                 name;         /* in lower case */
+
+    ngx_uint_t                naddrs;
+    in_addr_t                 addrs[NGX_RESOLVER_MAX_ADDRS];
+    time_t                    valid;        /* the answer TTL expiration */
+
+    /* the pending query: the 2-byte TCP length prefix and the DNS message */
+    u_char                   *query;
+    size_t                    query_len;
+    uint16_t                  id;
+    ngx_uint_t                tries;
+
+    ngx_event_t               event;        /* the resend and timeout timer */
+
+    ngx_peer_connection_t     tcp;
+    u_char                   *tcp_buf;
+    size_t                    tcp_sent;
+    size_t                    tcp_recv;
+
+    ngx_resolver_ctx_t       *waiting;
+
+    unsigned                  pending:1;
+    unsigned                  tcp_mode:1;
+};
+
+
+struct ngx_resolver_ctx_s {
+    ngx_resolver_ctx_t       *next;
+    ngx_resolver_t           *resolver;
+    ngx_resolver_node_t      *node;
+
+    ngx_str_t                 name;
+    ngx_msec_t                timeout;
+
+    ngx_int_t                 state;
+    ngx_uint_t                naddrs;
+    in_addr_t                 addrs[NGX_RESOLVER_MAX_ADDRS];
+    time_t                    valid;
+
+    ngx_resolver_handler_pt   handler;
+    void                     *data;
+};
+
+
+ngx_resolver_t *ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *server);
+ngx_int_t ngx_resolve_name(ngx_resolver_ctx_t *ctx);
+void ngx_resolve_name_done(ngx_resolver_ctx_t *ctx);
+char *ngx_resolver_strerror(ngx_int_t err);
+
+
+#endif /* _NGX_EVENT_RESOLVER_H_INCLUDED_ */
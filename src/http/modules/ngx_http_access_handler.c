@@ -19,13 +19,18 @@ typedef struct {
 
 
 typedef struct {
-    ngx_array_t  *rules;     /* array of ngx_http_access_rule_t */
+    ngx_array_t       *rules;     /* array of ngx_http_access_rule_t */
+
+    /* the rules compiled by ngx_http_access_compile() */
+    ngx_radix_tree_t  *tree;
 } ngx_http_access_loc_conf_t;
 
 
 static ngx_int_t ngx_http_access_handler(ngx_http_request_t *r);
 static char *ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd,
                                   void *conf);
+static ngx_int_t ngx_http_access_compile(ngx_conf_t *cf,
+                                          ngx_http_access_loc_conf_t *alcf);
 static void *ngx_http_access_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_access_merge_loc_conf(ngx_conf_t *cf,
                                             void *parent, void *child);
@@ -79,9 +84,8 @@ ngx_module_t  ngx_http_access_module = {
 
 static ngx_int_t ngx_http_access_handler(ngx_http_request_t *r)
 {
-    ngx_uint_t                   i;
+    uintptr_t                    deny;
     struct sockaddr_in          *addr_in;
-    ngx_http_access_rule_t      *rule;
     ngx_http_access_loc_conf_t  *alcf;
 
     alcf = ngx_http_get_module_loc_conf(r, ngx_http_access_module);
@@ -94,28 +98,19 @@ static ngx_int_t ngx_http_access_handler(ngx_http_request_t *r)
     // 获取连接中的ip
     addr_in = (struct sockaddr_in *) r->connection->sockaddr;
 
-    rule = alcf->rules->elts;
-    for (i = 0; i < alcf->rules->nelts; i++) {
+    /* the longest prefix in the tree is the first matching rule */
 
-ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "%08X %08X %08X",
-               addr_in->sin_addr.s_addr, rule[i].mask, rule[i].addr);
-        /*
-            分为以下几种格式
-            1 all => ip：0 mask：0
-            2 合法ip值，则掩码是32位的1 => ip:ip mask:32个1，等于这个ip的会命中规则
-            3 cidr，解析出网络地址和网络掩码。 ip:配置的ip mask:配置的mask，在这个网络的都会命中规则
-        */
-        if ((addr_in->sin_addr.s_addr & rule[i].mask) == rule[i].addr) {
-            // 命中并且是deny的时候，返回403
-            if (rule[i].deny) {
-                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                              "access forbidden by rule");
-
-                return NGX_HTTP_FORBIDDEN;
-            }
+    deny = ngx_radix32tree_find(alcf->tree, ntohl(addr_in->sin_addr.s_addr));
 
-            return NGX_OK;
-        }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %08X %d", addr_in->sin_addr.s_addr, (int) deny);
+
+    // 命中并且是deny的时候，返回403
+    if (deny != NGX_RADIX_NO_VALUE && deny) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "access forbidden by rule");
+
+        return NGX_HTTP_FORBIDDEN;
     }
 
     return NGX_OK;
@@ -200,13 +195,87 @@ static char *ngx_http_access_merge_loc_conf(ngx_conf_t *cf,
     ngx_http_access_loc_conf_t  *conf = child;
     // 如果location里的配置为空，则取父级的配置
     if (conf->rules == NULL) {
+
+        /* the rules of the "http" level are never merged as a child */
+
+        if (prev->rules && prev->tree == NULL) {
+            if (ngx_http_access_compile(cf, prev) == NGX_ERROR) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         conf->rules = prev->rules;
+        conf->tree = prev->tree;
+
+        return NGX_CONF_OK;
+    }
+
+    if (conf->tree == NULL) {
+        if (ngx_http_access_compile(cf, conf) == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
 }
 
 
+/*
+ * the lookup in the radix tree finds the longest prefix, so the rule
+ * is not added if an earlier rule already matches all its addresses:
+ * the earlier longer prefixes are found first anyway, and the rules are
+ * checked in the order of the configuration as before
+ */
+
+static ngx_int_t ngx_http_access_compile(ngx_conf_t *cf,
+                                          ngx_http_access_loc_conf_t *alcf)
+{
+    uint32_t                 addr, mask;
+    ngx_uint_t               i, n;
+    ngx_http_access_rule_t  *rule;
+
+    if (!(alcf->tree = ngx_radix_tree_create(cf->pool))) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    rule = alcf->rules->elts;
+
+    for (i = 0; i < alcf->rules->nelts; i++) {
+
+        /* the rule with the address bits out of the mask never matches */
+
+        if ((rule[i].addr & rule[i].mask) != rule[i].addr) {
+            continue;
+        }
+
+        addr = ntohl(rule[i].addr);
+        mask = ntohl(rule[i].mask);
+
+        if (ngx_radix32tree_find_prefix(alcf->tree, addr, mask)
+                                                         != NGX_RADIX_NO_VALUE)
+        {
+            continue;
+        }
+
+        if (ngx_radix32tree_insert(alcf->tree, addr, mask, rule[i].deny)
+                                                                 == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+
+        n++;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "access rules: %" NGX_UINT_T_FMT " of %" NGX_UINT_T_FMT
+                   ", radix nodes: %" NGX_UINT_T_FMT,
+                   n, alcf->rules->nelts, alcf->tree->nodes);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t ngx_http_access_init(ngx_cycle_t *cycle)
 {
     ngx_http_handler_pt        *h;
@@ -9,21 +9,43 @@
 #include <ngx_http.h>
 
 
-typedef struct {
-    char       **tables;
-    ngx_str_t    name;
-    unsigned     server;
-} ngx_http_charset_t;
+#define NGX_HTTP_CHARSET_BYTE        0
+#define NGX_HTTP_CHARSET_TO_UTF8     1
+#define NGX_HTTP_CHARSET_FROM_UTF8   2
+
+/* the length byte and up to 3 bytes of a UTF-8 sequence */
+#define NGX_HTTP_CHARSET_UTF_LEN     4
+
+#define NGX_HTTP_CHARSET_INVALID     0xffffffff
+#define NGX_HTTP_CHARSET_INCOMPLETE  0xfffffffe
+
+#define NGX_HTTP_CHARSET_HIGH_BITS   ((uintptr_t) -1 / 0xff * 0x80)
 
 
+/*
+ * the tables of a single byte charset are two 256 byte tables,
+ * the tables of a map to UTF-8 are the 256 sequences of
+ * NGX_HTTP_CHARSET_UTF_LEN bytes and the 256 pointers to the lazily
+ * allocated 256 byte pages of the Unicode Basic Multilingual Plane
+ */
+
 typedef struct {
-    ngx_int_t   src;
-    ngx_int_t   dst;
-    char       *src2dst;
-    char       *dst2src;
+    ngx_int_t     src;
+    ngx_int_t     dst;
+    void         *src2dst;
+    void         *dst2src;
+    unsigned      ascii:1;               /* the ASCII bytes are not recoded */
 } ngx_http_charset_tables_t;
 
 
+typedef struct {
+    ngx_http_charset_tables_t  **tables;
+    ngx_str_t                    name;
+    unsigned                     server:1;
+    unsigned                     utf8:1;
+} ngx_http_charset_t;
+
+
 typedef struct {
     ngx_array_t  charsets;               /* ngx_http_charset_t */
     ngx_array_t  tables;                 /* ngx_http_charset_tables_t */
@@ -40,12 +62,34 @@ typedef struct {
 
 
 typedef struct {
-    ngx_int_t   server;
-    ngx_int_t   client;
+    ngx_uint_t    mode;
+    void         *table;
+    unsigned      ascii:1;
+
+    /* the start of a UTF-8 sequence that is split between the bufs */
+    u_char        saved[NGX_HTTP_CHARSET_UTF_LEN];
+    size_t        saved_len;
+
+    ngx_chain_t  *free;
+    ngx_chain_t  *busy;
 } ngx_http_charset_ctx_t;
 
 
-static void ngx_charset_recode(ngx_buf_t *b, char *table);
+static ngx_buf_t *ngx_charset_recode(ngx_http_request_t *r,
+                                     ngx_http_charset_ctx_t *ctx,
+                                     ngx_buf_t *b);
+static ngx_buf_t *ngx_charset_recode_to_utf8(ngx_http_request_t *r,
+                                             ngx_http_charset_ctx_t *ctx,
+                                             ngx_buf_t *b);
+static ngx_buf_t *ngx_charset_recode_from_utf8(ngx_http_request_t *r,
+                                               ngx_http_charset_ctx_t *ctx,
+                                               ngx_buf_t *b);
+static ngx_buf_t *ngx_http_charset_get_buf(ngx_http_request_t *r,
+                                           ngx_http_charset_ctx_t *ctx,
+                                           ngx_buf_t *b, size_t size);
+static u_char *ngx_charset_skip_ascii(u_char *p, u_char *last);
+static uint32_t ngx_charset_utf8_decode(u_char **p, size_t n);
+static u_char ngx_charset_utf8_byte(u_char **pages, uint32_t u);
 
 static char *ngx_charset_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
                                    void *conf);
@@ -136,6 +180,7 @@ static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 static ngx_int_t ngx_http_charset_header_filter(ngx_http_request_t *r)
 {
     ngx_http_charset_t            *charsets;
+    ngx_http_charset_tables_t     *tables;
     ngx_http_charset_ctx_t        *ctx;
     ngx_http_charset_loc_conf_t   *lcf;
     ngx_http_charset_main_conf_t  *mcf;
@@ -196,6 +241,35 @@ static ngx_int_t ngx_http_charset_header_filter(ngx_http_request_t *r)
     ngx_http_create_ctx(r, ctx, ngx_http_charset_filter_module,
                         sizeof(ngx_http_charset_ctx_t), NGX_ERROR);
 
+    tables = charsets[lcf->source_charset].tables[lcf->default_charset];
+
+    ctx->ascii = tables->ascii;
+
+    if (charsets[lcf->source_charset].utf8) {
+        ctx->mode = NGX_HTTP_CHARSET_FROM_UTF8;
+        ctx->table = tables->dst2src;
+
+    } else if (charsets[lcf->default_charset].utf8) {
+        ctx->mode = NGX_HTTP_CHARSET_TO_UTF8;
+        ctx->table = tables->src2dst;
+
+    } else {
+        ctx->mode = NGX_HTTP_CHARSET_BYTE;
+        ctx->table = (tables->src == lcf->source_charset) ? tables->src2dst:
+                                                            tables->dst2src;
+    }
+
+    if (ctx->mode != NGX_HTTP_CHARSET_BYTE) {
+
+        /* the length of the recoded body is not known */
+
+        r->headers_out.content_length_n = -1;
+        if (r->headers_out.content_length) {
+            r->headers_out.content_length->key.len = 0;
+            r->headers_out.content_length = NULL;
+        }
+    }
+
     r->filter_need_in_memory = 1;
 
     return ngx_http_next_header_filter(r);
@@ -205,12 +279,10 @@ static ngx_int_t ngx_http_charset_header_filter(ngx_http_request_t *r)
 static ngx_int_t ngx_http_charset_body_filter(ngx_http_request_t *r,
                                               ngx_chain_t *in)
 {
-    char                          *table;
-    ngx_chain_t                   *cl;
-    ngx_http_charset_t            *charsets;
-    ngx_http_charset_ctx_t        *ctx;
-    ngx_http_charset_loc_conf_t   *lcf;
-    ngx_http_charset_main_conf_t  *mcf;
+    ngx_int_t                rc;
+    ngx_buf_t               *b;
+    ngx_chain_t             *cl, *tl, *out, **ll;
+    ngx_http_charset_ctx_t  *ctx;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_charset_filter_module);
 
@@ -218,28 +290,449 @@ static ngx_int_t ngx_http_charset_body_filter(ngx_http_request_t *r,
         return ngx_http_next_body_filter(r, in);
     }
 
-    mcf = ngx_http_get_module_main_conf(r, ngx_http_charset_filter_module);
-    lcf = ngx_http_get_module_loc_conf(r, ngx_http_charset_filter_module);
+    /*
+     * the bufs are passed in the new links because the recoded copies
+     * replace the bufs that are not changed in place
+     */
 
-    charsets = mcf->charsets.elts;
-    table = charsets[lcf->source_charset].tables[lcf->default_charset];
+    out = NULL;
+    ll = &out;
 
     for (cl = in; cl; cl = cl->next) {
-        ngx_charset_recode(cl->buf, table);
+
+        switch (ctx->mode) {
+
+        case NGX_HTTP_CHARSET_TO_UTF8:
+            b = ngx_charset_recode_to_utf8(r, ctx, cl->buf);
+            break;
+
+        case NGX_HTTP_CHARSET_FROM_UTF8:
+            b = ngx_charset_recode_from_utf8(r, ctx, cl->buf);
+            break;
+
+        default: /* NGX_HTTP_CHARSET_BYTE */
+            b = ngx_charset_recode(r, ctx, cl->buf);
+            break;
+        }
+
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (b != cl->buf) {
+
+            /* the copied buf is sent for its owner */
+
+            if (ngx_buf_in_memory(cl->buf)) {
+                cl->buf->pos = cl->buf->last;
+            }
+
+            if (cl->buf->in_file) {
+                cl->buf->file_pos = cl->buf->file_last;
+            }
+        }
+
+        ngx_alloc_link_and_set_buf(tl, b, r->pool, NGX_ERROR);
+        *ll = tl;
+        ll = &tl->next;
+    }
+
+    rc = ngx_http_next_body_filter(r, out);
+
+    ngx_chain_update_chains(&ctx->free, &ctx->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_charset_filter_module);
+
+    return rc;
+}
+
+
+/*
+ * the recoders skip the ASCII runs if the table does not change
+ * the ASCII bytes, and return the buf itself if it is recoded in place or
+ * has nothing to recode, or a copy if the buf is read only or grows
+ */
+
+static ngx_buf_t *ngx_charset_recode(ngx_http_request_t *r,
+                                     ngx_http_charset_ctx_t *ctx,
+                                     ngx_buf_t *b)
+{
+    u_char     *p, *q, *last, *dst, *table;
+    ngx_buf_t  *nb;
+
+    if (!ngx_buf_in_memory(b)) {
+        return b;
+    }
+
+    table = ctx->table;
+    p = b->pos;
+    last = b->last;
+
+    if (ctx->ascii) {
+        p = ngx_charset_skip_ascii(p, last);
+
+        if (p == last) {
+            return b;
+        }
+    }
+
+    if (b->temporary) {
+        nb = b;
+        dst = p;
+
+    } else {
+        if (!(nb = ngx_http_charset_get_buf(r, ctx, b, last - b->pos))) {
+            return NULL;
+        }
+
+        dst = ngx_cpymem(nb->pos, b->pos, (p - b->pos));
+    }
+
+    while (p < last) {
+        *dst++ = table[*p++];
+
+        if (ctx->ascii) {
+            q = ngx_charset_skip_ascii(p, last);
+
+            if (dst != p) {
+                ngx_memcpy(dst, p, q - p);
+            }
+
+            dst += q - p;
+            p = q;
+        }
     }
 
-    return ngx_http_next_body_filter(r, in);
+    nb->last = dst;
+
+    return nb;
 }
 
 
-static void ngx_charset_recode(ngx_buf_t *b, char *table)
+static ngx_buf_t *ngx_charset_recode_to_utf8(ngx_http_request_t *r,
+                                             ngx_http_charset_ctx_t *ctx,
+                                             ngx_buf_t *b)
 {
-    u_char  *p, c;
+    u_char     *p, *q, *last, *dst, *table, *utf;
+    size_t      size;
+    ngx_buf_t  *nb;
+
+    if (!ngx_buf_in_memory(b)) {
+        return b;
+    }
+
+    table = ctx->table;
+    last = b->last;
+
+    p = ctx->ascii ? ngx_charset_skip_ascii(b->pos, last): b->pos;
 
-    for (p = b->pos; p < b->last; p++) {
-        c = *p;
-        *p = table[c];
+    if (p == last) {
+        return b;
     }
+
+    size = last - b->pos;
+
+    for (q = p; q < last; q++) {
+        if (ctx->ascii) {
+            q = ngx_charset_skip_ascii(q, last);
+
+            if (q == last) {
+                break;
+            }
+        }
+
+        size += table[*q * NGX_HTTP_CHARSET_UTF_LEN] - 1;
+    }
+
+    if (b->temporary && size == (size_t) (last - b->pos)) {
+
+        /* all bytes are recoded to the single byte sequences */
+
+        nb = b;
+        dst = p;
+
+    } else {
+        if (!(nb = ngx_http_charset_get_buf(r, ctx, b, size))) {
+            return NULL;
+        }
+
+        dst = ngx_cpymem(nb->pos, b->pos, (p - b->pos));
+    }
+
+    while (p < last) {
+        utf = &table[*p++ * NGX_HTTP_CHARSET_UTF_LEN];
+        dst = ngx_cpymem(dst, utf + 1, utf[0]);
+
+        if (ctx->ascii) {
+            q = ngx_charset_skip_ascii(p, last);
+
+            if (dst != p) {
+                ngx_memcpy(dst, p, q - p);
+            }
+
+            dst += q - p;
+            p = q;
+        }
+    }
+
+    nb->last = dst;
+
+    return nb;
+}
+
+
+/*
+ * the start of a sequence at the end of a buf is saved and is completed
+ * by the next buf.  The output is never longer than the input, so
+ * the temporary bufs are recoded in place, but if the saved bytes turn
+ * out to be an invalid sequence, the '?' is output for them before
+ * the whole next buf, so such a buf is recoded to a copy one byte longer
+ */
+
+static ngx_buf_t *ngx_charset_recode_from_utf8(ngx_http_request_t *r,
+                                               ngx_http_charset_ctx_t *ctx,
+                                               ngx_buf_t *b)
+{
+    u_char     *p, *q, *last, *dst, **table;
+    size_t      size;
+    uint32_t    u;
+    ngx_buf_t  *nb;
+
+    table = ctx->table;
+
+    if (ngx_buf_in_memory(b)) {
+        p = b->pos;
+        last = b->last;
+
+    } else {
+        p = NULL;
+        last = NULL;
+    }
+
+    if (p == last && !(b->last_buf && ctx->saved_len)) {
+        return b;
+    }
+
+    if (ctx->saved_len == 0
+        && ctx->ascii
+        && ngx_charset_skip_ascii(p, last) == last)
+    {
+        return b;
+    }
+
+    size = (last - p) + (ctx->saved_len ? 1 : 0);
+
+    if (b->temporary && ctx->saved_len == 0) {
+        nb = b;
+
+    } else {
+        if (!(nb = ngx_http_charset_get_buf(r, ctx, b, size))) {
+            return NULL;
+        }
+    }
+
+    dst = nb->pos;
+
+    if (ctx->saved_len) {
+        while (p < last) {
+            ctx->saved[ctx->saved_len++] = *p++;
+
+            q = ctx->saved;
+            u = ngx_charset_utf8_decode(&q, ctx->saved_len);
+
+            if (u != NGX_HTTP_CHARSET_INCOMPLETE) {
+
+                /* the bytes after an invalid sequence are decoded again */
+
+                p -= ctx->saved_len - (q - ctx->saved);
+                ctx->saved_len = 0;
+
+                *dst++ = ngx_charset_utf8_byte(table, u);
+                break;
+            }
+        }
+    }
+
+    while (p < last) {
+        if (ctx->ascii) {
+            q = ngx_charset_skip_ascii(p, last);
+
+            if (dst != p) {
+                ngx_memmove(dst, p, q - p);
+            }
+
+            dst += q - p;
+            p = q;
+
+            if (p == last) {
+                break;
+            }
+        }
+
+        q = p;
+        u = ngx_charset_utf8_decode(&q, last - p);
+
+        if (u == NGX_HTTP_CHARSET_INCOMPLETE) {
+            ctx->saved_len = last - p;
+            ngx_memcpy(ctx->saved, p, ctx->saved_len);
+            break;
+        }
+
+        p = q;
+        *dst++ = ngx_charset_utf8_byte(table, u);
+    }
+
+    if (b->last_buf && ctx->saved_len) {
+        *dst++ = '?';
+        ctx->saved_len = 0;
+    }
+
+    nb->last = dst;
+
+    return nb;
+}
+
+
+/* the copy of the buf takes its flags */
+
+static ngx_buf_t *ngx_http_charset_get_buf(ngx_http_request_t *r,
+                                           ngx_http_charset_ctx_t *ctx,
+                                           ngx_buf_t *b, size_t size)
+{
+    ngx_buf_t  *nb;
+
+    if (ctx->free
+        && (size_t) (ctx->free->buf->end - ctx->free->buf->start) >= size)
+    {
+        nb = ctx->free->buf;
+        ctx->free = ctx->free->next;
+
+    } else {
+        if (!(nb = ngx_create_temp_buf(r->pool, size))) {
+            return NULL;
+        }
+
+        nb->tag = (ngx_buf_tag_t) &ngx_http_charset_filter_module;
+    }
+
+    nb->last_buf = b->last_buf;
+    nb->flush = b->flush;
+
+    return nb;
+}
+
+
+/* the ASCII bytes are checked by the words, 4 words at a time */
+
+static u_char *ngx_charset_skip_ascii(u_char *p, u_char *last)
+{
+    uintptr_t  *w;
+
+    while (p < last && ((uintptr_t) p & (sizeof(uintptr_t) - 1))) {
+        if (*p & 0x80) {
+            return p;
+        }
+
+        p++;
+    }
+
+    while ((size_t) (last - p) >= 4 * sizeof(uintptr_t)) {
+        w = (uintptr_t *) p;
+
+        if ((w[0] | w[1] | w[2] | w[3]) & NGX_HTTP_CHARSET_HIGH_BITS) {
+            break;
+        }
+
+        p += 4 * sizeof(uintptr_t);
+    }
+
+    while ((size_t) (last - p) >= sizeof(uintptr_t)) {
+        if (*(uintptr_t *) p & NGX_HTTP_CHARSET_HIGH_BITS) {
+            break;
+        }
+
+        p += sizeof(uintptr_t);
+    }
+
+    while (p < last && !(*p & 0x80)) {
+        p++;
+    }
+
+    return p;
+}
+
+
+/*
+ * returns the code point and moves *p after the sequence, or
+ * NGX_HTTP_CHARSET_INCOMPLETE if the n bytes are the start of a sequence,
+ * or NGX_HTTP_CHARSET_INVALID and moves *p after the invalid bytes
+ */
+
+static uint32_t ngx_charset_utf8_decode(u_char **p, size_t n)
+{
+    u_char    c, *s;
+    size_t    i, len;
+    uint32_t  u, min;
+
+    s = *p;
+    c = *s;
+
+    if (c < 0x80) {
+        *p = s + 1;
+        return c;
+    }
+
+    if (c >= 0xc2 && c < 0xe0) {
+        u = c & 0x1f;
+        len = 1;
+        min = 0x80;
+
+    } else if (c >= 0xe0 && c < 0xf0) {
+        u = c & 0x0f;
+        len = 2;
+        min = 0x800;
+
+    } else if (c >= 0xf0 && c < 0xf5) {
+        u = c & 0x07;
+        len = 3;
+        min = 0x10000;
+
+    } else {
+        *p = s + 1;
+        return NGX_HTTP_CHARSET_INVALID;
+    }
+
+    for (i = 1; i <= len; i++) {
+        if (i == n) {
+            return NGX_HTTP_CHARSET_INCOMPLETE;
+        }
+
+        c = s[i];
+
+        if ((c & 0xc0) != 0x80) {
+            *p = s + i;
+            return NGX_HTTP_CHARSET_INVALID;
+        }
+
+        u = (u << 6) | (c & 0x3f);
+    }
+
+    *p = s + i;
+
+    if (u < min || u > 0x10ffff) {
+        return NGX_HTTP_CHARSET_INVALID;
+    }
+
+    return u;
+}
+
+
+static u_char ngx_charset_utf8_byte(u_char **pages, uint32_t u)
+{
+    if (u < 0x10000 && pages[u >> 8]) {
+        return pages[u >> 8][u & 0xff];
+    }
+
+    return '?';
 }
 
 
@@ -249,10 +742,12 @@ static char *ngx_charset_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
     ngx_http_charset_main_conf_t  *mcf = conf;
 
     char                       *rv;
+    u_char                     *p, **pages;
     ngx_int_t                   src, dst;
     ngx_uint_t                  i;
     ngx_str_t                  *value;
     ngx_conf_t                  pvcf;
+    ngx_http_charset_t         *charset;
     ngx_http_charset_tables_t  *table;
 
     value = cf->args->elts;
@@ -275,10 +770,20 @@ static char *ngx_charset_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
         return NGX_CONF_ERROR;
     }
 
+    charset = mcf->charsets.elts;
+
+    if (charset[src].utf8) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"charset_map\" from \"%s\" is not supported, "
+                           "the UTF-8 charset must be the second one",
+                           value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
     table = mcf->tables.elts;
     for (i = 0; i < mcf->tables.nelts; i++) {
-        if ((src == table->src && dst == table->dst)
-             || (src == table->dst && dst == table->src))
+        if ((src == table[i].src && dst == table[i].dst)
+             || (src == table[i].dst && dst == table[i].src))
         {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "duplicate \"charset_map\" between "
@@ -294,23 +799,52 @@ static char *ngx_charset_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
 
     table->src = src;
     table->dst = dst;
+    table->ascii = 1;
 
-    if (!(table->src2dst = ngx_palloc(cf->pool, 256))) {
-        return NGX_CONF_ERROR;
-    }
+    if (charset[dst].utf8) {
+        p = ngx_palloc(cf->pool, 256 * NGX_HTTP_CHARSET_UTF_LEN);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
 
-    if (!(table->dst2src = ngx_palloc(cf->pool, 256))) {
-        return NGX_CONF_ERROR;
-    }
+        table->src2dst = p;
 
-    for (i = 0; i < 128; i++) {
-        table->src2dst[i] = (char) i;
-        table->dst2src[i] = (char) i;
-    }
+        for (i = 0; i < 256; i++) {
+            *p++ = 1;
+            *p++ = (u_char) (i < 128 ? i : '?');
+            p += NGX_HTTP_CHARSET_UTF_LEN - 2;
+        }
+
+        if (!(pages = ngx_pcalloc(cf->pool, 256 * sizeof(u_char *)))) {
+            return NGX_CONF_ERROR;
+        }
 
-    for (/* void */; i < 256; i++) {
-        table->src2dst[i] = '?';
-        table->dst2src[i] = '?';
+        table->dst2src = pages;
+
+        if (!(pages[0] = ngx_palloc(cf->pool, 256))) {
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < 256; i++) {
+            pages[0][i] = (u_char) (i < 128 ? i : '?');
+        }
+
+    } else {
+        if (!(table->src2dst = ngx_palloc(cf->pool, 256))) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (!(table->dst2src = ngx_palloc(cf->pool, 256))) {
+            return NGX_CONF_ERROR;
+        }
+
+        p = table->src2dst;
+
+        for (i = 0; i < 256; i++) {
+            p[i] = (u_char) (i < 128 ? i : '?');
+        }
+
+        ngx_memcpy(table->dst2src, table->src2dst, 256);
     }
 
     pvcf = *cf;
@@ -326,9 +860,15 @@ static char *ngx_charset_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
 
 static char *ngx_charset_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
 {
-    ngx_int_t                   src, dst;
-    ngx_str_t                  *value;
-    ngx_http_charset_tables_t  *table;
+    ngx_http_charset_main_conf_t  *mcf = conf;
+
+    u_char                      *p, *page, utf[NGX_HTTP_CHARSET_UTF_LEN];
+    size_t                       len, i;
+    uint32_t                     u;
+    ngx_int_t                    src, dst;
+    ngx_str_t                   *value;
+    ngx_http_charset_t          *charset;
+    ngx_http_charset_tables_t   *table;
 
     if (cf->args->nelts != 2) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameters number");
@@ -344,6 +884,70 @@ static char *ngx_charset_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    table = cf->ctx;
+    charset = mcf->charsets.elts;
+
+    if (charset[table->dst].utf8) {
+
+        /* the UTF-8 sequence of up to 3 bytes in hex, e.g. "D090" */
+
+        len = value[1].len / 2;
+
+        if (value[1].len % 2
+            || len == 0
+            || len > NGX_HTTP_CHARSET_UTF_LEN - 1)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid value \"%s\"", value[1].data);
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < len; i++) {
+            dst = ngx_hextoi(&value[1].data[2 * i], 2);
+            if (dst == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid value \"%s\"", value[1].data);
+                return NGX_CONF_ERROR;
+            }
+
+            utf[i] = (u_char) dst;
+        }
+
+        p = utf;
+        u = ngx_charset_utf8_decode(&p, len);
+
+        if (u >= 0x10000 || (size_t) (p - utf) != len) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid UTF-8 sequence \"%s\"",
+                               value[1].data);
+            return NGX_CONF_ERROR;
+        }
+
+        p = (u_char *) table->src2dst + src * NGX_HTTP_CHARSET_UTF_LEN;
+        *p++ = (u_char) len;
+        ngx_memcpy(p, utf, len);
+
+        page = ((u_char **) table->dst2src)[u >> 8];
+
+        if (page == NULL) {
+            if (!(page = ngx_palloc(cf->pool, 256))) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memset(page, '?', 256);
+
+            ((u_char **) table->dst2src)[u >> 8] = page;
+        }
+
+        page[u & 0xff] = (u_char) src;
+
+        if (src < 0x80 || u < 0x80) {
+            table->ascii = 0;
+        }
+
+        return NGX_CONF_OK;
+    }
+
     dst = ngx_hextoi(value[1].data, value[1].len);
     if (dst == NGX_ERROR || dst > 255) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -351,10 +955,12 @@ static char *ngx_charset_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    table = cf->ctx;
+    ((u_char *) table->src2dst)[src] = (u_char) dst;
+    ((u_char *) table->dst2src)[dst] = (u_char) src;
 
-    table->src2dst[src] = (char) dst;
-    table->dst2src[dst] = (char) src;
+    if (src < 0x80 || dst < 0x80) {
+        table->ascii = 0;
+    }
 
     return NGX_CONF_OK;
 }
@@ -419,7 +1025,11 @@ static ngx_int_t ngx_http_add_charset(ngx_array_t *charsets, ngx_str_t *name)
         return NGX_ERROR;
     }
 
+    c->tables = NULL;
     c->name = *name;
+    c->server = 0;
+    c->utf8 = (name->len == sizeof("utf-8") - 1
+               && ngx_strcasecmp(name->data, "utf-8") == 0);
 
     return i;
 }
@@ -472,7 +1082,8 @@ static char *ngx_http_charset_init_main_conf(ngx_conf_t *cf, void *conf)
         }
 
         charset[i].tables = ngx_pcalloc(cf->pool,
-                                        sizeof(char *) * mcf->charsets.nelts);
+                                        sizeof(ngx_http_charset_tables_t *)
+                                        * mcf->charsets.nelts);
 
         if (charset[i].tables == NULL) {
             return NGX_CONF_ERROR;
@@ -480,12 +1091,12 @@ static char *ngx_http_charset_init_main_conf(ngx_conf_t *cf, void *conf)
 
         for (n = 0; n < mcf->tables.nelts; n++) {
             if ((ngx_int_t) i == tables[n].src) {
-                charset[i].tables[tables[n].dst] = tables[n].src2dst;
+                charset[i].tables[tables[n].dst] = &tables[n];
                 continue;
             }
 
             if ((ngx_int_t) i == tables[n].dst) {
-                charset[i].tables[tables[n].src] = tables[n].dst2src;
+                charset[i].tables[tables[n].src] = &tables[n];
             }
         }
     }
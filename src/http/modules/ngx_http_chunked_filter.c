@@ -51,7 +51,7 @@ static ngx_int_t ngx_http_chunked_header_filter(ngx_http_request_t *r)
         if (r->http_version < NGX_HTTP_VERSION_11) {
             r->keepalive = 0;
 
-        } else {
+        } else if (r->http_version < NGX_HTTP_VERSION_20) {
             // 支持长连接，开启chunk传输模式
             r->chunked = 1;
         }
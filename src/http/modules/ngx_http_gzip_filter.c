@@ -38,6 +38,22 @@ typedef struct {
 #define NGX_HTTP_GZIP_PROXIED_ANY       0x0200
 
 
+/* the number of the idle zlib states kept by a worker */
+#define NGX_HTTP_GZIP_STATES            16
+
+
+typedef struct ngx_http_gzip_state_s  ngx_http_gzip_state_t;
+
+struct ngx_http_gzip_state_s {
+    z_stream                zstream;
+    ngx_http_gzip_state_t  *next;
+
+    int                     level;
+    int                     wbits;
+    int                     memlevel;
+};
+
+
 typedef struct {
     ngx_chain_t         *in;
     ngx_chain_t         *free;
@@ -50,9 +66,7 @@ typedef struct {
 
     off_t                length;
 
-    void                *preallocated;
-    char                *free_mem;
-    ngx_uint_t           allocated;
+    ngx_http_gzip_state_t  *state;
 
     unsigned             flush:4;
     unsigned             redo:1;
@@ -66,16 +80,19 @@ typedef struct {
     size_t               zout;
 
     uint32_t             crc32;
-    z_stream             zstream;
+    z_stream            *zstream;
     ngx_http_request_t  *request;
 } ngx_http_gzip_ctx_t;
 
 
 static ngx_int_t ngx_http_gzip_proxied(ngx_http_request_t *r,
                                        ngx_http_gzip_conf_t *conf);
-static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items,
-                                        u_int size);
-static void ngx_http_gzip_filter_free(void *opaque, void *address);
+static ngx_http_gzip_state_t *ngx_http_gzip_get_state(ngx_http_request_t *r,
+                                                      int level, int wbits,
+                                                      int memlevel);
+static void ngx_http_gzip_free_state(ngx_http_gzip_ctx_t *ctx,
+                                     ngx_uint_t reuse);
+static void ngx_http_gzip_cleanup(void *data);
 ngx_inline static int ngx_http_gzip_error(ngx_http_gzip_ctx_t *ctx);
 
 static u_char *ngx_http_gzip_log_ratio(ngx_http_request_t *r, u_char *buf,
@@ -241,6 +258,10 @@ struct gztrailer {
 #endif
 
 
+static ngx_http_gzip_state_t  *ngx_http_gzip_states;
+static ngx_uint_t              ngx_http_gzip_nstates;
+
+
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
@@ -413,6 +434,7 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
     struct gztrailer      *trailer;
     ngx_buf_t             *b;
     ngx_chain_t           *cl;
+    ngx_http_cleanup_t    *cleanup;
     ngx_http_gzip_ctx_t   *ctx;
     ngx_http_gzip_conf_t  *conf;
 
@@ -424,7 +446,7 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
 
-    if (ctx->preallocated == NULL) {
+    if (ctx->zstream == NULL) {
         wbits = conf->wbits;
         memlevel = conf->memlevel;
 
@@ -439,37 +461,32 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
         }
 
         /*
-         * We preallocate a memory for zlib in one buffer (200K-400K), this
-         * dicreases a number of malloc() and free() calls and also probably
-         * dicreases a number of syscalls (sbrk() or so).
-         * Besides we free this memory as soon as the gzipping will complete
-         * and do not wait while a whole response will be sent to a client.
-         *
-         * 8K is for zlib deflate_state, it takes
-         *  * 5816 bytes on x86 and sparc64 (32-bit mode)
-         *  * 5920 bytes on amd64 and sparc64
+         * the zlib states are not freed after a response is compressed,
+         * they are reset and kept for the next responses of the worker,
+         * so deflateInit2() and its 200K-400K allocation are not repeated
+         * on every response
          */
 
-        ctx->allocated = 8192 + (1 << (wbits + 2)) + (1 << (memlevel + 9));
-
-        if (!(ctx->preallocated = ngx_palloc(r->pool, ctx->allocated))) {
+        if (!(cleanup = ngx_push_array(&r->cleanup))) {
+            ctx->done = 1;
             return NGX_ERROR;
         }
 
-        ctx->free_mem = ctx->preallocated;
+        ctx->state = ngx_http_gzip_get_state(r, conf->level, wbits, memlevel);
 
-        ctx->zstream.zalloc = ngx_http_gzip_filter_alloc;
-        ctx->zstream.zfree = ngx_http_gzip_filter_free;
-        ctx->zstream.opaque = ctx;
+        if (ctx->state == NULL) {
+            cleanup->valid = 0;
+            ctx->done = 1;
+            return NGX_ERROR;
+        }
 
-        rc = deflateInit2(&ctx->zstream, conf->level, Z_DEFLATED,
-                          -wbits, memlevel, Z_DEFAULT_STRATEGY);
+        ctx->zstream = &ctx->state->zstream;
 
-        if (rc != Z_OK) {
-            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                          "deflateInit2() failed: %d", rc);
-            return ngx_http_gzip_error(ctx);
-        }
+        cleanup->data.handler.handler = ngx_http_gzip_cleanup;
+        cleanup->data.handler.data = ctx;
+        cleanup->valid = 1;
+        cleanup->cache = 0;
+        cleanup->handler = 1;
 
         if (!(b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t)))) {
             return ngx_http_gzip_error(ctx);
@@ -501,7 +518,7 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 
             /* does zlib need a new data ? */
 
-            if (ctx->zstream.avail_in == 0
+            if (ctx->zstream->avail_in == 0
                 && ctx->flush == Z_NO_FLUSH
                 && !ctx->redo)
             {
@@ -515,13 +532,13 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
                 ctx->in_buf = ctx->in->buf;
                 ctx->in = ctx->in->next;
 
-                ctx->zstream.next_in = ctx->in_buf->pos;
-                ctx->zstream.avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+                ctx->zstream->next_in = ctx->in_buf->pos;
+                ctx->zstream->avail_in = ctx->in_buf->last - ctx->in_buf->pos;
 
                 ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                                "gzip in_buf:" PTR_FMT " ni:" PTR_FMT " ai:%d",
                                ctx->in_buf,
-                               ctx->zstream.next_in, ctx->zstream.avail_in);
+                               ctx->zstream->next_in, ctx->zstream->avail_in);
 
                 /* STUB */
                 if (ctx->in_buf->last < ctx->in_buf->pos) {
@@ -539,21 +556,21 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
                     ctx->flush = Z_SYNC_FLUSH;
                 }
 
-                if (ctx->zstream.avail_in == 0) {
+                if (ctx->zstream->avail_in == 0) {
                     if (ctx->flush == Z_NO_FLUSH) {
                         continue;
                     }
 
                 } else {
-                    ctx->crc32 = crc32(ctx->crc32, ctx->zstream.next_in,
-                                       ctx->zstream.avail_in);
+                    ctx->crc32 = crc32(ctx->crc32, ctx->zstream->next_in,
+                                       ctx->zstream->avail_in);
                 }
             }
 
 
             /* is there a space for the gzipped data ? */
 
-            if (ctx->zstream.avail_out == 0) {
+            if (ctx->zstream->avail_out == 0) {
 
                 if (ctx->free) {
                     ctx->out_buf = ctx->free->buf;
@@ -581,17 +598,17 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 #if 0
                 ctx->blocked = 0;
 #endif
-                ctx->zstream.next_out = ctx->out_buf->pos;
-                ctx->zstream.avail_out = conf->bufs.size;
+                ctx->zstream->next_out = ctx->out_buf->pos;
+                ctx->zstream->avail_out = conf->bufs.size;
             }
 
             ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "deflate in: ni:%X no:%X ai:%d ao:%d fl:%d redo:%d",
-                           ctx->zstream.next_in, ctx->zstream.next_out,
-                           ctx->zstream.avail_in, ctx->zstream.avail_out,
+                           ctx->zstream->next_in, ctx->zstream->next_out,
+                           ctx->zstream->avail_in, ctx->zstream->avail_out,
                            ctx->flush, ctx->redo);
 
-            rc = deflate(&ctx->zstream, ctx->flush);
+            rc = deflate(ctx->zstream, ctx->flush);
 
             if (rc != Z_OK && rc != Z_STREAM_END) {
                 ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
@@ -601,8 +618,8 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 
             ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "deflate out: ni:%X no:%X ai:%d ao:%d rc:%d",
-                           ctx->zstream.next_in, ctx->zstream.next_out,
-                           ctx->zstream.avail_in, ctx->zstream.avail_out,
+                           ctx->zstream->next_in, ctx->zstream->next_out,
+                           ctx->zstream->avail_in, ctx->zstream->avail_out,
                            rc);
 
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -610,17 +627,17 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
                            ctx->in_buf, ctx->in_buf->pos);
 
 
-            if (ctx->zstream.next_in) {
-                ctx->in_buf->pos = ctx->zstream.next_in;
+            if (ctx->zstream->next_in) {
+                ctx->in_buf->pos = ctx->zstream->next_in;
 
-                if (ctx->zstream.avail_in == 0) {
-                    ctx->zstream.next_in = NULL;
+                if (ctx->zstream->avail_in == 0) {
+                    ctx->zstream->next_in = NULL;
                 }
             }
 
-            ctx->out_buf->last = ctx->zstream.next_out;
+            ctx->out_buf->last = ctx->zstream->next_out;
 
-            if (ctx->zstream.avail_out == 0) {
+            if (ctx->zstream->avail_out == 0) {
 
                 /* zlib wants to output some more gzipped data */
 
@@ -655,25 +672,15 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 
             if (rc == Z_STREAM_END) {
 
-                ctx->zin = ctx->zstream.total_in;
-                ctx->zout = 10 + ctx->zstream.total_out + 8;
-
-                rc = deflateEnd(&ctx->zstream);
-
-                if (rc != Z_OK) {
-                    ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                                  "deflateEnd() failed: %d", rc);
-                    return ngx_http_gzip_error(ctx);
-                }
-
-                ngx_pfree(r->pool, ctx->preallocated);
+                ctx->zin = ctx->zstream->total_in;
+                ctx->zout = 10 + ctx->zstream->total_out + 8;
 
                 ngx_alloc_link_and_set_buf(cl, ctx->out_buf, r->pool,
                                            ngx_http_gzip_error(ctx));
                 *ctx->last_out = cl;
                 ctx->last_out = &cl->next;
 
-                if (ctx->zstream.avail_out >= 8) {
+                if (ctx->zstream->avail_out >= 8) {
                     trailer = (struct gztrailer *) ctx->out_buf->last;
                     ctx->out_buf->last += 8;
                     ctx->out_buf->last_buf = 1;
@@ -708,8 +715,7 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
                 trailer->zlen[3] = (ctx->zin >> 24) & 0xff;
 #endif
 
-                ctx->zstream.avail_in = 0;
-                ctx->zstream.avail_out = 0;
+                ngx_http_gzip_free_state(ctx, 1);
 
                 ctx->done = 1;
 #if 0
@@ -798,53 +804,129 @@ static ngx_int_t ngx_http_gzip_body_filter(ngx_http_request_t *r,
 }
 
 
-static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
+static ngx_http_gzip_state_t *ngx_http_gzip_get_state(ngx_http_request_t *r,
+                                                      int level, int wbits,
+                                                      int memlevel)
 {
-    ngx_http_gzip_ctx_t *ctx = opaque;
+    int                     rc;
+    ngx_http_gzip_state_t  *state, **sp;
 
-    void        *p;
-    ngx_uint_t   alloc;
+    for (sp = &ngx_http_gzip_states; *sp; sp = &(*sp)->next) {
+        state = *sp;
 
-    alloc = items * size;
-    if (alloc % 512 != 0) {
+        if (state->wbits != wbits || state->memlevel != memlevel) {
+            continue;
+        }
 
-        /*
-         * the zlib deflate_state allocation, it takes about 6K, we allocate 8K
-         */
+        *sp = state->next;
+        ngx_http_gzip_nstates--;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "gzip reuse state: " PTR_FMT " w:%d m:%d",
+                       state, wbits, memlevel);
+
+        if (state->level != level) {
+
+            /* the stream is reset so deflateParams() does not flush */
+
+            rc = deflateParams(&state->zstream, level, Z_DEFAULT_STRATEGY);
+
+            if (rc != Z_OK) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "deflateParams() failed: %d", rc);
+                deflateEnd(&state->zstream);
+                ngx_free(state);
+                return NULL;
+            }
 
-        alloc = (alloc + ngx_pagesize - 1) & ~(ngx_pagesize - 1);
+            state->level = level;
+        }
+
+        return state;
+    }
+
+    if (!(state = ngx_alloc(sizeof(ngx_http_gzip_state_t),
+                            r->connection->log)))
+    {
+        return NULL;
     }
 
-    if (alloc <= ctx->allocated) {
-        p = ctx->free_mem;
-        ctx->free_mem += alloc;
-        ctx->allocated -= alloc;
+    /*
+     * zlib uses its own allocator, so the state may outlive the request pool
+     * and a zlib-compatible library may allocate the memory as it needs
+     */
+
+    ngx_memzero(&state->zstream, sizeof(z_stream));
 
-        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
-                       "gzip alloc: n:%d s:%d a:%d p:" PTR_FMT,
-                       items, size, alloc, p);
+    rc = deflateInit2(&state->zstream, level, Z_DEFLATED,
+                      -wbits, memlevel, Z_DEFAULT_STRATEGY);
 
-        return p;
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "deflateInit2() failed: %d", rc);
+        ngx_free(state);
+        return NULL;
     }
 
-    ngx_log_error(NGX_LOG_ALERT, ctx->request->connection->log, 0,
-                  "gzip filter failed to use preallocated memory: %d of %d",
-                  items * size, ctx->allocated);
+    state->level = level;
+    state->wbits = wbits;
+    state->memlevel = memlevel;
 
-    p = ngx_palloc(ctx->request->pool, items * size);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip new state: " PTR_FMT " w:%d m:%d",
+                   state, wbits, memlevel);
 
-    return p;
+    return state;
 }
 
 
-static void ngx_http_gzip_filter_free(void *opaque, void *address)
+static void ngx_http_gzip_free_state(ngx_http_gzip_ctx_t *ctx,
+                                     ngx_uint_t reuse)
 {
-#if 0
-    ngx_http_gzip_ctx_t *ctx = opaque;
+    ngx_http_gzip_state_t  *state;
+
+    state = ctx->state;
+
+    if (state == NULL) {
+        return;
+    }
+
+    ctx->state = NULL;
+
+    if (reuse
+        && ngx_http_gzip_nstates < NGX_HTTP_GZIP_STATES
+        && deflateReset(&state->zstream) == Z_OK)
+    {
+        /* deflateReset() does not touch the buffers of the previous request */
+
+        state->zstream.next_in = NULL;
+        state->zstream.avail_in = 0;
+        state->zstream.next_out = NULL;
+        state->zstream.avail_out = 0;
+
+        state->next = ngx_http_gzip_states;
+        ngx_http_gzip_states = state;
+        ngx_http_gzip_nstates++;
+        return;
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
-                   "gzip free: %X", address);
-#endif
+                   "gzip free state: " PTR_FMT, state);
+
+    /* deflateEnd() returns Z_DATA_ERROR for an unfinished stream */
+
+    deflateEnd(&state->zstream);
+    ngx_free(state);
+}
+
+
+static void ngx_http_gzip_cleanup(void *data)
+{
+    ngx_http_gzip_ctx_t *ctx = data;
+
+    /* the response has not been compressed completely */
+
+    ngx_http_gzip_free_state(ctx, 0);
 }
 
 
@@ -886,12 +968,7 @@ static u_char *ngx_http_gzip_log_ratio(ngx_http_request_t *r, u_char *buf,
 
 ngx_inline static int ngx_http_gzip_error(ngx_http_gzip_ctx_t *ctx)
 {
-    deflateEnd(&ctx->zstream);
-
-    ngx_pfree(ctx->request->pool, ctx->preallocated);
-
-    ctx->zstream.avail_in = 0;
-    ctx->zstream.avail_out = 0;
+    ngx_http_gzip_free_state(ctx, 0);
 
     ctx->done = 1;
 
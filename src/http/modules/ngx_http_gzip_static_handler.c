@@ -0,0 +1,936 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include <zlib.h>
+
+
+typedef struct {
+    ngx_flag_t                   enable;
+    ngx_path_t                  *cache_path;
+    int                          level;
+    size_t                       max_length;
+    ngx_array_t                 *types;        /* ngx_str_t */
+} ngx_http_gzip_static_conf_t;
+
+
+/*
+ * the cache file is compressed by the job in the steps of
+ * NGX_HTTP_GZIP_STATIC_STEP bytes of the original file, one step
+ * in an event loop iteration, so the worker is not blocked
+ */
+
+typedef struct ngx_http_gzip_static_job_s  ngx_http_gzip_static_job_t;
+
+struct ngx_http_gzip_static_job_s {
+    ngx_event_t                  event;
+    ngx_http_gzip_static_job_t  *next;
+
+    ngx_pool_t                  *pool;
+    ngx_path_t                  *path;
+    ngx_str_t                    cache;
+
+    ngx_file_t                   file;
+    off_t                        size;         /* the original file size */
+
+    z_stream                     zstream;
+    uint32_t                     crc;
+
+    u_char                      *in;
+    u_char                      *out;          /* the whole cache file */
+};
+
+
+#define NGX_HTTP_GZIP_STATIC_STEP  4096
+
+/* the simultaneous jobs in a worker */
+#define NGX_HTTP_GZIP_STATIC_JOBS  4
+
+
+static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_fd_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+                                          ngx_str_t *name, ngx_file_info_t *fi,
+                                          time_t mtime);
+static ngx_int_t ngx_http_gzip_static_send(ngx_http_request_t *r, ngx_fd_t fd,
+                                           ngx_str_t *name,
+                                           ngx_file_info_t *gzfi,
+                                           ngx_file_info_t *fi);
+static ngx_int_t ngx_http_gzip_static_compressible(ngx_http_request_t *r,
+                                           ngx_http_gzip_static_conf_t *conf);
+static void ngx_http_gzip_static_compress(ngx_http_request_t *r,
+                                          ngx_http_gzip_static_conf_t *conf,
+                                          ngx_str_t *name, ngx_str_t *cache,
+                                          off_t size);
+static void ngx_http_gzip_static_step(ngx_event_t *ev);
+static ngx_int_t ngx_http_gzip_static_store(ngx_http_gzip_static_job_t *job,
+                                            size_t len);
+static void ngx_http_gzip_static_done(ngx_http_gzip_static_job_t *job);
+static ngx_int_t ngx_http_gzip_static_create_path(ngx_log_t *log,
+                                                  ngx_str_t *name,
+                                                  size_t prefix);
+
+static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
+static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf,
+                                             void *parent, void *child);
+static char *ngx_http_gzip_static_set_types(ngx_conf_t *cf, ngx_command_t *cmd,
+                                            void *conf);
+static ngx_int_t ngx_http_gzip_static_init(ngx_cycle_t *cycle);
+
+
+static ngx_conf_num_bounds_t  ngx_http_gzip_static_comp_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 9
+};
+
+
+static ngx_command_t  ngx_http_gzip_static_commands[] = {
+
+    { ngx_string("gzip_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, enable),
+      NULL },
+
+    { ngx_string("gzip_static_cache_path"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_path_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, cache_path),
+      NULL },
+
+    { ngx_string("gzip_static_cache_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, level),
+      &ngx_http_gzip_static_comp_level_bounds },
+
+    { ngx_string("gzip_static_cache_max_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, max_length),
+      NULL },
+
+    { ngx_string("gzip_static_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_static_set_types,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_http_module_t  ngx_http_gzip_static_module_ctx = {
+    NULL,                                  /* pre conf */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_gzip_static_create_conf,      /* create location configuration */
+    ngx_http_gzip_static_merge_conf        /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_gzip_static_module = {
+    NGX_MODULE,
+    &ngx_http_gzip_static_module_ctx,      /* module context */
+    ngx_http_gzip_static_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    ngx_http_gzip_static_init,             /* init module */
+    NULL                                   /* init child */
+};
+
+
+static u_char  gzheader[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 };
+
+
+/* the job timers are not bound to a connection */
+
+static ngx_connection_t             ngx_http_gzip_static_dumb;
+
+static ngx_http_gzip_static_job_t  *ngx_http_gzip_static_jobs;
+static ngx_uint_t                   ngx_http_gzip_static_njobs;
+
+
+/*
+ * the default "gzip_static_types", the types are matched
+ * as the prefixes of the Content-Type value
+ */
+
+static ngx_str_t  ngx_http_gzip_static_types[] = {
+    ngx_string("text/"),
+    ngx_string("application/x-javascript"),
+    ngx_string("application/xml"),
+    ngx_string("application/json"),
+    ngx_string("image/svg+xml"),
+    ngx_null_string
+};
+
+
+static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r)
+{
+    u_char                       *last;
+    ngx_fd_t                      fd;
+    ngx_str_t                     name, gzname, cache;
+    ngx_file_info_t               fi, gzfi;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_gzip_static_conf_t  *conf;
+
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_static_module);
+
+    if (!conf->enable
+        || r->headers_in.accept_encoding == NULL
+        || ngx_strstr(r->headers_in.accept_encoding->value.data, "gzip") == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * if the URL (without the "http://" prefix) is longer than 253 bytes
+     * then MSIE 4.x can not handle the compressed stream
+     */
+
+    if (r->headers_in.msie4 && r->unparsed_uri.len > 200) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* make a file name, reserve 4 bytes for the ".gz" and for the last '\0' */
+
+    if (clcf->alias) {
+        name.data = ngx_palloc(r->pool, clcf->root.len + r->uri.len + 4
+                                        - clcf->name.len);
+        if (name.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        last = ngx_cpymem(name.data, clcf->root.data, clcf->root.len);
+        last = ngx_cpystrn(last, r->uri.data + clcf->name.len,
+                           r->uri.len + 1 - clcf->name.len);
+
+    } else {
+        name.data = ngx_palloc(r->pool, clcf->root.len + r->uri.len + 4);
+        if (name.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        last = ngx_cpymem(name.data, clcf->root.data, clcf->root.len);
+        last = ngx_cpystrn(last, r->uri.data, r->uri.len + 1);
+    }
+
+    name.len = last - name.data;
+
+    /*
+     * the original file must exist and the static handler
+     * will log the error if it does not
+     */
+
+    if (ngx_file_info(name.data, &fi) == NGX_FILE_ERROR || !ngx_is_file(&fi)) {
+        return NGX_DECLINED;
+    }
+
+    ngx_memcpy(last, ".gz", sizeof(".gz"));
+
+    gzname.len = name.len + sizeof(".gz") - 1;
+    gzname.data = name.data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip static filename: \"%s\"", gzname.data);
+
+    fd = ngx_http_gzip_static_open(r, &gzname, &gzfi, ngx_file_mtime(&fi));
+
+    if (fd != NGX_INVALID_FILE) {
+        return ngx_http_gzip_static_send(r, fd, &gzname, &gzfi, &fi);
+    }
+
+    *last = '\0';
+
+    if (conf->cache_path == NULL
+        || ngx_file_size(&fi) == 0
+        || ngx_file_size(&fi) > (off_t) conf->max_length)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_gzip_static_compressible(r, conf) == NGX_DECLINED) {
+        r->headers_out.content_type = NULL;
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the compressed variant is stored in the cache path under
+     * the full name of the original file: "/cache" + "/www/a.css" + ".gz"
+     */
+
+    cache.len = conf->cache_path->name.len + 1 + gzname.len;
+    if (!(cache.data = ngx_palloc(r->pool, cache.len + 1))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    last = ngx_cpymem(cache.data, conf->cache_path->name.data,
+                      conf->cache_path->name.len);
+
+    if (*name.data != '/') {
+        *last++ = '/';
+    }
+
+    last = ngx_cpymem(last, name.data, name.len);
+    ngx_memcpy(last, ".gz", sizeof(".gz"));
+
+    cache.len = last + sizeof(".gz") - 1 - cache.data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip static cache: \"%s\"", cache.data);
+
+    fd = ngx_http_gzip_static_open(r, &cache, &gzfi, ngx_file_mtime(&fi));
+
+    if (fd == NGX_INVALID_FILE) {
+
+        /* the original file is sent while the cache file is compressed */
+
+        ngx_http_gzip_static_compress(r, conf, &name, &cache,
+                                      ngx_file_size(&fi));
+
+        r->headers_out.content_type = NULL;
+        return NGX_DECLINED;
+    }
+
+    return ngx_http_gzip_static_send(r, fd, &cache, &gzfi, &fi);
+}
+
+
+/*
+ * the compressed file is used if it is at least as new as the original one
+ */
+
+static ngx_fd_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+                                          ngx_str_t *name, ngx_file_info_t *fi,
+                                          time_t mtime)
+{
+    ngx_fd_t   fd;
+    ngx_err_t  err;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT && err != NGX_ENOTDIR) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, err,
+                          ngx_open_file_n " \"%s\" failed", name->data);
+        }
+
+        return NGX_INVALID_FILE;
+    }
+
+    if (ngx_fd_info(fd, fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name->data);
+
+    } else if (ngx_is_file(fi) && ngx_file_mtime(fi) >= mtime) {
+        return fd;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip static \"%s\" is stale", name->data);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_INVALID_FILE;
+}
+
+
+static ngx_int_t ngx_http_gzip_static_send(ngx_http_request_t *r, ngx_fd_t fd,
+                                           ngx_str_t *name,
+                                           ngx_file_info_t *gzfi,
+                                           ngx_file_info_t *fi)
+{
+    ngx_int_t            rc;
+    ngx_log_t           *log;
+    ngx_buf_t           *b;
+    ngx_chain_t          out;
+    ngx_http_cleanup_t  *cleanup;
+    ngx_http_log_ctx_t  *ctx;
+
+    log = r->connection->log;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http gzip static fd: %d", fd);
+
+    if (!(cleanup = ngx_push_array(&r->cleanup))) {
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name->data);
+        }
+
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cleanup->data.file.fd = fd;
+    cleanup->data.file.name = name->data;
+    cleanup->valid = 1;
+    cleanup->cache = 0;
+    cleanup->handler = 0;
+
+    rc = ngx_http_discard_body(r);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        return rc;
+    }
+
+    ctx = log->data;
+    ctx->action = "sending response to client";
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = ngx_file_size(gzfi);
+    r->headers_out.last_modified_time = ngx_file_mtime(fi);
+
+    if (r->headers_out.content_type == NULL) {
+        if (ngx_http_set_content_type(r) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    r->headers_out.content_encoding = ngx_list_push(&r->headers_out.headers);
+    if (r->headers_out.content_encoding == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.content_encoding->key.len = sizeof("Content-Encoding") - 1;
+    r->headers_out.content_encoding->key.data = (u_char *) "Content-Encoding";
+    r->headers_out.content_encoding->value.len = sizeof("gzip") - 1;
+    r->headers_out.content_encoding->value.data = (u_char *) "gzip";
+
+    /* we need to allocate all before the header would be sent */
+
+    if (!(b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t)))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!(b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t)))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->filter_allow_ranges = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->in_file = 1;
+
+    if (!r->main) {
+        b->last_buf = 1;
+    }
+
+    b->file_pos = 0;
+    b->file_last = ngx_file_size(gzfi);
+
+    b->file->fd = fd;
+    b->file->log = log;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t ngx_http_gzip_static_compressible(ngx_http_request_t *r,
+                                            ngx_http_gzip_static_conf_t *conf)
+{
+    ngx_str_t   *type, *last;
+
+    if (conf->types) {
+        type = conf->types->elts;
+        last = type + conf->types->nelts;
+
+    } else {
+        type = ngx_http_gzip_static_types;
+        last = type + sizeof(ngx_http_gzip_static_types) / sizeof(ngx_str_t)
+                    - 1;
+    }
+
+    for ( /* void */ ; type < last; type++) {
+        if (r->headers_out.content_type->value.len >= type->len
+            && ngx_strncasecmp(r->headers_out.content_type->value.data,
+                               type->data, type->len) == 0)
+        {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+/*
+ * the job is not bound to the request, it has its own pool and the log
+ * of the cycle; the compressed data is kept in memory and is written to
+ * a temporary file in the cache path only when the whole file is
+ * compressed, so an exited worker does not leave an orphaned temporary file
+ */
+
+static void ngx_http_gzip_static_compress(ngx_http_request_t *r,
+                                          ngx_http_gzip_static_conf_t *conf,
+                                          ngx_str_t *name, ngx_str_t *cache,
+                                          off_t size)
+{
+    int                          rc;
+    size_t                       len;
+    ngx_pool_t                  *pool;
+    ngx_http_gzip_static_job_t  *job;
+
+    for (job = ngx_http_gzip_static_jobs; job; job = job->next) {
+        if (job->cache.len == cache->len
+            && ngx_strcmp(job->cache.data, cache->data) == 0)
+        {
+            return;
+        }
+    }
+
+    if (ngx_http_gzip_static_njobs == NGX_HTTP_GZIP_STATIC_JOBS) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http gzip static \"%s\" is not compressed: "
+                       "too many jobs", cache->data);
+        return;
+    }
+
+    if (!(pool = ngx_create_pool(1024, ngx_cycle->log))) {
+        return;
+    }
+
+    if (!(job = ngx_pcalloc(pool, sizeof(ngx_http_gzip_static_job_t)))) {
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    job->pool = pool;
+    job->path = conf->cache_path;
+    job->size = size;
+
+    job->file.name.len = name->len;
+    job->file.name.data = ngx_palloc(pool, name->len + 1);
+    job->cache.len = cache->len;
+    job->cache.data = ngx_palloc(pool, cache->len + 1);
+    job->in = ngx_palloc(pool, NGX_HTTP_GZIP_STATIC_STEP);
+
+    if (job->file.name.data == NULL
+        || job->cache.data == NULL
+        || job->in == NULL)
+    {
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    ngx_memcpy(job->file.name.data, name->data, name->len + 1);
+    ngx_memcpy(job->cache.data, cache->data, cache->len + 1);
+
+    job->file.log = pool->log;
+
+    job->file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+
+    if (job->file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name->data);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    rc = deflateInit2(&job->zstream, conf->level, Z_DEFLATED, -MAX_WBITS,
+                      MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "deflateInit2() failed: %d", rc);
+
+        if (ngx_close_file(job->file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name->data);
+        }
+
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    /* the file size is limited by gzip_static_cache_max_length */
+
+    len = deflateBound(&job->zstream, (uLong) size);
+
+    if (!(job->out = ngx_palloc(pool, sizeof(gzheader) + len + 8))) {
+        ngx_http_gzip_static_done(job);
+        return;
+    }
+
+    ngx_memcpy(job->out, gzheader, sizeof(gzheader));
+
+    job->zstream.next_out = job->out + sizeof(gzheader);
+    job->zstream.avail_out = len;
+
+    job->crc = crc32(0L, Z_NULL, 0);
+
+    ngx_http_gzip_static_dumb.fd = (ngx_socket_t) -1;
+
+    job->event.data = &ngx_http_gzip_static_dumb;
+    job->event.event_handler = ngx_http_gzip_static_step;
+    job->event.log = pool->log;
+
+    job->next = ngx_http_gzip_static_jobs;
+    ngx_http_gzip_static_jobs = job;
+    ngx_http_gzip_static_njobs++;
+
+    ngx_add_timer(&job->event, 1);
+}
+
+
+static void ngx_http_gzip_static_step(ngx_event_t *ev)
+{
+    int                          rc, flush;
+    size_t                       len;
+    ssize_t                      n;
+    u_char                      *trailer;
+    uint32_t                     crc, size;
+    ngx_http_gzip_static_job_t  *job;
+
+    job = (ngx_http_gzip_static_job_t *)
+                  ((u_char *) ev - offsetof(ngx_http_gzip_static_job_t, event));
+
+    len = NGX_HTTP_GZIP_STATIC_STEP;
+
+    if (job->size - job->file.offset < (off_t) len) {
+        len = (size_t) (job->size - job->file.offset);
+    }
+
+    n = ngx_read_file(&job->file, job->in, len, job->file.offset);
+
+    if (n == NGX_ERROR) {
+        ngx_http_gzip_static_done(job);
+        return;
+    }
+
+    if ((size_t) n != len) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "\"%s\" has been changed while compressing",
+                      job->file.name.data);
+        ngx_http_gzip_static_done(job);
+        return;
+    }
+
+    job->crc = crc32(job->crc, job->in, n);
+
+    flush = (job->file.offset == job->size) ? Z_FINISH : Z_NO_FLUSH;
+
+    job->zstream.next_in = job->in;
+    job->zstream.avail_in = n;
+
+    rc = deflate(&job->zstream, flush);
+
+    if (rc != Z_OK && rc != Z_STREAM_END) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "deflate() failed: %d, %d", flush, rc);
+        ngx_http_gzip_static_done(job);
+        return;
+    }
+
+    if (flush != Z_FINISH) {
+        ngx_add_timer(ev, 1);
+        return;
+    }
+
+    if (rc != Z_STREAM_END) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "deflate() has not finished the stream");
+        ngx_http_gzip_static_done(job);
+        return;
+    }
+
+    /* the gzip trailer is little-endian */
+
+    crc = job->crc;
+    size = (uint32_t) job->size;
+
+    trailer = job->zstream.next_out;
+
+    trailer[0] = (u_char) (crc & 0xff);
+    trailer[1] = (u_char) ((crc >> 8) & 0xff);
+    trailer[2] = (u_char) ((crc >> 16) & 0xff);
+    trailer[3] = (u_char) ((crc >> 24) & 0xff);
+    trailer[4] = (u_char) (size & 0xff);
+    trailer[5] = (u_char) ((size >> 8) & 0xff);
+    trailer[6] = (u_char) ((size >> 16) & 0xff);
+    trailer[7] = (u_char) ((size >> 24) & 0xff);
+
+    if (ngx_http_gzip_static_store(job, trailer + 8 - job->out) == NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, ev->log, 0,
+                      "\"%s\" is compressed to \"%s\"",
+                      job->file.name.data, job->cache.data);
+    }
+
+    ngx_http_gzip_static_done(job);
+}
+
+
+/*
+ * the compressed file is written to a temporary file in the cache path
+ * and then the temporary file is renamed to the cache file, so the other
+ * workers never see a partially written cache file; the temporary file
+ * is deleted on any error
+ */
+
+static ngx_int_t ngx_http_gzip_static_store(ngx_http_gzip_static_job_t *job,
+                                            size_t len)
+{
+    ngx_int_t    rc;
+    ngx_err_t    err;
+    ngx_log_t   *log;
+    ngx_file_t   dst;
+
+    log = job->pool->log;
+
+    ngx_memzero(&dst, sizeof(ngx_file_t));
+
+    dst.fd = NGX_INVALID_FILE;
+    dst.log = log;
+
+    if (ngx_create_temp_file(&dst, job->path, job->pool, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_OK;
+
+    if (ngx_write_file(&dst, job->out, len, 0) == NGX_ERROR) {
+        rc = NGX_ERROR;
+    }
+
+    if (ngx_close_file(dst.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", dst.name.data);
+    }
+
+    if (rc == NGX_OK
+        && ngx_rename_file(dst.name.data, job->cache.data) == NGX_FILE_ERROR)
+    {
+        err = ngx_errno;
+
+        if (err == NGX_ENOENT) {
+
+            /* the directories of the cache file do not exist yet */
+
+            if (ngx_http_gzip_static_create_path(log, &job->cache,
+                                        job->path->name.len) == NGX_ERROR)
+            {
+                rc = NGX_ERROR;
+
+            } else if (ngx_rename_file(dst.name.data, job->cache.data)
+                                                             != NGX_FILE_ERROR)
+            {
+                err = 0;
+
+            } else {
+                err = ngx_errno;
+            }
+        }
+
+        if (rc == NGX_OK && err) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                          dst.name.data, job->cache.data);
+            rc = NGX_ERROR;
+        }
+    }
+
+    if (rc == NGX_ERROR && ngx_delete_file(dst.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", dst.name.data);
+    }
+
+    return rc;
+}
+
+
+static void ngx_http_gzip_static_done(ngx_http_gzip_static_job_t *job)
+{
+    ngx_http_gzip_static_job_t  **jp;
+
+    for (jp = &ngx_http_gzip_static_jobs; *jp; jp = &(*jp)->next) {
+        if (*jp == job) {
+            *jp = job->next;
+            ngx_http_gzip_static_njobs--;
+            break;
+        }
+    }
+
+    if (job->event.timer_set) {
+        ngx_del_timer(&job->event);
+    }
+
+    deflateEnd(&job->zstream);
+
+    if (ngx_close_file(job->file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, job->pool->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", job->file.name.data);
+    }
+
+    ngx_destroy_pool(job->pool);
+}
+
+
+/* create the missing directories of the name after the prefix */
+
+static ngx_int_t ngx_http_gzip_static_create_path(ngx_log_t *log,
+                                                  ngx_str_t *name,
+                                                  size_t prefix)
+{
+    u_char     *p;
+    ngx_err_t   err;
+
+    for (p = name->data + prefix + 1; p < name->data + name->len; p++) {
+
+        if (*p != '/') {
+            continue;
+        }
+
+        *p = '\0';
+
+        if (ngx_create_dir(name->data) == NGX_FILE_ERROR) {
+            err = ngx_errno;
+
+            if (err != NGX_EEXIST) {
+                ngx_log_error(NGX_LOG_CRIT, log, err,
+                              ngx_create_dir_n " \"%s\" failed", name->data);
+                *p = '/';
+                return NGX_ERROR;
+            }
+        }
+
+        *p = '/';
+    }
+
+    return NGX_OK;
+}
+
+
+static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_static_conf_t  *conf;
+
+    if (!(conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_conf_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* set by ngx_pcalloc():
+
+    conf->cache_path = NULL;
+    conf->types = NULL;
+
+    */
+
+    conf->enable = NGX_CONF_UNSET;
+    conf->level = NGX_CONF_UNSET;
+    conf->max_length = NGX_CONF_UNSET_SIZE;
+
+    return conf;
+}
+
+
+static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf,
+                                             void *parent, void *child)
+{
+    ngx_http_gzip_static_conf_t *prev = parent;
+    ngx_http_gzip_static_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    if (conf->cache_path == NULL) {
+        conf->cache_path = prev->cache_path;
+    }
+
+    ngx_conf_merge_value(conf->level, prev->level, 9);
+    ngx_conf_merge_size_value(conf->max_length, prev->max_length,
+                              1024 * 1024);
+
+    if (conf->types == NULL) {
+        conf->types = prev->types;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *ngx_http_gzip_static_set_types(ngx_conf_t *cf, ngx_command_t *cmd,
+                                            void *conf)
+{
+    ngx_http_gzip_static_conf_t *gcf = conf;
+
+    ngx_str_t   *value, *type;
+    ngx_uint_t   i;
+
+    if (gcf->types) {
+        return "is duplicate";
+    }
+
+    gcf->types = ngx_create_array(cf->pool, cf->args->nelts - 1,
+                                  sizeof(ngx_str_t));
+    if (gcf->types == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+        if (!(type = ngx_push_array(gcf->types))) {
+            return NGX_CONF_ERROR;
+        }
+
+        *type = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t ngx_http_gzip_static_init(ngx_cycle_t *cycle)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    h = ngx_push_array(&cmcf->phases[NGX_HTTP_CONTENT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_gzip_static_handler;
+
+    return NGX_OK;
+}
@@ -10,7 +10,16 @@
 
 
 typedef struct {
-    time_t  expires;
+    time_t     expires;
+
+    /* the "Cache-Control" value is built once while merging */
+    ngx_str_t  cache_control;
+
+#if !(NGX_THREADS)
+    /* the "Expires" value is rebuilt at most once a second */
+    time_t     expires_time;
+    u_char     expires_value[sizeof("Mon, 28 Sep 1970 06:00:00 GMT")];
+#endif
 } ngx_http_headers_conf_t;
 
 
@@ -100,46 +109,36 @@ static ngx_int_t ngx_http_headers_filter(ngx_http_request_t *r)
 
         cc->key.len = sizeof("Cache-Control") - 1;
         cc->key.data = (u_char *) "Cache-Control";
+        cc->value = conf->cache_control;
 
         if (conf->expires == NGX_HTTP_EXPIRES_EPOCH) {
             expires->value.data = (u_char *) "Thu, 01 Jan 1970 00:00:01 GMT";
 
-            cc->value.len = sizeof("no-cache") - 1;
-            cc->value.data = (u_char *) "no-cache";
+        } else if (conf->expires == 0) {
+            expires->value.data = ngx_cached_http_time.data;
 
         } else {
+
+#if (NGX_THREADS)
+
             expires->value.data = ngx_palloc(r->pool, len);
             if (expires->value.data == NULL) {
                 return NGX_ERROR;
             }
 
-            if (conf->expires == 0) {
-                ngx_memcpy(expires->value.data, ngx_cached_http_time.data,
-                           ngx_cached_http_time.len + 1);
+            ngx_http_time(expires->value.data, ngx_time() + conf->expires);
 
-                cc->value.len = sizeof("max-age=0") - 1;
-                cc->value.data = (u_char *) "max-age=0";
+#else
 
-            } else {
-                ngx_http_time(expires->value.data, ngx_time() + conf->expires);
-
-                if (conf->expires < 0) {
-                    cc->value.len = sizeof("no-cache") - 1;
-                    cc->value.data = (u_char *) "no-cache";
+            if (conf->expires_time != ngx_time()) {
+                conf->expires_time = ngx_time();
+                ngx_http_time(conf->expires_value,
+                              conf->expires_time + conf->expires);
+            }
 
-                } else {
-                    cc->value.data = ngx_palloc(r->pool,
-                                          sizeof("max-age=") + TIME_T_LEN + 1);
-                    if (cc->value.data == NULL) {
-                        return NGX_ERROR;
-                    }
+            expires->value.data = conf->expires_value;
 
-                    cc->value.len = ngx_snprintf((char *) cc->value.data,
-                                               sizeof("max-age=") + TIME_T_LEN,
-                                               "max-age=" TIME_T_FMT,
-                                               conf->expires);
-                }
-            }
+#endif
         }
     }
 
@@ -166,6 +165,10 @@ static void *ngx_http_headers_create_conf(ngx_conf_t *cf)
 
     conf->expires = NGX_HTTP_EXPIRES_UNSET;
 
+#if !(NGX_THREADS)
+    conf->expires_time = 0;
+#endif
+
     return conf;
 }
 
@@ -181,6 +184,35 @@ static char *ngx_http_headers_merge_conf(ngx_conf_t *cf,
                                           NGX_HTTP_EXPIRES_OFF : prev->expires;
     }
 
+    if (conf->expires == NGX_HTTP_EXPIRES_OFF) {
+        conf->cache_control.len = 0;
+        conf->cache_control.data = NULL;
+
+    } else if (conf->expires < 0) {
+
+        /* NGX_HTTP_EXPIRES_EPOCH is negative too */
+
+        conf->cache_control.len = sizeof("no-cache") - 1;
+        conf->cache_control.data = (u_char *) "no-cache";
+
+    } else if (conf->expires == 0) {
+        conf->cache_control.len = sizeof("max-age=0") - 1;
+        conf->cache_control.data = (u_char *) "max-age=0";
+
+    } else {
+        conf->cache_control.data = ngx_palloc(cf->pool,
+                                          sizeof("max-age=") + TIME_T_LEN + 1);
+        if (conf->cache_control.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->cache_control.len = ngx_snprintf((char *)
+                                               conf->cache_control.data,
+                                               sizeof("max-age=") + TIME_T_LEN,
+                                               "max-age=" TIME_T_FMT,
+                                               conf->expires);
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -0,0 +1,835 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * the longer keys are compared by the first bytes, their length
+ * and the crc of the whole key
+ */
+
+#define NGX_HTTP_LIMIT_CONN_KEY_LEN  48
+
+/*
+ * the zone is split into the stripes that have their own locks, hash
+ * buckets and free nodes, so the workers contend only for the same stripe
+ */
+
+#define NGX_HTTP_LIMIT_CONN_STRIPES  32
+
+
+#define NGX_HTTP_LIMIT_CONN_ADDR     0
+#define NGX_HTTP_LIMIT_CONN_SERVER   1
+#define NGX_HTTP_LIMIT_CONN_HEADER   2
+
+
+typedef struct ngx_http_limit_conn_node_s  ngx_http_limit_conn_node_t;
+
+struct ngx_http_limit_conn_node_s {
+    ngx_http_limit_conn_node_t    *next;
+    uint32_t                       hash;
+    ngx_uint_t                     conn;
+    size_t                         len;
+    u_char                         key[NGX_HTTP_LIMIT_CONN_KEY_LEN];
+};
+
+
+typedef struct {
+    ngx_atomic_t                   lock;
+    ngx_http_limit_conn_node_t   **buckets;
+    ngx_http_limit_conn_node_t    *free;
+} ngx_http_limit_conn_stripe_t;
+
+
+/*
+ * the zone is allocated in the shared memory before the workers are
+ * forked, so the pointers are the same in all processes
+ */
+
+typedef struct {
+    ngx_uint_t                     nbuckets;   /* in the stripe */
+    ngx_http_limit_conn_stripe_t   stripes[NGX_HTTP_LIMIT_CONN_STRIPES];
+} ngx_http_limit_conn_shctx_t;
+
+
+typedef struct {
+    ngx_str_t                      name;
+
+    ngx_uint_t                     type;
+    ngx_str_t                      header;     /* the lowercased name */
+
+    ngx_http_limit_conn_shctx_t   *sh;
+} ngx_http_limit_conn_zone_t;
+
+
+typedef struct {
+    ngx_http_limit_conn_zone_t    *zone;
+    ngx_uint_t                     conn;
+} ngx_http_limit_conn_limit_t;
+
+
+typedef struct {
+    ngx_array_t                   *zones;  /* ngx_http_limit_conn_zone_t * */
+} ngx_http_limit_conn_main_conf_t;
+
+
+typedef struct {
+    ngx_array_t                   *limits;  /* ngx_http_limit_conn_limit_t */
+    ngx_int_t                      status;
+} ngx_http_limit_conn_conf_t;
+
+
+typedef struct {
+    ngx_http_limit_conn_stripe_t  *stripe;
+    ngx_http_limit_conn_node_t    *node;
+    ngx_uint_t                     bucket;
+} ngx_http_limit_conn_cleanup_t;
+
+
+static ngx_int_t ngx_http_limit_conn_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_limit_conn_add(ngx_http_limit_conn_zone_t *zone,
+                                         ngx_uint_t conn, ngx_str_t *key,
+                                         ngx_http_limit_conn_cleanup_t *lcc,
+                                         ngx_log_t *log);
+static ngx_int_t ngx_http_limit_conn_key(ngx_http_request_t *r,
+                                         ngx_http_limit_conn_zone_t *zone,
+                                         ngx_str_t *key);
+static void ngx_http_limit_conn_cleanup(void *data);
+static void ngx_http_limit_conn_connection_cleanup(void *data);
+
+static void *ngx_http_limit_conn_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
+static char *ngx_http_limit_conn_merge_conf(ngx_conf_t *cf,
+                                            void *parent, void *child);
+static char *ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+                                      void *conf);
+static char *ngx_http_limit_conn(ngx_conf_t *cf, ngx_command_t *cmd,
+                                 void *conf);
+static char *ngx_http_limit_conn_status_check(ngx_conf_t *cf, void *post,
+                                              void *data);
+static ngx_int_t ngx_http_limit_conn_init(ngx_cycle_t *cycle);
+
+
+static ngx_conf_post_t  ngx_http_limit_conn_status_post =
+                                          { ngx_http_limit_conn_status_check };
+
+
+static ngx_command_t  ngx_http_limit_conn_commands[] = {
+
+    { ngx_string("limit_conn_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      ngx_http_limit_conn_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_conn"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_http_limit_conn,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_conn_status"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_limit_conn_conf_t, status),
+      &ngx_http_limit_conn_status_post },
+
+      ngx_null_command
+};
+
+
+ngx_http_module_t  ngx_http_limit_conn_module_ctx = {
+    NULL,                                  /* pre conf */
+
+    ngx_http_limit_conn_create_main_conf,  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_limit_conn_create_conf,       /* create location configuration */
+    ngx_http_limit_conn_merge_conf         /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_limit_conn_module = {
+    NGX_MODULE,
+    &ngx_http_limit_conn_module_ctx,       /* module context */
+    ngx_http_limit_conn_commands,          /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    ngx_http_limit_conn_init,              /* init module */
+    NULL                                   /* init process */
+};
+
+
+/*
+ * the connection is counted in the $remote_addr zones of the default server
+ * of the address:port when its first request is initialized, so the idle
+ * keepalive connections and the incomplete requests are counted too;
+ * the virtual server is not known yet, so the $remote_addr limits are set
+ * on the http and server levels only; the connection pool cleanup
+ * uncounts the connection when it is closed; r->connection is not set yet
+ */
+
+ngx_int_t ngx_http_limit_conn_connection(ngx_http_request_t *r,
+                                         ngx_connection_t *c)
+{
+    ngx_str_t                       key;
+    ngx_uint_t                      i;
+    struct sockaddr_in             *addr_in;
+    ngx_pool_cleanup_t             *cln;
+    ngx_http_limit_conn_conf_t     *lccf;
+    ngx_http_limit_conn_zone_t     *zone;
+    ngx_http_limit_conn_limit_t    *limits;
+    ngx_http_limit_conn_cleanup_t  *lcc;
+
+    lccf = ngx_http_get_module_loc_conf(r, ngx_http_limit_conn_module);
+
+    if (lccf->limits == NULL) {
+        return NGX_OK;
+    }
+
+    /* AF_INET only, the other clients are not limited */
+
+    if (c->sockaddr->sa_family != AF_INET) {
+        return NGX_OK;
+    }
+
+    addr_in = (struct sockaddr_in *) c->sockaddr;
+
+    key.len = sizeof(in_addr_t);
+    key.data = (u_char *) &addr_in->sin_addr.s_addr;
+
+    limits = lccf->limits->elts;
+
+    for (i = 0; i < lccf->limits->nelts; i++) {
+        zone = limits[i].zone;
+
+        if (zone->type != NGX_HTTP_LIMIT_CONN_ADDR) {
+            continue;
+        }
+
+        /*
+         * the cleanup is moved to the new pool when the keepalive
+         * connection pool is freed, so its data is not allocated from it
+         */
+
+        if (!(lcc = ngx_alloc(sizeof(ngx_http_limit_conn_cleanup_t),
+                              c->log)))
+        {
+            return NGX_ERROR;
+        }
+
+        if (!(cln = ngx_pool_cleanup_add(c->pool, 0))) {
+            ngx_free(lcc);
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_limit_conn_add(zone, limits[i].conn, &key, lcc, c->log)
+                                                                  == NGX_ERROR)
+        {
+            ngx_free(lcc);
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_limit_conn_connection_cleanup;
+        cln->data = lcc;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * the request is counted in the $server_name and $http_name zones of
+ * the location until it is closed, the request cleanup uncounts it;
+ * the request over the limit is rejected before the other access handlers
+ * and the content handler
+ */
+
+static ngx_int_t ngx_http_limit_conn_handler(ngx_http_request_t *r)
+{
+    ngx_str_t                       key;
+    ngx_uint_t                      i;
+    ngx_http_cleanup_t             *cln;
+    ngx_http_limit_conn_conf_t     *lccf;
+    ngx_http_limit_conn_zone_t     *zone;
+    ngx_http_limit_conn_limit_t    *limits;
+    ngx_http_limit_conn_cleanup_t  *lcc;
+
+    /* the internal redirect is not counted again */
+
+    if (r->limit_conn_set) {
+        return NGX_DECLINED;
+    }
+
+    lccf = ngx_http_get_module_loc_conf(r, ngx_http_limit_conn_module);
+
+    if (lccf->limits == NULL) {
+        return NGX_DECLINED;
+    }
+
+    r->limit_conn_set = 1;
+
+    limits = lccf->limits->elts;
+
+    for (i = 0; i < lccf->limits->nelts; i++) {
+        zone = limits[i].zone;
+
+        /* the connection is already counted in the $remote_addr zones */
+
+        if (zone->type == NGX_HTTP_LIMIT_CONN_ADDR) {
+            continue;
+        }
+
+        if (ngx_http_limit_conn_key(r, zone, &key) == NGX_DECLINED) {
+            continue;
+        }
+
+        if (!(lcc = ngx_palloc(r->pool,
+                               sizeof(ngx_http_limit_conn_cleanup_t))))
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (!(cln = ngx_push_array(&r->cleanup))) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        cln->valid = 0;
+        cln->cache = 0;
+
+        if (ngx_http_limit_conn_add(zone, limits[i].conn, &key, lcc,
+                                    r->connection->log) == NGX_ERROR)
+        {
+            return lccf->status;
+        }
+
+        cln->data.handler.handler = ngx_http_limit_conn_cleanup;
+        cln->data.handler.data = lcc;
+        cln->handler = 1;
+        cln->valid = 1;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t ngx_http_limit_conn_add(ngx_http_limit_conn_zone_t *zone,
+                                         ngx_uint_t conn, ngx_str_t *key,
+                                         ngx_http_limit_conn_cleanup_t *lcc,
+                                         ngx_log_t *log)
+{
+    size_t                          len;
+    uint32_t                        hash;
+    ngx_uint_t                      bucket;
+    ngx_http_limit_conn_node_t     *node;
+    ngx_http_limit_conn_stripe_t   *stripe;
+
+    hash = ngx_crc((char *) key->data, key->len);
+
+    len = (key->len < NGX_HTTP_LIMIT_CONN_KEY_LEN) ?
+                                        key->len : NGX_HTTP_LIMIT_CONN_KEY_LEN;
+
+    stripe = &zone->sh->stripes[hash % NGX_HTTP_LIMIT_CONN_STRIPES];
+    bucket = hash / NGX_HTTP_LIMIT_CONN_STRIPES % zone->sh->nbuckets;
+
+    ngx_spinlock(&stripe->lock, 1000);
+
+    for (node = stripe->buckets[bucket]; node; node = node->next) {
+        if (node->hash == hash
+            && node->len == key->len
+            && ngx_memcmp(node->key, key->data, len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (node == NULL) {
+        node = stripe->free;
+
+        if (node == NULL) {
+            ngx_unlock(&stripe->lock);
+
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "the limit_conn zone \"%s\" is full",
+                          zone->name.data);
+
+            return NGX_ERROR;
+        }
+
+        stripe->free = node->next;
+
+        node->hash = hash;
+        node->conn = 0;
+        node->len = key->len;
+        ngx_memcpy(node->key, key->data, len);
+
+        node->next = stripe->buckets[bucket];
+        stripe->buckets[bucket] = node;
+
+    } else if (node->conn >= conn) {
+        ngx_unlock(&stripe->lock);
+
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "limiting connections by zone \"%s\"", zone->name.data);
+
+        return NGX_ERROR;
+    }
+
+    node->conn++;
+
+    ngx_unlock(&stripe->lock);
+
+    lcc->stripe = stripe;
+    lcc->node = node;
+    lcc->bucket = bucket;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_limit_conn_key(ngx_http_request_t *r,
+                                         ngx_http_limit_conn_zone_t *zone,
+                                         ngx_str_t *key)
+{
+    ngx_uint_t                 i;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header;
+    ngx_http_server_name_t    *name;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    if (zone->type == NGX_HTTP_LIMIT_CONN_SERVER) {
+
+        /* the first name of the virtual server, not the requested alias */
+
+        cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+        name = cscf->server_names.elts;
+
+        *key = name[0].name;
+
+        return NGX_OK;
+    }
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].key.len == zone->header.len
+            && ngx_strncasecmp(header[i].key.data, zone->header.data,
+                               zone->header.len) == 0)
+        {
+            if (header[i].value.len == 0) {
+                break;
+            }
+
+            *key = header[i].value;
+
+            return NGX_OK;
+        }
+    }
+
+    /* the request without the key is not limited */
+
+    return NGX_DECLINED;
+}
+
+
+static void ngx_http_limit_conn_cleanup(void *data)
+{
+    ngx_http_limit_conn_cleanup_t  *lcc = data;
+
+    ngx_http_limit_conn_node_t     *node, **np;
+    ngx_http_limit_conn_stripe_t   *stripe;
+
+    stripe = lcc->stripe;
+    node = lcc->node;
+
+    ngx_spinlock(&stripe->lock, 1000);
+
+    if (--node->conn == 0) {
+        for (np = &stripe->buckets[lcc->bucket]; *np; np = &(*np)->next) {
+            if (*np == node) {
+                *np = node->next;
+                break;
+            }
+        }
+
+        node->next = stripe->free;
+        stripe->free = node;
+    }
+
+    ngx_unlock(&stripe->lock);
+}
+
+
+static void ngx_http_limit_conn_connection_cleanup(void *data)
+{
+    ngx_http_limit_conn_cleanup(data);
+
+    ngx_free(data);
+}
+
+
+static void *ngx_http_limit_conn_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_conn_main_conf_t  *lmcf;
+
+    if (!(lmcf = ngx_pcalloc(cf->pool,
+                             sizeof(ngx_http_limit_conn_main_conf_t))))
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    lmcf->zones = ngx_create_array(cf->pool, 2,
+                                   sizeof(ngx_http_limit_conn_zone_t *));
+    if (lmcf->zones == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return lmcf;
+}
+
+
+static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_conn_conf_t  *conf;
+
+    if (!(conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_conn_conf_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* set by ngx_pcalloc(): conf->limits = NULL; */
+
+    conf->status = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *ngx_http_limit_conn_merge_conf(ngx_conf_t *cf,
+                                            void *parent, void *child)
+{
+    ngx_http_limit_conn_conf_t  *prev = parent;
+    ngx_http_limit_conn_conf_t  *conf = child;
+
+    if (conf->limits == NULL) {
+        conf->limits = prev->limits;
+    }
+
+    ngx_conf_merge_value(conf->status, prev->status,
+                         NGX_HTTP_SERVICE_UNAVAILABLE);
+
+    return NGX_CONF_OK;
+}
+
+
+/* limit_conn_zone  $remote_addr|$server_name|$http_name  zone=name:size; */
+
+static char *ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+                                      void *conf)
+{
+    ngx_http_limit_conn_main_conf_t *lmcf = conf;
+
+    u_char                        *p;
+    size_t                         size;
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s;
+    ngx_uint_t                     i, j, m, exists;
+    ngx_http_limit_conn_node_t    *node;
+    ngx_http_limit_conn_zone_t    *zone, **zp;
+    ngx_http_limit_conn_shctx_t   *sh;
+    ngx_http_limit_conn_stripe_t  *stripe;
+
+    value = cf->args->elts;
+
+    if (!(zone = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_conn_zone_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (value[1].len == sizeof("$remote_addr") - 1
+        && ngx_strcmp(value[1].data, "$remote_addr") == 0)
+    {
+        zone->type = NGX_HTTP_LIMIT_CONN_ADDR;
+
+    } else if (value[1].len == sizeof("$server_name") - 1
+               && ngx_strcmp(value[1].data, "$server_name") == 0)
+    {
+        zone->type = NGX_HTTP_LIMIT_CONN_SERVER;
+
+    } else if (value[1].len > sizeof("$http_") - 1
+               && ngx_strncmp(value[1].data, "$http_", sizeof("$http_") - 1)
+                                                                          == 0)
+    {
+        zone->type = NGX_HTTP_LIMIT_CONN_HEADER;
+        zone->header.len = value[1].len - (sizeof("$http_") - 1);
+        zone->header.data = value[1].data + sizeof("$http_") - 1;
+
+        for (i = 0; i < zone->header.len; i++) {
+            if (zone->header.data[i] == '_') {
+                zone->header.data[i] = '-';
+            }
+        }
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid key \"%s\", it must be \"$remote_addr\", "
+                           "\"$server_name\" or \"$http_name\"",
+                           value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (value[2].len <= sizeof("zone=") - 1
+        || ngx_strncmp(value[2].data, "zone=", sizeof("zone=") - 1) != 0)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%s\"", value[2].data);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->name.data = value[2].data + sizeof("zone=") - 1;
+
+    for (p = zone->name.data; *p && *p != ':'; p++) { /* void */ }
+
+    if (*p != ':' || p == zone->name.data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%s\"", value[2].data);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->name.len = p - zone->name.data;
+    *p++ = '\0';
+
+    s.len = value[2].data + value[2].len - p;
+    s.data = p;
+
+    if (s.len == 0 || (n = ngx_parse_size(&s)) == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%s\"", s.data);
+        return NGX_CONF_ERROR;
+    }
+
+    size = (size_t) n;
+
+    /* the nodes and the buckets of a stripe */
+
+    m = 0;
+
+    if (size > sizeof(ngx_http_limit_conn_shctx_t)) {
+        m = (size - sizeof(ngx_http_limit_conn_shctx_t))
+            / NGX_HTTP_LIMIT_CONN_STRIPES
+            / (sizeof(ngx_http_limit_conn_node_t)
+               + sizeof(ngx_http_limit_conn_node_t *));
+    }
+
+    if (m == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the zone \"%s\" is too small", zone->name.data);
+        return NGX_CONF_ERROR;
+    }
+
+    zp = lmcf->zones->elts;
+
+    for (i = 0; i < lmcf->zones->nelts; i++) {
+        if (zp[i]->name.len == zone->name.len
+            && ngx_strcmp(zp[i]->name.data, zone->name.data) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%s\"", zone->name.data);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    /*
+     * the zone of the same name and size is kept on the reload, so
+     * the requests of the old workers are uncounted in the same zone
+     */
+
+    p = ngx_shared_zone(cf->cycle, &zone->name, size,
+                        &ngx_http_limit_conn_module, &exists);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    sh = (ngx_http_limit_conn_shctx_t *) p;
+    zone->sh = sh;
+
+    if (!exists) {
+
+        /* the shared memory is zeroed, so the buckets are empty */
+
+        sh->nbuckets = m;
+
+        p += sizeof(ngx_http_limit_conn_shctx_t);
+
+        for (i = 0; i < NGX_HTTP_LIMIT_CONN_STRIPES; i++) {
+            stripe = &sh->stripes[i];
+
+            stripe->buckets = (ngx_http_limit_conn_node_t **) p;
+            p += m * sizeof(ngx_http_limit_conn_node_t *);
+
+            node = (ngx_http_limit_conn_node_t *) p;
+            p += m * sizeof(ngx_http_limit_conn_node_t);
+
+            for (j = 0; j < m; j++) {
+                node[j].next = stripe->free;
+                stripe->free = &node[j];
+            }
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                       "limit_conn zone \"%s\": %d keys",
+                       zone->name.data,
+                       (int) (m * NGX_HTTP_LIMIT_CONN_STRIPES));
+    }
+
+    if (!(zp = ngx_push_array(lmcf->zones))) {
+        return NGX_CONF_ERROR;
+    }
+
+    *zp = zone;
+
+    return NGX_CONF_OK;
+}
+
+
+/* limit_conn  zone  number; */
+
+static char *ngx_http_limit_conn(ngx_conf_t *cf, ngx_command_t *cmd,
+                                 void *conf)
+{
+    ngx_http_limit_conn_conf_t *lccf = conf;
+
+    ngx_int_t                         conn;
+    ngx_str_t                        *value;
+    ngx_uint_t                        i, n;
+    ngx_http_limit_conn_zone_t      **zp;
+    ngx_http_limit_conn_limit_t      *limit;
+    ngx_http_limit_conn_main_conf_t  *lmcf;
+
+    value = cf->args->elts;
+
+    conn = ngx_atoi(value[2].data, value[2].len);
+
+    if (conn == NGX_ERROR || conn == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of connections \"%s\"",
+                           value[2].data);
+        return NGX_CONF_ERROR;
+    }
+
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_limit_conn_module);
+
+    zp = lmcf->zones->elts;
+
+    for (i = 0; i < lmcf->zones->nelts; i++) {
+        if (zp[i]->name.len == value[1].len
+            && ngx_strcmp(zp[i]->name.data, value[1].data) == 0)
+        {
+            break;
+        }
+    }
+
+    if (i == lmcf->zones->nelts) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "unknown limit_conn_zone \"%s\"", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    /* the connection is counted before the location is known */
+
+    if (zp[i]->type == NGX_HTTP_LIMIT_CONN_ADDR
+        && cf->cmd_type == NGX_HTTP_LOC_CONF)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the \"$remote_addr\" zone \"%s\" can not be "
+                           "used in the location", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (lccf->limits == NULL) {
+        lccf->limits = ngx_create_array(cf->pool, 2,
+                                        sizeof(ngx_http_limit_conn_limit_t));
+        if (lccf->limits == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    limit = lccf->limits->elts;
+
+    for (n = 0; n < lccf->limits->nelts; n++) {
+        if (limit[n].zone == zp[i]) {
+            return "is duplicate";
+        }
+    }
+
+    if (!(limit = ngx_push_array(lccf->limits))) {
+        return NGX_CONF_ERROR;
+    }
+
+    limit->zone = zp[i];
+    limit->conn = conn;
+
+    return NGX_CONF_OK;
+}
+
+
+/* only the codes that have the status lines and the error pages */
+
+static char *ngx_http_limit_conn_status_check(ngx_conf_t *cf, void *post,
+                                              void *data)
+{
+    ngx_int_t *np = data;
+
+    if ((*np >= NGX_HTTP_BAD_REQUEST
+         && *np <= NGX_HTTP_RANGE_NOT_SATISFIABLE)
+        || (*np >= NGX_HTTP_INTERNAL_SERVER_ERROR
+            && *np <= NGX_HTTP_GATEWAY_TIME_OUT))
+    {
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"limit_conn_status\" must be "
+                       "between 400 and 416 or between 500 and 504");
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t ngx_http_limit_conn_init(ngx_cycle_t *cycle)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    h = ngx_push_array(&cmcf->phases[NGX_HTTP_ACCESS_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_limit_conn_handler;
+
+    return NGX_OK;
+}
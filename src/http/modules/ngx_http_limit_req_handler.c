@@ -0,0 +1,815 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * the longer keys are compared by the first bytes, their length
+ * and the crc of the whole key
+ */
+
+#define NGX_HTTP_LIMIT_REQ_KEY_LEN  48
+
+
+typedef struct ngx_http_limit_req_node_s  ngx_http_limit_req_node_t;
+
+struct ngx_http_limit_req_node_s {
+    ngx_rbtree_t                  rbtree;    /* the key is the crc */
+
+    ngx_http_limit_req_node_t    *prev;
+    ngx_http_limit_req_node_t    *next;
+
+    ngx_epoch_msec_t              last;
+    ngx_uint_t                    excess;    /* in 1/1000 of the request */
+
+    size_t                        len;
+    u_char                        key[NGX_HTTP_LIMIT_REQ_KEY_LEN];
+};
+
+
+/*
+ * the zone is allocated in the shared memory before the workers are
+ * forked, so the pointers are the same in all processes
+ */
+
+typedef struct {
+    ngx_atomic_t                  lock;
+
+    ngx_rbtree_t                 *root;
+    ngx_rbtree_t                  sentinel;
+
+    /* queue.next is the most recently used node */
+    ngx_http_limit_req_node_t     queue;
+    ngx_http_limit_req_node_t    *free;
+} ngx_http_limit_req_shctx_t;
+
+
+typedef struct {
+    ngx_str_t                     name;
+
+    /* the lowercased header name, the client address is used if empty */
+    ngx_str_t                     header;
+
+    ngx_uint_t                    rate;      /* in 1/1000 of the request */
+
+    ngx_http_limit_req_shctx_t   *sh;
+} ngx_http_limit_req_zone_t;
+
+
+typedef struct {
+    ngx_array_t                  *zones;     /* ngx_http_limit_req_zone_t * */
+} ngx_http_limit_req_main_conf_t;
+
+
+typedef struct {
+    ngx_http_limit_req_zone_t    *zone;
+    ngx_uint_t                    burst;     /* in 1/1000 of the request */
+    ngx_flag_t                    nodelay;
+} ngx_http_limit_req_conf_t;
+
+
+static ngx_int_t ngx_http_limit_req_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_limit_req_key(ngx_http_request_t *r,
+                                        ngx_http_limit_req_zone_t *zone,
+                                        ngx_str_t *key);
+static ngx_http_limit_req_node_t *ngx_http_limit_req_lookup(
+                                        ngx_http_limit_req_shctx_t *sh,
+                                        ngx_int_t hash, ngx_str_t *key);
+static ngx_uint_t ngx_http_limit_req_leaked(ngx_http_limit_req_node_t *node,
+                                            ngx_uint_t rate,
+                                            ngx_epoch_msec_t now);
+static void ngx_http_limit_req_expire(ngx_http_limit_req_shctx_t *sh,
+                                      ngx_uint_t rate, ngx_epoch_msec_t now);
+static void ngx_http_limit_req_delete(ngx_http_limit_req_shctx_t *sh,
+                                      ngx_http_limit_req_node_t *node);
+
+static void *ngx_http_limit_req_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
+static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf,
+                                           void *parent, void *child);
+static char *ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+                                     void *conf);
+static char *ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd,
+                                void *conf);
+static ngx_int_t ngx_http_limit_req_init(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_limit_req_commands[] = {
+
+    { ngx_string("limit_req_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      ngx_http_limit_req_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_req"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE123,
+      ngx_http_limit_req,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_http_module_t  ngx_http_limit_req_module_ctx = {
+    NULL,                                  /* pre conf */
+
+    ngx_http_limit_req_create_main_conf,   /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_limit_req_create_conf,        /* create location configuration */
+    ngx_http_limit_req_merge_conf          /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_limit_req_module = {
+    NGX_MODULE,
+    &ngx_http_limit_req_module_ctx,        /* module context */
+    ngx_http_limit_req_commands,           /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    ngx_http_limit_req_init,               /* init module */
+    NULL                                   /* init process */
+};
+
+
+/*
+ * the leaky bucket: the excess of the key leaks at the zone rate, and
+ * every request adds one to it.  The request that makes the excess
+ * larger than the burst is rejected, the other excessive requests are
+ * delayed until the excess leaks out, or they pass at once if "nodelay"
+ */
+
+static ngx_int_t ngx_http_limit_req_handler(ngx_http_request_t *r)
+{
+    size_t                       len;
+    ngx_int_t                    hash;
+    ngx_str_t                    key;
+    ngx_uint_t                   excess, leaked;
+    ngx_msec_t                   delay;
+    ngx_event_t                 *wev;
+    ngx_epoch_msec_t             now;
+    ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_zone_t   *zone;
+    ngx_http_limit_req_shctx_t  *sh;
+
+    if (r->limit_req_set) {
+
+        /* the delayed request or the internal redirect */
+
+        wev = r->connection->write;
+
+        if (wev->delayed) {
+            if (!wev->timedout) {
+                return NGX_AGAIN;
+            }
+
+            wev->delayed = 0;
+            wev->timedout = 0;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    lrcf = ngx_http_get_module_loc_conf(r, ngx_http_limit_req_module);
+
+    if (lrcf->zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    zone = lrcf->zone;
+
+    if (ngx_http_limit_req_key(r, zone, &key) == NGX_DECLINED) {
+        return NGX_DECLINED;
+    }
+
+    r->limit_req_set = 1;
+
+    hash = (ngx_int_t) ngx_crc((char *) key.data, key.len);
+    now = ngx_start_msec + ngx_elapsed_msec;
+
+    sh = zone->sh;
+
+    ngx_spinlock(&sh->lock, 1000);
+
+    ngx_http_limit_req_expire(sh, zone->rate, now);
+
+    node = ngx_http_limit_req_lookup(sh, hash, &key);
+
+    if (node) {
+        leaked = ngx_http_limit_req_leaked(node, zone->rate, now);
+
+        /* the request is added before the leak, it may leak out too */
+
+        excess = (node->excess + 1000 > leaked) ?
+                                           node->excess + 1000 - leaked : 0;
+
+        if (excess > lrcf->burst) {
+            ngx_unlock(&sh->lock);
+
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "limiting requests, excess: %d.%03d by zone \"%s\"",
+                          (int) (excess / 1000), (int) (excess % 1000),
+                          zone->name.data);
+
+            return NGX_HTTP_SERVICE_UNAVAILABLE;
+        }
+
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+
+    } else {
+        if (sh->free == NULL) {
+
+            /* evict the least recently used key */
+
+            ngx_http_limit_req_delete(sh, sh->queue.prev);
+        }
+
+        node = sh->free;
+        sh->free = node->next;
+
+        len = (key.len < NGX_HTTP_LIMIT_REQ_KEY_LEN) ?
+                                         key.len : NGX_HTTP_LIMIT_REQ_KEY_LEN;
+
+        node->rbtree.key = hash;
+        node->len = key.len;
+        ngx_memcpy(node->key, key.data, len);
+
+        ngx_rbtree_insert(&sh->root, &sh->sentinel, &node->rbtree);
+
+        excess = 0;
+    }
+
+    node->excess = excess;
+    node->last = now;
+
+    node->prev = &sh->queue;
+    node->next = sh->queue.next;
+    node->next->prev = node;
+    sh->queue.next = node;
+
+    ngx_unlock(&sh->lock);
+
+    if (excess == 0 || lrcf->nodelay) {
+        return NGX_DECLINED;
+    }
+
+    delay = (ngx_msec_t) (excess * 1000 / zone->rate);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "limit_req delay: %d by zone \"%s\"",
+                   (int) delay, zone->name.data);
+
+    /* the phase handler is called again by the timer */
+
+    wev = r->connection->write;
+
+    wev->delayed = 1;
+    ngx_add_timer(wev, delay);
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t ngx_http_limit_req_key(ngx_http_request_t *r,
+                                        ngx_http_limit_req_zone_t *zone,
+                                        ngx_str_t *key)
+{
+    ngx_uint_t            i;
+    ngx_list_part_t      *part;
+    ngx_table_elt_t      *header;
+    struct sockaddr_in   *addr_in;
+
+    if (zone->header.len == 0) {
+
+        /* AF_INET only, the other clients are not limited */
+
+        if (r->connection->sockaddr->sa_family != AF_INET) {
+            return NGX_DECLINED;
+        }
+
+        addr_in = (struct sockaddr_in *) r->connection->sockaddr;
+
+        key->len = sizeof(in_addr_t);
+        key->data = (u_char *) &addr_in->sin_addr.s_addr;
+
+        return NGX_OK;
+    }
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].key.len == zone->header.len
+            && ngx_strncasecmp(header[i].key.data, zone->header.data,
+                               zone->header.len) == 0)
+        {
+            if (header[i].value.len == 0) {
+                break;
+            }
+
+            *key = header[i].value;
+
+            return NGX_OK;
+        }
+    }
+
+    /* the request without the key is not limited */
+
+    return NGX_DECLINED;
+}
+
+
+/* the nodes with the same crc follow each other in the tree order */
+
+static ngx_http_limit_req_node_t *ngx_http_limit_req_lookup(
+                                        ngx_http_limit_req_shctx_t *sh,
+                                        ngx_int_t hash, ngx_str_t *key)
+{
+    size_t                      len;
+    ngx_rbtree_t               *node, *first, *parent;
+    ngx_http_limit_req_node_t  *lr;
+
+    node = sh->root;
+    first = NULL;
+
+    while (node != &sh->sentinel) {
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        first = node;
+        node = node->left;
+    }
+
+    len = (key->len < NGX_HTTP_LIMIT_REQ_KEY_LEN) ?
+                                        key->len : NGX_HTTP_LIMIT_REQ_KEY_LEN;
+
+    node = first;
+
+    while (node && node->key == hash) {
+        lr = (ngx_http_limit_req_node_t *) node;
+
+        if (lr->len == key->len && ngx_memcmp(lr->key, key->data, len) == 0) {
+            return lr;
+        }
+
+        /* the next node in the tree order */
+
+        if (node->right != &sh->sentinel) {
+            node = ngx_rbtree_min(node->right, &sh->sentinel);
+            continue;
+        }
+
+        for ( ;; ) {
+            if (node == sh->root) {
+                return NULL;
+            }
+
+            parent = node->parent;
+
+            if (node == parent->left) {
+                break;
+            }
+
+            node = parent;
+        }
+
+        node = parent;
+    }
+
+    return NULL;
+}
+
+
+static ngx_uint_t ngx_http_limit_req_leaked(ngx_http_limit_req_node_t *node,
+                                            ngx_uint_t rate,
+                                            ngx_epoch_msec_t now)
+{
+    ngx_epoch_msec_t  ms;
+
+    /* the time of another worker may be a bit ahead */
+
+    if (now <= node->last) {
+        return 0;
+    }
+
+    ms = now - node->last;
+
+    /* a day leaks any excess and does not overflow the product */
+
+    if (ms > 86400000) {
+        ms = 86400000;
+    }
+
+    return (ngx_uint_t) (rate * ms / 1000);
+}
+
+
+/*
+ * the least recently used keys whose next request would have no excess
+ * are the same as the new ones, so they are freed; two at most to bound
+ * the time under the lock
+ */
+
+static void ngx_http_limit_req_expire(ngx_http_limit_req_shctx_t *sh,
+                                      ngx_uint_t rate, ngx_epoch_msec_t now)
+{
+    ngx_uint_t                  n;
+    ngx_http_limit_req_node_t  *node;
+
+    for (n = 0; n < 2; n++) {
+        node = sh->queue.prev;
+
+        if (node == &sh->queue
+            || ngx_http_limit_req_leaked(node, rate, now)
+                                                      < node->excess + 1000)
+        {
+            return;
+        }
+
+        ngx_http_limit_req_delete(sh, node);
+    }
+}
+
+
+static void ngx_http_limit_req_delete(ngx_http_limit_req_shctx_t *sh,
+                                      ngx_http_limit_req_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+
+    ngx_rbtree_delete(&sh->root, &sh->sentinel, &node->rbtree);
+
+    node->next = sh->free;
+    sh->free = node;
+}
+
+
+static void *ngx_http_limit_req_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_req_main_conf_t  *lmcf;
+
+    if (!(lmcf = ngx_pcalloc(cf->pool,
+                             sizeof(ngx_http_limit_req_main_conf_t))))
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    lmcf->zones = ngx_create_array(cf->pool, 2,
+                                   sizeof(ngx_http_limit_req_zone_t *));
+    if (lmcf->zones == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return lmcf;
+}
+
+
+static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_limit_req_conf_t  *conf;
+
+    if (!(conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_conf_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->zone = NULL;
+     *     conf->burst = 0;
+     *     conf->nodelay = 0;
+     */
+
+    return conf;
+}
+
+
+static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf,
+                                           void *parent, void *child)
+{
+    ngx_http_limit_req_conf_t  *prev = parent;
+    ngx_http_limit_req_conf_t  *conf = child;
+
+    if (conf->zone == NULL) {
+        conf->zone = prev->zone;
+        conf->burst = prev->burst;
+        conf->nodelay = prev->nodelay;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/* limit_req_zone  $remote_addr|$http_name  zone=name:size  rate=Nr/s|Nr/m; */
+
+static char *ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+                                     void *conf)
+{
+    ngx_http_limit_req_main_conf_t *lmcf = conf;
+
+    u_char                      *p;
+    size_t                       size;
+    ngx_int_t                    n, scale;
+    ngx_str_t                   *value, s;
+    ngx_uint_t                   i, exists;
+    ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_zone_t   *zone, **zp;
+    ngx_http_limit_req_shctx_t  *sh;
+
+    value = cf->args->elts;
+
+    if (!(zone = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_req_zone_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (value[1].len == sizeof("$remote_addr") - 1
+        && ngx_strcmp(value[1].data, "$remote_addr") == 0)
+    {
+        /* zone->header.len = 0; */
+
+    } else if (value[1].len > sizeof("$http_") - 1
+               && ngx_strncmp(value[1].data, "$http_", sizeof("$http_") - 1)
+                                                                          == 0)
+    {
+        zone->header.len = value[1].len - (sizeof("$http_") - 1);
+        zone->header.data = value[1].data + sizeof("$http_") - 1;
+
+        for (i = 0; i < zone->header.len; i++) {
+            if (zone->header.data[i] == '_') {
+                zone->header.data[i] = '-';
+            }
+        }
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid key \"%s\", "
+                           "it must be \"$remote_addr\" or \"$http_name\"",
+                           value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (value[2].len <= sizeof("zone=") - 1
+        || ngx_strncmp(value[2].data, "zone=", sizeof("zone=") - 1) != 0)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%s\"", value[2].data);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->name.data = value[2].data + sizeof("zone=") - 1;
+
+    for (p = zone->name.data; *p && *p != ':'; p++) { /* void */ }
+
+    if (*p != ':' || p == zone->name.data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%s\"", value[2].data);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->name.len = p - zone->name.data;
+    *p++ = '\0';
+
+    s.len = value[2].data + value[2].len - p;
+    s.data = p;
+
+    if (s.len == 0 || (n = ngx_parse_size(&s)) == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%s\"", s.data);
+        return NGX_CONF_ERROR;
+    }
+
+    size = (size_t) n;
+
+    if (size < sizeof(ngx_http_limit_req_shctx_t)
+               + sizeof(ngx_http_limit_req_node_t))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the zone \"%s\" is too small", zone->name.data);
+        return NGX_CONF_ERROR;
+    }
+
+    n = 0;
+
+    if (ngx_strncmp(value[3].data, "rate=", sizeof("rate=") - 1) == 0
+        && value[3].len > sizeof("rate=r/s") - 1)
+    {
+        p = value[3].data + value[3].len - (sizeof("r/s") - 1);
+
+        if (ngx_strcmp(p, "r/s") == 0) {
+            scale = 1;
+
+        } else if (ngx_strcmp(p, "r/m") == 0) {
+            scale = 60;
+
+        } else {
+            scale = 0;
+        }
+
+        if (scale) {
+            n = ngx_atoi(value[3].data + sizeof("rate=") - 1,
+                         p - value[3].data - (sizeof("rate=") - 1));
+
+            if (n != NGX_ERROR) {
+                n = n * 1000 / scale;
+            }
+        }
+    }
+
+    if (n <= 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid rate \"%s\"", value[3].data);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->rate = n;
+
+    zp = lmcf->zones->elts;
+
+    for (i = 0; i < lmcf->zones->nelts; i++) {
+        if (zp[i]->name.len == zone->name.len
+            && ngx_strcmp(zp[i]->name.data, zone->name.data) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%s\"", zone->name.data);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    /* the zone of the same name and size keeps its keys on the reload */
+
+    p = ngx_shared_zone(cf->cycle, &zone->name, size,
+                        &ngx_http_limit_req_module, &exists);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    sh = (ngx_http_limit_req_shctx_t *) p;
+    zone->sh = sh;
+
+    if (!exists) {
+
+        /* the shared memory is zeroed, so the sentinel is black */
+
+        sh->root = &sh->sentinel;
+
+        sh->queue.prev = &sh->queue;
+        sh->queue.next = &sh->queue;
+
+        n = (size - sizeof(ngx_http_limit_req_shctx_t))
+            / sizeof(ngx_http_limit_req_node_t);
+
+        node = (ngx_http_limit_req_node_t *) (sh + 1);
+
+        for (i = 0; i < (ngx_uint_t) n; i++) {
+            node[i].next = sh->free;
+            sh->free = &node[i];
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                       "limit_req zone \"%s\": %d keys",
+                       zone->name.data, (int) n);
+    }
+
+    if (!(zp = ngx_push_array(lmcf->zones))) {
+        return NGX_CONF_ERROR;
+    }
+
+    *zp = zone;
+
+    return NGX_CONF_OK;
+}
+
+
+/* limit_req  zone=name  [burst=N]  [nodelay]; */
+
+static char *ngx_http_limit_req(ngx_conf_t *cf, ngx_command_t *cmd,
+                                void *conf)
+{
+    ngx_http_limit_req_conf_t *lrcf = conf;
+
+    ngx_int_t                        burst;
+    ngx_str_t                       *value, name;
+    ngx_uint_t                       i;
+    ngx_http_limit_req_zone_t      **zp;
+    ngx_http_limit_req_main_conf_t  *lmcf;
+
+    if (lrcf->zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    name.len = 0;
+    burst = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", sizeof("zone=") - 1) == 0) {
+            name.len = value[i].len - (sizeof("zone=") - 1);
+            name.data = value[i].data + sizeof("zone=") - 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "burst=", sizeof("burst=") - 1) == 0) {
+            burst = ngx_atoi(value[i].data + sizeof("burst=") - 1,
+                             value[i].len - (sizeof("burst=") - 1));
+
+            /* NGX_ERROR is negative too */
+
+            if (burst < 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid burst value \"%s\"",
+                                   value[i].data);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "nodelay") == 0) {
+            lrcf->nodelay = 1;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%s\"", value[i].data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%s\" must have the \"zone\" parameter",
+                           cmd->name.data);
+        return NGX_CONF_ERROR;
+    }
+
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_limit_req_module);
+
+    zp = lmcf->zones->elts;
+
+    for (i = 0; i < lmcf->zones->nelts; i++) {
+        if (zp[i]->name.len == name.len
+            && ngx_strcmp(zp[i]->name.data, name.data) == 0)
+        {
+            lrcf->zone = zp[i];
+            lrcf->burst = burst * 1000;
+
+            return NGX_CONF_OK;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "unknown limit_req_zone \"%s\"", name.data);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t ngx_http_limit_req_init(ngx_cycle_t *cycle)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    h = ngx_push_array(&cmcf->phases[NGX_HTTP_ACCESS_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_limit_req_handler;
+
+    return NGX_OK;
+}
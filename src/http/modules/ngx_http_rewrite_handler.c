@@ -37,8 +37,16 @@ typedef struct {
 
 
 typedef struct {
-    ngx_array_t   rules;
-    ngx_flag_t    log;
+    ngx_array_t       rules;
+    ngx_regex_set_t  *set;          /* the prefilter of the rules */
+
+    /*
+     * the match vector of the largest rule, it is used by all requests
+     * of the worker because the matches are not needed after the handler
+     */
+    int              *matches;
+
+    ngx_flag_t        log;
 } ngx_http_rewrite_srv_conf_t;
 
 
@@ -114,7 +122,7 @@ ngx_module_t  ngx_http_rewrite_module = {
 static ngx_int_t ngx_http_rewrite_handler(ngx_http_request_t *r)
 {
     int                          *matches;
-    u_char                       *p;
+    u_char                       *p, *candidates;
     size_t                        len;
     uintptr_t                     data;
     ngx_int_t                     rc;
@@ -129,18 +137,32 @@ static ngx_int_t ngx_http_rewrite_handler(ngx_http_request_t *r)
 
     scf = ngx_http_get_module_srv_conf(r, ngx_http_rewrite_module);
 
+    if (scf->set) {
+        if (!(candidates = ngx_palloc(r->pool, scf->rules.nelts))) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_regex_set_candidates(scf->set, &r->uri, candidates);
+
+    } else {
+        candidates = NULL;
+    }
+
     rule = scf->rules.elts;
     for (i = 0; i < scf->rules.nelts; i++) {
 
-        if (rule[i].msize) {
-            if (!(matches = ngx_palloc(r->pool, rule[i].msize * sizeof(int)))) {
-                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (candidates && !candidates[i]) {
+            if (scf->log) {
+                ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                              "\"%s\" does not match \"%s\"",
+                              rule[i].re_name.data, r->uri.data);
             }
 
-        } else {
-            matches = NULL;
+            continue;
         }
 
+        matches = rule[i].msize ? scf->matches : NULL;
+
         rc = ngx_regex_exec(rule[i].regex, &r->uri, matches, rule[i].msize);
 
         if (rc == NGX_DECLINED) {
@@ -273,6 +295,8 @@ static void *ngx_http_rewrite_create_srv_conf(ngx_conf_t *cf)
     ngx_init_array(conf->rules, cf->pool, 5, sizeof(ngx_http_rewrite_rule_t),
                    NGX_CONF_ERROR);
 
+    conf->set = NULL;
+    conf->matches = NULL;
     conf->log = NGX_CONF_UNSET;
 
     return conf;
@@ -285,8 +309,51 @@ static char *ngx_http_rewrite_merge_srv_conf(ngx_conf_t *cf,
     ngx_http_rewrite_srv_conf_t *prev = parent;
     ngx_http_rewrite_srv_conf_t *conf = child;
 
+    ngx_str_t                *patterns;
+    ngx_uint_t                i, msize;
+    ngx_http_rewrite_rule_t  *rule;
+
     ngx_conf_merge_value(conf->log, prev->log, 0);
 
+    msize = 0;
+
+    rule = conf->rules.elts;
+    for (i = 0; i < conf->rules.nelts; i++) {
+        if (msize < rule[i].msize) {
+            msize = rule[i].msize;
+        }
+    }
+
+    if (msize) {
+        if (!(conf->matches = ngx_palloc(cf->pool, msize * sizeof(int)))) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (conf->rules.nelts < 2) {
+        return NGX_CONF_OK;
+    }
+
+    patterns = ngx_palloc(cf->pool, conf->rules.nelts * sizeof(ngx_str_t));
+    if (patterns == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 0; i < conf->rules.nelts; i++) {
+        patterns[i] = rule[i].re_name;
+    }
+
+    if (!(conf->set = ngx_regex_set_compile(patterns, conf->rules.nelts,
+                                            cf->pool)))
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->set->nstates == 1) {
+        /* no rule has a literal */
+        conf->set = NULL;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -16,6 +16,17 @@
 static void *ngx_http_ssl_create_srv_conf(ngx_conf_t *cf);
 static char *ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf,
                                          void *parent, void *child);
+static char *ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf);
+static char *ngx_http_ssl_session_ticket_key(ngx_conf_t *cf,
+                                             ngx_command_t *cmd, void *conf);
+
+#if (NGX_HTTP_V2) && defined TLSEXT_TYPE_application_layer_protocol_negotiation
+static int ngx_http_ssl_alpn_select(SSL *ssl, const unsigned char **out,
+                                    unsigned char *outlen,
+                                    const unsigned char *in,
+                                    unsigned int inlen, void *arg);
+#endif
 
 
 static ngx_command_t  ngx_http_ssl_commands[] = {
@@ -41,6 +52,41 @@ static ngx_command_t  ngx_http_ssl_commands[] = {
       offsetof(ngx_http_ssl_srv_conf_t, certificate_key),
       NULL },
 
+    { ngx_string("ssl_ktls"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_ssl_srv_conf_t, ktls),
+      NULL },
+
+    { ngx_string("ssl_session_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_ssl_session_cache,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("ssl_session_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_ssl_srv_conf_t, session_timeout),
+      NULL },
+
+    { ngx_string("ssl_session_tickets"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_ssl_srv_conf_t, session_tickets),
+      NULL },
+
+    { ngx_string("ssl_session_ticket_key"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_ssl_session_ticket_key,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -77,7 +123,18 @@ static void *ngx_http_ssl_create_srv_conf(ngx_conf_t *cf)
         return NGX_CONF_ERROR;
     }
 
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     scf->session_cache_name = { 0, NULL };
+     *     scf->session_ticket_keys = NULL;
+     */
+
     scf->enable = NGX_CONF_UNSET;
+    scf->ktls = NGX_CONF_UNSET;
+    scf->session_cache = NGX_CONF_UNSET_SIZE;
+    scf->session_timeout = NGX_CONF_UNSET;
+    scf->session_tickets = NGX_CONF_UNSET;
 
     return scf;
 }
@@ -101,6 +158,19 @@ static char *ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf,
     ngx_conf_merge_str_value(conf->certificate_key, prev->certificate_key,
                              NGX_DEFLAUT_CERTIFICATE_KEY);
 
+    ngx_conf_merge_value(conf->ktls, prev->ktls, 0);
+    if (conf->session_cache == NGX_CONF_UNSET_SIZE) {
+        conf->session_cache = (prev->session_cache == NGX_CONF_UNSET_SIZE) ?
+                                                     0 : prev->session_cache;
+        conf->session_cache_name = prev->session_cache_name;
+    }
+
+    ngx_conf_merge_sec_value(conf->session_timeout, prev->session_timeout,
+                             300);
+    ngx_conf_merge_value(conf->session_tickets, prev->session_tickets, 1);
+    ngx_conf_merge_ptr_value(conf->session_ticket_keys,
+                             prev->session_ticket_keys, NULL);
+
     /* TODO: configure methods */
 
     conf->ssl_ctx = SSL_CTX_new(SSLv23_server_method());
@@ -128,6 +198,183 @@ static char *ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf,
         return NGX_CONF_ERROR;
     }
 
+    if (conf->ktls && ngx_ssl_ktls(conf->ssl_ctx, cf->log) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * without the shared cache every worker has its own OpenSSL session
+     * cache, so a client is resumed only if it comes to the same worker;
+     * the servers that set or inherit the same zone name share one cache,
+     * and it is kept on the reload
+     */
+
+    if (conf->session_cache) {
+        if (ngx_ssl_session_cache(conf->ssl_ctx, cf->cycle,
+                                  &conf->session_cache_name,
+                                  conf->session_cache,
+                                  conf->session_timeout, cf->log) != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+    } else {
+        SSL_CTX_set_timeout(conf->ssl_ctx, conf->session_timeout);
+    }
+
+    if (!conf->session_tickets) {
+#ifdef SSL_OP_NO_TICKET
+        SSL_CTX_set_options(conf->ssl_ctx, SSL_OP_NO_TICKET);
+#endif
+
+    } else if (conf->session_ticket_keys) {
+        if (ngx_ssl_session_ticket_keys(conf->ssl_ctx,
+                                        conf->session_ticket_keys,
+                                        cf->pool, cf->log) != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#if (NGX_HTTP_V2) && defined TLSEXT_TYPE_application_layer_protocol_negotiation
+    SSL_CTX_set_alpn_select_cb(conf->ssl_ctx, ngx_http_ssl_alpn_select, NULL);
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_HTTP_V2) && defined TLSEXT_TYPE_application_layer_protocol_negotiation
+
+static int ngx_http_ssl_alpn_select(SSL *ssl, const unsigned char **out,
+                                    unsigned char *outlen,
+                                    const unsigned char *in,
+                                    unsigned int inlen, void *arg)
+{
+    u_char                  *srv;
+    size_t                   len;
+    ngx_connection_t        *c;
+    ngx_http_request_t      *r;
+    ngx_http_v2_srv_conf_t  *h2scf;
+
+    c = SSL_get_app_data(ssl);
+    r = c->data;
+
+    /* the configuration of the default server of the address:port */
+
+    h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+
+    if (h2scf->enable) {
+        srv = (u_char *) NGX_HTTP_V2_ALPN_ADVERTISE;
+        len = sizeof(NGX_HTTP_V2_ALPN_ADVERTISE) - 1;
+
+    } else {
+        srv = (u_char *) "\x08http/1.1";
+        len = sizeof("\x08http/1.1") - 1;
+    }
+
+    if (SSL_select_next_proto((unsigned char **) out, outlen, srv, len,
+                              in, inlen)
+        != OPENSSL_NPN_NEGOTIATED)
+    {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0, "ssl alpn selected: %.*s",
+                   (int) *outlen, *out);
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+#endif
+
+
+/* ssl_session_cache  off | shared:name:size; */
+
+static char *ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf)
+{
+    ngx_http_ssl_srv_conf_t *scf = conf;
+
+    u_char     *p, *name;
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+
+    if (scf->session_cache != NGX_CONF_UNSET_SIZE) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len == sizeof("off") - 1
+        && ngx_strcmp(value[1].data, "off") == 0)
+    {
+        scf->session_cache = 0;
+        return NGX_CONF_OK;
+    }
+
+    if (value[1].len <= sizeof("shared:") - 1
+        || ngx_strncmp(value[1].data, "shared:", sizeof("shared:") - 1) != 0)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid session cache \"%s\", it must be "
+                           "\"off\" or \"shared:name:size\"",
+                           value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    name = value[1].data + sizeof("shared:") - 1;
+
+    for (p = name; *p && *p != ':'; p++) { /* void */ }
+
+    if (*p != ':' || p == name) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid session cache \"%s\"", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    scf->session_cache_name.len = p - name;
+    scf->session_cache_name.data = name;
+    *p++ = '\0';
+
+    s.len = value[1].data + value[1].len - p;
+    s.data = p;
+
+    if (s.len == 0 || (n = ngx_parse_size(&s)) == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid session cache size \"%s\"", s.data);
+        return NGX_CONF_ERROR;
+    }
+
+    scf->session_cache = (size_t) n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *ngx_http_ssl_session_ticket_key(ngx_conf_t *cf,
+                                             ngx_command_t *cmd, void *conf)
+{
+    ngx_http_ssl_srv_conf_t *scf = conf;
+
+    ngx_str_t  *value, *path;
+
+    if (scf->session_ticket_keys == NULL) {
+        scf->session_ticket_keys = ngx_create_array(cf->pool, 2,
+                                                    sizeof(ngx_str_t));
+        if (scf->session_ticket_keys == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (!(path = ngx_push_array(scf->session_ticket_keys))) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    *path = value[1];
+
     return NGX_CONF_OK;
 }
 
@@ -17,6 +17,13 @@ typedef struct {
     ngx_flag_t      enable;
     ngx_str_t       certificate;
     ngx_str_t       certificate_key;
+    ngx_flag_t      ktls;
+
+    ngx_str_t       session_cache_name;
+    size_t          session_cache;
+    time_t          session_timeout;
+    ngx_flag_t      session_tickets;
+    ngx_array_t    *session_ticket_keys;
 
     ngx_ssl_ctx_t  *ssl_ctx;
 } ngx_http_ssl_srv_conf_t;
@@ -9,12 +9,80 @@
 #include <ngx_http.h>
 
 
+/*
+ * the in-memory cache of small static files: the entries are allocated
+ * in the worker memory on demand, looked up by the file name and evicted
+ * in the LRU order when the cache size limit is reached
+ */
+
+typedef struct ngx_http_static_cache_entry_s  ngx_http_static_cache_entry_t;
+
 typedef struct {
-    ngx_http_cache_hash_t  *redirect_cache;
+    ngx_http_static_cache_entry_t  **hash;
+    ngx_uint_t                       hash_mask;
+
+    ngx_http_static_cache_entry_t   *head;     /* the most recently used */
+    ngx_http_static_cache_entry_t   *tail;     /* the least recently used */
+
+    size_t                           size;
+    size_t                           used;
+
+    ngx_log_t                       *log;
+} ngx_http_static_cache_t;
+
+
+struct ngx_http_static_cache_entry_s {
+    ngx_http_static_cache_entry_t   *next;     /* the hash chain */
+
+    ngx_http_static_cache_entry_t   *lru_prev;
+    ngx_http_static_cache_entry_t   *lru_next;
+
+    ngx_http_static_cache_t         *cache;
+
+    uint32_t                         crc;
+    ngx_uint_t                       count;    /* the requests using entry */
+    size_t                           alloc;
+
+    ngx_str_t                        name;
+    u_char                          *body;
+    size_t                           size;
+
+    time_t                           mtime;
+    time_t                           checked;
+
+    unsigned                         deleted:1;
+
+    u_char                           last_modified
+                                     [sizeof("Mon, 28 Sep 1970 06:00:00 GMT")];
+};
+
+
+#define NGX_HTTP_STATIC_CACHE_MIN_HASH  64
+
+
+typedef struct {
+    ngx_http_cache_hash_t    *redirect_cache;
+
+    ngx_http_static_cache_t  *cache;
+    size_t                    cache_max_file_size;
+    time_t                    cache_valid;
 } ngx_http_static_loc_conf_t;
 
 
 static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_static_cache_send(ngx_http_request_t *r,
+                                            ngx_http_static_loc_conf_t *slcf,
+                                            ngx_str_t *name);
+static ngx_http_static_cache_entry_t *ngx_http_static_cache_add(
+                ngx_http_request_t *r, ngx_http_static_cache_t *cache,
+                ngx_str_t *name, ngx_fd_t fd, ngx_file_info_t *fi);
+static ngx_int_t ngx_http_static_cache_output(ngx_http_request_t *r,
+                                            ngx_http_static_cache_entry_t *e);
+static void ngx_http_static_cache_delete(ngx_http_static_cache_entry_t *e);
+static void ngx_http_static_cache_release(void *data);
+static void ngx_http_static_cache_cleanup(void *data);
+static char *ngx_http_static_set_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+                                       void *conf);
 static void *ngx_http_static_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_static_merge_loc_conf(ngx_conf_t *cf,
                                             void *parent, void *child);
@@ -34,6 +102,27 @@ static ngx_command_t  ngx_http_static_commands[] = {
 
 #endif
 
+    { ngx_string("static_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_static_set_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("static_cache_max_file_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_static_loc_conf_t, cache_max_file_size),
+      NULL },
+
+    { ngx_string("static_cache_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_static_loc_conf_t, cache_valid),
+      NULL },
+
       ngx_null_command
 };
 
@@ -65,23 +154,24 @@ ngx_module_t  ngx_http_static_module = {
 
 static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
 {
-    u_char                      *last;
-    ngx_fd_t                     fd;
-    ngx_int_t                    rc;
-    ngx_uint_t                   level;
-    ngx_str_t                    name, location;
-    ngx_err_t                    err;
-    ngx_log_t                   *log;
-    ngx_buf_t                   *b;
-    ngx_chain_t                  out;
-    ngx_file_info_t              fi;
-    ngx_http_cleanup_t          *file_cleanup, *redirect_cleanup;
-    ngx_http_log_ctx_t          *ctx;
-    ngx_http_core_loc_conf_t    *clcf;
-    ngx_http_static_loc_conf_t  *slcf;
+    u_char                         *last;
+    ngx_fd_t                        fd;
+    ngx_int_t                       rc;
+    ngx_uint_t                      level;
+    ngx_str_t                       name, location;
+    ngx_err_t                       err;
+    ngx_log_t                      *log;
+    ngx_buf_t                      *b;
+    ngx_chain_t                     out;
+    ngx_file_info_t                 fi;
+    ngx_http_cleanup_t             *file_cleanup, *redirect_cleanup;
+    ngx_http_log_ctx_t             *ctx;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_static_loc_conf_t     *slcf;
+    ngx_http_static_cache_entry_t  *e;
 #if (NGX_HTTP_CACHE)
-    uint32_t                     file_crc, redirect_crc;
-    ngx_http_cache_t            *file, *redirect;
+    uint32_t                        file_crc, redirect_crc;
+    ngx_http_cache_t               *file, *redirect;
 #endif
 
     if (r->uri.data[r->uri.len - 1] == '/') {
@@ -169,6 +259,21 @@ static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                    "http filename: \"%s\"", name.data);
 
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_static_module);
+
+    /*
+     * the cached files are sent from memory in the single buf,
+     * and the range filter supports the file bufs only
+     */
+
+    if (slcf->cache && r->headers_in.range == NULL) {
+        rc = ngx_http_static_cache_send(r, slcf, &name);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
 
     /* allocate cleanups */
 
@@ -177,7 +282,6 @@ static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
     }
     file_cleanup->valid = 0;
 
-    slcf = ngx_http_get_module_loc_conf(r, ngx_http_static_module);
     if (slcf->redirect_cache) {
         if (!(redirect_cleanup = ngx_push_array(&r->cleanup))) {
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -475,6 +579,23 @@ static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
 
 #endif
 
+    if (slcf->cache
+        && r->headers_in.range == NULL
+        && ngx_file_size(&fi) > 0
+        && ngx_file_size(&fi) <= (off_t) slcf->cache_max_file_size)
+    {
+        e = ngx_http_static_cache_add(r, slcf->cache, &name, fd, &fi);
+
+        if (e) {
+            if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                              ngx_close_file_n " \"%s\" failed", name.data);
+            }
+
+            return ngx_http_static_cache_output(r, e);
+        }
+    }
+
     ctx = log->data;
     ctx->action = "sending response to client";
 
@@ -482,6 +603,7 @@ static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
     file_cleanup->data.file.name = name.data;
     file_cleanup->valid = 1;
     file_cleanup->cache = 0;
+    file_cleanup->handler = 0;
 
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = ngx_file_size(&fi);
@@ -538,6 +660,338 @@ static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t ngx_http_static_cache_send(ngx_http_request_t *r,
+                                            ngx_http_static_loc_conf_t *slcf,
+                                            ngx_str_t *name)
+{
+    uint32_t                        crc;
+    ngx_file_info_t                 fi;
+    ngx_http_static_cache_t        *cache;
+    ngx_http_static_cache_entry_t  *e;
+
+    cache = slcf->cache;
+
+    if (cache->hash == NULL) {
+        return NGX_DECLINED;
+    }
+
+    crc = ngx_crc((char *) name->data, name->len);
+
+    for (e = cache->hash[crc & cache->hash_mask]; e; e = e->next) {
+        if (e->crc == crc
+            && e->name.len == name->len
+            && ngx_memcmp(e->name.data, name->data, name->len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (e == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_time() - e->checked >= slcf->cache_valid) {
+
+        if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR
+            || !ngx_is_file(&fi)
+            || ngx_file_mtime(&fi) != e->mtime
+            || ngx_file_size(&fi) != (off_t) e->size)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http static cache stale: \"%s\"", name->data);
+
+            ngx_http_static_cache_delete(e);
+
+            return NGX_DECLINED;
+        }
+
+        e->checked = ngx_time();
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache hit: \"%s\"", name->data);
+
+    /* move the entry to the head of the LRU list */
+
+    if (e != cache->head) {
+        e->lru_prev->lru_next = e->lru_next;
+
+        if (e->lru_next) {
+            e->lru_next->lru_prev = e->lru_prev;
+
+        } else {
+            cache->tail = e->lru_prev;
+        }
+
+        e->lru_prev = NULL;
+        e->lru_next = cache->head;
+        cache->head->lru_prev = e;
+        cache->head = e;
+    }
+
+    return ngx_http_static_cache_output(r, e);
+}
+
+
+static ngx_http_static_cache_entry_t *ngx_http_static_cache_add(
+                ngx_http_request_t *r, ngx_http_static_cache_t *cache,
+                ngx_str_t *name, ngx_fd_t fd, ngx_file_info_t *fi)
+{
+    size_t                          size, alloc;
+    ssize_t                         n;
+    uint32_t                        crc;
+    ngx_uint_t                      i;
+    ngx_file_t                      file;
+    ngx_http_static_cache_entry_t  *e, **bucket;
+
+    size = (size_t) ngx_file_size(fi);
+    alloc = sizeof(ngx_http_static_cache_entry_t) + name->len + 1 + size;
+
+    if (alloc > cache->size) {
+        return NULL;
+    }
+
+    if (cache->hash == NULL) {
+        for (i = NGX_HTTP_STATIC_CACHE_MIN_HASH;
+             i < cache->size / ngx_pagesize;
+             i <<= 1)
+        {
+            /* void */
+        }
+
+        cache->hash = ngx_calloc(i * sizeof(ngx_http_static_cache_entry_t *),
+                                 cache->log);
+        if (cache->hash == NULL) {
+            return NULL;
+        }
+
+        cache->hash_mask = i - 1;
+    }
+
+    /*
+     * the entries that are still being sent are removed from the cache
+     * but freed only when the last request releases them,
+     * so the memory used may temporarily exceed the limit
+     */
+
+    while (cache->used + alloc > cache->size && cache->tail) {
+        ngx_http_static_cache_delete(cache->tail);
+    }
+
+    if (!(e = ngx_alloc(alloc, cache->log))) {
+        return NULL;
+    }
+
+    e->name.len = name->len;
+    e->name.data = (u_char *) e + sizeof(ngx_http_static_cache_entry_t);
+    e->body = e->name.data + name->len + 1;
+
+    file.fd = fd;
+    file.name = *name;
+    file.log = r->connection->log;
+    file.sys_offset = 0;
+
+    n = ngx_read_file(&file, e->body, size, 0);
+
+    if (n != (ssize_t) size) {
+        if (n != NGX_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                          ngx_read_file_n " read only " SIZE_T_FMT
+                          " of " SIZE_T_FMT " bytes from \"%s\"",
+                          (size_t) n, size, name->data);
+        }
+
+        ngx_free(e);
+        return NULL;
+    }
+
+    ngx_memcpy(e->name.data, name->data, name->len + 1);
+
+    crc = ngx_crc((char *) name->data, name->len);
+
+    e->cache = cache;
+    e->crc = crc;
+    e->count = 0;
+    e->alloc = alloc;
+    e->size = size;
+    e->mtime = ngx_file_mtime(fi);
+    e->checked = ngx_time();
+    e->deleted = 0;
+
+    ngx_http_time(e->last_modified, e->mtime);
+
+    bucket = &cache->hash[crc & cache->hash_mask];
+    e->next = *bucket;
+    *bucket = e;
+
+    e->lru_prev = NULL;
+    e->lru_next = cache->head;
+
+    if (cache->head) {
+        cache->head->lru_prev = e;
+
+    } else {
+        cache->tail = e;
+    }
+
+    cache->head = e;
+
+    cache->used += alloc;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache add: \"%s\" " SIZE_T_FMT
+                   ", used " SIZE_T_FMT,
+                   name->data, size, cache->used);
+
+    return e;
+}
+
+
+static ngx_int_t ngx_http_static_cache_output(ngx_http_request_t *r,
+                                            ngx_http_static_cache_entry_t *e)
+{
+    ngx_int_t            rc;
+    ngx_buf_t           *b;
+    ngx_chain_t          out;
+    ngx_table_elt_t     *h;
+    ngx_pool_cleanup_t  *cln;
+
+    /* the entry must not be freed while the response is being sent */
+
+    if (!(cln = ngx_pool_cleanup_add(r->pool, 0))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln->handler = ngx_http_static_cache_release;
+    cln->data = e;
+
+    e->count++;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = e->size;
+    r->headers_out.last_modified_time = e->mtime;
+
+    /* the "Last-Modified" value is formatted once per entry */
+
+    if (!(h = ngx_list_push(&r->headers_out.headers))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    h->key.len = sizeof("Last-Modified") - 1;
+    h->key.data = (u_char *) "Last-Modified";
+    h->value.len = sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1;
+    h->value.data = e->last_modified;
+
+    r->headers_out.last_modified = h;
+
+    if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    if (!(b = ngx_calloc_buf(r->pool))) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* only the requests without "Range" are served from the cache */
+
+    r->filter_allow_ranges = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    /*
+     * the header and the small body are both in memory,
+     * so the write filter sends them with the single writev()
+     */
+
+    b->memory = 1;
+    b->pos = e->body;
+    b->last = e->body + e->size;
+
+    if (!r->main) {
+        b->last_buf = 1;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static void ngx_http_static_cache_delete(ngx_http_static_cache_entry_t *e)
+{
+    ngx_http_static_cache_t         *cache;
+    ngx_http_static_cache_entry_t  **pe;
+
+    cache = e->cache;
+
+    for (pe = &cache->hash[e->crc & cache->hash_mask]; *pe; pe = &(*pe)->next) {
+        if (*pe == e) {
+            *pe = e->next;
+            break;
+        }
+    }
+
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+
+    } else {
+        cache->head = e->lru_next;
+    }
+
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+
+    } else {
+        cache->tail = e->lru_prev;
+    }
+
+    cache->used -= e->alloc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cache->log, 0,
+                   "http static cache delete: \"%s\", count %"
+                   NGX_UINT_T_FMT,
+                   e->name.data, e->count);
+
+    if (e->count) {
+        e->deleted = 1;
+        return;
+    }
+
+    ngx_free(e);
+}
+
+
+static void ngx_http_static_cache_release(void *data)
+{
+    ngx_http_static_cache_entry_t  *e = data;
+
+    if (--e->count == 0 && e->deleted) {
+        ngx_free(e);
+    }
+}
+
+
+static void ngx_http_static_cache_cleanup(void *data)
+{
+    ngx_http_static_cache_t  *cache = data;
+
+    while (cache->tail) {
+        ngx_http_static_cache_delete(cache->tail);
+    }
+
+    if (cache->hash) {
+        ngx_free(cache->hash);
+    }
+}
+
+
 static void *ngx_http_static_create_loc_conf(ngx_conf_t *cf)
 {
     ngx_http_static_loc_conf_t  *conf;
@@ -548,6 +1002,10 @@ static void *ngx_http_static_create_loc_conf(ngx_conf_t *cf)
 
     conf->redirect_cache = NULL;
 
+    conf->cache = NGX_CONF_UNSET_PTR;
+    conf->cache_max_file_size = NGX_CONF_UNSET_SIZE;
+    conf->cache_valid = NGX_CONF_UNSET;
+
     return conf;
 }
 
@@ -562,6 +1020,62 @@ static char *ngx_http_static_merge_loc_conf(ngx_conf_t *cf,
         conf->redirect_cache = prev->redirect_cache;
     }
 
+    if (conf->cache == NGX_CONF_UNSET_PTR) {
+        conf->cache = (prev->cache == NGX_CONF_UNSET_PTR) ? NULL : prev->cache;
+    }
+
+    ngx_conf_merge_size_value(conf->cache_max_file_size,
+                              prev->cache_max_file_size, 16 * 1024);
+    ngx_conf_merge_sec_value(conf->cache_valid, prev->cache_valid, 1);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *ngx_http_static_set_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+                                       void *conf)
+{
+    ngx_http_static_loc_conf_t *slcf = conf;
+
+    ngx_int_t                 size;
+    ngx_str_t                *value;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_static_cache_t  *cache;
+
+    if (slcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR || size == 0) {
+        return "invalid value";
+    }
+
+    if (!(cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_static_cache_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->size = size;
+    cache->log = cf->cycle->new_log;
+
+    /* free the worker memory of the cache with the cycle */
+
+    if (!(cln = ngx_pool_cleanup_add(cf->pool, 0))) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_static_cache_cleanup;
+    cln->data = cache;
+
+    slcf->cache = cache;
+
     return NGX_CONF_OK;
 }
 
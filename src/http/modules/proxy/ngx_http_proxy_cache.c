@@ -299,7 +299,11 @@ void ngx_http_proxy_cache_busy_lock(ngx_http_proxy_ctx_t *p)
     if (rc == NGX_AGAIN) {
 
         if ((ngx_event_flags & (NGX_USE_CLEAR_EVENT|NGX_HAVE_KQUEUE_EVENT))
-            && !p->request->connection->write->active)
+            && !p->request->connection->write->active
+#if (NGX_HTTP_V2)
+            && p->request->stream == NULL
+#endif
+           )
         {
             /*
              * kqueue allows to detect when client closes prematurely
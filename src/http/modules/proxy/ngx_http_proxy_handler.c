@@ -11,6 +11,10 @@
 
 
 static ngx_int_t ngx_http_proxy_handler(ngx_http_request_t *r);
+static void ngx_http_proxy_resolve(ngx_http_proxy_loc_conf_t *lcf);
+static void ngx_http_proxy_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_proxy_set_peer_text(ngx_peer_t *peer,
+                                         ngx_http_proxy_upstream_conf_t *u);
 
 static u_char *ngx_http_proxy_log_proxy_state(ngx_http_request_t *r,
                                               u_char *buf, uintptr_t data);
@@ -28,6 +32,8 @@ static char *ngx_http_proxy_set_pass(ngx_conf_t *cf, ngx_command_t *cmd,
                                      void *conf);
 static char *ngx_http_proxy_parse_upstream(ngx_str_t *url,
                                            ngx_http_proxy_upstream_conf_t *u);
+static char *ngx_http_proxy_set_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf);
 
 
 static ngx_conf_bitmask_t  next_upstream_masks[] = {
@@ -51,6 +57,14 @@ static ngx_conf_bitmask_t  use_stale_masks[] = {
 };
 
 
+static ngx_conf_enum_t  ngx_http_proxy_buffering[] = {
+    { ngx_string("disk"), NGX_EVENT_PIPE_BUFFERING_DISK },
+    { ngx_string("memory"), NGX_EVENT_PIPE_BUFFERING_MEMORY },
+    { ngx_string("adaptive"), NGX_EVENT_PIPE_BUFFERING_ADAPTIVE },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_conf_num_bounds_t  ngx_http_proxy_lm_factor_bounds = {
     ngx_conf_check_num_bounds, 0, 100
 };
@@ -79,6 +93,20 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, send_timeout),
       NULL },
 
+    { ngx_string("proxy_resolver"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_proxy_set_resolver,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("proxy_resolver_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, resolver_timeout),
+      NULL },
+
     { ngx_string("proxy_preserve_host"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -128,10 +156,24 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, busy_buffers_size),
       NULL },
 
+    { ngx_string("proxy_buffering"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, buffering),
+      &ngx_http_proxy_buffering },
+
+    { ngx_string("proxy_buffers_memory"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, buffers_memory),
+      NULL },
+
 #if (NGX_HTTP_FILE_CACHE)
 
     { ngx_string("proxy_cache_path"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1234,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_conf_set_path_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_proxy_loc_conf_t, cache_path),
@@ -140,7 +182,7 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
 #endif
 
     { ngx_string("proxy_temp_path"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1234,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_conf_set_path_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_proxy_loc_conf_t, temp_path),
@@ -153,6 +195,20 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, temp_file_write_size),
       NULL },
 
+    { ngx_string("proxy_temp_file_preallocate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, temp_file_preallocate),
+      NULL },
+
+    { ngx_string("proxy_temp_file_nocache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, temp_file_nocache),
+      NULL },
+
     { ngx_string("proxy_cache"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -326,6 +382,10 @@ static ngx_int_t ngx_http_proxy_handler(ngx_http_request_t *r)
     /* TODO: we currently support reverse proxy only */
     p->accel = 1;
 
+    if (p->lcf->resolver && p->lcf->upstream->resolve) {
+        ngx_http_proxy_resolve(p->lcf);
+    }
+
     ngx_init_array(p->states, r->pool, p->lcf->peers->number,
                    sizeof(ngx_http_proxy_state_t),
                    NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -374,6 +434,139 @@ static ngx_int_t ngx_http_proxy_handler(ngx_http_request_t *r)
 }
 
 
+/*
+ * the host name of "proxy_pass" is resolved on startup and then is refreshed
+ * when the answer TTL expires; the requests do not wait for the resolver
+ * and use the previous peers until the new answer arrives
+ */
+
+static void ngx_http_proxy_resolve(ngx_http_proxy_loc_conf_t *lcf)
+{
+    ngx_int_t                        rc;
+    ngx_resolver_ctx_t              *ctx;
+    ngx_http_proxy_upstream_conf_t  *u;
+
+    u = lcf->upstream;
+
+    if (u->resolving || u->valid > ngx_time()) {
+        return;
+    }
+
+    ctx = &u->resolver_ctx;
+
+    ctx->resolver = lcf->resolver;
+    ctx->name = u->host;
+    ctx->timeout = lcf->resolver_timeout;
+    ctx->handler = ngx_http_proxy_resolve_handler;
+    ctx->data = lcf;
+
+    rc = ngx_resolve_name(ctx);
+
+    if (rc == NGX_OK) {
+        ngx_http_proxy_resolve_handler(ctx);
+        return;
+    }
+
+    if (rc == NGX_AGAIN) {
+        u->resolving = 1;
+        return;
+    }
+
+    u->valid = ngx_time() + NGX_HTTP_PROXY_RESOLVE_RETRY;
+}
+
+
+static void ngx_http_proxy_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    ngx_http_proxy_loc_conf_t *lcf = ctx->data;
+
+    ngx_uint_t                       i, n;
+    ngx_peers_t                     *peers;
+    ngx_http_proxy_upstream_conf_t  *u;
+
+    u = lcf->upstream;
+    peers = lcf->peers;
+
+    u->resolving = 0;
+
+    if (ctx->state != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "%s could not be resolved (%d: %s), "
+                      "the previous addresses are used",
+                      peers->peers[0].host.data,
+                      ctx->state, ngx_resolver_strerror(ctx->state));
+
+        u->valid = ngx_time() + NGX_HTTP_PROXY_RESOLVE_RETRY;
+        return;
+    }
+
+    /* the TTL may be 0, the host is not resolved more than once a second */
+
+    u->valid = ctx->valid > ngx_time() ? ctx->valid : ngx_time() + 1;
+
+    if (ctx->naddrs == (ngx_uint_t) peers->number) {
+        for (n = 0; n < ctx->naddrs; n++) {
+            for (i = 0; i < ctx->naddrs; i++) {
+                if (peers->peers[i].addr == ctx->addrs[n]) {
+                    break;
+                }
+            }
+
+            if (i == ctx->naddrs) {
+                break;
+            }
+        }
+
+        if (n == ctx->naddrs) {
+            return;
+        }
+    }
+
+    /*
+     * the peers array has room for u->max_peers peers, so the requests
+     * in progress that still use the former peer numbers stay in its bounds
+     */
+
+    n = ctx->naddrs < u->max_peers ? ctx->naddrs : u->max_peers;
+
+    for (i = 0; i < n; i++) {
+        peers->peers[i].addr = ctx->addrs[i];
+        peers->peers[i].fails = 0;
+        peers->peers[i].accessed = 0;
+
+        ngx_http_proxy_set_peer_text(&peers->peers[i], u);
+    }
+
+    peers->number = n;
+
+    if (peers->current >= peers->number) {
+        peers->current = 0;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "%s is resolved to %d addresses, the first is %s",
+                  peers->peers[0].host.data, n,
+                  peers->peers[0].addr_port_text.data);
+}
+
+
+static void ngx_http_proxy_set_peer_text(ngx_peer_t *peer,
+                                         ngx_http_proxy_upstream_conf_t *u)
+{
+    size_t  len;
+
+    len = ngx_inet_ntop(AF_INET, &peer->addr, peer->addr_port_text.data,
+                        INET_ADDRSTRLEN);
+
+    peer->addr_port_text.data[len++] = ':';
+
+    ngx_cpystrn(peer->addr_port_text.data + len, u->port_text.data,
+                u->port_text.len + 1);
+
+    peer->addr_port_text.len = len + u->port_text.len;
+}
+
+
 void ngx_http_proxy_check_broken_connection(ngx_event_t *ev)
 {
     int                    n;
@@ -597,6 +790,7 @@ void ngx_http_proxy_finalize_request(ngx_http_proxy_ctx_t *p, int rc)
     }
 
     if (p->upstream && p->upstream->event_pipe) {
+        ngx_event_pipe_free_memory(p->upstream->event_pipe);
         r->file.fd = p->upstream->event_pipe->temp_file->file.fd;
 
     } else if (p->cache) {
@@ -678,9 +872,10 @@ void ngx_http_proxy_close_connection(ngx_http_proxy_ctx_t *p)
         ngx_mutex_unlock(ngx_posted_events_mutex);
     }
 
+    ngx_free_connection(c);
+
     fd = c->fd;
     c->fd = (ngx_socket_t) -1;
-    c->data = NULL;
 
     if (ngx_close_socket(fd) == -1) {
         ngx_log_error(NGX_LOG_ALERT, c->log, ngx_socket_errno,
@@ -867,6 +1062,7 @@ static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
 
     conf->upstreams = NULL;
     conf->peers = NULL;
+    conf->resolver = NULL;
 
     conf->cache_path = NULL;
     conf->temp_path = NULL;
@@ -877,6 +1073,7 @@ static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
 
     conf->connect_timeout = NGX_CONF_UNSET_MSEC;
     conf->send_timeout = NGX_CONF_UNSET_MSEC;
+    conf->resolver_timeout = NGX_CONF_UNSET_MSEC;
 
     conf->preserve_host = NGX_CONF_UNSET;
     conf->set_x_real_ip = NGX_CONF_UNSET;
@@ -886,6 +1083,9 @@ static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->read_timeout = NGX_CONF_UNSET_MSEC;
     conf->busy_buffers_size = NGX_CONF_UNSET_SIZE;
 
+    conf->buffering = NGX_CONF_UNSET_UINT;
+    conf->buffers_memory = NGX_CONF_UNSET_SIZE;
+
     /*
      * "proxy_max_temp_file_size" is hardcoded to 1G for reverse proxy,
      * it should be configurable in the generic proxy
@@ -893,6 +1093,8 @@ static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->max_temp_file_size = 1024 * 1024 * 1024;
 
     conf->temp_file_write_size = NGX_CONF_UNSET_SIZE;
+    conf->temp_file_preallocate = NGX_CONF_UNSET_SIZE;
+    conf->temp_file_nocache = NGX_CONF_UNSET;
 
     /* "proxy_cyclic_temp_file" is disabled */
     conf->cyclic_temp_file = 0;
@@ -921,6 +1123,10 @@ static char *ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf,
                               prev->connect_timeout, 60000);
     ngx_conf_merge_msec_value(conf->send_timeout, prev->send_timeout, 60000);
 
+    ngx_conf_merge_ptr_value(conf->resolver, prev->resolver, NULL);
+    ngx_conf_merge_msec_value(conf->resolver_timeout,
+                              prev->resolver_timeout, 30000);
+
     ngx_conf_merge_value(conf->preserve_host, prev->preserve_host, 0);
     ngx_conf_merge_value(conf->set_x_real_ip, prev->set_x_real_ip, 0);
     ngx_conf_merge_value(conf->add_x_forwarded_for,
@@ -1001,6 +1207,40 @@ static char *ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf,
     }
 
 
+    ngx_conf_merge_unsigned_value(conf->buffering, prev->buffering,
+                                  NGX_EVENT_PIPE_BUFFERING_DISK);
+
+    ngx_conf_merge_size_value(conf->buffers_memory, prev->buffers_memory,
+                              32 * 1024 * 1024);
+
+    ngx_conf_merge_size_value(conf->temp_file_preallocate,
+                              prev->temp_file_preallocate, 0);
+
+    ngx_conf_merge_value(conf->temp_file_nocache, prev->temp_file_nocache, 0);
+
+#if !(HAVE_POSIX_FALLOCATE)
+
+    if (conf->temp_file_preallocate) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"proxy_temp_file_preallocate\" is not supported "
+                           "on this platform, ignored");
+        conf->temp_file_preallocate = 0;
+    }
+
+#endif
+
+#if !(HAVE_POSIX_FADVISE)
+
+    if (conf->temp_file_nocache) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"proxy_temp_file_nocache\" is not supported "
+                           "on this platform, ignored");
+        conf->temp_file_nocache = 0;
+    }
+
+#endif
+
+
     ngx_conf_merge_bitmask_value(conf->next_upstream, prev->next_upstream,
                                  (NGX_CONF_BITMASK_SET
                                   |NGX_HTTP_PROXY_FT_ERROR
@@ -1113,20 +1353,26 @@ static char *ngx_http_proxy_set_pass(ngx_conf_t *cf, ngx_command_t *cmd,
 
         for (i = 0; h->h_addr_list[i] != NULL; i++) { /* void */ }
 
+        /* the resolver may return more addresses than the startup lookup */
+
+        lcf->upstream->resolve = 1;
+        lcf->upstream->max_peers = i > NGX_RESOLVER_MAX_ADDRS ?
+                                                   i : NGX_RESOLVER_MAX_ADDRS;
+
         /* MP: ngx_shared_palloc() */
 
         ngx_test_null(lcf->peers,
                       ngx_pcalloc(cf->pool,
                                   sizeof(ngx_peers_t)
-                                  + sizeof(ngx_peer_t) * (i - 1)),
+                                  + sizeof(ngx_peer_t)
+                                    * (lcf->upstream->max_peers - 1)),
                       NGX_CONF_ERROR);
 
         lcf->peers->number = i;
 
-        for (i = 0; h->h_addr_list[i] != NULL; i++) {
+        for (i = 0; i < lcf->upstream->max_peers; i++) {
             lcf->peers->peers[i].host.data = host;
             lcf->peers->peers[i].host.len = lcf->upstream->host.len;
-            lcf->peers->peers[i].addr = *(in_addr_t *)(h->h_addr_list[i]);
             lcf->peers->peers[i].port = lcf->upstream->port;
 
             len = INET_ADDRSTRLEN + lcf->upstream->port_text.len + 1;
@@ -1134,19 +1380,11 @@ static char *ngx_http_proxy_set_pass(ngx_conf_t *cf, ngx_command_t *cmd,
                           ngx_palloc(cf->pool, len),
                           NGX_CONF_ERROR);
 
-            len = ngx_inet_ntop(AF_INET,
-                                &lcf->peers->peers[i].addr,
-                                lcf->peers->peers[i].addr_port_text.data,
-                                len);
-
-            lcf->peers->peers[i].addr_port_text.data[len++] = ':';
-
-            ngx_cpystrn(lcf->peers->peers[i].addr_port_text.data + len,
-                        lcf->upstream->port_text.data,
-                        lcf->upstream->port_text.len + 1);
-
-            lcf->peers->peers[i].addr_port_text.len =
-                                        len + lcf->upstream->port_text.len + 1;
+            if (i < (ngx_uint_t) lcf->peers->number) {
+                lcf->peers->peers[i].addr = *(in_addr_t *)(h->h_addr_list[i]);
+                ngx_http_proxy_set_peer_text(&lcf->peers->peers[i],
+                                             lcf->upstream);
+            }
         }
 
     } else {
@@ -1194,6 +1432,31 @@ static char *ngx_http_proxy_set_pass(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *ngx_http_proxy_set_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf)
+{
+    ngx_http_proxy_loc_conf_t *lcf = conf;
+
+    ngx_str_t  *value;
+
+    if (lcf->resolver) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    lcf->resolver = ngx_resolver_create(cf, &value[1]);
+
+    if (lcf->resolver == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid resolver address \"%s\"", value[1].data);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *ngx_http_proxy_parse_upstream(ngx_str_t *url,
                                            ngx_http_proxy_upstream_conf_t *u)
 {
@@ -13,6 +13,7 @@
 #include <ngx_event.h>
 #include <ngx_event_connect.h>
 #include <ngx_event_pipe.h>
+#include <ngx_event_resolver.h>
 #include <ngx_http.h>
 
 
@@ -49,7 +50,14 @@ typedef struct {
 
     in_port_t                        port;
 
+    /* the peers of the host name are refreshed by the resolver */
+    ngx_uint_t                       max_peers;
+    time_t                           valid;
+    ngx_resolver_ctx_t               resolver_ctx;
+
     unsigned                         default_port:1;
+    unsigned                         resolve:1;
+    unsigned                         resolving:1;
 } ngx_http_proxy_upstream_conf_t;
 
 
@@ -58,20 +66,25 @@ typedef struct {
     size_t                           busy_buffers_size;
     size_t                           max_temp_file_size;
     size_t                           temp_file_write_size;
+    size_t                           temp_file_preallocate;
+    size_t                           buffers_memory;
 
     ngx_msec_t                       connect_timeout;
     ngx_msec_t                       send_timeout;
     ngx_msec_t                       read_timeout;
+    ngx_msec_t                       resolver_timeout;
     time_t                           default_expires;
 
     ngx_int_t                        lm_factor;
 
+    ngx_uint_t                       buffering;
     ngx_uint_t                       next_upstream;
     ngx_uint_t                       use_stale;
 
     ngx_bufs_t                       bufs;
 
     ngx_flag_t                       cyclic_temp_file;
+    ngx_flag_t                       temp_file_nocache;
     ngx_flag_t                       cache;
     ngx_flag_t                       preserve_host;
     ngx_flag_t                       set_x_real_ip;
@@ -87,6 +100,8 @@ typedef struct {
 
     ngx_http_proxy_upstream_conf_t  *upstream;
     ngx_peers_t                     *peers;
+
+    ngx_resolver_t                  *resolver;
 } ngx_http_proxy_loc_conf_t;
 
 
@@ -215,6 +230,10 @@ typedef struct {
 #define NGX_HTTP_PROXY_PARSE_NO_HEADER       30
 
 
+/* the failed resolving is retried in 5 seconds */
+#define NGX_HTTP_PROXY_RESOLVE_RETRY         5
+
+
 #define NGX_HTTP_PROXY_FT_ERROR              0x02
 #define NGX_HTTP_PROXY_FT_TIMEOUT            0x04
 #define NGX_HTTP_PROXY_FT_INVALID_HEADER     0x08
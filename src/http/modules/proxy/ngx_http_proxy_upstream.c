@@ -374,7 +374,17 @@ static void ngx_http_proxy_init_upstream(void *data)
 
     r->connection->read->event_handler = ngx_http_proxy_check_broken_connection;
 
-    if (ngx_event_flags & NGX_USE_CLEAR_EVENT) {
+    /*
+     * the events of an HTTP/2 stream are not in a kernel, the reset stream
+     * is detected when the response is sent
+     */
+
+    if ((ngx_event_flags & NGX_USE_CLEAR_EVENT)
+#if (NGX_HTTP_V2)
+        && r->stream == NULL
+#endif
+       )
+    {
 
         r->connection->write->event_handler =
                                         ngx_http_proxy_check_broken_connection;
@@ -1254,6 +1264,11 @@ static void ngx_http_proxy_send_response(ngx_http_proxy_ctx_t *p)
 
     ep->max_temp_file_size = p->lcf->max_temp_file_size;
     ep->temp_file_write_size = p->lcf->temp_file_write_size;
+    ep->temp_file_preallocate = p->lcf->temp_file_preallocate;
+    ep->temp_file_nocache = p->lcf->temp_file_nocache;
+
+    ep->buffering = p->lcf->buffering;
+    ep->max_memory = p->lcf->buffers_memory;
 
     if (!(ep->preread_bufs = ngx_alloc_chain_link(r->pool))) {
         ngx_http_proxy_finalize_request(p, 0);
@@ -658,15 +658,30 @@ static char *ngx_http_merge_locations(ngx_conf_t *cf,
     clcfp = /* (ngx_http_core_loc_conf_t **) */ locations->elts;
     // 遍历父层的location
     for (i = 0; i < locations->nelts; i++) {
-        /* 
-            先合并server和非嵌套location层的配置
-            loc_conf[ctx_index]:server层的location配置,
-            clcfp[i]->loc_conf[ctx_index]:location层各模块的配置
-        */
-        rv = module->merge_loc_conf(cf, loc_conf[ctx_index],
-                                    clcfp[i]->loc_conf[ctx_index]);
-        if (rv != NGX_CONF_OK) {
-            return rv;
+
+        /*
+         * the location without the module's directives would get the copy
+         * of the enclosing merged conf, so the enclosing conf is shared;
+         * the core module's conf is the location itself and is always merged
+         */
+
+        if (ctx_index != ngx_http_core_module.ctx_index
+            && clcfp[i]->modules_set
+            && !clcfp[i]->modules_set[ctx_index])
+        {
+            clcfp[i]->loc_conf[ctx_index] = loc_conf[ctx_index];
+
+        } else {
+            /* 
+                先合并server和非嵌套location层的配置
+                loc_conf[ctx_index]:server层的location配置,
+                clcfp[i]->loc_conf[ctx_index]:location层各模块的配置
+            */
+            rv = module->merge_loc_conf(cf, loc_conf[ctx_index],
+                                        clcfp[i]->loc_conf[ctx_index]);
+            if (rv != NGX_CONF_OK) {
+                return rv;
+            }
         }
         /*
           再合并嵌套location和非嵌套location的配置, 
@@ -15,6 +15,10 @@
 typedef struct ngx_http_request_s  ngx_http_request_t;
 typedef struct ngx_http_cleanup_s  ngx_http_cleanup_t;
 
+#if (NGX_HTTP_V2)
+typedef struct ngx_http_v2_stream_s  ngx_http_v2_stream_t;
+#endif
+
 #if (NGX_HTTP_CACHE)
 #include <ngx_http_cache.h>
 #endif
@@ -31,6 +35,10 @@ typedef struct ngx_http_cleanup_s  ngx_http_cleanup_t;
 #include <ngx_http_ssl_module.h>
 #endif
 
+#if (NGX_HTTP_V2)
+#include <ngx_http_v2.h>
+#endif
+
 
 typedef struct {
     u_int     connection;
@@ -92,6 +100,11 @@ size_t ngx_http_get_time(char *buf, time_t t);
 
 ngx_int_t ngx_http_discard_body(ngx_http_request_t *r);
 
+#if (NGX_HTTP_LIMIT_CONN)
+ngx_int_t ngx_http_limit_conn_connection(ngx_http_request_t *r,
+                                         ngx_connection_t *c);
+#endif
+
 
 extern ngx_module_t  ngx_http_module;
 
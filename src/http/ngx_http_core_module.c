@@ -32,6 +32,11 @@ static char *ngx_http_core_merge_loc_conf(ngx_conf_t *cf,
 
 static char *ngx_server_block(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static int ngx_cmp_locations(const void *first, const void *second);
+#if (HAVE_PCRE)
+static char *ngx_http_core_regex_set(ngx_conf_t *cf, ngx_array_t *locations);
+#endif
+
+
 static char *ngx_location_block(ngx_conf_t *cf, ngx_command_t *cmd,
                                 void *dummy);
 static char *ngx_types_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -108,6 +113,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_srv_conf_t, large_client_header_buffers),
       NULL },
 
+    { ngx_string("pipeline_output_buffer_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_core_srv_conf_t, pipeline_output_buffer_size),
+      NULL },
+
     { ngx_string("restrict_host_names"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
@@ -373,6 +385,16 @@ void ngx_http_handler(ngx_http_request_t *r)
     /* TEST STUB */ r->lingering_close = 1;
 #endif
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+
+        /* the stream is closed after the response, the connection is kept */
+
+        r->keepalive = 0;
+        r->lingering_close = 0;
+    }
+#endif
+
     r->connection->write->event_handler = ngx_http_phase_event_handler;
 
     ngx_http_run_phases(r);
@@ -513,6 +535,16 @@ ngx_int_t ngx_http_find_location_config(ngx_http_request_t *r)
         r->sendfile = 1;
     }
 
+#if (NGX_OPENSSL)
+
+    /* the SSL send chain can not send the file bufs */
+
+    if (r->connection->ssl && !r->connection->ssl->sendfile) {
+        r->sendfile = 0;
+    }
+
+#endif
+
     if (!clcf->tcp_nopush) {
         /* disable TCP_NOPUSH/TCP_CORK use */
         r->connection->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
@@ -562,6 +594,9 @@ static ngx_int_t ngx_http_find_location(ngx_http_request_t *r,
     ngx_int_t                  n, rc;
     ngx_uint_t                 i, found;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
+#if (HAVE_PCRE)
+    u_char                    *candidates;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "find location");
 
@@ -636,12 +671,30 @@ static ngx_int_t ngx_http_find_location(ngx_http_request_t *r,
 
     /* regex matches */
 
+    candidates = NULL;
+
     for (/* void */; i < locations->nelts; i++) {
 
         if (!clcfp[i]->regex) {
             continue;
         }
 
+        if (clcfp[i]->regex_set) {
+
+            /* the first regex location, the loop above stops at it */
+
+            if (!(candidates = ngx_palloc(r->pool, locations->nelts))) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            ngx_regex_set_candidates(clcfp[i]->regex_set, &r->uri,
+                                     candidates);
+        }
+
+        if (candidates && !candidates[i]) {
+            continue;
+        }
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "find location: ~ \"%s\"",
                        clcfp[i]->name.data);
@@ -976,6 +1029,10 @@ static char *ngx_server_block(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
     ngx_qsort(cscf->locations.elts, (size_t) cscf->locations.nelts,
               sizeof(ngx_http_core_loc_conf_t *), ngx_cmp_locations);
 
+#if (HAVE_PCRE)
+    rv = ngx_http_core_regex_set(cf, &cscf->locations);
+#endif
+
     return rv;
 }
 
@@ -1013,6 +1070,58 @@ static int ngx_cmp_locations(const void *one, const void *two)
 }
 
 
+#if (HAVE_PCRE)
+
+/*
+ * the patterns of the prefilter are indexed by the positions in the locations
+ * array, the empty patterns of the prefix locations are always candidates
+ */
+
+static char *ngx_http_core_regex_set(ngx_conf_t *cf, ngx_array_t *locations)
+{
+    ngx_str_t                  *patterns;
+    ngx_uint_t                  i, n, first;
+    ngx_regex_set_t            *set;
+    ngx_http_core_loc_conf_t  **clcfp;
+
+    if (!(patterns = ngx_pcalloc(cf->pool,
+                                 locations->nelts * sizeof(ngx_str_t))))
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    n = 0;
+    first = 0;
+
+    clcfp = locations->elts;
+    for (i = 0; i < locations->nelts; i++) {
+        if (clcfp[i]->regex) {
+            if (n++ == 0) {
+                first = i;
+            }
+
+            patterns[i] = clcfp[i]->name;
+        }
+    }
+
+    if (n < 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (!(set = ngx_regex_set_compile(patterns, locations->nelts, cf->pool))) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (set->nstates > 1) {
+        clcfp[first]->regex_set = set;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static char *ngx_location_block(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 {
     char                      *rv;
@@ -1060,6 +1169,10 @@ static char *ngx_location_block(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
     clcf = ctx->loc_conf[ngx_http_core_module.ctx_index];
     clcf->loc_conf = ctx->loc_conf;
 
+    if (!(clcf->modules_set = ngx_pcalloc(cf->pool, ngx_http_max_module))) {
+        return NGX_CONF_ERROR;
+    }
+
     value = cf->args->elts;
 
     if (cf->args->nelts == 3) {
@@ -1159,10 +1272,17 @@ static char *ngx_location_block(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
     // 更新上下文
     cf->ctx = ctx;
     cf->cmd_type = NGX_HTTP_LOC_CONF;
+    cf->modules_set = clcf->modules_set;
     rv = ngx_conf_parse(cf, NULL);
     // 恢复上下文
     *cf = pcf;
 
+#if (HAVE_PCRE)
+    if (rv == NGX_CONF_OK && clcf->locations.nelts) {
+        rv = ngx_http_core_regex_set(cf, &clcf->locations);
+    }
+#endif
+
     return rv;
 }
 
@@ -1281,6 +1401,7 @@ static void *ngx_http_core_create_srv_conf(ngx_conf_t *cf)
     cscf->request_pool_size = NGX_CONF_UNSET_SIZE;
     cscf->client_header_timeout = NGX_CONF_UNSET_MSEC;
     cscf->client_header_buffer_size = NGX_CONF_UNSET_SIZE;
+    cscf->pipeline_output_buffer_size = NGX_CONF_UNSET_SIZE;
     cscf->restrict_host_names = NGX_CONF_UNSET_UINT;
 
     return cscf;
@@ -1356,6 +1477,8 @@ static char *ngx_http_core_merge_srv_conf(ngx_conf_t *cf,
     ngx_conf_merge_bufs_value(conf->large_client_header_buffers,
                               prev->large_client_header_buffers,
                               4, ngx_pagesize);
+    ngx_conf_merge_size_value(conf->pipeline_output_buffer_size,
+                              prev->pipeline_output_buffer_size, 0);
 
     if (conf->large_client_header_buffers.size < conf->connection_pool_size) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -1386,10 +1509,13 @@ static void *ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     lcf->types = NULL;
     lcf->default_type.len = 0;
     lcf->default_type.data = NULL;
+    lcf->default_type_line.len = 0;
+    lcf->default_type_line.data = NULL;
     lcf->err_log = NULL;
     lcf->error_pages = NULL;
 
     lcf->regex = NULL;
+    lcf->regex_set = NULL;
     lcf->exact_match = 0;
     lcf->auto_redirect = 0;
     lcf->alias = 0;
@@ -1431,6 +1557,7 @@ static char *ngx_http_core_merge_loc_conf(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *conf = child;
 
     int               i, key;
+    u_char           *p;
     ngx_http_type_t  *t;
 
     ngx_conf_merge_str_value(conf->root, prev->root, "html");
@@ -1495,6 +1622,31 @@ static char *ngx_http_core_merge_loc_conf(ngx_conf_t *cf,
     ngx_conf_merge_str_value(conf->default_type,
                              prev->default_type, "text/plain");
 
+    /*
+     * the default "Content-Type" header line is prebuilt for
+     * the header filter, the inherited type shares the parent's line
+     */
+
+    if (conf->default_type.data == prev->default_type.data
+        && prev->default_type_line.len)
+    {
+        conf->default_type_line = prev->default_type_line;
+
+    } else {
+        conf->default_type_line.len = sizeof("Content-Type: ") - 1
+                                      + conf->default_type.len + 2;
+
+        if (!(p = ngx_palloc(cf->pool, conf->default_type_line.len))) {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->default_type_line.data = p;
+
+        p = ngx_cpymem(p, "Content-Type: ", sizeof("Content-Type: ") - 1);
+        p = ngx_cpymem(p, conf->default_type.data, conf->default_type.len);
+        *p++ = CR; *p = LF;
+    }
+
     ngx_conf_merge_size_value(conf->client_max_body_size,
                               prev->client_max_body_size, 1 * 1024 * 1024);
     ngx_conf_merge_size_value(conf->client_body_buffer_size,
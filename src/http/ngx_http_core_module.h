@@ -77,6 +77,7 @@ typedef struct {
     size_t                client_header_buffer_size;
 
     ngx_bufs_t            large_client_header_buffers;
+    size_t                pipeline_output_buffer_size;
     // 接收post数据的超时时间
     ngx_msec_t            post_accept_timeout;
     // 接收http头的超时时间
@@ -141,7 +142,10 @@ struct ngx_http_core_loc_conf_s {
     ngx_str_t     name;          /* location name */
 
 #if (HAVE_PCRE)
-    ngx_regex_t  *regex;
+    ngx_regex_t      *regex;
+
+    /* the prefilter of the regexes in the locations, set in the first one */
+    ngx_regex_set_t  *regex_set;
 #endif
 
     unsigned      exact_match:1;
@@ -154,12 +158,16 @@ struct ngx_http_core_loc_conf_s {
     /* pointer to the modules' loc_conf */
     void        **loc_conf ;
 
+    /* the ctx indices of the modules that have directives in the location */
+    u_char       *modules_set;
+
     ngx_http_handler_pt  handler;
 
     ngx_str_t     root;                    /* root, alias */
 
     ngx_array_t  *types;
     ngx_str_t     default_type;
+    ngx_str_t     default_type_line;       /* "Content-Type: ..." CRLF */
 
     size_t        client_max_body_size;    /* client_max_body_size */
     size_t        client_body_buffer_size; /* client_body_buffer_size */
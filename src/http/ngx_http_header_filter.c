@@ -41,56 +41,67 @@ ngx_module_t  ngx_http_header_filter_module = {
 static char server_string[] = "Server: " NGINX_VER CRLF;
 
 
-static ngx_str_t http_codes[] = {
+/*
+ * the status lines are prebuilt together with the trailing CRLF and
+ * the default "Server" header line, so the usual response starts with
+ * a single copy; the "Server" part is cut off if the header is set
+ * by a module
+ */
+
+#define ngx_http_status_line(text)                                          \
+    ngx_string("HTTP/1.1 " text CRLF "Server: " NGINX_VER CRLF)
+
+
+static ngx_str_t http_status_lines[] = {
 
-    ngx_string("200 OK"),
+    ngx_http_status_line("200 OK"),
     ngx_null_string,  /* "201 Created" */
     ngx_null_string,  /* "202 Accepted" */
     ngx_null_string,  /* "203 Non-Authoritative Information" */
     ngx_null_string,  /* "204 No Content" */
     ngx_null_string,  /* "205 Reset Content" */
-    ngx_string("206 Partial Content"),
+    ngx_http_status_line("206 Partial Content"),
     ngx_null_string,  /* "207 Multi-Status" */
 
 #if 0
     ngx_null_string,  /* "300 Multiple Choices" */
 #endif
 
-    ngx_string("301 Moved Permanently"),
+    ngx_http_status_line("301 Moved Permanently"),
 #if 0
-    ngx_string("302 Moved Temporarily"),
+    ngx_http_status_line("302 Moved Temporarily"),
 #else
-    ngx_string("302 Found"),
+    ngx_http_status_line("302 Found"),
 #endif
     ngx_null_string,  /* "303 See Other" */
-    ngx_string("304 Not Modified"),
+    ngx_http_status_line("304 Not Modified"),
 
-    ngx_string("400 Bad Request"),
-    ngx_string("401 Unauthorized"),
+    ngx_http_status_line("400 Bad Request"),
+    ngx_http_status_line("401 Unauthorized"),
     ngx_null_string,  /* "402 Payment Required" */
-    ngx_string("403 Forbidden"),
-    ngx_string("404 Not Found"),
-    ngx_string("405 Not Allowed"),
+    ngx_http_status_line("403 Forbidden"),
+    ngx_http_status_line("404 Not Found"),
+    ngx_http_status_line("405 Not Allowed"),
     ngx_null_string,  /* "406 Not Acceptable" */
     ngx_null_string,  /* "407 Proxy Authentication Required" */
-    ngx_string("408 Request Time-out"),
+    ngx_http_status_line("408 Request Time-out"),
     ngx_null_string,  /* "409 Conflict" */
     ngx_null_string,  /* "410 Gone" */
-    ngx_string("411 Length Required"),
+    ngx_http_status_line("411 Length Required"),
     ngx_null_string,  /* "412 Precondition Failed" */
-    ngx_string("413 Request Entity Too Large"),
+    ngx_http_status_line("413 Request Entity Too Large"),
     ngx_null_string,  /* "414 Request-URI Too Large" but we never send it
                        * because we treat such requests as the HTTP/0.9
                        * requests and send only a body without a header
                        */
     ngx_null_string,  /* "415 Unsupported Media Type" */
-    ngx_string("416 Requested Range Not Satisfiable"),
+    ngx_http_status_line("416 Requested Range Not Satisfiable"),
 
-    ngx_string("500 Internal Server Error"),
-    ngx_string("501 Method Not Implemented"),
-    ngx_string("502 Bad Gateway"),
-    ngx_string("503 Service Temporarily Unavailable"),
-    ngx_string("504 Gateway Time-out")
+    ngx_http_status_line("500 Internal Server Error"),
+    ngx_http_status_line("501 Method Not Implemented"),
+    ngx_http_status_line("502 Bad Gateway"),
+    ngx_http_status_line("503 Service Temporarily Unavailable"),
+    ngx_http_status_line("504 Gateway Time-out")
 };
 
 
@@ -121,7 +132,8 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
 {
     u_char                    *p;
     size_t                     len;
-    ngx_uint_t                 status, i;
+    ngx_uint_t                 status, server, i;
+    ngx_str_t                 *line, *type;
     ngx_buf_t                 *b;
     ngx_chain_t               *ln;
     ngx_list_part_t           *part;
@@ -142,21 +154,21 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
             && r->headers_out.status != NGX_HTTP_PARTIAL_CONTENT)
         {
             r->headers_out.last_modified_time = -1;
-            r->headers_out.last_modified = NULL;
+
+            if (r->headers_out.last_modified) {
+                r->headers_out.last_modified->key.len = 0;
+                r->headers_out.last_modified = NULL;
+            }
         }
     }
 
-    /* 2 is for trailing "\r\n" and 2 is for "\r\n" in the end of header */
-    len = sizeof("HTTP/1.x ") - 1 + 2 + 2;
+    /* 2 is for "\r\n" in the end of header */
+    len = 2;
 
     /* status line */
-    if (r->headers_out.status_line.len) {
-        len += r->headers_out.status_line.len;
-#if (NGX_SUPPRESS_WARN)
-        status = NGX_INVALID_ARRAY_INDEX;
-#endif
+    line = NULL;
 
-    } else {
+    if (r->headers_out.status_line.len == 0) {
 
         if (r->headers_out.status < NGX_HTTP_MOVED_PERMANENTLY) {
             /* 2XX */
@@ -180,21 +192,33 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
                                  - NGX_HTTP_INTERNAL_SERVER_ERROR + 8 + 4 + 17;
         }
 
-        len += http_codes[status].len;
+        if (http_status_lines[status].len) {
+            line = &http_status_lines[status];
+        }
     }
 
     if (r->headers_out.server && r->headers_out.server->key.len) {
+        server = 0;
         len += r->headers_out.server->key.len
                + r->headers_out.server->value.len + 2;
     } else {
-        len += sizeof(server_string) - 1;
+        server = sizeof(server_string) - 1;
+    }
+
+    if (line) {
+        len += line->len - (sizeof(server_string) - 1) + server;
+
+    } else {
+        /* 2 is for trailing "\r\n" */
+        len += sizeof("HTTP/1.x ") - 1 + r->headers_out.status_line.len + 2
+               + server;
     }
 
     if (r->headers_out.date && r->headers_out.date->key.len) {
         len += r->headers_out.date->key.len
                + r->headers_out.date->value.len + 2;
     } else {
-        len += sizeof("Date: Mon, 28 Sep 1970 06:00:00 GMT" CRLF) - 1;
+        len += ngx_cached_http_date.len;
     }
 
     if (r->headers_out.content_length == NULL) {
@@ -203,13 +227,29 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
         }
     }
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* the default type without a charset has the prebuilt header line */
+
+    type = NULL;
+
     if (r->headers_out.content_type && r->headers_out.content_type->value.len) {
         r->headers_out.content_type->key.len = 0;
-        len += sizeof("Content-Type: ") - 1
-               + r->headers_out.content_type->value.len + 2;
 
-        if (r->headers_out.charset.len) {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+        if (r->headers_out.content_type->value.data == clcf->default_type.data
+            && r->headers_out.content_type->value.len == clcf->default_type.len
+            && r->headers_out.charset.len == 0)
+        {
+            type = &clcf->default_type_line;
+            len += type->len;
+
+        } else {
+            len += sizeof("Content-Type: ") - 1
+                   + r->headers_out.content_type->value.len + 2;
+
+            if (r->headers_out.charset.len) {
+                len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            }
         }
     }
 
@@ -238,8 +278,6 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
         len += sizeof("Transfer-Encoding: chunked" CRLF) - 1;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
     if (r->keepalive) {
         len += sizeof("Connection: keep-alive" CRLF) - 1;
 
@@ -288,30 +326,22 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    /* "HTTP/1.x " */
-    b->last = ngx_cpymem(b->last, "HTTP/1.1 ", sizeof("HTTP/1.x ") - 1);
+    if (line) {
+        b->last = ngx_cpymem(b->last, line->data,
+                             line->len - (sizeof(server_string) - 1) + server);
 
-    /* status line */
-    if (r->headers_out.status_line.len) {
+    } else {
+        b->last = ngx_cpymem(b->last, "HTTP/1.1 ", sizeof("HTTP/1.x ") - 1);
         b->last = ngx_cpymem(b->last, r->headers_out.status_line.data,
                              r->headers_out.status_line.len);
+        *(b->last++) = CR; *(b->last++) = LF;
 
-    } else {
-        b->last = ngx_cpymem(b->last, http_codes[status].data,
-                             http_codes[status].len);
-    }
-    *(b->last++) = CR; *(b->last++) = LF;
-
-    if (!(r->headers_out.server && r->headers_out.server->key.len)) {
-        b->last = ngx_cpymem(b->last, server_string, sizeof(server_string) - 1);
+        b->last = ngx_cpymem(b->last, server_string, server);
     }
 
     if (!(r->headers_out.date && r->headers_out.date->key.len)) {
-        b->last = ngx_cpymem(b->last, "Date: ", sizeof("Date: ") - 1);
-        b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
-                             ngx_cached_http_time.len);
-
-        *(b->last++) = CR; *(b->last++) = LF;
+        b->last = ngx_cpymem(b->last, ngx_cached_http_date.data,
+                             ngx_cached_http_date.len);
     }
 
     if (r->headers_out.content_length == NULL) {
@@ -323,7 +353,12 @@ static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r)
         }
     }
 
-    if (r->headers_out.content_type && r->headers_out.content_type->value.len) {
+    if (type) {
+        b->last = ngx_cpymem(b->last, type->data, type->len);
+
+    } else if (r->headers_out.content_type
+               && r->headers_out.content_type->value.len)
+    {
         b->last = ngx_cpymem(b->last, "Content-Type: ",
                              sizeof("Content-Type: ") - 1);
         p = b->last;
@@ -29,6 +29,11 @@ static ngx_int_t ngx_http_read_discarded_body(ngx_http_request_t *r);
 
 static void ngx_http_set_keepalive(ngx_http_request_t *r);
 static void ngx_http_keepalive_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_keepalive_pool(ngx_connection_t *c, size_t size);
+static ssize_t ngx_http_keepalive_probe(ngx_connection_t *c);
+#if (NGX_STAT_STUB)
+static void ngx_http_idle_account(ngx_http_connection_t *hc, size_t size);
+#endif
 static void ngx_http_set_lingering_close(ngx_http_request_t *r);
 static void ngx_http_lingering_close_handler(ngx_event_t *ev);
 
@@ -185,6 +190,12 @@ static void ngx_http_init_request(ngx_event_t *rev)
 #if (NGX_HTTP_SSL)
     ngx_http_ssl_srv_conf_t   *sscf;
 #endif
+#if (NGX_HTTP_V2)
+    ngx_http_v2_srv_conf_t    *h2scf;
+#endif
+#if (NGX_HTTP_LIMIT_CONN)
+    ngx_uint_t                 first;
+#endif
 
     c = rev->data;
     // 建立连接却没有发送数据
@@ -201,6 +212,10 @@ static void ngx_http_init_request(ngx_event_t *rev)
 
     hc = c->data;
 
+#if (NGX_HTTP_LIMIT_CONN)
+    first = (hc == NULL);
+#endif
+
     if (hc) {
 
 #if (NGX_STAT_STUB)
@@ -359,6 +374,40 @@ static void ngx_http_init_request(ngx_event_t *rev)
         c->log->log_level = clcf->err_log->log_level;
     }
 
+#if (NGX_HTTP_LIMIT_CONN)
+
+    /* the keepalive and pipelined requests are not counted again */
+
+    if (first && ngx_http_limit_conn_connection(r, c) == NGX_ERROR) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+#endif
+
+#if (NGX_HTTP_V2)
+
+    if (c->recv == ngx_http_v2_recv) {
+        r->stream = ngx_http_v2_stream(c);
+
+    } else {
+        h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+
+        /* h2c with the prior knowledge, HTTP/2 over SSL is set by ALPN */
+
+        if (h2scf->enable
+#if (NGX_HTTP_SSL)
+            && c->ssl == NULL
+#endif
+           )
+        {
+            ngx_http_v2_init(rev);
+            return;
+        }
+    }
+
+#endif
+
     if (c->buffer == NULL) {
         c->buffer = ngx_create_temp_buf(c->pool,
                                         cscf->client_header_buffer_size);
@@ -515,6 +564,17 @@ static void ngx_http_process_request_line(ngx_event_t *rev)
             if (n == NGX_AGAIN || n == NGX_ERROR) {
                 return;
             }
+
+#if (NGX_HTTP_SSL && NGX_HTTP_V2)
+
+            /* the SSL handshake is completed by the first read */
+
+            if (r->stream == NULL && c->ssl && ngx_http_v2_negotiated(c)) {
+                ngx_http_v2_init(rev);
+                return;
+            }
+
+#endif
         }
         // 解析读取到的数据
         rc = ngx_http_parse_request_line(r, r->header_in);
@@ -1667,7 +1727,28 @@ static void ngx_http_set_keepalive(ngx_http_request_t *r)
         hc->nbusy = 0;
     }
 
+    /* the deferred pipelined responses are already sent */
+
+    if (hc->flush && hc->flush->prev) {
+        ngx_delete_posted_event(hc->flush);
+    }
+
+    if (hc->out) {
+        ngx_pfree(c->pool, hc->out->start);
+        hc->out = NULL;
+    }
+
+    if (ngx_http_keepalive_pool(c, 0) == NGX_OK) {
+        hc = c->data;
+        ctx = c->log->data;
+
+#if (NGX_STAT_STUB)
+        ngx_http_idle_account(hc, c->pool->end - (char *) c->pool);
+#endif
+    }
+
     rev->event_handler = ngx_http_keepalive_handler;
+    c->idle = 1;
 
     if (wev->active) {
         if (ngx_event_flags & NGX_HAVE_KQUEUE_EVENT) {
@@ -1708,6 +1789,208 @@ static void ngx_http_set_keepalive(ngx_http_request_t *r)
 }
 
 
+/*
+ * an idle keepalive connection keeps the fixed size state only: the client
+ * address, the log, the log context, the http connection, the descriptor
+ * of the client header buffer and the SSL connection.  This state is copied
+ * to a new pool of the exact size and the old pool is destroyed together
+ * with the request, the header buffers and the SSL send buffer.
+ *
+ * When the idle connection gets a new request the same state is copied
+ * back to a pool of the listening pool size, otherwise all allocations
+ * of the following requests would not fit the tiny pool and would be
+ * allocated as the large ones.  The zero size means the exact size.
+ *
+ * The connection pool cleanups, e.g. the limit_conn ones, are moved to
+ * the new pool, so their data must not be allocated from the connection
+ * pool.  The deferred responses flush event is already deleted and is freed
+ * with the old pool.
+ */
+
+static ngx_int_t ngx_http_keepalive_pool(ngx_connection_t *c, size_t size)
+{
+    u_char                 *addr;
+    ngx_buf_t              *b;
+    ngx_uint_t              n;
+    ngx_log_t              *log;
+    ngx_pool_t             *pool;
+    struct sockaddr        *sa;
+    ngx_pool_cleanup_t     *cln, *ncln;
+    ngx_http_log_ctx_t     *ctx;
+    ngx_http_connection_t  *hc, *ohc;
+#if (NGX_OPENSSL)
+    ngx_ssl_t              *ssl;
+    ngx_buf_t              *sb;
+#endif
+
+    ohc = c->data;
+
+    n = 0;
+
+    for (cln = c->pool->cleanup; cln; cln = cln->next) {
+        if (cln->handler && (ohc->flush == NULL || cln->data != ohc->flush)) {
+            n++;
+        }
+    }
+
+    if (size == 0) {
+        size = sizeof(ngx_pool_t)
+               + c->listening->socklen + sizeof(ngx_log_t)
+               + c->addr_text.len + 1
+               + sizeof(ngx_http_log_ctx_t) + sizeof(ngx_http_connection_t)
+               + sizeof(ngx_buf_t)
+               + n * (sizeof(ngx_pool_cleanup_t) + NGX_ALIGN)
+               + 6 * NGX_ALIGN;
+
+#if (NGX_OPENSSL)
+
+        if (c->ssl) {
+            if (ngx_ssl_free_buffers(c) == NGX_DECLINED) {
+                return NGX_DECLINED;
+            }
+
+            size += sizeof(ngx_ssl_t) + sizeof(ngx_buf_t) + 2 * NGX_ALIGN;
+        }
+
+#endif
+    }
+
+    if (!(pool = ngx_create_pool(size, c->log))) {
+        return NGX_DECLINED;
+    }
+
+    if (!(sa = ngx_palloc(pool, c->listening->socklen))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+    if (!(log = ngx_palloc(pool, sizeof(ngx_log_t)))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+    if (!(addr = ngx_palloc(pool, c->addr_text.len + 1))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+    if (!(ctx = ngx_palloc(pool, sizeof(ngx_http_log_ctx_t)))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+    if (!(hc = ngx_pcalloc(pool, sizeof(ngx_http_connection_t)))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+    if (!(b = ngx_palloc(pool, sizeof(ngx_buf_t)))) {
+        ngx_destroy_pool(pool);
+        return NGX_DECLINED;
+    }
+
+#if (NGX_OPENSSL)
+
+    ssl = NULL;
+
+    if (c->ssl) {
+        if (!(ssl = ngx_palloc(pool, sizeof(ngx_ssl_t)))) {
+            ngx_destroy_pool(pool);
+            return NGX_DECLINED;
+        }
+
+        if (!(sb = ngx_pcalloc(pool, sizeof(ngx_buf_t)))) {
+            ngx_destroy_pool(pool);
+            return NGX_DECLINED;
+        }
+
+        *ssl = *c->ssl;
+        ssl->buf = sb;
+
+        /* the send buffer is allocated again by ngx_ssl_send_chain() */
+
+        sb->temporary = 1;
+    }
+
+#endif
+
+    for (cln = c->pool->cleanup; cln; cln = cln->next) {
+        if (cln->handler == NULL
+            || (ohc->flush && cln->data == ohc->flush))
+        {
+            continue;
+        }
+
+        if (!(ncln = ngx_pool_cleanup_add(pool, 0))) {
+
+            /* the moved cleanups must not run with the new pool */
+
+            pool->cleanup = NULL;
+            ngx_destroy_pool(pool);
+            return NGX_DECLINED;
+        }
+
+        ncln->handler = cln->handler;
+        ncln->data = cln->data;
+    }
+
+    for (cln = c->pool->cleanup; cln; cln = cln->next) {
+        cln->handler = NULL;
+    }
+
+#if (NGX_STAT_STUB)
+    hc->idle = ohc->idle;
+#endif
+
+    ngx_memcpy(sa, c->sockaddr, c->listening->socklen);
+
+    ngx_memcpy(addr, c->addr_text.data, c->addr_text.len);
+    addr[c->addr_text.len] = '\0';
+
+    ngx_memcpy(ctx, c->log->data, sizeof(ngx_http_log_ctx_t));
+    ctx->client = addr;
+    ctx->url = NULL;
+
+    ngx_memcpy(log, c->log, sizeof(ngx_log_t));
+    log->data = ctx;
+    pool->log = log;
+
+    /*
+     * the header buffer memory is freed with the old pool,
+     * its size is kept in b->end - b->start
+     */
+
+    *b = *c->buffer;
+    b->pos = NULL;
+    b->last = NULL;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http keepalive pool: " PTR_FMT " " SIZE_T_FMT,
+                   pool, size);
+
+    ngx_destroy_pool(c->pool);
+
+    c->pool = pool;
+    c->log = log;
+    c->read->log = log;
+    c->write->log = log;
+    c->sockaddr = sa;
+    c->addr_text.data = addr;
+    c->buffer = b;
+    c->data = hc;
+
+#if (NGX_OPENSSL)
+    c->ssl = ssl;
+#endif
+
+#if (HAVE_IOCP)
+    c->local_sockaddr = NULL;
+#endif
+
+    return NGX_OK;
+}
+
+
 static void ngx_http_keepalive_handler(ngx_event_t *rev)
 {
     size_t                  size;
@@ -1716,12 +1999,23 @@ static void ngx_http_keepalive_handler(ngx_event_t *rev)
     ngx_connection_t       *c;
     ngx_http_log_ctx_t     *ctx;
     ngx_http_connection_t  *hc;
+#if (NGX_STAT_STUB)
+    size_t                  idle;
+#endif
 
     c = rev->data;
+    hc = c->data;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http keepalive handler");
 
-    if (rev->timedout) {
+#if (NGX_STAT_STUB)
+    idle = hc->idle;
+    ngx_http_idle_account(hc, 0);
+#endif
+
+    /* c->close is set when the connection is passed to another worker */
+
+    if (rev->timedout || c->close) {
         ngx_http_close_connection(c);
         return;
     }
@@ -1742,21 +2036,9 @@ static void ngx_http_keepalive_handler(ngx_event_t *rev)
 
 #endif
 
-    hc = c->data;
     b = c->buffer;
     size = b->end - b->start;
 
-    if (b->pos == NULL) {
-        if (!(b->pos = ngx_palloc(c->pool, size))) {
-            ngx_http_close_connection(c);
-            return;
-        }
-
-        b->start = b->pos;
-        b->last = b->pos;
-        b->end = b->pos + size;
-    }
-
     /*
      * MSIE closes a keepalive connection with RST flag
      * so we ignore ECONNRESET here.
@@ -1765,10 +2047,61 @@ static void ngx_http_keepalive_handler(ngx_event_t *rev)
     c->log_error = NGX_ERROR_IGNORE_ECONNRESET;
     ngx_set_socket_errno(0);
 
-    n = c->recv(c, b->last, size);
+    n = 1;
+
+    if (b->pos == NULL) {
+
+        /*
+         * the header buffer is allocated only if the data have really come,
+         * so the spurious wakeups of the idle connection do not cost memory
+         */
+
+        n = ngx_http_keepalive_probe(c);
+
+        if (n > 0) {
+            /* the tiny idle pool is replaced by a regular connection pool */
+
+            if (ngx_http_keepalive_pool(c, c->listening->pool_size)
+                                                                   == NGX_OK)
+            {
+                hc = c->data;
+                ctx = c->log->data;
+                b = c->buffer;
+
+#if (NGX_STAT_STUB)
+                if (idle) {
+                    idle = c->pool->end - (char *) c->pool;
+                }
+#endif
+            }
+
+            if (!(b->pos = ngx_palloc(c->pool, size))) {
+                ngx_http_close_connection(c);
+                return;
+            }
+
+            b->start = b->pos;
+            b->last = b->pos;
+            b->end = b->pos + size;
+
+#if (NGX_STAT_STUB)
+            if (idle) {
+                idle += size;
+            }
+#endif
+        }
+    }
+
+    if (n > 0) {
+        n = c->recv(c, b->last, size);
+    }
+
     c->log_error = NGX_ERROR_INFO;
 
     if (n == NGX_AGAIN) {
+#if (NGX_STAT_STUB)
+        ngx_http_idle_account(hc, idle);
+#endif
         return;
     }
 
@@ -1790,10 +2123,78 @@ static void ngx_http_keepalive_handler(ngx_event_t *rev)
     rev->log->handler = ngx_http_log_error;
     ctx->action = "reading client request line";
 
+    c->idle = 0;
+
     ngx_http_init_request(rev);
 }
 
 
+/*
+ * ngx_http_keepalive_probe() peeks a byte to learn whether the client
+ * has sent a new request, it returns 1, 0 if the client has closed
+ * the connection, NGX_AGAIN or NGX_ERROR as c->recv() does
+ */
+
+static ssize_t ngx_http_keepalive_probe(ngx_connection_t *c)
+{
+    u_char     ch;
+    ssize_t    n;
+    ngx_err_t  err;
+
+#if (NGX_OPENSSL)
+
+    if (c->ssl && ngx_ssl_pending(c)) {
+        return 1;
+    }
+
+#endif
+
+    n = recv(c->fd, (void *) &ch, 1, MSG_PEEK);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http keepalive probe: %d", n);
+
+    if (n >= 0) {
+        return n;
+    }
+
+    err = ngx_socket_errno;
+
+    if (err == NGX_EAGAIN) {
+        c->read->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (err == NGX_EINTR) {
+        return 1;
+    }
+
+    ngx_connection_error(c, err, "recv() failed");
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_STAT_STUB)
+
+static void ngx_http_idle_account(ngx_http_connection_t *hc, size_t size)
+{
+    if (hc->idle) {
+        (*ngx_stat_idle)--;
+        (*ngx_stat_idle_memory) -= hc->idle;
+    }
+
+    if (size) {
+        (*ngx_stat_idle)++;
+        (*ngx_stat_idle_memory) += size;
+    }
+
+    hc->idle = size;
+}
+
+#endif
+
+
 static void ngx_http_set_lingering_close(ngx_http_request_t *r)
 {   
     ngx_event_t               *rev, *wev;
@@ -1981,6 +2382,11 @@ void ngx_http_close_request(ngx_http_request_t *r, int error)
 
 #endif
 
+        if (cleanup[i].handler) {
+            cleanup[i].data.handler.handler(cleanup[i].data.handler.data);
+            continue;
+        }
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http cleanup fd: %d",
                        cleanup[i].data.file.fd);
 
@@ -2012,6 +2418,13 @@ void ngx_http_close_request(ngx_http_request_t *r, int error)
         }
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        ngx_http_v2_release_request(r);
+
+    } else
+#endif
+
     if (r->connection->timedout) {
         clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
@@ -2065,8 +2478,19 @@ void ngx_http_close_connection(ngx_connection_t *c)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "close http connection: %d", c->fd);
 
+#if (NGX_HTTP_V2)
+    if (c->recv == ngx_http_v2_recv) {
+        ngx_http_v2_close_stream(ngx_http_v2_stream(c));
+        return;
+    }
+#endif
+
 #if (NGX_STAT_STUB)
     (*ngx_stat_active)--;
+
+    if (c->idle) {
+        ngx_http_idle_account(c->data, 0);
+    }
 #endif
 
     ngx_close_connection(c);
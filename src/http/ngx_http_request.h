@@ -15,6 +15,7 @@
 #define NGX_HTTP_VERSION_9                 9
 #define NGX_HTTP_VERSION_10                1000
 #define NGX_HTTP_VERSION_11                1001
+#define NGX_HTTP_VERSION_20                2000
 
 #define NGX_HTTP_GET                       1
 #define NGX_HTTP_HEAD                      2
@@ -208,6 +209,8 @@ typedef struct {
 } ngx_http_request_body_t;
 
 
+typedef void (*ngx_http_cleanup_pt)(void *data);
+
 struct ngx_http_cleanup_s {
     union {
         struct {
@@ -219,10 +222,16 @@ struct ngx_http_cleanup_s {
             ngx_http_cache_hash_t   *hash;
             ngx_http_cache_t        *cache;
         } cache;
+
+        struct {
+            ngx_http_cleanup_pt      handler;
+            void                    *data;
+        } handler;
     } data;
 
     unsigned                         valid:1;
     unsigned                         cache:1;
+    unsigned                         handler:1;
 };
 
 
@@ -235,7 +244,15 @@ typedef struct {
     ngx_buf_t           **free;
     ngx_int_t             nfree;
 
+    ngx_buf_t            *out;           /* the deferred responses */
+    ngx_event_t          *flush;         /* sends the deferred responses */
+    ngx_event_handler_pt  write_handler; /* replaced while they are sent */
+
     ngx_uint_t            pipeline;      /* unsigned  pipeline:1; */
+
+#if (NGX_STAT_STUB)
+    size_t                idle;          /* the accounted idle memory */
+#endif
 } ngx_http_connection_t;
 
 
@@ -301,6 +318,10 @@ struct ngx_http_request_s {
 
     ngx_http_connection_t  *http_connection;
 
+#if (NGX_HTTP_V2)
+    ngx_http_v2_stream_t   *stream;
+#endif
+
     unsigned             http_state:4;
 
 #if 0
@@ -335,6 +356,12 @@ struct ngx_http_request_s {
     unsigned             filter_need_temporary:1;
     unsigned             filter_allow_ranges:1;
 
+    /* the request is accounted by limit_req, the redirect is not again */
+    unsigned             limit_req_set:1;
+
+    /* the request is counted by limit_conn, the redirect is not again */
+    unsigned             limit_conn_set:1;
+
 #if (NGX_STAT_STUB)
     unsigned             stat_reading:1;
     unsigned             stat_writing:1;
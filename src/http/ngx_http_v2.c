@@ -0,0 +1,3451 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_http.h>
+
+
+typedef ngx_int_t (*ngx_http_v2_handler_pt)(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t flags, ngx_uint_t sid,
+                                            u_char *pos, size_t len);
+
+
+#define ngx_http_v2_index(sid)  (((sid) >> 1) & (NGX_HTTP_V2_INDEX_SIZE - 1))
+
+
+static void ngx_http_v2_read_handler(ngx_event_t *rev);
+static void ngx_http_v2_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_v2_process(ngx_http_v2_connection_t *h2c);
+
+static ngx_int_t ngx_http_v2_state_data(ngx_http_v2_connection_t *h2c,
+                                        ngx_uint_t flags, ngx_uint_t sid,
+                                        u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_headers(ngx_http_v2_connection_t *h2c,
+                                           ngx_uint_t flags, ngx_uint_t sid,
+                                           u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t flags, ngx_uint_t sid,
+                                            u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c,
+                                              ngx_uint_t flags, ngx_uint_t sid,
+                                              u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t flags, ngx_uint_t sid,
+                                            u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_push_promise(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t flags,
+                                                ngx_uint_t sid,
+                                                u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_ping(ngx_http_v2_connection_t *h2c,
+                                        ngx_uint_t flags, ngx_uint_t sid,
+                                        u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_goaway(ngx_http_v2_connection_t *h2c,
+                                          ngx_uint_t flags, ngx_uint_t sid,
+                                          u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_window_update(ngx_http_v2_connection_t *h2c,
+                                                 ngx_uint_t flags,
+                                                 ngx_uint_t sid,
+                                                 u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_state_continuation(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t flags,
+                                                ngx_uint_t sid,
+                                                u_char *pos, size_t len);
+
+static ngx_int_t ngx_http_v2_save_header_block(ngx_http_v2_connection_t *h2c,
+                                               u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_process_header_block(ngx_http_v2_connection_t *h2c,
+                                                  u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_decode_header_block(ngx_http_v2_connection_t *h2c,
+                                                 ngx_pool_t *pool,
+                                                 u_char *pos, size_t len,
+                                                 ngx_array_t *fields);
+static ngx_int_t ngx_http_v2_parse_int(u_char **pos, u_char *end,
+                                       ngx_uint_t prefix, ngx_uint_t *value);
+static ngx_int_t ngx_http_v2_parse_string(ngx_pool_t *pool, u_char **pos,
+                                          u_char *end, ngx_str_t *s);
+static ngx_int_t ngx_http_v2_huff_decode(u_char *src, size_t len, u_char *dst,
+                                         size_t *size);
+static ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
+                                                ngx_pool_t *pool,
+                                                ngx_uint_t index,
+                                                ngx_str_t *name,
+                                                ngx_str_t *value);
+static ngx_int_t ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c,
+                                       ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t size);
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_t *hpack);
+static ngx_int_t ngx_http_v2_construct_request(ngx_pool_t *pool,
+                                               ngx_array_t *fields,
+                                               ngx_buf_t **bp);
+
+static ngx_http_v2_stream_t *ngx_http_v2_create_stream(
+                          ngx_http_v2_connection_t *h2c, ngx_pool_t *pool);
+static ngx_http_v2_stream_t *ngx_http_v2_find_stream(
+                          ngx_http_v2_connection_t *h2c, ngx_uint_t sid);
+static void ngx_http_v2_set_priority(ngx_http_v2_connection_t *h2c,
+                                     ngx_http_v2_stream_t *stream,
+                                     ngx_uint_t depend, ngx_uint_t weight);
+static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
+                                              ngx_http_v2_stream_t *stream,
+                                              ngx_uint_t status);
+static void ngx_http_v2_reset_stream(ngx_http_v2_stream_t *stream);
+static void ngx_http_v2_wake_stream(ngx_http_v2_connection_t *h2c,
+                                    ngx_http_v2_stream_t *stream);
+static void ngx_http_v2_block_stream(ngx_http_v2_stream_t *stream);
+
+static ngx_http_v2_out_frame_t *ngx_http_v2_get_frame(
+                          ngx_http_v2_connection_t *h2c,
+                          ngx_http_v2_stream_t *stream);
+static ngx_http_v2_out_frame_t *ngx_http_v2_get_control_frame(
+                          ngx_http_v2_connection_t *h2c, size_t len,
+                          ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_chain_t *ngx_http_v2_get_link(ngx_http_v2_stream_t *stream);
+static void ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
+                                    ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_frame_is_sent(ngx_http_v2_out_frame_t *frame);
+static void ngx_http_v2_frame_sent(ngx_http_v2_connection_t *h2c,
+                                   ngx_http_v2_out_frame_t *frame);
+static void ngx_http_v2_free_links(ngx_http_v2_stream_t *stream,
+                                   ngx_http_v2_out_frame_t *frame,
+                                   ngx_uint_t sent);
+static ngx_int_t ngx_http_v2_detach_frame(ngx_http_v2_stream_t *stream,
+                                          ngx_http_v2_out_frame_t *frame);
+
+static ngx_int_t ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c,
+                                           ngx_uint_t ack);
+static ngx_int_t ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t sid, size_t inc);
+static ngx_int_t ngx_http_v2_send_rst_stream(ngx_http_v2_connection_t *h2c,
+                                             ngx_uint_t sid,
+                                             ngx_uint_t status);
+static ngx_int_t ngx_http_v2_send_goaway(ngx_http_v2_connection_t *h2c,
+                                         ngx_uint_t status);
+
+static ngx_int_t ngx_http_v2_connection_error(ngx_http_v2_connection_t *h2c,
+                                              ngx_uint_t status, char *text);
+static void ngx_http_v2_handle_idle(ngx_http_v2_connection_t *h2c);
+static void ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t status);
+static void ngx_http_v2_close_connection(ngx_http_v2_connection_t *h2c);
+
+static ngx_int_t ngx_http_v2_init_module(ngx_cycle_t *cycle);
+static void *ngx_http_v2_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_v2_merge_srv_conf(ngx_conf_t *cf,
+                                        void *parent, void *child);
+
+
+static ngx_command_t  ngx_http_v2_commands[] = {
+
+    { ngx_string("http2"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, enable),
+      NULL },
+
+    { ngx_string("http2_max_concurrent_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, concurrent_streams),
+      NULL },
+
+    { ngx_string("http2_chunk_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, chunk_size),
+      NULL },
+
+    { ngx_string("http2_idle_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, idle_timeout),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_v2_module_ctx = {
+    NULL,                                  /* pre conf */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_v2_create_srv_conf,           /* create server configuration */
+    ngx_http_v2_merge_srv_conf,            /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL,                                  /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_v2_module = {
+    NGX_MODULE,
+    &ngx_http_v2_module_ctx,               /* module context */
+    ngx_http_v2_commands,                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    ngx_http_v2_init_module,               /* init module */
+    NULL                                   /* init process */
+};
+
+
+static ngx_http_v2_handler_pt  ngx_http_v2_frame_states[] = {
+    ngx_http_v2_state_data,
+    ngx_http_v2_state_headers,
+    ngx_http_v2_state_priority,
+    ngx_http_v2_state_rst_stream,
+    ngx_http_v2_state_settings,
+    ngx_http_v2_state_push_promise,
+    ngx_http_v2_state_ping,
+    ngx_http_v2_state_goaway,
+    ngx_http_v2_state_window_update,
+    ngx_http_v2_state_continuation
+};
+
+#define NGX_HTTP_V2_FRAME_STATES                                             \
+    (sizeof(ngx_http_v2_frame_states) / sizeof(ngx_http_v2_handler_pt))
+
+
+/* RFC 7541, Appendix A */
+
+static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
+    { ngx_string(":authority"), ngx_string("") },
+    { ngx_string(":method"), ngx_string("GET") },
+    { ngx_string(":method"), ngx_string("POST") },
+    { ngx_string(":path"), ngx_string("/") },
+    { ngx_string(":path"), ngx_string("/index.html") },
+    { ngx_string(":scheme"), ngx_string("http") },
+    { ngx_string(":scheme"), ngx_string("https") },
+    { ngx_string(":status"), ngx_string("200") },
+    { ngx_string(":status"), ngx_string("204") },
+    { ngx_string(":status"), ngx_string("206") },
+    { ngx_string(":status"), ngx_string("304") },
+    { ngx_string(":status"), ngx_string("400") },
+    { ngx_string(":status"), ngx_string("404") },
+    { ngx_string(":status"), ngx_string("500") },
+    { ngx_string("accept-charset"), ngx_string("") },
+    { ngx_string("accept-encoding"), ngx_string("gzip, deflate") },
+    { ngx_string("accept-language"), ngx_string("") },
+    { ngx_string("accept-ranges"), ngx_string("") },
+    { ngx_string("accept"), ngx_string("") },
+    { ngx_string("access-control-allow-origin"), ngx_string("") },
+    { ngx_string("age"), ngx_string("") },
+    { ngx_string("allow"), ngx_string("") },
+    { ngx_string("authorization"), ngx_string("") },
+    { ngx_string("cache-control"), ngx_string("") },
+    { ngx_string("content-disposition"), ngx_string("") },
+    { ngx_string("content-encoding"), ngx_string("") },
+    { ngx_string("content-language"), ngx_string("") },
+    { ngx_string("content-length"), ngx_string("") },
+    { ngx_string("content-location"), ngx_string("") },
+    { ngx_string("content-range"), ngx_string("") },
+    { ngx_string("content-type"), ngx_string("") },
+    { ngx_string("cookie"), ngx_string("") },
+    { ngx_string("date"), ngx_string("") },
+    { ngx_string("etag"), ngx_string("") },
+    { ngx_string("expect"), ngx_string("") },
+    { ngx_string("expires"), ngx_string("") },
+    { ngx_string("from"), ngx_string("") },
+    { ngx_string("host"), ngx_string("") },
+    { ngx_string("if-match"), ngx_string("") },
+    { ngx_string("if-modified-since"), ngx_string("") },
+    { ngx_string("if-none-match"), ngx_string("") },
+    { ngx_string("if-range"), ngx_string("") },
+    { ngx_string("if-unmodified-since"), ngx_string("") },
+    { ngx_string("last-modified"), ngx_string("") },
+    { ngx_string("link"), ngx_string("") },
+    { ngx_string("location"), ngx_string("") },
+    { ngx_string("max-forwards"), ngx_string("") },
+    { ngx_string("proxy-authenticate"), ngx_string("") },
+    { ngx_string("proxy-authorization"), ngx_string("") },
+    { ngx_string("range"), ngx_string("") },
+    { ngx_string("referer"), ngx_string("") },
+    { ngx_string("refresh"), ngx_string("") },
+    { ngx_string("retry-after"), ngx_string("") },
+    { ngx_string("server"), ngx_string("") },
+    { ngx_string("set-cookie"), ngx_string("") },
+    { ngx_string("strict-transport-security"), ngx_string("") },
+    { ngx_string("transfer-encoding"), ngx_string("") },
+    { ngx_string("user-agent"), ngx_string("") },
+    { ngx_string("vary"), ngx_string("") },
+    { ngx_string("via"), ngx_string("") },
+    { ngx_string("www-authenticate"), ngx_string("") }
+};
+
+#define NGX_HTTP_V2_STATIC_TABLE_ENTRIES                                     \
+    (sizeof(ngx_http_v2_static_table) / sizeof(ngx_http_v2_header_t))
+
+
+/*
+ * RFC 7541, Appendix B: the code lengths of the symbols 0-256, the code
+ * is canonical, so the codes themselves are built from the lengths
+ */
+
+static u_char  ngx_http_v2_huff_len[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+#define NGX_HTTP_V2_HUFF_EOS      256
+#define NGX_HTTP_V2_HUFF_MAX_LEN  30
+
+/* built by ngx_http_v2_init_module() */
+
+static uint32_t    ngx_http_v2_huff_first[NGX_HTTP_V2_HUFF_MAX_LEN + 1];
+static uint32_t    ngx_http_v2_huff_count[NGX_HTTP_V2_HUFF_MAX_LEN + 1];
+static uint32_t    ngx_http_v2_huff_offset[NGX_HTTP_V2_HUFF_MAX_LEN + 1];
+static uint16_t    ngx_http_v2_huff_sym[257];
+
+
+/* the hop-by-hop fields are not allowed in HTTP/2 */
+
+static ngx_str_t  ngx_http_v2_skip_fields[] = {
+    ngx_string("connection"),
+    ngx_string("keep-alive"),
+    ngx_string("proxy-connection"),
+    ngx_string("transfer-encoding"),
+    ngx_string("upgrade"),
+    ngx_string("te"),
+    ngx_null_string
+};
+
+
+void ngx_http_v2_init(ngx_event_t *rev)
+{
+    size_t                     size;
+    ngx_buf_t                 *b;
+    ngx_connection_t          *c;
+    ngx_http_request_t        *r;
+    ngx_http_log_ctx_t        *ctx;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = rev->data;
+    r = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "init http2 connection");
+
+    if (!(h2c = ngx_pcalloc(c->pool, sizeof(ngx_http_v2_connection_t)))) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     h2c->hpack.entries = NULL;
+     *     h2c->hpack.storage = NULL;
+     *     h2c->processing = 0;
+     *     h2c->last_sid = 0;
+     *     h2c->waiting = NULL;
+     *     h2c->out = NULL;
+     *     h2c->free_frames = NULL;
+     */
+
+    h2c->connection = c;
+    h2c->conf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
+    h2c->cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+    h2c->clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    h2c->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+    h2c->hpack.max_size = NGX_HTTP_V2_TABLE_SIZE;
+
+    h2c->streams = ngx_pcalloc(c->pool, NGX_HTTP_V2_INDEX_SIZE
+                                        * sizeof(ngx_http_v2_stream_t *));
+    if (h2c->streams == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    b = ngx_create_temp_buf(c->pool, NGX_HTTP_V2_RECV_BUFFER_SIZE);
+    if (b == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    h2c->buffer = b;
+
+    /* the preface may be already read as an HTTP/1.x request line */
+
+    if (r->header_in) {
+        size = r->header_in->last - r->header_in->pos;
+
+        if (size > NGX_HTTP_V2_RECV_BUFFER_SIZE) {
+            size = NGX_HTTP_V2_RECV_BUFFER_SIZE;
+        }
+
+        b->last = ngx_cpymem(b->last, r->header_in->pos, size);
+    }
+
+    /* the connection is not counted as a request */
+
+#if (NGX_STAT_STUB)
+    if (r->stat_reading) {
+        (*ngx_stat_reading)--;
+    }
+
+    if (r->pool) {
+        (*ngx_stat_requests)--;
+    }
+#endif
+
+    if (r->pool) {
+        ngx_destroy_pool(r->pool);
+    }
+
+    ctx = c->log->data;
+    ctx->action = "processing HTTP/2 connection";
+
+    c->data = h2c;
+    c->read->event_handler = ngx_http_v2_read_handler;
+    c->write->event_handler = ngx_http_v2_write_handler;
+
+#if (NGX_HTTP_SSL)
+    if (c->ssl) {
+        /* the frames are already coalesced by the output queue */
+        c->ssl->buffer = 0;
+    }
+#endif
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (ngx_http_v2_send_settings(h2c, 0) == NGX_ERROR
+        || ngx_http_v2_send_window_update(h2c, 0, NGX_HTTP_V2_MAX_WINDOW
+                                          - NGX_HTTP_V2_DEFAULT_WINDOW)
+           == NGX_ERROR)
+    {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    h2c->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+
+    h2c->handling = 1;
+
+    if (b->last != b->pos) {
+        ngx_http_v2_process(h2c);
+    }
+
+    h2c->handling = 0;
+
+    if (h2c->closing) {
+        ngx_http_v2_handle_idle(h2c);
+        return;
+    }
+
+    ngx_http_v2_read_handler(c->read);
+}
+
+
+#if (NGX_HTTP_SSL)
+
+ngx_int_t ngx_http_v2_negotiated(ngx_connection_t *c)
+{
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    u_int                 len;
+    const unsigned char  *data;
+
+    SSL_get0_alpn_selected(c->ssl->ssl, &data, &len);
+
+    if (len == 2 && data[0] == 'h' && data[1] == '2') {
+        return 1;
+    }
+
+#endif
+
+    return 0;
+}
+
+#endif
+
+
+static void ngx_http_v2_read_handler(ngx_event_t *rev)
+{
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_connection_t          *c;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = rev->data;
+    h2c = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 read handler");
+
+    if (h2c->closing) {
+        return;
+    }
+
+    if (rev->timedout) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 idle connection timed out");
+
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    h2c->handling = 1;
+    b = h2c->buffer;
+
+    do {
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+
+            /* ngx_ssl_recv() does not clear the ready flag */
+
+            rev->ready = 0;
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http2 client closed connection");
+
+            if (n == NGX_ERROR) {
+                rev->error = 1;
+
+            } else {
+                rev->eof = 1;
+            }
+
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+            break;
+        }
+
+        b->last += n;
+
+        if (ngx_http_v2_process(h2c) == NGX_ERROR) {
+            break;
+        }
+
+    } while (rev->ready && !h2c->closing);
+
+    if (!h2c->closing) {
+        if (ngx_handle_read_event(rev, 0) == NGX_ERROR
+            || ngx_http_v2_send_output(h2c) == NGX_ERROR)
+        {
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+        }
+    }
+
+    h2c->handling = 0;
+
+    ngx_http_v2_handle_idle(h2c);
+}
+
+
+static void ngx_http_v2_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t          *c;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = wev->data;
+    h2c = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 write handler");
+
+    if (h2c->closing) {
+        return;
+    }
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT, "client timed out");
+        c->timedout = 1;
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    h2c->handling = 1;
+
+    if (ngx_http_v2_send_output(h2c) == NGX_ERROR) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+    }
+
+    h2c->handling = 0;
+
+    ngx_http_v2_handle_idle(h2c);
+}
+
+
+static ngx_int_t ngx_http_v2_process(ngx_http_v2_connection_t *h2c)
+{
+    u_char      *p;
+    size_t       size, len;
+    ngx_buf_t   *b;
+    ngx_uint_t   type, sid;
+
+    b = h2c->buffer;
+
+    if (!h2c->preface) {
+        size = b->last - b->pos;
+        len = sizeof(NGX_HTTP_V2_PREFACE) - 1;
+
+        if (ngx_memcmp(b->pos, NGX_HTTP_V2_PREFACE, size < len ? size : len)
+                                                                         != 0)
+        {
+            return ngx_http_v2_connection_error(h2c,
+                                              NGX_HTTP_V2_PROTOCOL_ERROR,
+                                              "client sent invalid preface");
+        }
+
+        if (size < len) {
+            return NGX_OK;
+        }
+
+        b->pos += len;
+        h2c->preface = 1;
+    }
+
+    while (!h2c->closing) {
+        p = b->pos;
+        size = b->last - p;
+
+        if (size < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+            break;
+        }
+
+        len = p[0] << 16 | p[1] << 8 | p[2];
+
+        if (len > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+            return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                                                "client sent too large frame");
+        }
+
+        if (size < NGX_HTTP_V2_FRAME_HEADER_SIZE + len) {
+            break;
+        }
+
+        b->pos += NGX_HTTP_V2_FRAME_HEADER_SIZE + len;
+
+        type = p[3];
+        sid = ngx_http_v2_parse_uint32(&p[5]) & 0x7fffffff;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 frame type:%" NGX_UINT_T_FMT
+                       " flags:%" NGX_UINT_T_FMT " len:" SIZE_T_FMT
+                       " sid:%" NGX_UINT_T_FMT,
+                       type, (ngx_uint_t) p[4], len, sid);
+
+        if (h2c->headers.active && type != NGX_HTTP_V2_CONTINUATION_FRAME) {
+            return ngx_http_v2_connection_error(h2c,
+                                   NGX_HTTP_V2_PROTOCOL_ERROR,
+                                   "client sent frame instead of CONTINUATION");
+        }
+
+        if (!h2c->settings && type != NGX_HTTP_V2_SETTINGS_FRAME) {
+            return ngx_http_v2_connection_error(h2c,
+                                   NGX_HTTP_V2_PROTOCOL_ERROR,
+                                   "client did not start with SETTINGS frame");
+        }
+
+        /* the frames of the unknown types are ignored */
+
+        if (type >= NGX_HTTP_V2_FRAME_STATES) {
+            continue;
+        }
+
+        if (ngx_http_v2_frame_states[type](h2c, p[4], sid,
+                                           p + NGX_HTTP_V2_FRAME_HEADER_SIZE,
+                                           len) == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    size = b->last - b->pos;
+
+    if (b->pos != b->start) {
+        if (size) {
+            ngx_memmove(b->start, b->pos, size);
+        }
+
+        b->pos = b->start;
+        b->last = b->start + size;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_data(ngx_http_v2_connection_t *h2c,
+                                        ngx_uint_t flags, ngx_uint_t sid,
+                                        u_char *pos, size_t len)
+{
+    size_t                 size;
+    ngx_buf_t             *b;
+    ngx_event_t           *rev;
+    ngx_http_v2_stream_t  *stream;
+
+    if (sid == 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                                  "client sent DATA frame with zero stream id");
+    }
+
+    /* the flow control counts the padding too */
+
+    size = len;
+
+    if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (len == 0 || (size_t) pos[0] >= len) {
+            return ngx_http_v2_connection_error(h2c,
+                              NGX_HTTP_V2_PROTOCOL_ERROR,
+                              "client sent DATA frame with incorrect padding");
+        }
+
+        len -= pos[0] + 1;
+        pos++;
+    }
+
+    if (size > h2c->recv_window) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_FLOW_CTRL_ERROR,
+                            "client violated connection flow control");
+    }
+
+    h2c->recv_window -= size;
+
+    if (h2c->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+        if (ngx_http_v2_send_window_update(h2c, 0, NGX_HTTP_V2_MAX_WINDOW
+                                                   - h2c->recv_window)
+            == NGX_ERROR)
+        {
+            return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+        }
+
+        h2c->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    }
+
+    stream = ngx_http_v2_find_stream(h2c, sid);
+
+    if (stream == NULL) {
+        if (sid > h2c->last_sid) {
+            return ngx_http_v2_connection_error(h2c,
+                                   NGX_HTTP_V2_PROTOCOL_ERROR,
+                                   "client sent DATA frame for idle stream");
+        }
+
+        /* the DATA frames of the closed streams are ignored */
+
+        return NGX_OK;
+    }
+
+    if (stream->reset) {
+        return NGX_OK;
+    }
+
+    if (stream->in_closed) {
+        return ngx_http_v2_terminate_stream(h2c, stream,
+                                            NGX_HTTP_V2_STREAM_CLOSED);
+    }
+
+    if (size > stream->recv_window) {
+        return ngx_http_v2_terminate_stream(h2c, stream,
+                                            NGX_HTTP_V2_FLOW_CTRL_ERROR);
+    }
+
+    stream->recv_window -= size;
+    stream->recv_unacked += size - len;
+
+    if (len) {
+        b = stream->preread;
+
+        if (b == NULL) {
+            b = ngx_create_temp_buf(stream->pool, NGX_HTTP_V2_STREAM_WINDOW);
+            if (b == NULL) {
+                return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+            }
+
+            stream->preread = b;
+        }
+
+        if ((size_t) (b->end - b->last) < len) {
+            ngx_memmove(b->start, b->pos, b->last - b->pos);
+            b->last = b->start + (b->last - b->pos);
+            b->pos = b->start;
+        }
+
+        /* the stream window guarantees the room */
+
+        b->last = ngx_cpymem(b->last, pos, len);
+    }
+
+    if (flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+        stream->in_closed = 1;
+    }
+
+    if (stream->reading) {
+        stream->reading = 0;
+        rev = &stream->read;
+        ngx_post_event(rev);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_headers(ngx_http_v2_connection_t *h2c,
+                                           ngx_uint_t flags, ngx_uint_t sid,
+                                           u_char *pos, size_t len)
+{
+    size_t                       padding;
+    ngx_http_v2_header_block_t  *hb;
+
+    hb = &h2c->headers;
+
+    if (sid == 0 || sid % 2 == 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                           "client sent HEADERS frame with incorrect stream id");
+    }
+
+    padding = 0;
+
+    if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (len == 0) {
+            goto failed;
+        }
+
+        padding = pos[0];
+        pos++;
+        len--;
+    }
+
+    hb->priority = 0;
+
+    if (flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+        if (len < 5) {
+            goto failed;
+        }
+
+        hb->depend = ngx_http_v2_parse_uint32(pos) & 0x7fffffff;
+        hb->weight = pos[4] + 1;
+        hb->priority = 1;
+
+        pos += 5;
+        len -= 5;
+    }
+
+    if (padding > len) {
+        goto failed;
+    }
+
+    len -= padding;
+
+    hb->sid = sid;
+    hb->end_stream = (flags & NGX_HTTP_V2_END_STREAM_FLAG) ? 1 : 0;
+
+    if (flags & NGX_HTTP_V2_END_HEADERS_FLAG) {
+        return ngx_http_v2_process_header_block(h2c, pos, len);
+    }
+
+    return ngx_http_v2_save_header_block(h2c, pos, len);
+
+failed:
+
+    return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                                "client sent HEADERS frame with incorrect length");
+}
+
+
+static ngx_int_t ngx_http_v2_state_continuation(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t flags,
+                                                ngx_uint_t sid,
+                                                u_char *pos, size_t len)
+{
+    ngx_buf_t                   *b;
+    ngx_http_v2_header_block_t  *hb;
+
+    hb = &h2c->headers;
+
+    if (!hb->active || sid != hb->sid) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                                   "client sent unexpected CONTINUATION frame");
+    }
+
+    if (ngx_http_v2_save_header_block(h2c, pos, len) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (!(flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+        return NGX_OK;
+    }
+
+    hb->active = 0;
+    b = hb->buf;
+
+    return ngx_http_v2_process_header_block(h2c, b->pos, b->last - b->pos);
+}
+
+
+static ngx_int_t ngx_http_v2_save_header_block(ngx_http_v2_connection_t *h2c,
+                                               u_char *pos, size_t len)
+{
+    ngx_buf_t                   *b;
+    ngx_http_v2_header_block_t  *hb;
+
+    hb = &h2c->headers;
+    b = hb->buf;
+
+    if (b == NULL) {
+        b = ngx_create_temp_buf(h2c->connection->pool,
+                              h2c->cscf->large_client_header_buffers.num
+                              * h2c->cscf->large_client_header_buffers.size);
+        if (b == NULL) {
+            return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+        }
+
+        hb->buf = b;
+    }
+
+    if (!hb->active) {
+        b->pos = b->start;
+        b->last = b->start;
+        hb->active = 1;
+    }
+
+    if ((size_t) (b->end - b->last) < len) {
+        return ngx_http_v2_connection_error(h2c,
+                                            NGX_HTTP_V2_ENHANCE_YOUR_CALM,
+                                            "client sent too large header block");
+    }
+
+    b->last = ngx_cpymem(b->last, pos, len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_process_header_block(ngx_http_v2_connection_t *h2c,
+                                                  u_char *pos, size_t len)
+{
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b;
+    ngx_pool_t                  *pool;
+    ngx_uint_t                   status;
+    ngx_event_t                 *rev;
+    ngx_array_t                  fields;
+    ngx_http_v2_stream_t        *stream;
+    ngx_http_v2_header_block_t  *hb;
+
+    hb = &h2c->headers;
+
+    if (!(pool = ngx_create_pool(NGX_HTTP_V2_STREAM_POOL_SIZE,
+                                 h2c->connection->log)))
+    {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    if (ngx_array_init(&fields, pool, 16, sizeof(ngx_http_v2_header_t))
+                                                                 == NGX_ERROR)
+    {
+        ngx_destroy_pool(pool);
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    /* the block is decoded anyway to keep the dynamic table in sync */
+
+    rc = ngx_http_v2_decode_header_block(h2c, pool, pos, len, &fields);
+
+    if (rc == NGX_ERROR) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    stream = ngx_http_v2_find_stream(h2c, hb->sid);
+
+    if (stream || hb->sid <= h2c->last_sid) {
+        ngx_destroy_pool(pool);
+
+        if (stream == NULL || stream->reset) {
+            return NGX_OK;
+        }
+
+        if (stream->in_closed) {
+            return ngx_http_v2_terminate_stream(h2c, stream,
+                                                NGX_HTTP_V2_STREAM_CLOSED);
+        }
+
+        if (!hb->end_stream) {
+            return ngx_http_v2_terminate_stream(h2c, stream,
+                                                NGX_HTTP_V2_PROTOCOL_ERROR);
+        }
+
+        /* the trailer fields are ignored */
+
+        stream->in_closed = 1;
+
+        if (stream->reading) {
+            stream->reading = 0;
+            rev = &stream->read;
+            ngx_post_event(rev);
+        }
+
+        return NGX_OK;
+    }
+
+    h2c->last_sid = hb->sid;
+
+    status = NGX_HTTP_V2_NO_ERROR;
+    b = NULL;
+
+    if (h2c->goaway
+        || h2c->processing >= (ngx_uint_t) h2c->conf->concurrent_streams)
+    {
+        status = NGX_HTTP_V2_REFUSED_STREAM;
+
+    } else if (rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent too large request header");
+
+        status = NGX_HTTP_V2_ENHANCE_YOUR_CALM;
+
+    } else {
+        rc = ngx_http_v2_construct_request(pool, &fields, &b);
+
+        if (rc == NGX_ERROR) {
+            ngx_destroy_pool(pool);
+            return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent invalid request header");
+
+            status = NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+    }
+
+    if (status != NGX_HTTP_V2_NO_ERROR) {
+        ngx_destroy_pool(pool);
+
+        if (ngx_http_v2_send_rst_stream(h2c, hb->sid, status) == NGX_ERROR) {
+            return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+        }
+
+        return NGX_OK;
+    }
+
+    if (!(stream = ngx_http_v2_create_stream(h2c, pool))) {
+        ngx_destroy_pool(pool);
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    stream->connection.buffer = b;
+
+    if (hb->priority) {
+        ngx_http_v2_set_priority(h2c, stream, hb->depend, hb->weight);
+    }
+
+    if (hb->end_stream) {
+        stream->in_closed = 1;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 stream %" NGX_UINT_T_FMT, stream->id);
+
+    /* the request line and headers are run by the HTTP/1.x parser */
+
+    ngx_http_init_connection(&stream->connection);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_decode_header_block(ngx_http_v2_connection_t *h2c,
+                                                 ngx_pool_t *pool,
+                                                 u_char *pos, size_t len,
+                                                 ngx_array_t *fields)
+{
+    u_char                *end;
+    size_t                 size, limit;
+    ngx_int_t              rc;
+    ngx_str_t              name, value;
+    ngx_uint_t             ch, index, add, update, too_large;
+    ngx_http_v2_header_t  *h;
+
+    end = pos + len;
+
+    size = 0;
+    limit = h2c->cscf->large_client_header_buffers.num
+            * h2c->cscf->large_client_header_buffers.size;
+    too_large = 0;
+
+    /* the table size update is allowed only at the block start */
+
+    update = 1;
+
+    while (pos < end) {
+        ch = *pos;
+
+        if (ch & 0x80) {
+
+            /* the indexed field */
+
+            if (ngx_http_v2_parse_int(&pos, end, 7, &index) != NGX_OK) {
+                goto failed;
+            }
+
+            rc = ngx_http_v2_get_indexed_header(h2c, pool, index,
+                                                &name, &value);
+            if (rc != NGX_OK) {
+                goto error;
+            }
+
+        } else if ((ch & 0xe0) == 0x20) {
+
+            /* the dynamic table size update */
+
+            if (!update
+                || ngx_http_v2_parse_int(&pos, end, 5, &index) != NGX_OK
+                || index > NGX_HTTP_V2_TABLE_SIZE)
+            {
+                goto failed;
+            }
+
+            ngx_http_v2_table_resize(&h2c->hpack, index);
+            continue;
+
+        } else {
+
+            /* the literal field with or without incremental indexing */
+
+            add = (ch & 0x40) ? 1 : 0;
+
+            if (ngx_http_v2_parse_int(&pos, end, add ? 6 : 4, &index)
+                                                                    != NGX_OK)
+            {
+                goto failed;
+            }
+
+            if (index) {
+                rc = ngx_http_v2_get_indexed_header(h2c, pool, index,
+                                                    &name, NULL);
+
+            } else {
+                rc = ngx_http_v2_parse_string(pool, &pos, end, &name);
+            }
+
+            if (rc != NGX_OK) {
+                goto error;
+            }
+
+            if ((rc = ngx_http_v2_parse_string(pool, &pos, end, &value))
+                                                                    != NGX_OK)
+            {
+                goto error;
+            }
+
+            if (add && ngx_http_v2_table_add(h2c, &name, &value) == NGX_ERROR) {
+                return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+            }
+        }
+
+        update = 0;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 header: \"%.*s: %.*s\"",
+                       (int) name.len, name.data,
+                       (int) value.len, value.data);
+
+        size += name.len + value.len + 4;
+
+        if (size > limit) {
+            too_large = 1;
+            continue;
+        }
+
+        if (!(h = ngx_push_array(fields))) {
+            return ngx_http_v2_connection_error(h2c,
+                                           NGX_HTTP_V2_INTERNAL_ERROR, NULL);
+        }
+
+        h->name = name;
+        h->value = value;
+    }
+
+    return too_large ? NGX_DECLINED : NGX_OK;
+
+error:
+
+    if (rc == NGX_ERROR) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+failed:
+
+    return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_COMP_ERROR,
+                                        "client sent invalid header block");
+}
+
+
+static ngx_int_t ngx_http_v2_parse_int(u_char **pos, u_char *end,
+                                       ngx_uint_t prefix, ngx_uint_t *value)
+{
+    u_char      *p;
+    ngx_uint_t   mask, shift, v;
+
+    p = *pos;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    mask = (1 << prefix) - 1;
+    v = *p++ & mask;
+
+    if (v == mask) {
+
+        /* the values are limited to 2^28 */
+
+        for (shift = 0; /* void */; shift += 7) {
+            if (p == end || shift > 21) {
+                return NGX_ERROR;
+            }
+
+            v += (ngx_uint_t) (*p & 0x7f) << shift;
+
+            if (!(*p++ & 0x80)) {
+                break;
+            }
+        }
+    }
+
+    *pos = p;
+    *value = v;
+
+    return NGX_OK;
+}
+
+
+/*
+ * returns NGX_OK, NGX_DECLINED on the invalid string, or NGX_ERROR
+ * on the allocation failure
+ */
+
+static ngx_int_t ngx_http_v2_parse_string(ngx_pool_t *pool, u_char **pos,
+                                          u_char *end, ngx_str_t *s)
+{
+    u_char      *p;
+    ngx_uint_t   huff, len;
+
+    if (*pos == end) {
+        return NGX_DECLINED;
+    }
+
+    huff = **pos & 0x80;
+
+    if (ngx_http_v2_parse_int(pos, end, 7, &len) != NGX_OK
+        || len > (size_t) (end - *pos))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (huff) {
+
+        /* the shortest code is 5 bits long */
+
+        if (!(p = ngx_palloc(pool, len * 8 / 5 + 1))) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_v2_huff_decode(*pos, len, p, &s->len) != NGX_OK) {
+            return NGX_DECLINED;
+        }
+
+        s->data = p;
+
+    } else {
+        s->len = len;
+        s->data = *pos;
+    }
+
+    *pos += len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_huff_decode(u_char *src, size_t len, u_char *dst,
+                                         size_t *size)
+{
+    u_char      *p, *last;
+    uint32_t     code, n;
+    ngx_uint_t   bits, bit;
+
+    p = dst;
+    last = src + len;
+
+    code = 0;
+    bits = 0;
+
+    while (src < last) {
+        for (bit = 0x80; bit; bit >>= 1) {
+            code = code << 1 | ((*src & bit) ? 1 : 0);
+            bits++;
+
+            n = code - ngx_http_v2_huff_first[bits];
+
+            if (n < ngx_http_v2_huff_count[bits]) {
+                n = ngx_http_v2_huff_sym[ngx_http_v2_huff_offset[bits] + n];
+
+                if (n == NGX_HTTP_V2_HUFF_EOS) {
+                    return NGX_ERROR;
+                }
+
+                *p++ = (u_char) n;
+
+                code = 0;
+                bits = 0;
+                continue;
+            }
+
+            if (bits == NGX_HTTP_V2_HUFF_MAX_LEN) {
+                return NGX_ERROR;
+            }
+        }
+
+        src++;
+    }
+
+    /* the padding is the most significant bits of EOS, i.e. all ones */
+
+    if (bits > 7 || code != (1U << bits) - 1) {
+        return NGX_ERROR;
+    }
+
+    *size = p - dst;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the fields of the dynamic table are copied to the stream pool
+ * because the entries may be evicted while the block is decoded
+ */
+
+static ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
+                                                ngx_pool_t *pool,
+                                                ngx_uint_t index,
+                                                ngx_str_t *name,
+                                                ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_http_v2_hpack_t        *hpack;
+    ngx_http_v2_hpack_entry_t  *e;
+
+    if (index == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (index <= NGX_HTTP_V2_STATIC_TABLE_ENTRIES) {
+        *name = ngx_http_v2_static_table[index - 1].name;
+
+        if (value) {
+            *value = ngx_http_v2_static_table[index - 1].value;
+        }
+
+        return NGX_OK;
+    }
+
+    hpack = &h2c->hpack;
+    index -= NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1;
+
+    if (index >= hpack->nentries) {
+        return NGX_DECLINED;
+    }
+
+    /* the newest entry has the lowest index */
+
+    e = &hpack->entries[hpack->nentries - 1 - index];
+
+    len = e->name_len + (value ? e->value_len : 0);
+
+    if (!(p = ngx_palloc(pool, len + 1))) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, hpack->storage + e->offset, len);
+
+    name->len = e->name_len;
+    name->data = p;
+
+    if (value) {
+        value->len = e->value_len;
+        value->data = p + e->name_len;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_table_add(ngx_http_v2_connection_t *h2c,
+                                       ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      size;
+    ngx_http_v2_hpack_t        *hpack;
+    ngx_http_v2_hpack_entry_t  *e;
+
+    hpack = &h2c->hpack;
+    size = name->len + value->len + NGX_HTTP_V2_TABLE_ENTRY_OVERHEAD;
+
+    if (size > hpack->max_size) {
+
+        /* RFC 7541, 4.4: the table is emptied */
+
+        hpack->nentries = 0;
+        hpack->used = 0;
+        hpack->size = 0;
+
+        return NGX_OK;
+    }
+
+    if (hpack->storage == NULL) {
+        hpack->storage = ngx_palloc(h2c->connection->pool,
+                                    NGX_HTTP_V2_TABLE_SIZE);
+        if (hpack->storage == NULL) {
+            return NGX_ERROR;
+        }
+
+        hpack->entries = ngx_palloc(h2c->connection->pool,
+                                   sizeof(ngx_http_v2_hpack_entry_t)
+                                   * (NGX_HTTP_V2_TABLE_SIZE
+                                      / NGX_HTTP_V2_TABLE_ENTRY_OVERHEAD));
+        if (hpack->entries == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    while (hpack->size + size > hpack->max_size) {
+        ngx_http_v2_table_evict(hpack);
+    }
+
+    e = &hpack->entries[hpack->nentries++];
+
+    e->offset = hpack->used;
+    e->name_len = name->len;
+    e->value_len = value->len;
+
+    p = ngx_cpymem(hpack->storage + hpack->used, name->data, name->len);
+    ngx_memcpy(p, value->data, value->len);
+
+    hpack->used += name->len + value->len;
+    hpack->size += size;
+
+    return NGX_OK;
+}
+
+
+static void ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t size)
+{
+    hpack->max_size = size;
+
+    while (hpack->size > hpack->max_size) {
+        ngx_http_v2_table_evict(hpack);
+    }
+}
+
+
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_t *hpack)
+{
+    size_t      len;
+    ngx_uint_t  i;
+
+    len = hpack->entries[0].name_len + hpack->entries[0].value_len;
+
+    hpack->used -= len;
+    hpack->size -= len + NGX_HTTP_V2_TABLE_ENTRY_OVERHEAD;
+    hpack->nentries--;
+
+    ngx_memmove(hpack->storage, hpack->storage + len, hpack->used);
+
+    for (i = 0; i < hpack->nentries; i++) {
+        hpack->entries[i] = hpack->entries[i + 1];
+        hpack->entries[i].offset -= len;
+    }
+}
+
+
+/*
+ * the request is converted to the HTTP/1.x request line and header lines,
+ * so it is handled by the usual parser and phases
+ */
+
+static ngx_int_t ngx_http_v2_construct_request(ngx_pool_t *pool,
+                                               ngx_array_t *fields,
+                                               ngx_buf_t **bp)
+{
+    u_char                *p, ch;
+    size_t                 len;
+    ngx_buf_t             *b;
+    ngx_str_t              method, path, scheme, authority, *pseudo, *skip;
+    ngx_uint_t             i, n, regular;
+    ngx_http_v2_header_t  *h;
+
+    method.len = 0;
+    path.len = 0;
+    scheme.len = 0;
+    authority.len = 0;
+
+    len = 0;
+    regular = 0;
+
+    h = fields->elts;
+
+    for (i = 0; i < fields->nelts; i++) {
+
+        if (h[i].name.len && h[i].name.data[0] == ':') {
+
+            /* the pseudo-header fields precede the regular ones */
+
+            if (regular) {
+                return NGX_DECLINED;
+            }
+
+            if (h[i].name.len == sizeof(":method") - 1
+                && ngx_strncmp(h[i].name.data, ":method", 7) == 0)
+            {
+                pseudo = &method;
+
+            } else if (h[i].name.len == sizeof(":path") - 1
+                       && ngx_strncmp(h[i].name.data, ":path", 5) == 0)
+            {
+                pseudo = &path;
+
+            } else if (h[i].name.len == sizeof(":scheme") - 1
+                       && ngx_strncmp(h[i].name.data, ":scheme", 7) == 0)
+            {
+                pseudo = &scheme;
+
+            } else if (h[i].name.len == sizeof(":authority") - 1
+                       && ngx_strncmp(h[i].name.data, ":authority", 10) == 0)
+            {
+                pseudo = &authority;
+
+            } else {
+                return NGX_DECLINED;
+            }
+
+            if (pseudo->len || h[i].value.len == 0) {
+                return NGX_DECLINED;
+            }
+
+            for (n = 0; n < h[i].value.len; n++) {
+                ch = h[i].value.data[n];
+
+                if (ch <= ' ' || ch == 0x7f) {
+                    return NGX_DECLINED;
+                }
+            }
+
+            *pseudo = h[i].value;
+
+            continue;
+        }
+
+        regular = 1;
+
+        if (h[i].name.len == 0) {
+            return NGX_DECLINED;
+        }
+
+        for (n = 0; n < h[i].name.len; n++) {
+            ch = h[i].name.data[n];
+
+            if (ch <= ' ' || ch >= 0x7f || ch == ':'
+                || (ch >= 'A' && ch <= 'Z'))
+            {
+                return NGX_DECLINED;
+            }
+        }
+
+        for (n = 0; n < h[i].value.len; n++) {
+            ch = h[i].value.data[n];
+
+            if (ch == '\0' || ch == CR || ch == LF) {
+                return NGX_DECLINED;
+            }
+        }
+
+        for (skip = ngx_http_v2_skip_fields; skip->len; skip++) {
+            if (h[i].name.len == skip->len
+                && ngx_strncmp(h[i].name.data, skip->data, skip->len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (skip->len
+            || (authority.len && h[i].name.len == sizeof("host") - 1
+                && ngx_strncmp(h[i].name.data, "host", 4) == 0))
+        {
+            /* the field is skipped */
+            h[i].name.len = 0;
+            continue;
+        }
+
+        len += h[i].name.len + sizeof(": ") - 1 + h[i].value.len + 2;
+    }
+
+    if (method.len == 0 || scheme.len == 0 || path.len == 0
+        || path.data[0] != '/')
+    {
+        return NGX_DECLINED;
+    }
+
+    len += method.len + 1 + path.len + sizeof(" HTTP/2.0" CRLF) - 1
+           + sizeof(CRLF) - 1;
+
+    if (authority.len) {
+        len += sizeof("Host: ") - 1 + authority.len + sizeof(CRLF) - 1;
+    }
+
+    if (!(b = ngx_create_temp_buf(pool, len))) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(b->last, method.data, method.len);
+    *p++ = ' ';
+    p = ngx_cpymem(p, path.data, path.len);
+    p = ngx_cpymem(p, " HTTP/2.0" CRLF, sizeof(" HTTP/2.0" CRLF) - 1);
+
+    if (authority.len) {
+        p = ngx_cpymem(p, "Host: ", sizeof("Host: ") - 1);
+        p = ngx_cpymem(p, authority.data, authority.len);
+        *p++ = CR; *p++ = LF;
+    }
+
+    for (i = 0; i < fields->nelts; i++) {
+        if (h[i].name.len == 0 || h[i].name.data[0] == ':') {
+            continue;
+        }
+
+        p = ngx_cpymem(p, h[i].name.data, h[i].name.len);
+        *p++ = ':'; *p++ = ' ';
+        p = ngx_cpymem(p, h[i].value.data, h[i].value.len);
+        *p++ = CR; *p++ = LF;
+    }
+
+    *p++ = CR; *p++ = LF;
+
+    b->last = p;
+    *bp = b;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_v2_stream_t *ngx_http_v2_create_stream(
+                          ngx_http_v2_connection_t *h2c, ngx_pool_t *pool)
+{
+    ngx_event_t            *rev, *wev;
+    ngx_connection_t       *c, *fc;
+    ngx_http_v2_stream_t   *stream, **index;
+
+    c = h2c->connection;
+
+    if (!(stream = ngx_pcalloc(pool, sizeof(ngx_http_v2_stream_t)))) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     stream->parent = NULL;
+     *     stream->preread = NULL;
+     *     stream->queued = 0;
+     *     stream->free_frames = NULL;
+     *     stream->free_links = NULL;
+     */
+
+    stream->h2c = h2c;
+    stream->pool = pool;
+    stream->id = h2c->headers.sid;
+    stream->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+    stream->send_window = h2c->init_window;
+    stream->recv_window = NGX_HTTP_V2_STREAM_WINDOW;
+
+    stream->log = *c->log;
+
+    rev = &stream->read;
+    wev = &stream->write;
+    fc = &stream->connection;
+
+    rev->data = fc;
+    rev->ready = 1;
+    rev->log = &stream->log;
+    rev->index = NGX_INVALID_INDEX;
+
+    wev->data = fc;
+    wev->write = 1;
+    wev->ready = 1;
+    wev->log = &stream->log;
+    wev->index = NGX_INVALID_INDEX;
+
+    fc->read = rev;
+    fc->write = wev;
+    fc->fd = c->fd;
+    fc->recv = ngx_http_v2_recv;
+    fc->send_chain = ngx_http_v2_send_chain;
+    fc->pool = pool;
+    fc->log = &stream->log;
+
+#if (NGX_OPENSSL)
+    fc->ssl = c->ssl;
+#endif
+
+    fc->listening = c->listening;
+    fc->servers = c->servers;
+    fc->sockaddr = c->sockaddr;
+    fc->socklen = c->socklen;
+    fc->addr_text = c->addr_text;
+    fc->number = c->number;
+
+    index = &h2c->streams[ngx_http_v2_index(stream->id)];
+    stream->index_next = *index;
+    *index = stream;
+
+    h2c->processing++;
+
+    /* the idle timer */
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    return stream;
+}
+
+
+static ngx_http_v2_stream_t *ngx_http_v2_find_stream(
+                          ngx_http_v2_connection_t *h2c, ngx_uint_t sid)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    for (stream = h2c->streams[ngx_http_v2_index(sid)];
+         stream;
+         stream = stream->index_next)
+    {
+        if (stream->id == sid) {
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * the exclusive flag is ignored: the dependencies only set the rank
+ * of the stream frames in the output queue
+ */
+
+static void ngx_http_v2_set_priority(ngx_http_v2_connection_t *h2c,
+                                     ngx_http_v2_stream_t *stream,
+                                     ngx_uint_t depend, ngx_uint_t weight)
+{
+    ngx_http_v2_stream_t  *parent, *p;
+
+    parent = NULL;
+
+    if (depend && depend != stream->id) {
+        parent = ngx_http_v2_find_stream(h2c, depend);
+    }
+
+    /* RFC 7540, 5.3.3: the dependent parent is moved to our former parent */
+
+    for (p = parent; p; p = p->parent) {
+        if (p == stream) {
+            parent->parent = stream->parent;
+            break;
+        }
+    }
+
+    stream->parent = parent;
+    stream->weight = weight;
+}
+
+
+static ngx_int_t ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t flags, ngx_uint_t sid,
+                                            u_char *pos, size_t len)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    if (len != 5) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                          "client sent PRIORITY frame with incorrect length");
+    }
+
+    if (sid == 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                          "client sent PRIORITY frame with zero stream id");
+    }
+
+    /* the priorities of the idle and closed streams are not kept */
+
+    stream = ngx_http_v2_find_stream(h2c, sid);
+
+    if (stream) {
+        ngx_http_v2_set_priority(h2c, stream,
+                                 ngx_http_v2_parse_uint32(pos) & 0x7fffffff,
+                                 pos[4] + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c,
+                                              ngx_uint_t flags, ngx_uint_t sid,
+                                              u_char *pos, size_t len)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    if (len != 4) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                        "client sent RST_STREAM frame with incorrect length");
+    }
+
+    if (sid == 0 || sid > h2c->last_sid) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                        "client sent RST_STREAM frame for idle stream");
+    }
+
+    stream = ngx_http_v2_find_stream(h2c, sid);
+
+    if (stream == NULL || stream->reset) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, stream->connection.log, 0,
+                  "client terminated stream %" NGX_UINT_T_FMT
+                  " with status %" NGX_UINT_T_FMT,
+                  sid, (ngx_uint_t) ngx_http_v2_parse_uint32(pos));
+
+    ngx_http_v2_reset_stream(stream);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t flags, ngx_uint_t sid,
+                                            u_char *pos, size_t len)
+{
+    ssize_t                delta;
+    ngx_uint_t             i, id, value;
+    ngx_http_v2_stream_t  *stream;
+
+    if (sid != 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                        "client sent SETTINGS frame with non-zero stream id");
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+        if (len != 0) {
+            goto failed;
+        }
+
+        return NGX_OK;
+    }
+
+    if (len % 6) {
+        goto failed;
+    }
+
+    for ( /* void */ ; len; len -= 6, pos += 6) {
+        id = ngx_http_v2_parse_uint16(pos);
+        value = ngx_http_v2_parse_uint32(&pos[2]);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 setting %" NGX_UINT_T_FMT ":%" NGX_UINT_T_FMT,
+                       id, value);
+
+        switch (id) {
+
+        case NGX_HTTP_V2_ENABLE_PUSH:
+            if (value > 1) {
+                return ngx_http_v2_connection_error(h2c,
+                                 NGX_HTTP_V2_PROTOCOL_ERROR,
+                                 "client sent incorrect ENABLE_PUSH setting");
+            }
+
+            break;
+
+        case NGX_HTTP_V2_INIT_WINDOW_SIZE:
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                return ngx_http_v2_connection_error(h2c,
+                         NGX_HTTP_V2_FLOW_CTRL_ERROR,
+                         "client sent incorrect INITIAL_WINDOW_SIZE setting");
+            }
+
+            /* RFC 7540, 6.9.2: the open stream windows are adjusted */
+
+            delta = (ssize_t) value - (ssize_t) h2c->init_window;
+            h2c->init_window = value;
+
+            for (i = 0; i < NGX_HTTP_V2_INDEX_SIZE; i++) {
+                for (stream = h2c->streams[i];
+                     stream;
+                     stream = stream->index_next)
+                {
+                    if (stream->send_window + delta
+                                            > (ssize_t) NGX_HTTP_V2_MAX_WINDOW)
+                    {
+                        return ngx_http_v2_connection_error(h2c,
+                                      NGX_HTTP_V2_FLOW_CTRL_ERROR,
+                                      "client overflowed stream window");
+                    }
+
+                    stream->send_window += delta;
+
+                    if (stream->exhausted && stream->send_window > 0
+                        && h2c->send_window > 0)
+                    {
+                        ngx_http_v2_wake_stream(h2c, stream);
+                    }
+                }
+            }
+
+            break;
+
+        case NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING:
+            if (value < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+                || value > NGX_HTTP_V2_MAX_FRAME_SIZE)
+            {
+                return ngx_http_v2_connection_error(h2c,
+                            NGX_HTTP_V2_PROTOCOL_ERROR,
+                            "client sent incorrect MAX_FRAME_SIZE setting");
+            }
+
+            h2c->frame_size = value;
+            break;
+
+        default:
+
+            /* HEADER_TABLE_SIZE limits our encoder that does not index */
+
+            break;
+        }
+    }
+
+    h2c->settings = 1;
+
+    if (ngx_http_v2_send_settings(h2c, 1) == NGX_ERROR) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                          "client sent SETTINGS frame with incorrect length");
+}
+
+
+static ngx_int_t ngx_http_v2_state_push_promise(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t flags,
+                                                ngx_uint_t sid,
+                                                u_char *pos, size_t len)
+{
+    return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                                        "client sent PUSH_PROMISE frame");
+}
+
+
+static ngx_int_t ngx_http_v2_state_ping(ngx_http_v2_connection_t *h2c,
+                                        ngx_uint_t flags, ngx_uint_t sid,
+                                        u_char *pos, size_t len)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    if (len != 8) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                              "client sent PING frame with incorrect length");
+    }
+
+    if (sid != 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                            "client sent PING frame with non-zero stream id");
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+        return NGX_OK;
+    }
+
+    frame = ngx_http_v2_get_control_frame(h2c, 8, NGX_HTTP_V2_PING_FRAME,
+                                          NGX_HTTP_V2_ACK_FLAG, 0);
+    if (frame == NULL) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    frame->buf.last = ngx_cpymem(frame->buf.last, pos, 8);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_goaway(ngx_http_v2_connection_t *h2c,
+                                          ngx_uint_t flags, ngx_uint_t sid,
+                                          u_char *pos, size_t len)
+{
+    if (len < 8) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                            "client sent GOAWAY frame with incorrect length");
+    }
+
+    if (sid != 0) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR,
+                          "client sent GOAWAY frame with non-zero stream id");
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 goaway with status %" NGX_UINT_T_FMT,
+                   (ngx_uint_t) ngx_http_v2_parse_uint32(&pos[4]));
+
+    /* the running streams are completed */
+
+    h2c->goaway = 1;
+
+    if (h2c->processing == 0) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_state_window_update(ngx_http_v2_connection_t *h2c,
+                                                 ngx_uint_t flags,
+                                                 ngx_uint_t sid,
+                                                 u_char *pos, size_t len)
+{
+    size_t                 inc;
+    ngx_http_v2_stream_t  *stream, *next;
+
+    if (len != 4) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR,
+                     "client sent WINDOW_UPDATE frame with incorrect length");
+    }
+
+    inc = ngx_http_v2_parse_uint32(pos) & 0x7fffffff;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 window update sid:%" NGX_UINT_T_FMT
+                   " inc:" SIZE_T_FMT, sid, inc);
+
+    if (sid == 0) {
+        if (inc == 0) {
+            return ngx_http_v2_connection_error(h2c,
+                      NGX_HTTP_V2_PROTOCOL_ERROR,
+                      "client sent WINDOW_UPDATE frame with zero increment");
+        }
+
+        if (h2c->send_window + (ssize_t) inc
+                                            > (ssize_t) NGX_HTTP_V2_MAX_WINDOW)
+        {
+            return ngx_http_v2_connection_error(h2c,
+                                      NGX_HTTP_V2_FLOW_CTRL_ERROR,
+                                      "client overflowed connection window");
+        }
+
+        h2c->send_window += inc;
+
+        if (h2c->send_window > 0) {
+            for (stream = h2c->waiting; stream; stream = next) {
+                next = stream->waiting_next;
+
+                if (stream->send_window > 0) {
+                    ngx_http_v2_wake_stream(h2c, stream);
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    stream = ngx_http_v2_find_stream(h2c, sid);
+
+    if (stream == NULL) {
+        if (sid > h2c->last_sid) {
+            return ngx_http_v2_connection_error(h2c,
+                            NGX_HTTP_V2_PROTOCOL_ERROR,
+                            "client sent WINDOW_UPDATE frame for idle stream");
+        }
+
+        return NGX_OK;
+    }
+
+    if (stream->reset) {
+        return NGX_OK;
+    }
+
+    if (inc == 0) {
+        return ngx_http_v2_terminate_stream(h2c, stream,
+                                            NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if (stream->send_window + (ssize_t) inc > (ssize_t) NGX_HTTP_V2_MAX_WINDOW)
+    {
+        return ngx_http_v2_terminate_stream(h2c, stream,
+                                            NGX_HTTP_V2_FLOW_CTRL_ERROR);
+    }
+
+    stream->send_window += inc;
+
+    if (stream->exhausted && stream->send_window > 0 && h2c->send_window > 0) {
+        ngx_http_v2_wake_stream(h2c, stream);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
+                                              ngx_http_v2_stream_t *stream,
+                                              ngx_uint_t status)
+{
+    if (ngx_http_v2_send_rst_stream(h2c, stream->id, status) == NGX_ERROR) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR,
+                                            NULL);
+    }
+
+    ngx_http_v2_reset_stream(stream);
+
+    return NGX_OK;
+}
+
+
+/* the stream is not sent and received anymore, the request is woken up */
+
+static void ngx_http_v2_reset_stream(ngx_http_v2_stream_t *stream)
+{
+    ngx_event_t  *ev;
+
+    stream->reset = 1;
+    stream->connection.read->error = 1;
+    stream->connection.write->error = 1;
+
+    if (stream->reading) {
+        stream->reading = 0;
+        ev = &stream->read;
+        ngx_post_event(ev);
+    }
+
+    if (stream->blocked) {
+        stream->blocked = 0;
+        ev = &stream->write;
+        ngx_post_event(ev);
+    }
+}
+
+
+static void ngx_http_v2_wake_stream(ngx_http_v2_connection_t *h2c,
+                                    ngx_http_v2_stream_t *stream)
+{
+    ngx_event_t            *wev;
+    ngx_http_v2_stream_t  **sp;
+
+    for (sp = &h2c->waiting; *sp; sp = &(*sp)->waiting_next) {
+        if (*sp == stream) {
+            *sp = stream->waiting_next;
+            break;
+        }
+    }
+
+    stream->exhausted = 0;
+
+    if (stream->blocked && stream->queued == 0) {
+        stream->blocked = 0;
+        wev = &stream->write;
+        ngx_post_event(wev);
+    }
+}
+
+
+/*
+ * the fake write event is always ready, so ngx_http_writer() does not set
+ * the send timeout itself
+ */
+
+static void ngx_http_v2_block_stream(ngx_http_v2_stream_t *stream)
+{
+    ngx_event_t               *wev;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    stream->blocked = 1;
+
+    wev = &stream->write;
+
+    if (wev->delayed) {
+        return;
+    }
+
+    r = stream->connection.data;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_add_timer(wev, clcf->send_timeout);
+}
+
+
+ssize_t ngx_http_v2_recv(ngx_connection_t *fc, u_char *buf, size_t size)
+{
+    size_t                     n;
+    ngx_buf_t                 *b;
+    ngx_event_t               *rev;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = ngx_http_v2_stream(fc);
+    h2c = stream->h2c;
+    rev = fc->read;
+
+    if (stream->reset || h2c->closing) {
+        rev->error = 1;
+        return NGX_ERROR;
+    }
+
+    b = stream->preread;
+
+    if (b == NULL || b->pos == b->last) {
+        if (stream->in_closed) {
+            rev->eof = 1;
+            return 0;
+        }
+
+        stream->reading = 1;
+        return NGX_AGAIN;
+    }
+
+    n = b->last - b->pos;
+
+    if (n > size) {
+        n = size;
+    }
+
+    ngx_memcpy(buf, b->pos, n);
+    b->pos += n;
+
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
+
+        /*
+         * the caller that got less than it asked for waits for the next
+         * read event as ngx_unix_recv() clears rev->ready in this case
+         */
+
+        if (n < size) {
+            if (stream->in_closed) {
+                ngx_post_event(rev);
+
+            } else {
+                stream->reading = 1;
+            }
+        }
+    }
+
+    stream->recv_unacked += n;
+
+    if (!stream->in_closed
+        && stream->recv_unacked >= NGX_HTTP_V2_STREAM_WINDOW / 2)
+    {
+        if (ngx_http_v2_send_window_update(h2c, stream->id,
+                                           stream->recv_unacked) == NGX_ERROR
+            || ngx_http_v2_send_output(h2c) == NGX_ERROR)
+        {
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+            rev->error = 1;
+            return NGX_ERROR;
+        }
+
+        stream->recv_window += stream->recv_unacked;
+        stream->recv_unacked = 0;
+    }
+
+    return n;
+}
+
+
+/*
+ * the bufs are framed into the shadow bufs, so the original bufs are
+ * advanced only when the frames are really sent
+ */
+
+ngx_chain_t *ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in,
+                                    off_t limit)
+{
+    u_char                    *pos;
+    size_t                     avail, payload, n, frame_size;
+    off_t                      framed;
+    ngx_buf_t                 *b, *shadow;
+    ngx_uint_t                 fin;
+    ngx_chain_t               *cl, *ln, *last;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = ngx_http_v2_stream(fc);
+    h2c = stream->h2c;
+
+    if (stream->reset || h2c->closing) {
+        fc->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (stream->queued) {
+
+        /* the frames of the previous call are not sent yet */
+
+        goto done;
+    }
+
+    if (stream->out_closed) {
+        for (cl = in; cl; cl = cl->next) {
+            cl->buf->pos = cl->buf->last;
+        }
+
+        fc->buffered = 0;
+        return NULL;
+    }
+
+    frame_size = h2c->frame_size;
+
+    if (frame_size > h2c->conf->chunk_size) {
+        frame_size = h2c->conf->chunk_size;
+    }
+
+    framed = 0;
+    cl = in;
+    pos = cl ? cl->buf->pos : NULL;
+
+    while (cl) {
+        b = cl->buf;
+
+        if (b->tag == (ngx_buf_tag_t) &ngx_http_v2_module) {
+
+            /* the HEADERS and CONTINUATION frames of the header filter */
+
+            if (b->pos != b->last) {
+                if (!(frame = ngx_http_v2_get_frame(h2c, stream))) {
+                    goto failed;
+                }
+
+                frame->link.buf = b;
+                frame->size = b->last - b->pos;
+                frame->fin = b->last_buf;
+
+                ngx_http_v2_queue_frame(h2c, frame);
+
+                if (b->last_buf) {
+                    stream->out_closed = 1;
+                    break;
+                }
+            }
+
+            cl = cl->next;
+            pos = cl ? cl->buf->pos : NULL;
+
+            continue;
+        }
+
+        avail = frame_size;
+
+        if (stream->send_window < (ssize_t) avail) {
+            avail = stream->send_window > 0 ? stream->send_window : 0;
+        }
+
+        if (h2c->send_window < (ssize_t) avail) {
+            avail = h2c->send_window > 0 ? h2c->send_window : 0;
+        }
+
+        if (limit - framed < (off_t) avail) {
+            avail = (size_t) (limit - framed);
+        }
+
+        frame = NULL;
+        last = NULL;
+        payload = 0;
+        fin = 0;
+
+        for ( ;; ) {
+            b = cl->buf;
+
+            if (b->tag == (ngx_buf_tag_t) &ngx_http_v2_module) {
+                break;
+            }
+
+            if (!ngx_buf_in_memory(b) && !ngx_buf_special(b)) {
+                ngx_log_error(NGX_LOG_ALERT, fc->log, 0,
+                              "http2 stream got buf not in memory");
+                fc->write->error = 1;
+                return NGX_CHAIN_ERROR;
+            }
+
+            n = b->last - pos;
+
+            if (n > avail - payload) {
+                n = avail - payload;
+            }
+
+            if (n) {
+                if (frame == NULL) {
+                    if (!(frame = ngx_http_v2_get_frame(h2c, stream))) {
+                        goto failed;
+                    }
+
+                    last = &frame->link;
+                }
+
+                if (!(ln = ngx_http_v2_get_link(stream))) {
+                    goto failed;
+                }
+
+                shadow = ln->buf;
+                shadow->start = pos;
+                shadow->pos = pos;
+                shadow->last = pos + n;
+                shadow->end = pos + n;
+                shadow->memory = 1;
+                shadow->shadow = b;
+
+                last->next = ln;
+                last = ln;
+
+                payload += n;
+                pos += n;
+            }
+
+            if (pos != b->last) {
+
+                /* the frame is full */
+                break;
+            }
+
+            if (b->last_buf) {
+                fin = 1;
+            }
+
+            cl = cl->next;
+
+            if (cl == NULL) {
+                break;
+            }
+
+            pos = cl->buf->pos;
+        }
+
+        if (payload == 0 && !fin) {
+            if (cl && cl->buf->tag == (ngx_buf_tag_t) &ngx_http_v2_module) {
+                continue;
+            }
+
+            /* no window or the limit is reached */
+            break;
+        }
+
+        if (frame == NULL) {
+            if (!(frame = ngx_http_v2_get_frame(h2c, stream))) {
+                goto failed;
+            }
+
+            last = &frame->link;
+        }
+
+        frame->buf.last = ngx_http_v2_write_frame_head(frame->buf.last,
+                                   payload, NGX_HTTP_V2_DATA_FRAME,
+                                   fin ? NGX_HTTP_V2_END_STREAM_FLAG
+                                       : NGX_HTTP_V2_NO_FLAG,
+                                   stream->id);
+        frame->last = last;
+        last->next = NULL;
+        frame->size = NGX_HTTP_V2_FRAME_HEADER_SIZE + payload;
+        frame->fin = fin;
+
+        stream->send_window -= payload;
+        h2c->send_window -= payload;
+        framed += payload;
+
+        ngx_http_v2_queue_frame(h2c, frame);
+
+        if (fin) {
+            stream->out_closed = 1;
+            break;
+        }
+    }
+
+    if (cl && !stream->out_closed && !stream->exhausted
+        && (stream->send_window <= 0 || h2c->send_window <= 0))
+    {
+        stream->exhausted = 1;
+        stream->waiting_next = h2c->waiting;
+        h2c->waiting = stream;
+    }
+
+    if (ngx_http_v2_send_output(h2c) == NGX_ERROR) {
+        goto failed;
+    }
+
+done:
+
+    /* skip the sent bufs */
+
+    for ( /* void */ ; in; in = in->next) {
+        if (ngx_buf_size(in->buf)
+            || (in->buf->last_buf && !stream->out_closed))
+        {
+            break;
+        }
+    }
+
+    if (stream->queued || stream->exhausted) {
+        fc->buffered = stream->queued ? 1 : 0;
+        ngx_http_v2_block_stream(stream);
+        return in;
+    }
+
+    fc->buffered = 0;
+
+    if (in) {
+        return in;
+    }
+
+    if (fc->write->timer_set && !fc->write->delayed) {
+        ngx_del_timer(fc->write);
+    }
+
+    return NULL;
+
+failed:
+
+    ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+    fc->write->error = 1;
+
+    return NGX_CHAIN_ERROR;
+}
+
+
+/* sends END_STREAM if the last buf was not framed */
+
+ngx_int_t ngx_http_v2_end_stream(ngx_http_v2_stream_t *stream)
+{
+    ngx_connection_t          *fc;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    h2c = stream->h2c;
+    fc = &stream->connection;
+
+    if (stream->reset || h2c->closing) {
+        fc->write->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (!stream->out_closed) {
+        if (!(frame = ngx_http_v2_get_frame(h2c, stream))) {
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+            return NGX_ERROR;
+        }
+
+        frame->buf.last = ngx_http_v2_write_frame_head(frame->buf.last, 0,
+                                                   NGX_HTTP_V2_DATA_FRAME,
+                                                   NGX_HTTP_V2_END_STREAM_FLAG,
+                                                   stream->id);
+        frame->size = NGX_HTTP_V2_FRAME_HEADER_SIZE;
+        frame->fin = 1;
+
+        ngx_http_v2_queue_frame(h2c, frame);
+
+        stream->out_closed = 1;
+
+        if (ngx_http_v2_send_output(h2c) == NGX_ERROR) {
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+            return NGX_ERROR;
+        }
+    }
+
+    if (stream->queued) {
+        fc->buffered = 1;
+        ngx_http_v2_block_stream(stream);
+        return NGX_AGAIN;
+    }
+
+    fc->buffered = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_v2_out_frame_t *ngx_http_v2_get_frame(
+                          ngx_http_v2_connection_t *h2c,
+                          ngx_http_v2_stream_t *stream)
+{
+    ngx_http_v2_out_frame_t  *frame, **free;
+
+    free = stream ? &stream->free_frames : &h2c->free_frames;
+
+    if (*free) {
+        frame = *free;
+        *free = frame->next;
+
+    } else {
+        frame = ngx_palloc(stream ? stream->pool : h2c->connection->pool,
+                           sizeof(ngx_http_v2_out_frame_t));
+        if (frame == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(frame, offsetof(ngx_http_v2_out_frame_t, data));
+
+    frame->stream = stream;
+    frame->first = &frame->link;
+    frame->last = &frame->link;
+
+    frame->link.buf = &frame->buf;
+
+    frame->buf.start = frame->data;
+    frame->buf.pos = frame->data;
+    frame->buf.last = frame->data;
+    frame->buf.end = frame->data + NGX_HTTP_V2_FRAME_BUFFER_SIZE;
+    frame->buf.temporary = 1;
+
+    return frame;
+}
+
+
+static ngx_http_v2_out_frame_t *ngx_http_v2_get_control_frame(
+                          ngx_http_v2_connection_t *h2c, size_t len,
+                          ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    if (!(frame = ngx_http_v2_get_frame(h2c, NULL))) {
+        return NULL;
+    }
+
+    frame->buf.last = ngx_http_v2_write_frame_head(frame->buf.last, len,
+                                                   type, flags, sid);
+    frame->size = NGX_HTTP_V2_FRAME_HEADER_SIZE + len;
+
+    return frame;
+}
+
+
+static ngx_chain_t *ngx_http_v2_get_link(ngx_http_v2_stream_t *stream)
+{
+    ngx_chain_t  *cl;
+
+    if (stream->free_links) {
+        cl = stream->free_links;
+        stream->free_links = cl->next;
+
+    } else {
+        if (!(cl = ngx_alloc_chain_link(stream->pool))) {
+            return NULL;
+        }
+
+        if (!(cl->buf = ngx_alloc_buf(stream->pool))) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(cl->buf, sizeof(ngx_buf_t));
+    cl->next = NULL;
+
+    return cl;
+}
+
+
+u_char *ngx_http_v2_write_frame_head(u_char *p, size_t len, ngx_uint_t type,
+                                     ngx_uint_t flags, ngx_uint_t sid)
+{
+    *p++ = (u_char) (len >> 16);
+    *p++ = (u_char) (len >> 8);
+    *p++ = (u_char) len;
+    *p++ = (u_char) type;
+    *p++ = (u_char) flags;
+
+    return ngx_http_v2_write_uint32(p, sid);
+}
+
+
+/* the first octet must be already set to the representation type */
+
+u_char *ngx_http_v2_write_int(u_char *p, ngx_uint_t prefix, ngx_uint_t value)
+{
+    ngx_uint_t  mask;
+
+    mask = (1 << prefix) - 1;
+
+    if (value < mask) {
+        *p++ |= (u_char) value;
+        return p;
+    }
+
+    *p++ |= (u_char) mask;
+    value -= mask;
+
+    while (value >= 128) {
+        *p++ = (u_char) (value % 128 + 128);
+        value /= 128;
+    }
+
+    *p++ = (u_char) value;
+
+    return p;
+}
+
+
+/*
+ * the control frames are sent before the stream frames, the stream frames
+ * are ordered by the dependency depth and then by the weight
+ */
+
+static void ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
+                                    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_stream_t      *s;
+    ngx_http_v2_out_frame_t  **fp, *f;
+
+    fp = &h2c->out;
+
+    /* the partially sent frame is not preempted */
+
+    if (*fp && (*fp)->started) {
+        fp = &(*fp)->next;
+    }
+
+    if (frame->stream == NULL) {
+        while (*fp && (*fp)->stream == NULL) {
+            fp = &(*fp)->next;
+        }
+
+    } else {
+        frame->rank = 0;
+
+        for (s = frame->stream->parent; s; s = s->parent) {
+            frame->rank++;
+        }
+
+        frame->weight = frame->stream->weight;
+
+        for ( /* void */ ; *fp; fp = &(*fp)->next) {
+            f = *fp;
+
+            if (f->stream == NULL) {
+                continue;
+            }
+
+            if (f->rank > frame->rank
+                || (f->rank == frame->rank && f->weight < frame->weight))
+            {
+                break;
+            }
+        }
+
+        /* the frames of a stream are never reordered */
+
+        for (f = *fp; f; f = f->next) {
+            if (f->stream == frame->stream) {
+                for (fp = &f->next; *fp; fp = &(*fp)->next) {
+                    if ((*fp)->stream == frame->stream) {
+                        f = *fp;
+                    }
+                }
+
+                fp = &f->next;
+                break;
+            }
+        }
+
+        frame->stream->queued++;
+    }
+
+    frame->next = *fp;
+    *fp = frame;
+}
+
+
+ngx_int_t ngx_http_v2_send_output(ngx_http_v2_connection_t *h2c)
+{
+    ngx_event_t              *wev;
+    ngx_chain_t              *cl;
+    ngx_connection_t         *c;
+    ngx_http_v2_out_frame_t  *frame, *next;
+
+    c = h2c->connection;
+    wev = c->write;
+
+    if (wev->error) {
+        return NGX_ERROR;
+    }
+
+    if (h2c->sending) {
+        return NGX_OK;
+    }
+
+    h2c->sending = 1;
+
+    while (wev->ready && (h2c->out || c->buffered)) {
+
+        for (frame = h2c->out; frame; frame = frame->next) {
+            frame->last->next = frame->next ? frame->next->first : NULL;
+        }
+
+        cl = c->send_chain(c, h2c->out ? h2c->out->first : NULL,
+                           OFF_T_MAX_VALUE);
+
+        if (cl == NGX_CHAIN_ERROR) {
+            wev->error = 1;
+            h2c->sending = 0;
+            return NGX_ERROR;
+        }
+
+        for (frame = h2c->out; frame; frame = next) {
+            if (!ngx_http_v2_frame_is_sent(frame)) {
+                break;
+            }
+
+            next = frame->next;
+            ngx_http_v2_frame_sent(h2c, frame);
+        }
+
+        h2c->out = frame;
+
+        if (frame && frame->first->buf->pos != frame->first->buf->start) {
+            frame->started = 1;
+        }
+    }
+
+    h2c->sending = 0;
+
+    if (h2c->out || c->buffered) {
+        ngx_add_timer(wev, h2c->clcf->send_timeout);
+
+        if (ngx_handle_write_event(wev, 0) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (ngx_handle_write_event(wev, 0) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_frame_is_sent(ngx_http_v2_out_frame_t *frame)
+{
+    ngx_chain_t  *cl;
+
+    for (cl = frame->first; /* void */; cl = cl->next) {
+        if (cl->buf->pos != cl->buf->last) {
+            return 0;
+        }
+
+        if (cl == frame->last) {
+            return 1;
+        }
+    }
+}
+
+
+static void ngx_http_v2_frame_sent(ngx_http_v2_connection_t *h2c,
+                                   ngx_http_v2_out_frame_t *frame)
+{
+    ngx_event_t           *wev;
+    ngx_http_v2_stream_t  *stream;
+
+    stream = frame->stream;
+
+    if (stream == NULL) {
+        frame->next = h2c->free_frames;
+        h2c->free_frames = frame;
+        return;
+    }
+
+    ngx_http_v2_free_links(stream, frame, 1);
+
+    stream->connection.sent += frame->size;
+
+    frame->next = stream->free_frames;
+    stream->free_frames = frame;
+
+    if (--stream->queued) {
+        return;
+    }
+
+    if (stream->closed) {
+        ngx_destroy_pool(stream->pool);
+        return;
+    }
+
+    if (stream->blocked && !stream->exhausted) {
+        stream->blocked = 0;
+        wev = &stream->write;
+        ngx_post_event(wev);
+    }
+}
+
+
+static void ngx_http_v2_free_links(ngx_http_v2_stream_t *stream,
+                                   ngx_http_v2_out_frame_t *frame,
+                                   ngx_uint_t sent)
+{
+    ngx_chain_t  *cl, *next;
+
+    if (frame->last == &frame->link) {
+        return;
+    }
+
+    for (cl = frame->link.next; /* void */; cl = next) {
+        next = cl->next;
+
+        if (sent && cl->buf->shadow) {
+            cl->buf->shadow->pos = cl->buf->last;
+        }
+
+        cl->next = stream->free_links;
+        stream->free_links = cl;
+
+        if (cl == frame->last) {
+            break;
+        }
+    }
+}
+
+
+/*
+ * the request is finalized: the unsent frames of the stream are dropped
+ * and the rest of the partially sent frame is copied to the stream pool
+ */
+
+void ngx_http_v2_release_request(ngx_http_request_t *r)
+{
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame, **fp;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = r->stream;
+    h2c = stream->h2c;
+
+    for (fp = &h2c->out; *fp; /* void */) {
+        frame = *fp;
+
+        if (frame->stream != stream) {
+            fp = &frame->next;
+            continue;
+        }
+
+        if (frame->started) {
+            if (ngx_http_v2_detach_frame(stream, frame) == NGX_ERROR) {
+                ngx_http_v2_finalize_connection(h2c,
+                                                NGX_HTTP_V2_INTERNAL_ERROR);
+                h2c->connection->write->error = 1;
+                return;
+            }
+
+            fp = &frame->next;
+            continue;
+        }
+
+        *fp = frame->next;
+
+        if (frame->fin) {
+            stream->out_closed = 0;
+        }
+
+        ngx_http_v2_free_links(stream, frame, 0);
+
+        frame->next = stream->free_frames;
+        stream->free_frames = frame;
+
+        stream->queued--;
+    }
+}
+
+
+static ngx_int_t ngx_http_v2_detach_frame(ngx_http_v2_stream_t *stream,
+                                          ngx_http_v2_out_frame_t *frame)
+{
+    u_char       *p;
+    size_t        size;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    for (cl = frame->first; /* void */; cl = cl->next) {
+        b = cl->buf;
+
+        if (b != &frame->buf) {
+            size = b->last - b->pos;
+            p = NULL;
+
+            if (size) {
+                if (!(p = ngx_palloc(stream->pool, size))) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(p, b->pos, size);
+            }
+
+            if (cl == &frame->link) {
+
+                /* the HEADERS frame buf is allocated from the request pool */
+
+                b = &frame->buf;
+                cl->buf = b;
+            }
+
+            b->pos = p;
+            b->last = p + size;
+            b->shadow = NULL;
+        }
+
+        if (cl == frame->last) {
+            break;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream)
+{
+    ngx_uint_t                 i, status;
+    ngx_event_t               *ev;
+    ngx_http_v2_stream_t      *s, **sp;
+    ngx_http_v2_connection_t  *h2c;
+
+    h2c = stream->h2c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 close stream %" NGX_UINT_T_FMT, stream->id);
+
+    if (!stream->reset && !h2c->closing
+        && (!stream->out_closed || !stream->in_closed))
+    {
+        /* NO_ERROR tells that the rest of the request body is not needed */
+
+        status = stream->out_closed ? NGX_HTTP_V2_NO_ERROR:
+                                      NGX_HTTP_V2_INTERNAL_ERROR;
+
+        if (ngx_http_v2_send_rst_stream(h2c, stream->id, status) == NGX_ERROR) {
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+        }
+    }
+
+    ev = &stream->read;
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+
+    ev = &stream->write;
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+
+    for (sp = &h2c->streams[ngx_http_v2_index(stream->id)];
+         *sp;
+         sp = &(*sp)->index_next)
+    {
+        if (*sp == stream) {
+            *sp = stream->index_next;
+            break;
+        }
+    }
+
+    if (stream->exhausted) {
+        for (sp = &h2c->waiting; *sp; sp = &(*sp)->waiting_next) {
+            if (*sp == stream) {
+                *sp = stream->waiting_next;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < NGX_HTTP_V2_INDEX_SIZE; i++) {
+        for (s = h2c->streams[i]; s; s = s->index_next) {
+            if (s->parent == stream) {
+                s->parent = stream->parent;
+            }
+        }
+    }
+
+    h2c->processing--;
+    stream->closed = 1;
+
+    if (stream->queued == 0) {
+        ngx_destroy_pool(stream->pool);
+    }
+
+    if (!h2c->closing && ngx_http_v2_send_output(h2c) == NGX_ERROR) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+    }
+
+    ngx_http_v2_handle_idle(h2c);
+}
+
+
+static ngx_int_t ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c,
+                                           ngx_uint_t ack)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    if (ack) {
+        frame = ngx_http_v2_get_control_frame(h2c, 0,
+                                              NGX_HTTP_V2_SETTINGS_FRAME,
+                                              NGX_HTTP_V2_ACK_FLAG, 0);
+        if (frame == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        frame = ngx_http_v2_get_control_frame(h2c, 2 * 6,
+                                              NGX_HTTP_V2_SETTINGS_FRAME,
+                                              NGX_HTTP_V2_NO_FLAG, 0);
+        if (frame == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = frame->buf.last;
+
+        p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_MAX_STREAMS);
+        p = ngx_http_v2_write_uint32(p, h2c->conf->concurrent_streams);
+
+        p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_INIT_WINDOW_SIZE);
+        p = ngx_http_v2_write_uint32(p, NGX_HTTP_V2_STREAM_WINDOW);
+
+        frame->buf.last = p;
+    }
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c,
+                                                ngx_uint_t sid, size_t inc)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_http_v2_get_control_frame(h2c, 4,
+                                          NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                          NGX_HTTP_V2_NO_FLAG, sid);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    frame->buf.last = ngx_http_v2_write_uint32(frame->buf.last, inc);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_send_rst_stream(ngx_http_v2_connection_t *h2c,
+                                             ngx_uint_t sid,
+                                             ngx_uint_t status)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 send RST_STREAM sid:%" NGX_UINT_T_FMT
+                   " status:%" NGX_UINT_T_FMT, sid, status);
+
+    frame = ngx_http_v2_get_control_frame(h2c, 4,
+                                          NGX_HTTP_V2_RST_STREAM_FRAME,
+                                          NGX_HTTP_V2_NO_FLAG, sid);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    frame->buf.last = ngx_http_v2_write_uint32(frame->buf.last, status);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_send_goaway(ngx_http_v2_connection_t *h2c,
+                                         ngx_uint_t status)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_http_v2_get_control_frame(h2c, 8, NGX_HTTP_V2_GOAWAY_FRAME,
+                                          NGX_HTTP_V2_NO_FLAG, 0);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = frame->buf.last;
+    p = ngx_http_v2_write_uint32(p, h2c->last_sid);
+    p = ngx_http_v2_write_uint32(p, status);
+    frame->buf.last = p;
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_v2_connection_error(ngx_http_v2_connection_t *h2c,
+                                              ngx_uint_t status, char *text)
+{
+    if (text) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0, "%s", text);
+    }
+
+    ngx_http_v2_finalize_connection(h2c, status);
+
+    return NGX_ERROR;
+}
+
+
+static void ngx_http_v2_handle_idle(ngx_http_v2_connection_t *h2c)
+{
+    if (h2c->processing || h2c->handling) {
+        return;
+    }
+
+    if (h2c->closing) {
+        ngx_http_v2_close_connection(h2c);
+        return;
+    }
+
+    if (h2c->goaway || ngx_exiting || ngx_terminate) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    ngx_add_timer(h2c->connection->read, h2c->conf->idle_timeout);
+}
+
+
+static void ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
+                                            ngx_uint_t status)
+{
+    ngx_uint_t             i;
+    ngx_connection_t      *c;
+    ngx_http_v2_stream_t  *stream;
+
+    if (h2c->closing) {
+        return;
+    }
+
+    h2c->closing = 1;
+    c = h2c->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 finalize connection: %" NGX_UINT_T_FMT, status);
+
+    if (!c->read->eof && !c->read->error && !c->write->error
+        && !c->timedout)
+    {
+        if (ngx_http_v2_send_goaway(h2c, status) == NGX_OK) {
+            (void) ngx_http_v2_send_output(h2c);
+        }
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_event_flags & NGX_USE_LEVEL_EVENT) {
+        if (c->read->active) {
+            ngx_del_event(c->read, NGX_READ_EVENT, 0);
+        }
+
+        if (c->write->active) {
+            ngx_del_event(c->write, NGX_WRITE_EVENT, 0);
+        }
+    }
+
+    for (i = 0; i < NGX_HTTP_V2_INDEX_SIZE; i++) {
+        for (stream = h2c->streams[i]; stream; stream = stream->index_next) {
+            if (!stream->reset) {
+                ngx_http_v2_reset_stream(stream);
+            }
+        }
+    }
+
+    ngx_http_v2_handle_idle(h2c);
+}
+
+
+static void ngx_http_v2_close_connection(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t  **fp;
+
+    /* the closed streams still wait for their frames to be sent */
+
+    while (h2c->out) {
+        stream = h2c->out->stream;
+
+        if (stream == NULL) {
+            h2c->out = h2c->out->next;
+            continue;
+        }
+
+        for (fp = &h2c->out; *fp; /* void */) {
+            if ((*fp)->stream == stream) {
+                *fp = (*fp)->next;
+
+            } else {
+                fp = &(*fp)->next;
+            }
+        }
+
+        ngx_destroy_pool(stream->pool);
+    }
+
+    ngx_http_close_connection(h2c->connection);
+}
+
+
+static ngx_int_t ngx_http_v2_init_module(ngx_cycle_t *cycle)
+{
+    uint32_t    code;
+    ngx_uint_t  len, sym, n;
+
+    n = 0;
+    code = 0;
+
+    for (len = 1; len <= NGX_HTTP_V2_HUFF_MAX_LEN; len++) {
+        ngx_http_v2_huff_first[len] = code;
+        ngx_http_v2_huff_offset[len] = n;
+
+        for (sym = 0; sym <= NGX_HTTP_V2_HUFF_EOS; sym++) {
+            if (ngx_http_v2_huff_len[sym] == len) {
+                ngx_http_v2_huff_sym[n++] = (uint16_t) sym;
+            }
+        }
+
+        ngx_http_v2_huff_count[len] = n - ngx_http_v2_huff_offset[len];
+
+        code = (code + ngx_http_v2_huff_count[len]) << 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_v2_srv_conf_t  *h2scf;
+
+    if (!(h2scf = ngx_pcalloc(cf->pool, sizeof(ngx_http_v2_srv_conf_t)))) {
+        return NGX_CONF_ERROR;
+    }
+
+    h2scf->enable = NGX_CONF_UNSET;
+    h2scf->concurrent_streams = NGX_CONF_UNSET;
+    h2scf->chunk_size = NGX_CONF_UNSET_SIZE;
+    h2scf->idle_timeout = NGX_CONF_UNSET_MSEC;
+
+    return h2scf;
+}
+
+
+static char *ngx_http_v2_merge_srv_conf(ngx_conf_t *cf,
+                                        void *parent, void *child)
+{
+    ngx_http_v2_srv_conf_t *prev = parent;
+    ngx_http_v2_srv_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_conf_merge_value(conf->concurrent_streams, prev->concurrent_streams,
+                         128);
+    ngx_conf_merge_size_value(conf->chunk_size, prev->chunk_size,
+                              8 * 1024);
+    ngx_conf_merge_msec_value(conf->idle_timeout, prev->idle_timeout,
+                              180000);
+
+    if (conf->concurrent_streams < 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the \"http2_max_concurrent_streams\" "
+                           "must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->chunk_size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the \"http2_chunk_size\" must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
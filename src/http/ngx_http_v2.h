@@ -0,0 +1,285 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#ifndef _NGX_HTTP_V2_H_INCLUDED_
+#define _NGX_HTTP_V2_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_V2_ALPN_ADVERTISE         "\x02h2\x08http/1.1"
+#define NGX_HTTP_V2_PREFACE                "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+#define NGX_HTTP_V2_FRAME_HEADER_SIZE      9
+#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE     16384
+#define NGX_HTTP_V2_MAX_FRAME_SIZE         ((1 << 24) - 1)
+
+#define NGX_HTTP_V2_DEFAULT_WINDOW         65535
+#define NGX_HTTP_V2_MAX_WINDOW             ((1U << 31) - 1)
+
+/* the request body window of a stream, it is also the preread buffer size */
+#define NGX_HTTP_V2_STREAM_WINDOW          NGX_HTTP_V2_DEFAULT_WINDOW
+
+#define NGX_HTTP_V2_TABLE_SIZE             4096
+#define NGX_HTTP_V2_TABLE_ENTRY_OVERHEAD   32
+
+#define NGX_HTTP_V2_DEFAULT_WEIGHT         16
+
+#define NGX_HTTP_V2_RECV_BUFFER_SIZE                                         \
+    (2 * (NGX_HTTP_V2_FRAME_HEADER_SIZE + NGX_HTTP_V2_DEFAULT_FRAME_SIZE))
+
+#define NGX_HTTP_V2_STREAM_POOL_SIZE       2048
+#define NGX_HTTP_V2_INDEX_SIZE             64
+
+/* enough for the SETTINGS frame that we send, GOAWAY, PING and others */
+#define NGX_HTTP_V2_FRAME_BUFFER_SIZE      32
+
+/* the maximum size of an HPACK integer that we encode */
+#define NGX_HTTP_V2_INT_OCTETS             4
+
+
+/* the frame types */
+
+#define NGX_HTTP_V2_DATA_FRAME             0x0
+#define NGX_HTTP_V2_HEADERS_FRAME          0x1
+#define NGX_HTTP_V2_PRIORITY_FRAME         0x2
+#define NGX_HTTP_V2_RST_STREAM_FRAME       0x3
+#define NGX_HTTP_V2_SETTINGS_FRAME         0x4
+#define NGX_HTTP_V2_PUSH_PROMISE_FRAME     0x5
+#define NGX_HTTP_V2_PING_FRAME             0x6
+#define NGX_HTTP_V2_GOAWAY_FRAME           0x7
+#define NGX_HTTP_V2_WINDOW_UPDATE_FRAME    0x8
+#define NGX_HTTP_V2_CONTINUATION_FRAME     0x9
+
+/* the frame flags */
+
+#define NGX_HTTP_V2_NO_FLAG                0x00
+#define NGX_HTTP_V2_ACK_FLAG               0x01
+#define NGX_HTTP_V2_END_STREAM_FLAG        0x01
+#define NGX_HTTP_V2_END_HEADERS_FLAG       0x04
+#define NGX_HTTP_V2_PADDED_FLAG            0x08
+#define NGX_HTTP_V2_PRIORITY_FLAG          0x20
+
+/* the settings */
+
+#define NGX_HTTP_V2_HEADER_TABLE_SIZE      0x1
+#define NGX_HTTP_V2_ENABLE_PUSH            0x2
+#define NGX_HTTP_V2_MAX_STREAMS            0x3
+#define NGX_HTTP_V2_INIT_WINDOW_SIZE       0x4
+#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING 0x5
+
+/* the error codes */
+
+#define NGX_HTTP_V2_NO_ERROR               0x0
+#define NGX_HTTP_V2_PROTOCOL_ERROR         0x1
+#define NGX_HTTP_V2_INTERNAL_ERROR         0x2
+#define NGX_HTTP_V2_FLOW_CTRL_ERROR        0x3
+#define NGX_HTTP_V2_STREAM_CLOSED          0x5
+#define NGX_HTTP_V2_SIZE_ERROR             0x6
+#define NGX_HTTP_V2_REFUSED_STREAM         0x7
+#define NGX_HTTP_V2_COMP_ERROR             0x9
+#define NGX_HTTP_V2_ENHANCE_YOUR_CALM      0xb
+
+
+typedef struct ngx_http_v2_connection_s  ngx_http_v2_connection_t;
+typedef struct ngx_http_v2_out_frame_s   ngx_http_v2_out_frame_t;
+
+
+typedef struct {
+    ngx_flag_t                  enable;
+    ngx_int_t                   concurrent_streams;
+    size_t                      chunk_size;
+    ngx_msec_t                  idle_timeout;
+} ngx_http_v2_srv_conf_t;
+
+
+typedef struct {
+    ngx_str_t                   name;
+    ngx_str_t                   value;
+} ngx_http_v2_header_t;
+
+
+/*
+ * the HPACK dynamic table: the names and values are kept one after another
+ * in the storage from the oldest entry to the newest one, so an eviction
+ * is a single memmove()
+ */
+
+typedef struct {
+    size_t                      offset;       /* of the name in the storage */
+    size_t                      name_len;
+    size_t                      value_len;
+} ngx_http_v2_hpack_entry_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_entry_t  *entries;
+    ngx_uint_t                  nentries;
+    u_char                     *storage;
+    size_t                      used;         /* the bytes in the storage */
+    size_t                      size;         /* the size by RFC 7541 4.1 */
+    size_t                      max_size;
+} ngx_http_v2_hpack_t;
+
+
+/* the header block that is continued by the CONTINUATION frames */
+
+typedef struct {
+    ngx_buf_t                  *buf;
+    ngx_uint_t                  sid;
+    ngx_uint_t                  depend;
+    ngx_uint_t                  weight;
+
+    unsigned                    active:1;
+    unsigned                    end_stream:1;
+    unsigned                    priority:1;
+} ngx_http_v2_header_block_t;
+
+
+struct ngx_http_v2_out_frame_s {
+    ngx_http_v2_out_frame_t    *next;
+    ngx_http_v2_stream_t       *stream;       /* NULL for the control frames */
+
+    ngx_chain_t                *first;
+    ngx_chain_t                *last;
+
+    size_t                      size;         /* with the frame header */
+    ngx_uint_t                  rank;
+    ngx_uint_t                  weight;
+
+    unsigned                    fin:1;        /* END_STREAM is set */
+    unsigned                    started:1;    /* the frame is partially sent */
+
+    /* the frame header or the whole control frame */
+    ngx_chain_t                 link;
+    ngx_buf_t                   buf;
+    u_char                      data[NGX_HTTP_V2_FRAME_BUFFER_SIZE];
+};
+
+
+/*
+ * the request of a stream works with the fake connection and the fake
+ * events: they are always ready, so ngx_handle_read_event() and
+ * ngx_handle_write_event() never pass them to a kernel, and the stream
+ * posts them itself when the request body data arrive or the output
+ * is sent
+ */
+
+struct ngx_http_v2_stream_s {
+    ngx_connection_t            connection;
+    ngx_event_t                 read;
+    ngx_event_t                 write;
+    ngx_log_t                   log;
+
+    ngx_http_v2_connection_t   *h2c;
+    ngx_pool_t                 *pool;
+    ngx_uint_t                  id;
+
+    ngx_http_v2_stream_t       *index_next;
+    ngx_http_v2_stream_t       *waiting_next; /* waits for the send window */
+
+    ngx_http_v2_stream_t       *parent;
+    ngx_uint_t                  weight;
+
+    ssize_t                     send_window;
+    size_t                      recv_window;
+    size_t                      recv_unacked; /* the read but unacked data */
+
+    ngx_buf_t                  *preread;      /* the received body data */
+
+    ngx_uint_t                  queued;       /* the frames in the queue */
+    ngx_http_v2_out_frame_t    *free_frames;
+    ngx_chain_t                *free_links;
+
+    unsigned                    in_closed:1;
+    unsigned                    out_closed:1;
+    unsigned                    last_buf:1;   /* the last buf was output */
+    unsigned                    reset:1;
+    unsigned                    reading:1;    /* the request waits for data */
+    unsigned                    blocked:1;    /* the request waits for output */
+    unsigned                    exhausted:1;  /* no send window */
+    unsigned                    closed:1;
+};
+
+
+struct ngx_http_v2_connection_s {
+    ngx_connection_t           *connection;
+
+    /* the configuration of the default server of the address:port */
+    ngx_http_v2_srv_conf_t     *conf;
+    ngx_http_core_srv_conf_t   *cscf;
+    ngx_http_core_loc_conf_t   *clcf;
+
+    ngx_buf_t                  *buffer;       /* the received frames */
+    ngx_http_v2_header_block_t  headers;
+    ngx_http_v2_hpack_t         hpack;
+
+    ngx_http_v2_stream_t      **streams;      /* the index by the stream id */
+    ngx_uint_t                  processing;
+    ngx_uint_t                  last_sid;
+
+    ssize_t                     send_window;
+    size_t                      recv_window;
+    size_t                      init_window;  /* the client stream window */
+    size_t                      frame_size;   /* the client maximum */
+
+    ngx_http_v2_stream_t       *waiting;
+
+    ngx_http_v2_out_frame_t    *out;
+    ngx_http_v2_out_frame_t    *free_frames;
+
+    unsigned                    preface:1;
+    unsigned                    settings:1;
+    unsigned                    goaway:1;
+    unsigned                    closing:1;
+    unsigned                    handling:1;
+    unsigned                    sending:1;
+};
+
+
+#define ngx_http_v2_stream(c)                                                 \
+    ((ngx_http_v2_stream_t *) ((u_char *) (c)                                 \
+                               - offsetof(ngx_http_v2_stream_t, connection)))
+
+#define ngx_http_v2_parse_uint16(p)  ((p)[0] << 8 | (p)[1])
+#define ngx_http_v2_parse_uint32(p)                                           \
+    ((uint32_t) (p)[0] << 24 | (p)[1] << 16 | (p)[2] << 8 | (p)[3])
+
+#define ngx_http_v2_write_uint16(p, s)                                        \
+    ((p)[0] = (u_char) ((s) >> 8), (p)[1] = (u_char) (s), (p) + 2)
+
+#define ngx_http_v2_write_uint32(p, s)                                        \
+    ((p)[0] = (u_char) ((s) >> 24), (p)[1] = (u_char) ((s) >> 16),            \
+     (p)[2] = (u_char) ((s) >> 8), (p)[3] = (u_char) (s), (p) + 4)
+
+
+void ngx_http_v2_init(ngx_event_t *rev);
+#if (NGX_HTTP_SSL)
+ngx_int_t ngx_http_v2_negotiated(ngx_connection_t *c);
+#endif
+
+ssize_t ngx_http_v2_recv(ngx_connection_t *fc, u_char *buf, size_t size);
+ngx_chain_t *ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in,
+                                    off_t limit);
+ngx_int_t ngx_http_v2_end_stream(ngx_http_v2_stream_t *stream);
+ngx_int_t ngx_http_v2_send_output(ngx_http_v2_connection_t *h2c);
+
+void ngx_http_v2_release_request(ngx_http_request_t *r);
+void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream);
+
+u_char *ngx_http_v2_write_int(u_char *p, ngx_uint_t prefix, ngx_uint_t value);
+u_char *ngx_http_v2_write_frame_head(u_char *p, size_t len, ngx_uint_t type,
+                                     ngx_uint_t flags, ngx_uint_t sid);
+
+
+extern ngx_module_t  ngx_http_v2_module;
+
+
+#endif /* _NGX_HTTP_V2_H_INCLUDED_ */
@@ -0,0 +1,521 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <nginx.h>
+
+
+/* the static table indices */
+
+#define NGX_HTTP_V2_STATUS_INDEX          8
+#define NGX_HTTP_V2_STATUS_200_INDEX      8
+#define NGX_HTTP_V2_STATUS_204_INDEX      9
+#define NGX_HTTP_V2_STATUS_206_INDEX      10
+#define NGX_HTTP_V2_STATUS_304_INDEX      11
+#define NGX_HTTP_V2_STATUS_400_INDEX      12
+#define NGX_HTTP_V2_STATUS_404_INDEX      13
+#define NGX_HTTP_V2_STATUS_500_INDEX      14
+
+#define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
+#define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
+#define NGX_HTTP_V2_DATE_INDEX            33
+#define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
+#define NGX_HTTP_V2_LOCATION_INDEX        46
+#define NGX_HTTP_V2_SERVER_INDEX          54
+
+
+/* the upper bound of the literal field without indexing */
+
+#define ngx_http_v2_field_len(name_len, value_len)                            \
+    (1 + NGX_HTTP_V2_INT_OCTETS + (name_len)                                  \
+     + NGX_HTTP_V2_INT_OCTETS + (value_len))
+
+#define ngx_http_v2_lower(c)                                                  \
+    (u_char) (((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : (c))
+
+
+static u_char *ngx_http_v2_write_name(u_char *p, ngx_uint_t index,
+                                      ngx_str_t *name);
+static u_char *ngx_http_v2_write_value(u_char *p, u_char *value, size_t len);
+static ngx_int_t ngx_http_v2_filter_init(ngx_cycle_t *cycle);
+
+
+static ngx_http_module_t  ngx_http_v2_filter_module_ctx = {
+    NULL,                                  /* pre conf */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL,                                  /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_v2_filter_module = {
+    NGX_MODULE,
+    &ngx_http_v2_filter_module_ctx,        /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    ngx_http_v2_filter_init,               /* init module */
+    NULL                                   /* init child */
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+
+/* the connection specific fields are not allowed in HTTP/2 */
+
+static ngx_str_t  ngx_http_v2_skip_headers[] = {
+    ngx_string("Connection"),
+    ngx_string("Keep-Alive"),
+    ngx_string("Proxy-Connection"),
+    ngx_string("Transfer-Encoding"),
+    ngx_string("Upgrade"),
+    ngx_null_string
+};
+
+
+/*
+ * the response header is encoded by the literal fields without indexing
+ * and without the Huffman coding, so the encoder keeps no state and
+ * the header block is built in one pass like the HTTP/1.x header
+ */
+
+static ngx_int_t ngx_http_v2_header_filter(ngx_http_request_t *r)
+{
+    u_char                *p, *block, *last;
+    size_t                 len, size, frame_size;
+    ngx_str_t             *skip;
+    ngx_buf_t             *b;
+    ngx_uint_t             i, status, index, nframes, flags, type;
+    ngx_chain_t           *ln;
+    ngx_list_part_t       *part;
+    ngx_table_elt_t       *header;
+    ngx_http_v2_stream_t  *stream;
+    u_char                 buf[NGX_OFF_T_LEN + 1];
+
+    stream = r->stream;
+
+    if (stream == NULL) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->header_only = 1;
+    }
+
+    if (r->headers_out.last_modified_time != -1) {
+        if (r->headers_out.status != NGX_HTTP_OK
+            && r->headers_out.status != NGX_HTTP_NOT_MODIFIED
+            && r->headers_out.status != NGX_HTTP_PARTIAL_CONTENT)
+        {
+            r->headers_out.last_modified_time = -1;
+
+            if (r->headers_out.last_modified) {
+                r->headers_out.last_modified->key.len = 0;
+                r->headers_out.last_modified = NULL;
+            }
+        }
+    }
+
+    status = r->headers_out.status;
+
+    if (status == 0 && r->headers_out.status_line.len >= 3) {
+        status = ngx_atoi(r->headers_out.status_line.data, 3);
+
+        if (status == (ngx_uint_t) NGX_ERROR) {
+            status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    if (status == NGX_HTTP_NOT_MODIFIED) {
+        r->header_only = 1;
+    }
+
+    switch (status) {
+
+    case NGX_HTTP_OK:
+        index = NGX_HTTP_V2_STATUS_200_INDEX;
+        break;
+
+    case 204:
+        index = NGX_HTTP_V2_STATUS_204_INDEX;
+        break;
+
+    case NGX_HTTP_PARTIAL_CONTENT:
+        index = NGX_HTTP_V2_STATUS_206_INDEX;
+        break;
+
+    case NGX_HTTP_NOT_MODIFIED:
+        index = NGX_HTTP_V2_STATUS_304_INDEX;
+        break;
+
+    case NGX_HTTP_BAD_REQUEST:
+        index = NGX_HTTP_V2_STATUS_400_INDEX;
+        break;
+
+    case NGX_HTTP_NOT_FOUND:
+        index = NGX_HTTP_V2_STATUS_404_INDEX;
+        break;
+
+    case NGX_HTTP_INTERNAL_SERVER_ERROR:
+        index = NGX_HTTP_V2_STATUS_500_INDEX;
+        break;
+
+    default:
+        index = 0;
+        break;
+    }
+
+    len = index ? 1 : ngx_http_v2_field_len(0, 3);
+
+    if (!(r->headers_out.server && r->headers_out.server->key.len)) {
+        len += ngx_http_v2_field_len(0, sizeof(NGINX_VER) - 1);
+    }
+
+    if (!(r->headers_out.date && r->headers_out.date->key.len)) {
+        len += ngx_http_v2_field_len(0, ngx_cached_http_time.len);
+    }
+
+    if (r->headers_out.content_length == NULL
+        && r->headers_out.content_length_n >= 0)
+    {
+        len += ngx_http_v2_field_len(0, NGX_OFF_T_LEN);
+    }
+
+    if (r->headers_out.content_type && r->headers_out.content_type->value.len) {
+        r->headers_out.content_type->key.len = 0;
+        len += ngx_http_v2_field_len(0,
+                                     r->headers_out.content_type->value.len
+                                     + sizeof("; charset=") - 1
+                                     + r->headers_out.charset.len);
+    }
+
+    if (r->headers_out.location
+        && r->headers_out.location->value.len
+        && r->headers_out.location->value.data[0] == '/')
+    {
+        r->headers_out.location->key.len = 0;
+        len += ngx_http_v2_field_len(0, sizeof("https://") - 1
+                                        + r->server_name->len
+                                        + r->port_text->len
+                                        + r->headers_out.location->value.len);
+    }
+
+    if (!(r->headers_out.last_modified && r->headers_out.last_modified->key.len)
+        && r->headers_out.last_modified_time != -1)
+    {
+        len += ngx_http_v2_field_len(0,
+                            sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+    }
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].key.len == 0) {
+            continue;
+        }
+
+        for (skip = ngx_http_v2_skip_headers; skip->len; skip++) {
+            if (header[i].key.len == skip->len
+                && ngx_strncasecmp(header[i].key.data, skip->data,
+                                   skip->len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (skip->len) {
+            header[i].key.len = 0;
+            continue;
+        }
+
+        len += ngx_http_v2_field_len(header[i].key.len, header[i].value.len);
+    }
+
+    if (!(block = ngx_palloc(r->pool, len))) {
+        return NGX_ERROR;
+    }
+
+    p = block;
+
+    if (index) {
+        *p = 0x80;
+        p = ngx_http_v2_write_int(p, 7, index);
+
+    } else {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_STATUS_INDEX, NULL);
+        len = ngx_snprintf((char *) buf, sizeof(buf),
+                           "%03" NGX_UINT_T_FMT, status % 1000);
+        p = ngx_http_v2_write_value(p, buf, len);
+    }
+
+    if (!(r->headers_out.server && r->headers_out.server->key.len)) {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_SERVER_INDEX, NULL);
+        p = ngx_http_v2_write_value(p, (u_char *) NGINX_VER,
+                                    sizeof(NGINX_VER) - 1);
+    }
+
+    if (!(r->headers_out.date && r->headers_out.date->key.len)) {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_DATE_INDEX, NULL);
+        p = ngx_http_v2_write_value(p, ngx_cached_http_time.data,
+                                    ngx_cached_http_time.len);
+    }
+
+    if (r->headers_out.content_length == NULL
+        && r->headers_out.content_length_n >= 0)
+    {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_CONTENT_LENGTH_INDEX, NULL);
+        len = ngx_snprintf((char *) buf, sizeof(buf), OFF_T_FMT,
+                           r->headers_out.content_length_n);
+        p = ngx_http_v2_write_value(p, buf, len);
+    }
+
+    if (r->headers_out.content_type && r->headers_out.content_type->value.len) {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_CONTENT_TYPE_INDEX, NULL);
+
+        size = r->headers_out.content_type->value.len;
+
+        if (r->headers_out.charset.len) {
+            size += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+        }
+
+        *p = 0;
+        p = ngx_http_v2_write_int(p, 7, size);
+
+        p = ngx_cpymem(p, r->headers_out.content_type->value.data,
+                       r->headers_out.content_type->value.len);
+
+        if (r->headers_out.charset.len) {
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+            p = ngx_cpymem(p, r->headers_out.charset.data,
+                           r->headers_out.charset.len);
+        }
+    }
+
+    if (r->headers_out.location
+        && r->headers_out.location->value.len
+        && r->headers_out.location->value.data[0] == '/')
+    {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_LOCATION_INDEX, NULL);
+
+#if (NGX_OPENSSL)
+        if (r->connection->ssl) {
+            size = sizeof("https://") - 1;
+            last = (u_char *) "https://";
+
+        } else
+#endif
+        {
+            size = sizeof("http://") - 1;
+            last = (u_char *) "http://";
+        }
+
+        *p = 0;
+        p = ngx_http_v2_write_int(p, 7, size + r->server_name->len
+                                        + (r->port != 80 ? r->port_text->len
+                                                         : 0)
+                                        + r->headers_out.location->value.len);
+
+        p = ngx_cpymem(p, last, size);
+        p = ngx_cpymem(p, r->server_name->data, r->server_name->len);
+
+        if (r->port != 80) {
+            p = ngx_cpymem(p, r->port_text->data, r->port_text->len);
+        }
+
+        p = ngx_cpymem(p, r->headers_out.location->value.data,
+                       r->headers_out.location->value.len);
+    }
+
+    if (!(r->headers_out.last_modified && r->headers_out.last_modified->key.len)
+        && r->headers_out.last_modified_time != -1)
+    {
+        p = ngx_http_v2_write_name(p, NGX_HTTP_V2_LAST_MODIFIED_INDEX, NULL);
+
+        /* the first octet is left for the length */
+
+        size = ngx_http_time(p + 1, r->headers_out.last_modified_time);
+        *p = 0;
+        p = ngx_http_v2_write_int(p, 7, size);
+        p += size;
+    }
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].key.len == 0) {
+            continue;
+        }
+
+        p = ngx_http_v2_write_name(p, 0, &header[i].key);
+        p = ngx_http_v2_write_value(p, header[i].value.data,
+                                    header[i].value.len);
+    }
+
+    /* the block is split to the HEADERS and CONTINUATION frames */
+
+    len = p - block;
+    frame_size = stream->h2c->frame_size;
+    nframes = len ? (len + frame_size - 1) / frame_size : 1;
+
+    if (!(b = ngx_create_temp_buf(r->pool, len + nframes
+                                               * NGX_HTTP_V2_FRAME_HEADER_SIZE)))
+    {
+        return NGX_ERROR;
+    }
+
+    type = NGX_HTTP_V2_HEADERS_FRAME;
+    flags = r->header_only ? NGX_HTTP_V2_END_STREAM_FLAG : NGX_HTTP_V2_NO_FLAG;
+    p = block;
+
+    do {
+        size = len > frame_size ? frame_size : len;
+        len -= size;
+
+        b->last = ngx_http_v2_write_frame_head(b->last, size, type,
+                                         flags | (len ? NGX_HTTP_V2_NO_FLAG
+                                                 : NGX_HTTP_V2_END_HEADERS_FLAG),
+                                         stream->id);
+        b->last = ngx_cpymem(b->last, p, size);
+
+        p += size;
+        type = NGX_HTTP_V2_CONTINUATION_FRAME;
+        flags = NGX_HTTP_V2_NO_FLAG;
+
+    } while (len);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 header: %" NGX_UINT_T_FMT " " SIZE_T_FMT,
+                   status, (size_t) (b->last - b->pos));
+
+    /* the buf is recognized by ngx_http_v2_send_chain() by the tag */
+
+    b->tag = (ngx_buf_tag_t) &ngx_http_v2_module;
+
+    r->header_size = b->last - b->pos;
+
+    if (r->header_only) {
+        b->last_buf = 1;
+    }
+
+    if (!(ln = ngx_alloc_chain_link(r->pool))) {
+        return NGX_ERROR;
+    }
+
+    ln->buf = b;
+    ln->next = NULL;
+
+    return ngx_http_write_filter(r, ln);
+}
+
+
+static u_char *ngx_http_v2_write_name(u_char *p, ngx_uint_t index,
+                                      ngx_str_t *name)
+{
+    ngx_uint_t  i;
+
+    *p = 0;
+
+    if (index) {
+        return ngx_http_v2_write_int(p, 4, index);
+    }
+
+    /* the literal name, HTTP/2 requires it in lower case */
+
+    *++p = 0;
+    p = ngx_http_v2_write_int(p, 7, name->len);
+
+    for (i = 0; i < name->len; i++) {
+        *p++ = ngx_http_v2_lower(name->data[i]);
+    }
+
+    return p;
+}
+
+
+static u_char *ngx_http_v2_write_value(u_char *p, u_char *value, size_t len)
+{
+    *p = 0;
+    p = ngx_http_v2_write_int(p, 7, len);
+
+    return ngx_cpymem(p, value, len);
+}
+
+
+static ngx_int_t ngx_http_v2_body_filter(ngx_http_request_t *r,
+                                         ngx_chain_t *in)
+{
+    ngx_int_t     rc;
+    ngx_chain_t  *cl;
+
+    if (r->stream == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        if (cl->buf->last_buf) {
+            r->stream->last_buf = 1;
+            break;
+        }
+    }
+
+    rc = ngx_http_next_body_filter(r, in);
+
+    /*
+     * the empty last buf is not passed to ngx_http_v2_send_chain()
+     * by the write filter, so END_STREAM is sent separately
+     */
+
+    if (rc != NGX_OK || !r->stream->last_buf) {
+        return rc;
+    }
+
+    return ngx_http_v2_end_stream(r->stream);
+}
+
+
+static ngx_int_t ngx_http_v2_filter_init(ngx_cycle_t *cycle)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_v2_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_v2_body_filter;
+
+    return NGX_OK;
+}
@@ -15,6 +15,11 @@ typedef struct {
 } ngx_http_write_filter_ctx_t;
 
 
+static ngx_int_t ngx_http_write_filter_defer(ngx_http_request_t *r,
+                                             ngx_http_write_filter_ctx_t *ctx);
+static void ngx_http_write_filter_flush(ngx_event_t *ev);
+static void ngx_http_write_filter_flush_handler(ngx_event_t *wev);
+static void ngx_http_write_filter_flush_cleanup(void *data);
 static ngx_int_t ngx_http_write_filter_init(ngx_cycle_t *cycle);
 
 
@@ -48,9 +53,16 @@ ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
     off_t                         size, flush, sent;
     ngx_chain_t                  *cl, *ln, **ll, *chain;
     ngx_connection_t             *c;
+    ngx_http_connection_t        *hc;
     ngx_http_core_loc_conf_t     *clcf;
     ngx_http_write_filter_ctx_t  *ctx;
 
+    /* the sending of the deferred pipelined responses could fail */
+
+    if (r->connection->write->error) {
+        return NGX_ERROR;
+    }
+
     ctx = ngx_http_get_module_ctx(r->main ? r->main : r,
                                   ngx_http_write_filter_module);
 
@@ -107,6 +119,16 @@ ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
     clcf = ngx_http_get_module_loc_conf(r->main ? r->main : r,
                                         ngx_http_core_module);
 
+    /*
+     * the complete response of a pipelined request is copied to the
+     * connection buffer if the next request is already read, so the
+     * responses are sent together by the first request that can not defer
+     */
+
+    if (last && ngx_http_write_filter_defer(r, ctx) == NGX_OK) {
+        return NGX_OK;
+    }
+
     /*
      * avoid the output if there is no last buf, no flush point,
      * there are the incoming bufs and the size of all bufs
@@ -129,6 +151,20 @@ ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return NGX_OK;
     }
 
+    /* the deferred responses of the previous pipelined requests go first */
+
+    hc = r->http_connection;
+
+    if (hc
+        && hc->out
+        && hc->out->pos < hc->out->last
+        && (ctx->out == NULL || ctx->out->buf != hc->out))
+    {
+        ngx_alloc_link_and_set_buf(cl, hc->out, r->pool, NGX_ERROR);
+        cl->next = ctx->out;
+        ctx->out = cl;
+    }
+
     sent = c->sent;
 
     chain = c->send_chain(c, ctx->out,
@@ -158,6 +194,301 @@ ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+static ngx_int_t ngx_http_write_filter_defer(ngx_http_request_t *r,
+                                             ngx_http_write_filter_ctx_t *ctx)
+{
+    u_char                    *p;
+    size_t                     size;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl;
+    ngx_event_t               *ev;
+    ngx_connection_t          *c;
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_connection_t     *hc;
+    ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->connection;
+    hc = r->http_connection;
+
+    if (r->main
+        || hc == NULL
+        || !r->keepalive
+        || ngx_terminate
+        || ngx_exiting
+        || ngx_threaded
+        || c->buffered
+        || c->write->delayed
+        || r->headers_in.content_length_n > 0)
+    {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        return NGX_DECLINED;
+    }
+#endif
+
+#if (NGX_OPENSSL)
+
+    /*
+     * the closed SSL connection keeps its pool while the shutdown
+     * is in progress, so the posted flush event could run on it
+     */
+
+    if (c->ssl) {
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+
+    if (cscf->pipeline_output_buffer_size == 0) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->limit_rate || clcf->keepalive_timeout == 0) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the whole next request header must be already read, otherwise
+     * the responses would wait for the client
+     */
+
+    b = r->header_in;
+
+    for (p = b->pos; p < b->last - 1; p++) {
+        if (*p == LF && (p[1] == LF || (p[1] == CR && p + 2 < b->last
+                                        && p[2] == LF)))
+        {
+            break;
+        }
+    }
+
+    if (p >= b->last - 1) {
+        return NGX_DECLINED;
+    }
+
+    /* only the bufs in memory are deferred */
+
+    size = 0;
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+        if (cl->buf == hc->out) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(cl->buf) && !ngx_buf_special(cl->buf)) {
+            return NGX_DECLINED;
+        }
+
+        if (ngx_buf_in_memory(cl->buf)) {
+            size += cl->buf->last - cl->buf->pos;
+        }
+    }
+
+    if (hc->out == NULL) {
+        if (size > cscf->pipeline_output_buffer_size) {
+            return NGX_DECLINED;
+        }
+
+        if (!(hc->out = ngx_create_temp_buf(c->pool,
+                                          cscf->pipeline_output_buffer_size)))
+        {
+            return NGX_DECLINED;
+        }
+
+    } else if (hc->out->pos == hc->out->last) {
+        hc->out->pos = hc->out->start;
+        hc->out->last = hc->out->start;
+    }
+
+    if (size > (size_t) (hc->out->end - hc->out->last)) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the next request may not finish at once, e.g. it waits for
+     * an upstream, so the flush event posted to the end of the current
+     * event loop iteration sends the deferred responses in this case,
+     * the event is deleted with the connection pool
+     */
+
+    if (hc->flush == NULL) {
+        if (!(cln = ngx_pool_cleanup_add(c->pool, 0))) {
+            return NGX_DECLINED;
+        }
+
+        if (!(ev = ngx_pcalloc(c->pool, sizeof(ngx_event_t)))) {
+            return NGX_DECLINED;
+        }
+
+        ev->data = c;
+        ev->event_handler = ngx_http_write_filter_flush;
+        ev->log = c->log;
+
+        cln->handler = ngx_http_write_filter_flush_cleanup;
+        cln->data = ev;
+
+        hc->flush = ev;
+    }
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+        if (cl->buf == hc->out || !ngx_buf_in_memory(cl->buf)) {
+            continue;
+        }
+
+        hc->out->last = ngx_cpymem(hc->out->last, cl->buf->pos,
+                                   (cl->buf->last - cl->buf->pos));
+        cl->buf->pos = cl->buf->last;
+    }
+
+    ctx->out = NULL;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http write filter deferred: " SIZE_T_FMT " "
+                   SIZE_T_FMT, size, (size_t) (hc->out->last - hc->out->pos));
+
+    ev = hc->flush;
+    ngx_post_event(ev);
+
+    return NGX_OK;
+}
+
+
+static void ngx_http_write_filter_flush(ngx_event_t *ev)
+{
+    ngx_chain_t               out, *chain;
+    ngx_event_t              *wev;
+    ngx_connection_t         *c;
+    ngx_http_request_t       *r;
+    ngx_http_connection_t    *hc;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = ev->data;
+
+    /* the flush event is deleted when the connection goes to keepalive */
+
+    r = c->data;
+    hc = r->http_connection;
+
+    if (hc->out == NULL
+        || hc->out->pos == hc->out->last
+        || c->write->error
+        || c->buffered
+        || c->write->delayed)
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http write filter flush: " SIZE_T_FMT,
+                   (size_t) (hc->out->last - hc->out->pos));
+
+    out.buf = hc->out;
+    out.next = NULL;
+
+    /*
+     * the unsent rest is left in the buffer and is sent before
+     * the output of the current request
+     */
+
+    chain = c->send_chain(c, &out, OFF_T_MAX_VALUE);
+
+    if (chain == NGX_CHAIN_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "sending the deferred pipelined responses failed");
+
+        /*
+         * the current request may be still handled, e.g. proxied,
+         * so it is finalized by its own output that fails on the write error
+         */
+
+        c->write->error = 1;
+        return;
+    }
+
+    if (hc->out->pos == hc->out->last) {
+        return;
+    }
+
+    /*
+     * the request that uses the write event itself, e.g. the delayed one,
+     * sends the rest before its output, otherwise the rest is sent
+     * by the write event handler that is replaced until the rest is sent
+     */
+
+    wev = c->write;
+
+    if (wev->delayed || wev->timer_set) {
+        return;
+    }
+
+    if (wev->event_handler != ngx_http_write_filter_flush_handler) {
+        hc->write_handler = wev->event_handler;
+        wev->event_handler = ngx_http_write_filter_flush_handler;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_add_timer(wev, clcf->send_timeout);
+
+    wev->available = clcf->send_lowat;
+
+    if (ngx_handle_write_event(wev, NGX_LOWAT_EVENT) == NGX_ERROR) {
+        ngx_del_timer(wev);
+        wev->event_handler = hc->write_handler;
+        wev->error = 1;
+    }
+}
+
+
+static void ngx_http_write_filter_flush_handler(ngx_event_t *wev)
+{
+    ngx_connection_t       *c;
+    ngx_http_request_t     *r;
+    ngx_http_connection_t  *hc;
+
+    c = wev->data;
+    r = c->data;
+    hc = r->http_connection;
+
+    wev->event_handler = hc->write_handler;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        c->timedout = 1;
+        wev->timedout = 0;
+        wev->error = 1;
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_http_write_filter_flush(wev);
+}
+
+
+static void ngx_http_write_filter_flush_cleanup(void *data)
+{
+    ngx_event_t  *ev;
+
+    ev = data;
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+}
+
+
 static ngx_int_t ngx_http_write_filter_init(ngx_cycle_t *cycle)
 {
     ngx_http_top_body_filter = ngx_http_write_filter;
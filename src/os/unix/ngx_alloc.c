@@ -45,12 +45,18 @@ void *ngx_calloc(size_t size, ngx_log_t *log)
 
 void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
 {
+    int    err;
     void  *p;
 
-    if (posix_memalign(&p, alignment, size) == -1) {
-        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+    /* posix_memalign() returns an error instead of setting errno */
+
+    err = posix_memalign(&p, alignment, size);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err,
                       "posix_memalign() " SIZE_T_FMT " bytes aligned to "
                       SIZE_T_FMT " failed", size, alignment);
+        p = NULL;
     }
 
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
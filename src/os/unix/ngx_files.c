@@ -205,6 +205,38 @@ ssize_t ngx_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl,
 }
 
 
+/*
+ * the mapping is private: the pages are shared with the page cache and
+ * the forked processes until they are changed, and the changes are not
+ * written to the file
+ */
+
+void *ngx_map_file(ngx_file_t *file, size_t size)
+{
+    void  *p;
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_CRIT, file->log, ngx_errno,
+                      "mmap(MAP_PRIVATE, " SIZE_T_FMT ") \"%s\" failed",
+                      size, file->name.data);
+        return NULL;
+    }
+
+    return p;
+}
+
+
+void ngx_unmap_file(void *p, size_t size, ngx_log_t *log)
+{
+    if (munmap(p, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(" PTR_FMT ", " SIZE_T_FMT ") failed", p, size);
+    }
+}
+
+
 int ngx_open_dir(ngx_str_t *name, ngx_dir_t *dir)
 {
     dir->dir = opendir((const char *) name->data);
@@ -51,8 +51,27 @@ ssize_t ngx_write_file(ngx_file_t *file, u_char *buf, size_t size,
 ssize_t ngx_write_chain_to_file(ngx_file_t *file, ngx_chain_t *ce,
                                 off_t offset, ngx_pool_t *pool);
 
+void *ngx_map_file(ngx_file_t *file, size_t size);
+void ngx_unmap_file(void *p, size_t size, ngx_log_t *log);
 
-#define ngx_rename_file          rename
+
+#if (HAVE_POSIX_FALLOCATE)
+#define ngx_fallocate_file(fd, offset, size)                                \
+                                 posix_fallocate(fd, offset, size)
+#define ngx_fallocate_file_n     "posix_fallocate()"
+#endif
+
+
+#if (HAVE_POSIX_FADVISE)
+#define ngx_fadvise_dontneed(fd, offset, size)                              \
+                                 posix_fadvise(fd, offset, size,            \
+                                               POSIX_FADV_DONTNEED)
+#define ngx_fadvise_dontneed_n   "posix_fadvise(POSIX_FADV_DONTNEED)"
+#endif
+
+
+#define ngx_rename_file(from, to)                                           \
+                         rename((const char *) from, (const char *) to)
 #define ngx_rename_file_n        "rename"
 
 
@@ -92,7 +92,15 @@ ngx_int_t ngx_posix_init(ngx_log_t *log)
 
     ngx_pagesize = getpagesize();
 
+#ifdef _SC_NPROCESSORS_ONLN
+
     if (ngx_ncpu == 0) {
+        ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+#endif
+
+    if (ngx_ncpu < 1) {
         ngx_ncpu = 1;
     }
 
@@ -227,6 +235,7 @@ void ngx_signal_handler(int signo)
         break;
 
     case NGX_PROCESS_WORKER:
+    case NGX_PROCESS_CACHE_MANAGER:
         switch (signo) {
 
         case ngx_signal_value(NGX_SHUTDOWN_SIGNAL):
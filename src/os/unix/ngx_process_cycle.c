@@ -12,11 +12,19 @@
 
 static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
                                        ngx_int_t type);
+static void ngx_start_cache_manager_process(ngx_cycle_t *cycle,
+                                            ngx_int_t type);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
+static ngx_int_t ngx_worker_successor(ngx_int_t prev);
 static ngx_uint_t ngx_reap_childs(ngx_cycle_t *cycle);
 static void ngx_master_exit(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx);
+static void ngx_child_process_init(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_channel_handler(ngx_event_t *ev);
+static void ngx_pass_idle_connections(ngx_cycle_t *cycle);
+static void ngx_pass_idle_handler(ngx_event_t *ev);
+static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
+static void ngx_cache_manager_wait(ngx_cycle_t *cycle, ngx_msec_t timer);
 #if (NGX_THREADS)
 static void ngx_wakeup_worker_threads(ngx_cycle_t *cycle);
 static void *ngx_worker_thread_cycle(void *data);
@@ -46,6 +54,12 @@ ngx_uint_t    ngx_noaccepting;
 ngx_uint_t    ngx_restart;
 
 
+/* the slot of the new worker process that takes the idle connections */
+static ngx_int_t         ngx_successor = -1;
+static ngx_event_t       ngx_pass_event;
+static ngx_connection_t  ngx_pass_dumb;
+
+
 #if (NGX_THREADS)
 volatile ngx_thread_t  ngx_threads[NGX_MAX_THREADS];
 ngx_int_t              ngx_threads_n;
@@ -110,6 +124,7 @@ void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
     // 根据配置worker_processes创建多进程
     ngx_start_worker_processes(cycle, ccf->worker_processes,
                                NGX_PROCESS_RESPAWN);
+    ngx_start_cache_manager_process(cycle, NGX_PROCESS_RESPAWN);
 
     ngx_new_binary = 0;
     delay = 0;
@@ -193,6 +208,7 @@ void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
             ngx_timer = 0;
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_JUST_RESPAWN);
+            ngx_start_cache_manager_process(cycle, NGX_PROCESS_JUST_RESPAWN);
             live = 1;
             ngx_signal_worker_processes(cycle,
                                         ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
@@ -206,6 +222,7 @@ void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
 
                 ngx_start_worker_processes(cycle, ccf->worker_processes,
                                            NGX_PROCESS_RESPAWN);
+                ngx_start_cache_manager_process(cycle, NGX_PROCESS_RESPAWN);
                 ngx_noaccepting = 0;
 
                 continue;
@@ -224,6 +241,7 @@ void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
                                                    ngx_core_module);
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_JUST_RESPAWN);
+            ngx_start_cache_manager_process(cycle, NGX_PROCESS_JUST_RESPAWN);
             live = 1;
             ngx_signal_worker_processes(cycle,
                                         ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
@@ -233,6 +251,7 @@ void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
             ngx_restart = 0;
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_RESPAWN);
+            ngx_start_cache_manager_process(cycle, NGX_PROCESS_RESPAWN);
             live = 1;
         }
 
@@ -313,7 +332,7 @@ void ngx_single_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
 static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
                                        ngx_int_t type)
 {
-    ngx_int_t         i;
+    ngx_int_t         i, w;
     ngx_channel_t     ch;
     struct itimerval  itv;
 
@@ -321,9 +340,12 @@ static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
 
     ch.command = NGX_CMD_OPEN_CHANNEL;
     // 创建多个进程
-    while (n--) {
-        ngx_spawn_process(cycle, ngx_worker_process_cycle, NULL,
-                          "worker process", type);
+    for (w = 0; w < n; w++) {
+
+        /* the worker number is kept in the process data for the respawn */
+
+        ngx_spawn_process(cycle, ngx_worker_process_cycle,
+                          (void *) (intptr_t) w, "worker process", type);
 
         ch.pid = ngx_processes[ngx_process_slot].pid;
         ch.slot = ngx_process_slot;
@@ -370,9 +392,27 @@ static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
 }
 
 
+static void ngx_start_cache_manager_process(ngx_cycle_t *cycle,
+                                            ngx_int_t type)
+{
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->cache_manager || cycle->pathes.nelts == 0) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0, "start cache manager process");
+
+    ngx_spawn_process(cycle, ngx_cache_manager_process_cycle, NULL,
+                      "cache manager process", type);
+}
+
+
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 {
-    ngx_int_t      i;
+    ngx_int_t      i, successor;
     ngx_err_t      err;
     ngx_channel_t  ch;
 
@@ -396,6 +436,10 @@ static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
     }
 
     ch.fd = -1;
+    ch.pid = -1;
+    ch.slot = -1;
+
+    successor = -1;
 
 
     for (i = 0; i < ngx_last_process; i++) {
@@ -415,7 +459,6 @@ static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
         }
 
         if (ngx_processes[i].just_respawn) {
-            ngx_processes[i].just_respawn = 0;
             continue;
         }
 
@@ -425,6 +468,27 @@ static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
             continue;
         }
 
+        if (ch.command == NGX_CMD_QUIT) {
+
+            /*
+             * on the reconfiguration the old workers pass their idle
+             * connections to the new ones, each old worker to the next
+             * new worker in turn
+             */
+
+            ch.pid = -1;
+            ch.slot = -1;
+
+            if (ngx_processes[i].proc == ngx_worker_process_cycle) {
+                successor = ngx_worker_successor(successor);
+
+                if (successor != -1) {
+                    ch.pid = ngx_processes[successor].pid;
+                    ch.slot = successor;
+                }
+            }
+        }
+
         if (ch.command) {
             if (ngx_write_channel(ngx_processes[i].channel[0],
                            &ch, sizeof(ngx_channel_t), cycle->log) == NGX_OK)
@@ -460,9 +524,31 @@ static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
             ngx_processes[i].exiting = 1;
         }
     }
+
+    for (i = 0; i < ngx_last_process; i++) {
+        ngx_processes[i].just_respawn = 0;
+    }
 }
 
 
+static ngx_int_t ngx_worker_successor(ngx_int_t prev)
+{
+    ngx_int_t  i, n;
+
+    for (n = 1; n <= ngx_last_process; n++) {
+        i = (prev + n) % ngx_last_process;
+
+        if (ngx_processes[i].pid != -1
+            && ngx_processes[i].just_respawn
+            && ngx_processes[i].proc == ngx_worker_process_cycle)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 static ngx_uint_t ngx_reap_childs(ngx_cycle_t *cycle)
 {
     ngx_int_t      i, n;
@@ -575,28 +661,34 @@ static void ngx_master_exit(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx)
 }
 
 
-static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
+static void ngx_child_process_init(ngx_cycle_t *cycle)
 {
-    sigset_t           set;
-    ngx_err_t          err;
-    ngx_int_t          n;
-    ngx_uint_t         i;
-    struct timeval     tv;
-    ngx_listening_t   *ls;
-    ngx_core_conf_t   *ccf;
-    ngx_connection_t  *c;
-
+    sigset_t          set;
+    struct rlimit     rlmt;
+    ngx_core_conf_t  *ccf;
 
-    ngx_gettimeofday(&tv);
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
-    ngx_start_msec = (ngx_epoch_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
-    ngx_old_elapsed_msec = 0;
-    ngx_elapsed_msec = 0;
+    /* the priority and the limit may be raised only before setuid() */
 
+    if (ccf->priority != 0) {
+        if (setpriority(PRIO_PROCESS, 0, (int) ccf->priority) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "setpriority(%" NGX_INT_T_FMT ") failed",
+                          ccf->priority);
+        }
+    }
 
-    ngx_process = NGX_PROCESS_WORKER;
+    if (ccf->rlimit_nofile != NGX_CONF_UNSET) {
+        rlmt.rlim_cur = (rlim_t) ccf->rlimit_nofile;
+        rlmt.rlim_max = (rlim_t) ccf->rlimit_nofile;
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+        if (setrlimit(RLIMIT_NOFILE, &rlmt) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "setrlimit(RLIMIT_NOFILE, %" NGX_INT_T_FMT
+                          ") failed", ccf->rlimit_nofile);
+        }
+    }
 
     if (ccf->group != (gid_t) NGX_CONF_UNSET) {
         if (setgid(ccf->group) == -1) {
@@ -635,6 +727,64 @@ static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
     }
 
     ngx_init_temp_number();
+}
+
+
+static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
+{
+    ngx_err_t          err;
+    ngx_int_t          n;
+    ngx_uint_t         i;
+    struct timeval     tv;
+    ngx_listening_t   *ls;
+    ngx_core_conf_t   *ccf;
+    ngx_connection_t  *c;
+#if (HAVE_SCHED_SETAFFINITY)
+    uint64_t           cpu_affinity;
+    cpu_set_t          mask;
+#endif
+
+
+    ngx_gettimeofday(&tv);
+
+    ngx_start_msec = (ngx_epoch_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    ngx_old_elapsed_msec = 0;
+    ngx_elapsed_msec = 0;
+
+
+    ngx_process = NGX_PROCESS_WORKER;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+#if (HAVE_SCHED_SETAFFINITY)
+
+    /*
+     * the worker is bound before the modules allocate and initialize
+     * the connections, the events and the pools in init_process(), so
+     * with the default first-touch policy their pages are allocated
+     * on the NUMA node of the worker's CPUs
+     */
+
+    cpu_affinity = ngx_get_cpu_affinity(cycle, (ngx_uint_t) (intptr_t) data);
+
+    if (cpu_affinity) {
+        CPU_ZERO(&mask);
+
+        for (i = 0; i < 64; i++) {
+            if (cpu_affinity & ((uint64_t) 1 << i)) {
+                CPU_SET(i, &mask);
+            }
+        }
+
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &mask) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "sched_setaffinity() failed");
+        }
+    }
+
+#endif
+
+    ngx_child_process_init(cycle);
 
     /*
      * disable deleting previous events for the listening sockets because
@@ -781,6 +931,8 @@ static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
             if (!ngx_exiting) {
                 ngx_close_listening_sockets(cycle);
                 ngx_exiting = 1;
+
+                ngx_pass_idle_connections(cycle);
             }
         }
 
@@ -803,55 +955,420 @@ static void ngx_channel_handler(ngx_event_t *ev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "channel handler");
 
-    n = ngx_read_channel(c->fd, &ch, sizeof(ngx_channel_t), ev->log);
+    /*
+     * the channel is read until it is empty because the passed
+     * connections come by many at once and the event may be edge-triggered
+     */
+
+    for ( ;; ) {
+
+        n = ngx_read_channel(c->fd, &ch, sizeof(ngx_channel_t), ev->log);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0, "channel: %d", n);
+
+        if (n <= 0) {
+            return;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                       "channel command: %d", ch.command);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0, "channel: %d", n);
+        switch (ch.command) {
 
-    if (n <= 0) {
+        case NGX_CMD_QUIT:
+            ngx_quit = 1;
+
+            if (ch.slot >= 0
+                && ch.slot < NGX_MAX_PROCESSES
+                && ngx_processes[ch.slot].pid == ch.pid
+                && ngx_processes[ch.slot].channel[0] != -1)
+            {
+                ngx_successor = ch.slot;
+            }
+
+            break;
+
+        case NGX_CMD_TERMINATE:
+            ngx_terminate = 1;
+            break;
+
+        case NGX_CMD_REOPEN:
+            ngx_reopen = 1;
+            break;
+
+        case NGX_CMD_OPEN_CHANNEL:
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get channel s:%d pid:" PID_T_FMT " fd:%d",
+                           ch.slot, ch.pid, ch.fd);
+
+            ngx_processes[ch.slot].pid = ch.pid;
+            ngx_processes[ch.slot].channel[0] = ch.fd;
+            break;
+
+        case NGX_CMD_CLOSE_CHANNEL:
+
+            ngx_log_debug4(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "close channel s:%d pid:" PID_T_FMT " our:" PID_T_FMT
+                           " fd:%d",
+                           ch.slot, ch.pid, ngx_processes[ch.slot].pid,
+                           ngx_processes[ch.slot].channel[0]);
+
+            if (close(ngx_processes[ch.slot].channel[0]) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                              "close() failed");
+            }
+
+            ngx_processes[ch.slot].channel[0] = -1;
+
+            if (ch.slot == ngx_successor) {
+                ngx_successor = -1;
+            }
+
+            break;
+
+        case NGX_CMD_PASS_CONNECTION:
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection fd:%d from s:%d pid:" PID_T_FMT,
+                           ch.fd, ch.slot, ch.pid);
+
+            ngx_event_accept_passed((ngx_cycle_t *) ngx_cycle, ch.fd);
+            break;
+        }
+    }
+}
+
+
+/*
+ * the idle keepalive connections are passed to the successor worker
+ * on the reconfiguration instead of being closed, so the clients do not
+ * reconnect; the SSL connections keep their state in this process and
+ * are not passed.  The socket is deleted from the event set explicitly
+ * because it stays open in the successor and the closing does not
+ * delete it from the epoll set
+ */
+
+static void ngx_pass_idle_connections(ngx_cycle_t *cycle)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               i, passed;
+    ngx_channel_t            ch;
+    ngx_connection_t        *c;
+    ngx_connection_chunk_t  *chunk;
+
+    if (ngx_successor == -1) {
         return;
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
-                   "channel command: %d", ch.command);
+    ch.command = NGX_CMD_PASS_CONNECTION;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
 
-    switch (ch.command) {
+    passed = 0;
+    rc = NGX_OK;
 
-    case NGX_CMD_QUIT:
-        ngx_quit = 1;
-        break;
+    for (chunk = cycle->chunks; chunk && rc == NGX_OK; chunk = chunk->next) {
+        for (i = 0; i < chunk->n; i++) {
+            c = &chunk->connections[i];
 
-    case NGX_CMD_TERMINATE:
-        ngx_terminate = 1;
-        break;
+            if (c->fd == (ngx_socket_t) -1 || !c->idle) {
+                continue;
+            }
 
-    case NGX_CMD_REOPEN:
-        ngx_reopen = 1;
-        break;
+#if (NGX_OPENSSL)
+            if (c->ssl) {
+                continue;
+            }
+#endif
 
-    case NGX_CMD_OPEN_CHANNEL:
+            ch.fd = c->fd;
 
-        ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
-                       "get channel s:%d pid:" PID_T_FMT " fd:%d",
-                       ch.slot, ch.pid, ch.fd);
+            rc = ngx_write_channel(ngx_processes[ngx_successor].channel[0],
+                                   &ch, sizeof(ngx_channel_t), cycle->log);
 
-        ngx_processes[ch.slot].pid = ch.pid;
-        ngx_processes[ch.slot].channel[0] = ch.fd;
-        break;
+            if (rc != NGX_OK) {
+                break;
+            }
+
+            if (ngx_del_conn) {
+                ngx_del_conn(c, 0);
+
+            } else {
+                if (c->read->active || c->read->disabled) {
+                    ngx_del_event(c->read, NGX_READ_EVENT, 0);
+                }
 
-    case NGX_CMD_CLOSE_CHANNEL:
+                if (c->write->active || c->write->disabled) {
+                    ngx_del_event(c->write, NGX_WRITE_EVENT, 0);
+                }
+            }
 
-        ngx_log_debug4(NGX_LOG_DEBUG_CORE, ev->log, 0,
-                       "close channel s:%d pid:" PID_T_FMT " our:" PID_T_FMT
-                       " fd:%d",
-                       ch.slot, ch.pid, ngx_processes[ch.slot].pid,
-                       ngx_processes[ch.slot].channel[0]);
+            c->close = 1;
+            c->read->event_handler(c->read);
 
-        if (close(ngx_processes[ch.slot].channel[0]) == -1) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno, "close() failed");
+            passed++;
         }
+    }
 
-        ngx_processes[ch.slot].channel[0] = -1;
-        break;
+    if (passed) {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "%" NGX_UINT_T_FMT " idle connections are passed "
+                      "to the worker process " PID_T_FMT,
+                      passed, ngx_processes[ngx_successor].pid);
+    }
+
+    if (rc == NGX_AGAIN) {
+
+        /* the channel is full, the rest are passed later */
+
+        ngx_pass_dumb.fd = (ngx_socket_t) -1;
+
+        ngx_pass_event.event_handler = ngx_pass_idle_handler;
+        ngx_pass_event.log = cycle->log;
+        ngx_pass_event.data = &ngx_pass_dumb;
+
+        ngx_add_timer(&ngx_pass_event, 10);
+
+    } else if (rc == NGX_ERROR) {
+        ngx_successor = -1;
+    }
+}
+
+
+static void ngx_pass_idle_handler(ngx_event_t *ev)
+{
+    ngx_pass_idle_connections((ngx_cycle_t *) ngx_cycle);
+}
+
+
+static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
+{
+    ngx_int_t          rc;
+    ngx_uint_t         i, k, n, cur, files, walked;
+    ngx_msec_t         timer, elapsed;
+    ngx_gc_t          *gc;
+    ngx_path_t       **path;
+    struct timeval     tv;
+    ngx_core_conf_t   *ccf;
+    ngx_epoch_msec_t   start;
+
+    ngx_process = NGX_PROCESS_CACHE_MANAGER;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    ngx_child_process_init(cycle);
+
+    for (n = 0; n < (ngx_uint_t) ngx_last_process; n++) {
+
+        if (ngx_processes[n].pid == -1) {
+            continue;
+        }
+
+        if (n == (ngx_uint_t) ngx_process_slot) {
+            continue;
+        }
+
+        if (ngx_processes[n].channel[1] == -1) {
+            continue;
+        }
+
+        if (close(ngx_processes[n].channel[1]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "close() failed");
+        }
+    }
+
+    if (close(ngx_processes[ngx_process_slot].channel[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    ngx_setproctitle("cache manager process");
+
+    if (!(gc = ngx_pcalloc(cycle->pool,
+                           cycle->pathes.nelts * sizeof(ngx_gc_t))))
+    {
+        /* fatal */
+        exit(2);
+    }
+
+    /* the same path may be set in several locations */
+
+    n = 0;
+    path = cycle->pathes.elts;
+
+    for (i = 0; i < cycle->pathes.nelts; i++) {
+
+        if (path[i]->gc_handler == NULL) {
+            continue;
+        }
+
+        for (k = 0; k < n; k++) {
+            if (gc[k].path->name.len == path[i]->name.len
+                && ngx_strncmp(gc[k].path->name.data, path[i]->name.data,
+                               path[i]->name.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (k < n) {
+            continue;
+        }
+
+        gc[n].path = path[i];
+        gc[n].handler = path[i]->gc_handler;
+        gc[n].log = cycle->log;
+        n++;
+    }
+
+    /* the number of the directory entries walked in one slice */
+
+    files = ccf->cache_manager_files * ccf->cache_manager_slice / 1000;
+    if (files == 0) {
+        files = 1;
+    }
+
+    cur = 0;
+
+    for ( ;; ) {
+        if (ngx_terminate || ngx_quit) {
+            ngx_log_error(NGX_LOG_INFO, cycle->log, 0, "exiting");
+            exit(0);
+        }
+
+        if (ngx_reopen) {
+            ngx_reopen = 0;
+            ngx_log_error(NGX_LOG_INFO, cycle->log, 0, "reopen logs");
+            ngx_reopen_files(cycle, -1);
+        }
+
+        ngx_gettimeofday(&tv);
+        ngx_time_update(tv.tv_sec);
+
+        start = (ngx_epoch_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+        timer = 0;
+        walked = 0;
+        elapsed = 0;
+
+        if (n == 0) {
+            timer = ccf->cache_manager_sleep;
+        }
+
+        while (timer == 0
+               && walked < files
+               && elapsed < ccf->cache_manager_slice)
+        {
+            rc = ngx_collect_garbage(&gc[cur], files - walked,
+                                     ccf->cache_manager_slice - elapsed);
+
+            walked += gc[cur].walked;
+
+            ngx_gettimeofday(&tv);
+            elapsed = (ngx_msec_t) ((ngx_epoch_msec_t) tv.tv_sec * 1000
+                                    + tv.tv_usec / 1000 - start);
+
+            if (rc == NGX_ABORT) {
+                timer = ccf->cache_manager_sleep;
+                break;
+            }
+
+            if (rc == NGX_OK && ++cur == n) {
+                cur = 0;
+                timer = ccf->cache_manager_sleep;
+            }
+        }
+
+        if (timer == 0) {
+
+            /* limit the walk rate by cache_manager_files per second */
+
+            timer = (ngx_msec_t) (walked * 1000 / ccf->cache_manager_files);
+            timer = (timer > elapsed) ? timer - elapsed : 1;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "cache manager walked: %d, timer: %d", walked, timer);
+
+        ngx_cache_manager_wait(cycle, timer);
+    }
+}
+
+
+/*
+ * the cache manager does not run the event loop, so it waits for
+ * the channel commands in select() between the walk slices
+ */
+
+static void ngx_cache_manager_wait(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_int_t       n;
+    ngx_err_t       err;
+    fd_set          rfd;
+    ngx_channel_t   ch;
+    struct timeval  tv;
+
+    FD_ZERO(&rfd);
+    FD_SET(ngx_channel, &rfd);
+
+    tv.tv_sec = timer / 1000;
+    tv.tv_usec = (timer % 1000) * 1000;
+
+    if (select(ngx_channel + 1, &rfd, NULL, NULL, &tv) == -1) {
+        err = ngx_errno;
+
+        if (err != NGX_EINTR) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, err, "select() failed");
+        }
+
+        return;
+    }
+
+    if (!FD_ISSET(ngx_channel, &rfd)) {
+        return;
+    }
+
+    for ( ;; ) {
+        n = ngx_read_channel(ngx_channel, &ch, sizeof(ngx_channel_t),
+                             cycle->log);
+
+        if (n <= 0) {
+            return;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "channel command: %d", ch.command);
+
+        switch (ch.command) {
+
+        case NGX_CMD_QUIT:
+            ngx_quit = 1;
+            break;
+
+        case NGX_CMD_TERMINATE:
+            ngx_terminate = 1;
+            break;
+
+        case NGX_CMD_REOPEN:
+            ngx_reopen = 1;
+            break;
+
+        case NGX_CMD_OPEN_CHANNEL:
+            ngx_processes[ch.slot].pid = ch.pid;
+            ngx_processes[ch.slot].channel[0] = ch.fd;
+            break;
+
+        case NGX_CMD_CLOSE_CHANNEL:
+            if (close(ngx_processes[ch.slot].channel[0]) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                              "close() failed");
+            }
+
+            ngx_processes[ch.slot].channel[0] = -1;
+            break;
+        }
     }
 }
 
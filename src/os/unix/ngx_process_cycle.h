@@ -12,11 +12,12 @@
 #include <ngx_core.h>
 
 
-#define NGX_CMD_OPEN_CHANNEL   1
-#define NGX_CMD_CLOSE_CHANNEL  2
-#define NGX_CMD_QUIT           3
-#define NGX_CMD_TERMINATE      4
-#define NGX_CMD_REOPEN         5
+#define NGX_CMD_OPEN_CHANNEL     1
+#define NGX_CMD_CLOSE_CHANNEL    2
+#define NGX_CMD_QUIT             3
+#define NGX_CMD_TERMINATE        4
+#define NGX_CMD_REOPEN           5
+#define NGX_CMD_PASS_CONNECTION  6
 
 
 typedef struct {
@@ -28,6 +29,7 @@ typedef struct {
 #define NGX_PROCESS_SINGLE   0
 #define NGX_PROCESS_MASTER   1
 #define NGX_PROCESS_WORKER   2
+#define NGX_PROCESS_CACHE_MANAGER  3
 
 
 void ngx_master_process_cycle(ngx_cycle_t *cycle, ngx_master_ctx_t *ctx);
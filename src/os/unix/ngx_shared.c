@@ -26,6 +26,15 @@ void *ngx_create_shared_memory(size_t size, ngx_log_t *log)
     return p;
 }
 
+
+void ngx_free_shared_memory(void *p, size_t size, ngx_log_t *log)
+{
+    if (munmap(p, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(" PTR_FMT ", " SIZE_T_FMT ") failed", p, size);
+    }
+}
+
 #elif (HAVE_MAP_DEVZERO)
 
 void *ngx_create_shared_memory(size_t size, ngx_log_t *log)
@@ -57,6 +66,15 @@ void *ngx_create_shared_memory(size_t size, ngx_log_t *log)
     return p;
 }
 
+
+void ngx_free_shared_memory(void *p, size_t size, ngx_log_t *log)
+{
+    if (munmap(p, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(" PTR_FMT ", " SIZE_T_FMT ") failed", p, size);
+    }
+}
+
 #elif (HAVE_SYSVSHM)
 
 #include <sys/ipc.h>
@@ -93,4 +111,13 @@ void *ngx_create_shared_memory(size_t size, ngx_log_t *log)
     return p;
 }
 
+
+void ngx_free_shared_memory(void *p, size_t size, ngx_log_t *log)
+{
+    if (shmdt(p) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "shmdt(" PTR_FMT ") failed", p);
+    }
+}
+
 #endif